@@ -10,6 +10,13 @@
 #include <iomanip>
 #include <cctype>
 
+#if defined(_WIN32)
+#include <windows.h>
+#include <io.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#endif
+
 #define TRUE 1
 #define FALSE 0
 
@@ -104,3 +111,42 @@ size_t core_fsize(core_file* fc)
    }
    return 0;
 }
+
+void* core_fmap(core_file* fc, size_t* size)
+{
+   CORE_FILE* f = (CORE_FILE*)fc;
+   size_t len = core_fsize(fc);
+   void* rv = 0;
+
+   if (!f->f || len == 0)
+      return 0;
+
+#if defined(_WIN32)
+   HANDLE mapping = CreateFileMapping((HANDLE)_get_osfhandle(_fileno(f->f)), 0, PAGE_READONLY, 0, 0, 0);
+
+   if (mapping)
+   {
+      rv = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(mapping);
+   }
+#elif defined(__unix__) || defined(__APPLE__)
+   rv = mmap(0, len, PROT_READ, MAP_SHARED, fileno(f->f), 0);
+
+   if (rv == MAP_FAILED)
+      rv = 0;
+#endif
+
+   if (rv)
+      *size = len;
+
+   return rv;
+}
+
+void core_funmap(void* ptr, size_t size)
+{
+#if defined(_WIN32)
+   UnmapViewOfFile(ptr);
+#elif defined(__unix__) || defined(__APPLE__)
+   munmap(ptr, size);
+#endif
+}
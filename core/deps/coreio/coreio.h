@@ -10,4 +10,8 @@ size_t core_fseek(core_file* fc, size_t offs, size_t origin);
 int core_fread(core_file* fc, void* buff, size_t len);
 int core_fclose(core_file* fc);
 size_t core_fsize(core_file* fc);
-size_t core_ftell(core_file* fc);
\ No newline at end of file
+size_t core_ftell(core_file* fc);
+
+//maps the whole file read only, 0 if the host can't (or the address space is full)
+void* core_fmap(core_file* fc, size_t* size);
+void core_funmap(void* ptr, size_t size);
\ No newline at end of file
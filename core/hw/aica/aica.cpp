@@ -9,6 +9,8 @@
 #include "hw/holly/holly_intc.h"
 #include "hw/holly/sb.h"
 #include "hw/arm7/arm7.h"
+#include "sgc_if.h"
+#include "serialize.h"
 
 #include "../libretro/libretro.h"
 
@@ -295,3 +297,21 @@ void libAICA_Term(void)
 {
 	sgc_Term();
 }
+
+//registers, timers, dsp and channel state. The dsp program itself lives in the registers
+void aica_serialize(dc_state& st)
+{
+	st.raw(aica_reg,sizeof(aica_reg));
+
+	for (int i=0;i<3;i++)
+	{
+		st(timers[i].c_step);
+		st(timers[i].m_step);
+	}
+
+	st.raw(dsp.TEMP,(u8*)&dsp.dyndirty-(u8*)dsp.TEMP);
+	if (st.load)
+		dsp.dyndirty=true;
+
+	channel_serialize(st);
+}
@@ -307,6 +307,9 @@ void UpdateAICA(u32 Cycles);
 void AICA_Init();
 void AICA_Term();
 
+struct dc_state;
+void aica_serialize(dc_state& st);
+
 extern u32 VREG;
 extern VArray2 aica_ram;
 u32 ReadMem_aica_rtc(u32 addr,u32 sz);
@@ -1,4 +1,12 @@
-﻿#include "dsp.h"
+﻿#include "build.h"
+
+//xbyak has to come before types.h, the die() macro breaks it
+#if HOST_CPU == CPU_X64 && FEAT_DSPREC == DYNAREC_JIT && !defined(TARGET_NO_JIT)
+#define DSP_REC_X64
+#include "deps/xbyak/xbyak.h"
+#endif
+
+#include "dsp.h"
 #include "aica.h"
 
 /*
@@ -13,22 +21,28 @@
 	electronics assumptions, as well as "best-fitted" my typical 
 	test game suite.
 
+	The same model is also implemented as a portable interpreter (dsp_interpret), used where there
+	is no recompiler and as the reference in validation mode, and as an x64 recompiler (xbyak).
+	The program is decoded/recompiled when MPRO or RBL/RBP change, COEF and MADRS are read
+	when the program runs.
+
 
 	Initial code by skmp, now part of the reicast project.
 	See LICENSE & COPYRIGHT files further details
 */
 
-DECL_ALIGN(4096) dsp_t dsp;
-
-#if HOST_CPU == CPU_X86 && FEAT_DSPREC == DYNAREC_JIT
-#include "emitter/x86_emitter.h"
-
-const bool SUPPORT_NOFL=false;
+#if (HOST_CPU == CPU_X86 && FEAT_DSPREC == DYNAREC_JIT) || defined(DSP_REC_X64)
+#define DSP_REC
+#endif
 
+//the validation mode is a debugging aid, release builds only have the recompiler
+#if defined(DSP_REC) && !defined(NDEBUG)
+#define DSP_VALIDATE
+#endif
 
-#define assert verify
+DECL_ALIGN(4096) dsp_t dsp;
 
-#pragma warning(disable:4311)
+const bool SUPPORT_NOFL=false;
 
 struct _INST
 {
@@ -62,8 +76,6 @@ struct _INST
 };
 
 
-#define DYNBUF  0x10000
-
 //float format is ?
 static u16 DYNACALL PACK(s32 val)
 {
@@ -109,22 +121,6 @@ static s32 DYNACALL UNPACK(u16 val)
 	return uval;
 }
 
-void dsp_init(void)
-{
-	memset(&dsp,0,sizeof(dsp));
-	memset(DSPData,0,sizeof(*DSPData));
-
-	dsp.dyndirty=true;
-	dsp.RBL=0x2000-1;
-	dsp.RBP=0;
-	dsp.regs.MDEC_CT=1;
-
-
-	os_MakeExecutable(dsp.DynCode,sizeof(dsp.DynCode));
-}
-
-void dsp_recompile(void);
-
 void DecodeInst(u32 *IPtr,_INST *i)
 {
 	i->TRA=(IPtr[0]>>9)&0x7F;
@@ -159,6 +155,35 @@ void DecodeInst(u32 *IPtr,_INST *i)
 }
 
 
+
+//the decoded program, and what it was decoded from
+static _INST dsp_prog[128];
+static u32 dsp_prog_mpro[128*4];
+static u32 dsp_prog_RBL;
+static u32 dsp_prog_RBP;
+static bool dsp_prog_valid;
+
+#ifdef DSP_VALIDATE
+static struct
+{
+	u32 samples;        //validated samples, since the last report
+	u32 mismatches;
+} dsp_stats;
+#endif
+
+//sign extends the low src_sz bits, then drops (src_sz-dst_sz) bits
+static INLINE s32 dsp_sx(u32 val,u32 src_sz,u32 dst_sz)
+{
+	return (s32)(val<<(32-src_sz))>>(32-dst_sz);
+}
+
+#if HOST_CPU == CPU_X86 && FEAT_DSPREC == DYNAREC_JIT
+#include "emitter/x86_emitter.h"
+
+#define assert verify
+
+#pragma warning(disable:4311)
+
 void* dyna_realloc(void*ptr,u32 oldsize,u32 newsize)
 {
 	return dsp.DynCode;
@@ -746,9 +771,597 @@ void dsp_recompile()
 	x86e.Generate();
 }
 
-void dsp_print_mame();
-void dsp_step_mame();
-void dsp_emu_grandia();
+#elif defined(DSP_REC_X64)
+
+/*
+	x64 version of the recompiler above, step for step the same as dsp_interpret. The dsp registers
+	stay in memory, the wires (MEM_RD_DATA_NV, INPUTS, MAD_OUT_NV) are host registers.
+*/
+class DspCompiler : public Xbyak::CodeGenerator
+{
+	//rbx points to dsp.regs, so the registers are in disp8 range
+	Xbyak::Address dspreg(const void* ptr) { return dword[rbx+(int)((u8*)ptr-(u8*)&dsp.regs)]; }
+	Xbyak::Address dspdata(const void* ptr) { return dword[rbp+(int)((u8*)ptr-(u8*)DSPData)]; }
+
+	//TEMP[(MDEC_CT+idx)&127], uses ecx
+	Xbyak::Address Temp(u32 idx)
+	{
+		mov(ecx,dspreg(&dsp.regs.MDEC_CT));
+		add(ecx,idx);
+		and_(ecx,127);
+		return dword[rbx+rcx*4+(int)((u8*)dsp.TEMP-(u8*)&dsp.regs)];
+	}
+
+	void SignExtend(const Xbyak::Reg32& reg,u32 src_sz,u32 dst_sz)
+	{
+		shl(reg,32-src_sz);
+		sar(reg,32-dst_sz);
+	}
+
+	void Call(const void* fn)
+	{
+		mov(rax,(size_t)fn);
+		call(rax);
+	}
+
+	void Step(u32 step,const _INST& op,const _INST& prev_op,const _INST& prev2_op)
+	{
+		const Xbyak::Reg32 MEM_RD_DATA_NV=r13d;
+		const Xbyak::Reg32 INPUTS=r14d;
+		const Xbyak::Reg32 MAD_OUT_NV=r15d;
+
+		//memory access requested by the previous step
+		if (!(step&1) && (prev_op.MRD || prev_op.MWT))
+		{
+			mov(eax,dspreg(&dsp.regs.MEM_ADDR));
+			and_(eax,AICA_RAM_MASK);
+
+			if (prev_op.MRD)
+				movsx(MEM_RD_DATA_NV,word[r12+rax]);
+
+			if (prev_op.MWT)
+			{
+				mov(edx,dspreg(&dsp.regs.MEM_WT_DATA));
+				mov(word[r12+rax],dx);
+			}
+		}
+
+		//address generation
+		if (step&1)
+		{
+			mov(eax,dspdata(&DSPData->MADRS[op.MASA]));
+			if (op.ADREB)
+				add(eax,dspreg(&dsp.regs.ADRS_REG));
+			if (op.NXADR)
+				inc(eax);
+
+			if (!op.TABLE)
+			{
+				add(eax,dspreg(&dsp.regs.MDEC_CT));
+				and_(eax,dsp.RBL);
+			}
+			else
+				and_(eax,0xFFFF);
+
+			lea(eax,ptr[rax*2+dsp.RBP]);
+			mov(dspreg(&dsp.regs.MEM_ADDR),eax);
+		}
+
+		//INPUTS, only if something reads it
+		if (op.XSEL || op.YRL)
+		{
+			if (op.IRA<0x20)
+			{
+				mov(INPUTS,dspreg(&dsp.MEMS[op.IRA]));
+				SignExtend(INPUTS,24,24);
+			}
+			else if (op.IRA<0x30)
+			{
+				mov(INPUTS,dspreg(&dsp.MIXS[op.IRA-0x20]));
+				SignExtend(INPUTS,20,24);
+			}
+			else if (op.IRA<0x32)
+			{
+				mov(INPUTS,dspdata(&DSPData->EXTS[op.IRA-0x30]));
+				SignExtend(INPUTS,16,24);
+			}
+			else
+				xor_(INPUTS,INPUTS);
+		}
+
+		//MEMS write, NOFL_2 is known here as long as the program doesn't change
+		if (op.IWT)
+		{
+			if (SUPPORT_NOFL && !prev2_op.NOFL)
+			{
+#ifdef _WIN32
+				mov(ecx,dspreg(&dsp.regs.MEM_RD_DATA));
+#else
+				mov(edi,dspreg(&dsp.regs.MEM_RD_DATA));
+#endif
+				Call((void*)UNPACK);
+			}
+			else
+			{
+				movsx(eax,word[rbx+(int)((u8*)&dsp.regs.MEM_RD_DATA-(u8*)&dsp.regs)]);
+				shl(eax,8);
+			}
+			mov(dspreg(&dsp.MEMS[op.IWA]),eax);
+		}
+
+		if (!(step&1) && prev_op.MRD)
+			mov(dspreg(&dsp.regs.MEM_RD_DATA),MEM_RD_DATA_NV);
+
+		//mul-add, TEMPS on ecx
+		if (!op.XSEL || (!op.BSEL && !op.ZERO))
+		{
+			mov(ecx,Temp(op.TRA));
+			SignExtend(ecx,24,24);
+		}
+
+		switch(op.YSEL)
+		{
+		case 0:
+			mov(eax,dspreg(&dsp.regs.FRC_REG));
+			SignExtend(eax,13,13);
+			break;
+
+		case 1:
+			mov(eax,dspdata(&DSPData->COEF[step]));
+			SignExtend(eax,16,13);
+			break;
+
+		case 2:
+			mov(eax,dspreg(&dsp.regs.Y_REG));
+			SignExtend(eax,19,13);
+			break;
+
+		case 3:
+			mov(eax,dspreg(&dsp.regs.Y_REG));
+			and_(eax,0xFFF);
+			break;
+		}
+
+		imul(op.XSEL?INPUTS:ecx);
+		shrd(eax,edx,10);
+		SignExtend(eax,26,26);
+
+		if (!op.ZERO)
+		{
+			if (op.BSEL)
+				mov(edx,dspreg(&dsp.regs.MAD_OUT));
+			else
+				lea(edx,ptr[rcx*4]);
+
+			if (op.NEGB)
+				neg(edx);
+
+			add(eax,edx);
+			SignExtend(eax,26,26);
+		}
+		mov(MAD_OUT_NV,eax);
+
+		//effect output/feedback, from the previous MAD_OUT
+		mov(eax,dspreg(&dsp.regs.MAD_OUT));
+		switch(op.SHIFT)
+		{
+		case 0:
+			sar(eax,2);
+			mov(edx,-524288);
+			cmp(eax,edx);
+			cmovl(eax,edx);
+			neg(edx);
+			cmp(eax,edx);
+			cmovg(eax,edx);
+			break;
+
+		case 1:
+			sar(eax,1);
+			mov(edx,-524288);
+			cmp(eax,edx);
+			cmovl(eax,edx);
+			not_(edx);
+			cmp(eax,edx);
+			cmovg(eax,edx);
+			break;
+
+		case 2:
+			sar(eax,1);
+			SignExtend(eax,24,24);
+			break;
+
+		case 3:
+			sar(eax,1);
+			shl(eax,2);
+			SignExtend(eax,24,24);
+			break;
+		}
+
+		if (op.EWT)
+		{
+			mov(edx,eax);
+			sar(edx,4);
+			mov(word[rbp+(int)((u8*)&DSPData->EFREG[op.EWA]-(u8*)DSPData)],dx);
+		}
+
+		if (op.TWT)
+			mov(Temp(op.TWA),eax);
+
+		if (op.FRCL)
+		{
+			mov(ecx,eax);
+			if (op.SHIFT==3)
+				sar(ecx,11);
+			else
+				and_(ecx,(1<<12)-1);
+			mov(dspreg(&dsp.regs.FRC_REG),ecx);
+		}
+
+		if (op.ADRL)
+		{
+			mov(ecx,eax);
+			if (op.SHIFT==3)
+			{
+				shl(ecx,8);
+				sar(ecx,24);
+			}
+			else
+			{
+				sar(ecx,12);
+				and_(ecx,(1<<12)-1);
+			}
+			mov(dspreg(&dsp.regs.ADRS_REG),ecx);
+		}
+
+		if (SUPPORT_NOFL && !op.NOFL)
+		{
+#ifdef _WIN32
+			mov(ecx,eax);
+#else
+			mov(edi,eax);
+#endif
+			Call((void*)PACK);
+			movzx(eax,ax);
+		}
+		else
+			sar(eax,8);
+		mov(dspreg(&dsp.regs.MEM_WT_DATA),eax);
+
+		mov(dspreg(&dsp.regs.MAD_OUT),MAD_OUT_NV);
+
+		if (op.YRL)
+		{
+			mov(eax,INPUTS);
+			sar(eax,4);
+			mov(dspreg(&dsp.regs.Y_REG),eax);
+		}
+	}
+
+public:
+	DspCompiler() : Xbyak::CodeGenerator(sizeof(dsp.DynCode),dsp.DynCode) { }
+
+	void Compile()
+	{
+		push(rbx);
+		push(rbp);
+		push(r12);
+		push(r13);
+		push(r14);
+		push(r15);
+#ifdef _WIN32
+		sub(rsp,40);
+#else
+		sub(rsp,8);
+#endif
+		mov(rbx,(size_t)&dsp.regs);
+		mov(rbp,(size_t)DSPData);
+		mov(r12,(size_t)aica_ram.data);
+
+		for (u32 step=0;step<128;step++)
+			Step(step,dsp_prog[step],dsp_prog[(step-1)&127],dsp_prog[(step-2)&127]);
+
+		//the delayed flags only depend on the program, only their final values are stored
+		mov(dspreg(&dsp.regs.NOFL_2),dsp_prog[126].NOFL);
+		mov(dspreg(&dsp.regs.NOFL_1),dsp_prog[127].NOFL);
+		mov(dspreg(&dsp.regs.MWT_1),dsp_prog[127].MWT);
+		mov(dspreg(&dsp.regs.MRD_1),dsp_prog[127].MRD);
+
+#ifdef _WIN32
+		add(rsp,40);
+#else
+		add(rsp,8);
+#endif
+		pop(r15);
+		pop(r14);
+		pop(r13);
+		pop(r12);
+		pop(rbp);
+		pop(rbx);
+		ret();
+
+		ready();
+	}
+};
+
+void dsp_recompile()
+{
+	DspCompiler compiler;
+	compiler.Compile();
+
+#ifndef NDEBUG
+	printf("dsp: program recompiled, %d bytes\n",(int)compiler.getSize());
+#endif
+}
+#endif
+
+
+//aram writes of the interpreter, so validation can undo them
+static struct
+{
+	u32 addr;
+	u16 data;
+} dsp_wlog[64];
+static u32 dsp_wlog_count;
+
+//Portable version of the recompilers, and the reference for them. All steps run the same
+//data path, registers that are written later in a step are read with their old value
+template<bool validate>
+static void dsp_interpret()
+{
+	for (u32 step=0;step<128;step++)
+	{
+		const _INST& op=dsp_prog[step];
+		const _INST& prev_op=dsp_prog[(step-1)&127];
+
+		//Request : step x (odd step)
+		//Operation : x+1   (even step)
+		//Data avail : x+2   (odd step, can request again)
+		s32 MEM_RD_DATA_NV=0;
+		if (!(step&1))
+		{
+			u32 addr=dsp.regs.MEM_ADDR&AICA_RAM_MASK;
+
+			if (prev_op.MRD)
+				MEM_RD_DATA_NV=*(s16*)&aica_ram.data[addr];
+
+			if (prev_op.MWT)
+			{
+				if (validate)
+				{
+					dsp_wlog[dsp_wlog_count].addr=addr;
+					dsp_wlog[dsp_wlog_count++].data=*(u16*)&aica_ram.data[addr];
+				}
+				*(u16*)&aica_ram.data[addr]=dsp.regs.MEM_WT_DATA;
+			}
+		}
+
+		//address generation, the address is used on the next step
+		if (step&1)
+		{
+			u32 addr=DSPData->MADRS[op.MASA];
+			if (op.ADREB)
+				addr+=dsp.regs.ADRS_REG;
+			if (op.NXADR)
+				addr++;
+
+			if (!op.TABLE)
+				addr=(addr+dsp.regs.MDEC_CT)&dsp.RBL;
+			else
+				addr&=0xFFFF;
+
+			dsp.regs.MEM_ADDR=addr*2+dsp.RBP;
+		}
+
+		//INPUTS is 24 bits
+		s32 INPUTS;
+		if (op.IRA<0x20)
+			INPUTS=dsp_sx(dsp.MEMS[op.IRA],24,24);
+		else if (op.IRA<0x30)
+			INPUTS=dsp_sx(dsp.MIXS[op.IRA-0x20],20,24);
+		else if (op.IRA<0x32)
+			INPUTS=dsp_sx(DSPData->EXTS[op.IRA-0x30],16,24);
+		else
+			INPUTS=0;
+
+		if (op.IWT)
+		{
+			if (SUPPORT_NOFL && !dsp.regs.NOFL_2)
+				dsp.MEMS[op.IWA]=UNPACK(dsp.regs.MEM_RD_DATA);
+			else
+				dsp.MEMS[op.IWA]=(s16)dsp.regs.MEM_RD_DATA<<8;
+		}
+
+		if (!(step&1) && prev_op.MRD)
+			dsp.regs.MEM_RD_DATA=MEM_RD_DATA_NV;
+
+		//mul-add
+		s32 TEMPS=dsp_sx(dsp.TEMP[(op.TRA+dsp.regs.MDEC_CT)&127],24,24);
+		s32 X=op.XSEL?INPUTS:TEMPS;
+		s32 Y;
+
+		switch(op.YSEL)
+		{
+		case 0: Y=dsp_sx(dsp.regs.FRC_REG,13,13); break;
+		case 1: Y=dsp_sx(DSPData->COEF[step],16,13); break;
+		case 2: Y=dsp_sx(dsp.regs.Y_REG,19,13); break;
+		default: Y=dsp.regs.Y_REG&0xFFF; break;
+		}
+
+		s32 MAD_OUT_NV=dsp_sx((u32)(((s64)X*Y)>>10),26,26);
+
+		if (!op.ZERO)
+		{
+			s32 B=op.BSEL?dsp.regs.MAD_OUT:TEMPS*4;
+			if (op.NEGB)
+				B=-B;
+
+			MAD_OUT_NV=dsp_sx(MAD_OUT_NV+B,26,26);
+		}
+
+		//effect output/feedback, from the previous MAD_OUT
+		s32 SHIFTED=dsp.regs.MAD_OUT;
+		switch(op.SHIFT)
+		{
+		case 0:
+			SHIFTED>>=2;
+			SHIFTED=max(-524288,min(SHIFTED,524288));
+			break;
+		case 1:
+			SHIFTED>>=1;
+			SHIFTED=max(-524288,min(SHIFTED,524287));
+			break;
+		case 2:
+			SHIFTED=dsp_sx(SHIFTED>>1,24,24);
+			break;
+		case 3:
+			SHIFTED=dsp_sx((SHIFTED>>1)<<2,24,24);
+			break;
+		}
+
+		if (op.EWT)
+			*(u16*)&DSPData->EFREG[op.EWA]=SHIFTED>>4;
+
+		if (op.TWT)
+			dsp.TEMP[(op.TWA+dsp.regs.MDEC_CT)&127]=SHIFTED;
+
+		if (op.FRCL)
+			dsp.regs.FRC_REG=op.SHIFT==3?SHIFTED>>11:SHIFTED&((1<<12)-1);
+
+		if (op.ADRL)
+			dsp.regs.ADRS_REG=op.SHIFT==3?dsp_sx(SHIFTED,24,8):(SHIFTED>>12)&((1<<12)-1);
+
+		if (SUPPORT_NOFL && !op.NOFL)
+			dsp.regs.MEM_WT_DATA=PACK(SHIFTED);
+		else
+			dsp.regs.MEM_WT_DATA=SHIFTED>>8;
+
+		dsp.regs.MAD_OUT=MAD_OUT_NV;
+
+		if (op.YRL)
+			dsp.regs.Y_REG=INPUTS>>4;
+
+		dsp.regs.NOFL_2=dsp.regs.NOFL_1;
+		dsp.regs.NOFL_1=op.NOFL;
+		dsp.regs.MWT_1=op.MWT;
+		dsp.regs.MRD_1=op.MRD;
+	}
+}
+
+//decodes (and recompiles) the program, if it has changed since the last time
+static void dsp_update_program()
+{
+	if (dsp_prog_valid && dsp_prog_RBL==dsp.RBL && dsp_prog_RBP==dsp.RBP &&
+		memcmp(dsp_prog_mpro,DSPData->MPRO,sizeof(dsp_prog_mpro))==0)
+		return;
+
+	memcpy(dsp_prog_mpro,DSPData->MPRO,sizeof(dsp_prog_mpro));
+	dsp_prog_RBL=dsp.RBL;
+	dsp_prog_RBP=dsp.RBP;
+	dsp_prog_valid=true;
+
+	for (u32 step=0;step<128;step++)
+		DecodeInst(&dsp_prog_mpro[step*4],&dsp_prog[step]);
+
+#ifdef DSP_REC
+	dsp_recompile();
+#endif
+}
+
+#ifdef DSP_REC
+static INLINE void dsp_rec_step()
+{
+	((void (*)())&dsp.DynCode)();
+}
+#endif
+
+#ifdef DSP_VALIDATE
+//Runs the interpreter and the recompiled program from the same state, and compares the result.
+//The aram writes of the interpreter are undone, the recompiled run is the one that is kept
+static void dsp_validate()
+{
+	const u32 state_size=offsetof(dsp_t,dyndirty)-offsetof(dsp_t,TEMP);
+	u8 state[state_size];
+	u8 int_state[state_size];
+	u32 int_efreg[16];
+	u16 int_wdata[64];
+
+	memcpy(state,dsp.TEMP,state_size);
+
+	dsp_wlog_count=0;
+	dsp_interpret<true>();
+
+	memcpy(int_state,dsp.TEMP,state_size);
+	memcpy(int_efreg,DSPData->EFREG,sizeof(int_efreg));
+
+	for (u32 i=0;i<dsp_wlog_count;i++)
+		int_wdata[i]=*(u16*)&aica_ram.data[dsp_wlog[i].addr];
+
+	for (int i=dsp_wlog_count-1;i>=0;i--)
+		*(u16*)&aica_ram.data[dsp_wlog[i].addr]=dsp_wlog[i].data;
+
+	memcpy(dsp.TEMP,state,state_size);
+	memset(DSPData->EFREG,0,sizeof(DSPData->EFREG));
+
+	dsp_rec_step();
+
+	bool match=memcmp(int_efreg,DSPData->EFREG,sizeof(int_efreg))==0 && memcmp(int_state,dsp.TEMP,state_size)==0;
+	for (u32 i=0;i<dsp_wlog_count;i++)
+		match&=int_wdata[i]==*(u16*)&aica_ram.data[dsp_wlog[i].addr];
+
+	//only the first mismatch of a report is printed, a bad program mismatches on every sample
+	if (!match && dsp_stats.mismatches++==0)
+	{
+		u32* rec=(u32*)dsp.TEMP;
+		u32* ref=(u32*)int_state;
+
+		for (u32 i=0;i<state_size/4;i++)
+		{
+			if (rec[i]!=ref[i])
+				printf("dsp rec: state word %d (TEMP+%d) is %08X, the interpreter has %08X\n",i,i*4,rec[i],ref[i]);
+		}
+
+		for (u32 i=0;i<16;i++)
+		{
+			if (int_efreg[i]!=DSPData->EFREG[i])
+				printf("dsp rec: EFREG[%d] is %04X, the interpreter has %04X\n",i,DSPData->EFREG[i],int_efreg[i]);
+		}
+	}
+
+	if (++dsp_stats.samples==44100)
+	{
+		if (dsp_stats.mismatches)
+			printf("dsp rec: %d of %d samples didn't match\n",dsp_stats.mismatches,dsp_stats.samples);
+
+		dsp_stats.samples=0;
+		dsp_stats.mismatches=0;
+	}
+}
+#endif
+
+void dsp_init(void)
+{
+	memset(&dsp,0,sizeof(dsp));
+	memset(DSPData,0,sizeof(*DSPData));
+#ifdef DSP_VALIDATE
+	memset(&dsp_stats,0,sizeof(dsp_stats));
+#endif
+
+	dsp.dyndirty=true;
+	dsp.RBL=0x2000-1;
+	dsp.RBP=0;
+	dsp.regs.MDEC_CT=1;
+	dsp_prog_valid=false;
+
+#ifdef DSP_REC
+	os_MakeExecutable(dsp.DynCode,sizeof(dsp.DynCode));
+#endif
+}
+
+void dsp_term(void)
+{
+	dsp_prog_valid=false;
+}
+
 void dsp_step(void)
 {
 	//clear output reg
@@ -757,14 +1370,20 @@ void dsp_step(void)
 	if (dsp.dyndirty)
 	{
 		dsp.dyndirty=false;
-		//dsp_print_mame();
-		dsp_recompile();
+		dsp_update_program();
 	}
-	//dsp_step_mame();
-	//dsp_emu_grandia();
-	
-	//run the code :p
-	((void (*)())&dsp.DynCode)();
+
+#ifdef DSP_VALIDATE
+	if (settings.aica.DSPRec==DSP_Validate)
+		dsp_validate();
+	else
+#endif
+#ifdef DSP_REC
+	if (settings.aica.DSPRec!=DSP_Interpreter)
+		dsp_rec_step();
+	else
+#endif
+		dsp_interpret<false>();
 
 	dsp.regs.MDEC_CT--;
 	if (dsp.regs.MDEC_CT==0)
@@ -794,15 +1413,3 @@ void dsp_writenmem(u32 addr)
 	s32 MIXS[16];
 	*/
 }
-
-void dsp_readmem(u32 addr)
-{
-	//nothing ? :p
-}
-#else
-
-void dsp_init() { }
-void dsp_term() { }
-void dsp_step() { }
-void dsp_writenmem(u32 addr) { }
-#endif
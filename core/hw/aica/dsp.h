@@ -86,6 +86,13 @@ struct dsp_t
 	bool dyndirty;
 };
 
+enum DspRecMode
+{
+	DSP_Interpreter=0,
+	DSP_Recompiler=1,
+	DSP_Validate=2,    //every sample runs on both, the interpreter is the reference (debug builds)
+};
+
 DECL_ALIGN(4096)
 extern dsp_t dsp;
 
@@ -1,4 +1,5 @@
 #include "sgc_if.h"
+#include <atomic>
 #include <time.h>
 #include <math.h>
 
@@ -10,6 +11,7 @@
 #include "hw/holly/holly_intc.h"
 #include "hw/holly/sb.h"
 #include "hw/arm7/arm7.h"
+#include "serialize.h"
 
 #include "../libretro/libretro.h"
 
@@ -68,6 +70,7 @@ const s32 quant_mul[16] =
 
 
 void AICA_Sample();
+static void SelectMixKernels();
 
 //Remove the fractional part , with rounding ;) -- does not need an extra bit
 #define well(a,bits) (((a) + ((1<<(bits-1))))>>bits)
@@ -268,6 +271,17 @@ enum _EG_state
 
 struct ChannelEx;
 
+//Structure of arrays of one channel for the samples of a batch (see AICA_Sample32)
+struct ChannelBatch
+{
+	s32 s0[32];
+	s32 s1[32];
+	s32 fp[32];
+	s32 attl[32];
+	s32 attr[32];
+	s32 attdsp[32];
+};
+
 //make these DYNACALL ? they were fastcall before ..
 void (* STREAM_STEP_LUT[5][2][2])(ChannelEx* ch);
 void (* STREAM_INITAL_STEP_LUT[5])(ChannelEx* ch);
@@ -398,16 +412,9 @@ struct ChannelEx
 
 		return rv;
 	}
-	__forceinline bool Step(int32_t& oLeft, int32_t& oRight, int32_t& oDsp, int32_t mixl, int32_t mixr)
-   {
-      if (!enabled)
-      {
-         oLeft=oRight=oDsp=0;
-         return false;
-      }
-
-      int32_t sample=InterpolateSample();
-
+	//attenuations of the current sample, as tl_lut values
+	__forceinline void GetAtts(s32& attl, s32& attr, s32& attdsp)
+	{
       //Volume & Mixer processing
       //All attenuations are added together then applied and mixed :)
       u32 ofsatt=lfo.alfo+(AEG.GetValue()>>2);
@@ -417,14 +424,13 @@ struct ChannelEx
 
       s32* logtable=ofsatt+tl_lut;
 
-      u32 dl = MIN(VolMix.DLAtt,max_att);
-      u32 dr = MIN(VolMix.DRAtt,max_att);
-      u32 ds = MIN(VolMix.DSPAtt,max_att);
-
-      oLeft=FPMul(sample,logtable[dl],15);
-      oRight=FPMul(sample,logtable[dr],15);
-      oDsp=FPMul(sample,logtable[ds],15);
-
+      attl=logtable[MIN(VolMix.DLAtt,max_att)];
+      attr=logtable[MIN(VolMix.DRAtt,max_att)];
+      attdsp=logtable[MIN(VolMix.DSPAtt,max_att)];
+	}
+	//steps the envelopes, stream and lfo to the next sample
+	__forceinline void Advance(int32_t mixl, int32_t mixr)
+	{
       if (settings.aica.EGHack)
       {
          if( (s64)(this->ccd->DL + mixl + mixr + *VolMix.DSPOut) == 0)
@@ -460,9 +466,44 @@ struct ChannelEx
       StepFEG(this);
       StepStream(this);
       lfo.Step(this);
+	}
+	__forceinline bool Step(int32_t& oLeft, int32_t& oRight, int32_t& oDsp, int32_t mixl, int32_t mixr)
+   {
+      if (!enabled)
+      {
+         oLeft=oRight=oDsp=0;
+         return false;
+      }
+
+      int32_t sample=InterpolateSample();
+
+      s32 attl,attr,attdsp;
+      GetAtts(attl,attr,attdsp);
+
+      oLeft=FPMul(sample,attl,15);
+      oRight=FPMul(sample,attr,15);
+      oDsp=FPMul(sample,attdsp,15);
+
+      Advance(mixl,mixr);
       return true;
    }
 
+	//Runs the channel for up to 32 samples of a batch, and records what the mixing kernels need.
+	//Returns the number of samples, the channel stops early if it gets disabled
+	__forceinline u32 StepBatch(ChannelBatch& cb, const int32_t* mixl, const int32_t* mixr)
+	{
+		u32 i;
+		for (i=0;i<32 && enabled;i++)
+		{
+			cb.s0[i]=s0;
+			cb.s1[i]=s1;
+			cb.fp[i]=step.fp;
+			GetAtts(cb.attl[i],cb.attr[i],cb.attdsp[i]);
+			Advance(mixl[i],mixr[i]);
+		}
+		return i;
+	}
+
 	__forceinline void Step(int32_t& mixl, int32_t& mixr)
 	{
 		int32_t oLeft,oRight,oDsp;
@@ -753,6 +794,48 @@ struct ChannelEx
 
 		}
 	} 
+
+	//the host pointers aren't saved, they are rebuilt from the (already loaded) channel regs
+	void Serialize(dc_state& st)
+	{
+		u32 sa_offs=SA-aica_ram.data;
+		u32 dsp_out=VolMix.DSPOut-dsp.MIXS;
+
+		st(sa_offs);
+		st(CA);
+		st(step);
+		st(update_rate);
+		st(s0);
+		st(s1);
+		st(loop);
+		st(adpcm);
+		st(noise_state);
+		st(VolMix.DLAtt);
+		st(VolMix.DRAtt);
+		st(VolMix.DSPAtt);
+		st(dsp_out);
+		st(AEG);
+		st(FEG);
+		st(lfo.counter);
+		st(lfo.start_value);
+		st(lfo.state);
+		st(lfo.alfo);
+		st(lfo.alfo_shft);
+		st(lfo.plfo);
+		st(lfo.plfo_shft);
+		st(enabled);
+
+		if (st.load)
+		{
+			SA=&aica_ram.data[sa_offs&ARAM_MASK];
+			VolMix.DSPOut=&dsp.MIXS[dsp_out&15];
+			StepAEG=AEG_STEP_LUT[AEG.state];
+			StepFEG=FEG_STEP_LUT[FEG.state];
+			UpdateStreamStep();
+			lfo.alfo_calc=ALFOWS_CALC[ccd->ALFOWS];
+			lfo.plfo_calc=PLFOWS_CALC[ccd->PLFOWS];
+		}
+	}
 };
 
 // DecodeADPCM Implementation from MAME - 
@@ -1101,6 +1184,7 @@ void sgc_Init()
 		Chans[i].Init(i,aica_reg);
 	dsp_out_vol=(DSP_OUT_VOL_REG*)&aica_reg[0x2000];
 
+	SelectMixKernels();
 	dsp_init();
 }
 
@@ -1161,12 +1245,10 @@ void WriteCommonReg8(u32 reg,u32 data)
 }
 
 #define CDDA_SIZE    (2352/2)
-#define SAMPLE_COUNT 512
 
 static s16 cdda_sector[CDDA_SIZE] = {0};
 static u32 cdda_index             = CDDA_SIZE<<1;
 
-static int32_t mxlr[64];
 
 struct SoundFrame
 {
@@ -1174,55 +1256,409 @@ struct SoundFrame
    s16 r;
 };
 
+/*
+	Audio output
+
+	The mixer writes its samples to a ring, the frontend drains it once per video frame
+	(audio_Output). Single producer (the aica) and single consumer, as the render queue,
+	so the two indices are enough. The tail is only written by WriteSample, the head only
+	by audio_Output.
+
+	The frontend gets a steady sample_rate/fps frames per video frame, whatever the
+	emulation produced during that frame. The ring is read with a linear resampler whose
+	rate follows the fill level: when more than the target is buffered the ring is read
+	slightly faster, when less slightly slower, by at most AUDIO_MAX_DRIFT. This absorbs
+	the difference between the 44100Hz aica clock, the emulated refresh and what the
+	frontend was told, instead of letting it pile up (crackling) or run dry (judder).
+	The target is a quarter of the audio buffer size option, on top of the frame.
+*/
+#define AUDIO_RING_SIZE   4096   //frames, power of 2
+#define AUDIO_OUT_MAX     2048   //frames per video frame, 44100/fps is ~882 at most
+#define AUDIO_MAX_DRIFT   0.005
+
+static SoundFrame audio_ring[AUDIO_RING_SIZE];
+static std::atomic<u32> audio_head;   //next frame to read
+static std::atomic<u32> audio_tail;   //next frame to write
+static bool audio_discard;
+
+static double audio_frames;           //fractional frames owed to the frontend
+static double audio_pos;              //read position between audio_ring[head] and the next frame
+static SoundFrame audio_last;
+
+audio_stats_t audio_stats;
+
 extern retro_audio_sample_batch_t audio_batch_cb;
 
 static void WriteSample(s16 r, s16 l)
 {
-   static SoundFrame RingBuffer[SAMPLE_COUNT];
-   static const u32 RingBufferByteSize = sizeof(RingBuffer);
-   static const u32 RingBufferSampleCount = SAMPLE_COUNT;
-   static volatile u32 WritePtr;  //last written sample
-   static volatile u32 ReadPtr;   //next sample to read
-	const u32 ptr = (WritePtr+1)%RingBufferSampleCount;
-	RingBuffer[ptr].r=r;
-	RingBuffer[ptr].l=l;
-	WritePtr=ptr;
-
-	if (WritePtr==(SAMPLE_COUNT-1))
-      audio_batch_cb((const int16_t*)RingBuffer, SAMPLE_COUNT);
+	if (audio_discard)
+		return;
+
+	u32 tail=audio_tail.load(std::memory_order_relaxed);
+
+	if (tail-audio_head.load(std::memory_order_acquire)>=AUDIO_RING_SIZE)
+	{
+		audio_stats.dropped++;
+		return;
+	}
+
+	audio_ring[tail%AUDIO_RING_SIZE].r=r;
+	audio_ring[tail%AUDIO_RING_SIZE].l=l;
+	audio_tail.store(tail+1,std::memory_order_release);
+
+	audio_stats.written++;
+}
+
+u32 audio_Fill(void)
+{
+	return audio_tail.load(std::memory_order_acquire)-audio_head.load(std::memory_order_acquire);
+}
+
+void audio_Discard(bool discard)
+{
+	audio_discard=discard;
 }
 
-//no DSP for now in this version
+void audio_Output(double fps)
+{
+	static SoundFrame out[AUDIO_OUT_MAX];
+
+	audio_frames+=44100.0/fps;
+	u32 count=min((u32)audio_frames,(u32)AUDIO_OUT_MAX);
+	audio_frames-=(u32)audio_frames;
+
+	u32 head=audio_head.load(std::memory_order_relaxed);
+	u32 fill=audio_tail.load(std::memory_order_acquire)-head;
+
+	//frames read per frame output
+	double window=max(settings.aica.BufferSize/4,64u);
+	double error=(fill-(window+count))/window;
+	clip(error,-1,1);
+	double step=1+AUDIO_MAX_DRIFT*error;
+
+	for (u32 i=0;i<count;i++)
+	{
+		u32 ip=(u32)audio_pos;
+
+		//the resampler needs the frame after the read position too
+		if (ip+1>=fill)
+		{
+			if (fill)
+				audio_last=audio_ring[(head+fill-1)%AUDIO_RING_SIZE];
+			out[i]=audio_last;
+			audio_stats.underruns++;
+			continue;
+		}
+
+		const SoundFrame& s0=audio_ring[(head+ip)%AUDIO_RING_SIZE];
+		const SoundFrame& s1=audio_ring[(head+ip+1)%AUDIO_RING_SIZE];
+		double fp=audio_pos-ip;
+
+		out[i].l=s0.l+(s32)((s1.l-s0.l)*fp);
+		out[i].r=s0.r+(s32)((s1.r-s0.r)*fp);
+		audio_last=out[i];
+
+		audio_pos+=step;
+	}
+
+	u32 consumed=min((u32)audio_pos,fill ? fill-1 : 0);
+	audio_pos-=consumed;
+	clip(audio_pos,0,1);
+	audio_head.store(head+consumed,std::memory_order_release);
+
+	audio_stats.output+=count;
+	audio_stats.min_fill=audio_stats.frames ? min(audio_stats.min_fill,fill) : fill;
+	audio_stats.max_fill=max(audio_stats.max_fill,fill);
+	audio_stats.step_min=audio_stats.frames ? min(audio_stats.step_min,step) : step;
+	audio_stats.step_max=max(audio_stats.step_max,step);
+	audio_stats.frames++;
+
+	audio_batch_cb((const int16_t*)out,count);
+}
+
+//ring stats since the last call
+void audio_print_stats(void)
+{
+	printf("audio: %d frames written, %d output, %d dropped, %d underruns, fill %d..%d, rate %+.3f%%..%+.3f%%\n",
+		audio_stats.written,audio_stats.output,audio_stats.dropped,audio_stats.underruns,
+		audio_stats.min_fill,audio_stats.max_fill,(audio_stats.step_min-1)*100,(audio_stats.step_max-1)*100);
+
+	memset(&audio_stats,0,sizeof(audio_stats));
+}
+
+/*
+	Batched mixing
+
+	AICA_Sample32 runs each channel for 32 samples, in two passes. StepBatch steps the
+	envelopes, lfo and stream (adpcm decoding included) one sample at a time, and records
+	the interpolation inputs and the attenuations in a ChannelBatch. The mixing kernels then
+	interpolate, attenuate and mix the whole batch, 4 (SSE2) or 8 (AVX2) samples at a time.
+	The final volume/clip pass over the 32 output samples is vectorized the same way.
+
+	The kernels do the same integer math as the scalar versions, so the output is the same
+	on every path. The products all fit in 32 bits (samples are 16 bit, the attenuations
+	and volumes at most 1<<15), only the master volume needs a wider multiply, which is
+	split as (hi<<15 + lo)*vol>>15 = hi*vol + (lo*vol>>15).
+*/
+
+//mix outputs and dsp sends (MIXS) of each sample of a batch
+DECL_ALIGN(32) static int32_t mixl_buf[32];
+DECL_ALIGN(32) static int32_t mixr_buf[32];
+DECL_ALIGN(32) static s32 mixs[16][32];
+DECL_ALIGN(32) static ChannelBatch chan_batch;
+DECL_ALIGN(32) static s16 outl_buf[32];
+DECL_ALIGN(32) static s16 outr_buf[32];
+
+//dsp_send is null without the dsp, channels that only go to the dsp are mixed directly then
+static void MixChannel_C(u32 count, const ChannelBatch& cb, int32_t* mixl, int32_t* mixr, s32* dsp_send)
+{
+	for (u32 i=0;i<count;i++)
+	{
+		int32_t sample=FPMul(cb.s0[i],(s32)(1024-cb.fp[i]),10);
+		sample+=FPMul(cb.s1[i],cb.fp[i],10);
+
+		int32_t oLeft=FPMul(sample,cb.attl[i],15);
+		int32_t oRight=FPMul(sample,cb.attr[i],15);
+		int32_t oDsp=FPMul(sample,cb.attdsp[i],15);
+
+		if (dsp_send)
+		{
+			dsp_send[i]+=oDsp;
+		}
+		else if (0==(oLeft+oRight))
+		{
+			oLeft=oRight=oDsp;
+		}
+
+		mixl[i]+=oLeft;
+		mixr[i]+=oRight;
+	}
+}
+
+//master volume, 18 bit dac and clipping of the 32 samples
+static void FinalMix_C(const int32_t* mixl, const int32_t* mixr, s16* outl, s16* outr)
+{
+	//we want to make sure mix* is *At least* 23 bits wide here, so 64 bit mul !
+	s32 val=volume_lut[CommonData->MVOL];
+
+	for (int i=0;i<32;i++)
+	{
+		int32_t l=(s32)FPMul((s64)mixl[i],val,15);
+		int32_t r=(s32)FPMul((s64)mixr[i],val,15);
+
+		if (CommonData->DAC18B)
+		{
+			//If 18 bit output , make it 16b :p
+			l=FPs(l,2);
+			r=FPs(r,2);
+		}
+
+		clip16(l);
+		clip16(r);
+
+		outl[i]=l;
+		outr[i]=r;
+	}
+}
+
+static void (*MixChannel)(u32 count, const ChannelBatch& cb, int32_t* mixl, int32_t* mixr, s32* dsp_send)=MixChannel_C;
+static void (*FinalMix)(const int32_t* mixl, const int32_t* mixr, s16* outl, s16* outr)=FinalMix_C;
+
+#if (HOST_CPU == CPU_X86 || HOST_CPU == CPU_X64) && (defined(__SSE2__) || defined(_M_X64))
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SGC_AVX2
+#else
+#define SGC_AVX2 __attribute__((target("avx2")))
+#endif
+
+//low 32 bits of the products, sse2 only has the 32x32->64 multiply
+static __forceinline __m128i mullo32_sse2(__m128i a, __m128i b)
+{
+	__m128i even=_mm_mul_epu32(a,b);
+	__m128i odd=_mm_mul_epu32(_mm_srli_epi64(a,32),_mm_srli_epi64(b,32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even,_MM_SHUFFLE(0,0,2,0)),_mm_shuffle_epi32(odd,_MM_SHUFFLE(0,0,2,0)));
+}
+
+static void MixChannel_SSE2(u32 count, const ChannelBatch& cb, int32_t* mixl, int32_t* mixr, s32* dsp_send)
+{
+	const __m128i k1024=_mm_set1_epi32(1024);
+	const __m128i zero=_mm_setzero_si128();
+
+	for (u32 i=0;i<count;i+=4)
+	{
+		__m128i fp=_mm_load_si128((__m128i*)&cb.fp[i]);
+		__m128i sample=_mm_srai_epi32(mullo32_sse2(_mm_load_si128((__m128i*)&cb.s0[i]),_mm_sub_epi32(k1024,fp)),10);
+		sample=_mm_add_epi32(sample,_mm_srai_epi32(mullo32_sse2(_mm_load_si128((__m128i*)&cb.s1[i]),fp),10));
+
+		__m128i l=_mm_srai_epi32(mullo32_sse2(sample,_mm_load_si128((__m128i*)&cb.attl[i])),15);
+		__m128i r=_mm_srai_epi32(mullo32_sse2(sample,_mm_load_si128((__m128i*)&cb.attr[i])),15);
+		__m128i d=_mm_srai_epi32(mullo32_sse2(sample,_mm_load_si128((__m128i*)&cb.attdsp[i])),15);
+
+		if (dsp_send)
+		{
+			_mm_store_si128((__m128i*)&dsp_send[i],_mm_add_epi32(_mm_load_si128((__m128i*)&dsp_send[i]),d));
+		}
+		else
+		{
+			__m128i direct=_mm_cmpeq_epi32(_mm_add_epi32(l,r),zero);
+			d=_mm_and_si128(direct,d);
+			l=_mm_or_si128(_mm_andnot_si128(direct,l),d);
+			r=_mm_or_si128(_mm_andnot_si128(direct,r),d);
+		}
+
+		_mm_store_si128((__m128i*)&mixl[i],_mm_add_epi32(_mm_load_si128((__m128i*)&mixl[i]),l));
+		_mm_store_si128((__m128i*)&mixr[i],_mm_add_epi32(_mm_load_si128((__m128i*)&mixr[i]),r));
+	}
+}
+
+static __forceinline __m128i MasterVolume_SSE2(__m128i mix, __m128i val)
+{
+	__m128i hi=mullo32_sse2(_mm_srai_epi32(mix,15),val);
+	__m128i lo=_mm_srli_epi32(mullo32_sse2(_mm_and_si128(mix,_mm_set1_epi32(0x7FFF)),val),15);
+	return _mm_add_epi32(hi,lo);
+}
+
+static void FinalMix_SSE2(const int32_t* mixl, const int32_t* mixr, s16* outl, s16* outr)
+{
+	const __m128i val=_mm_set1_epi32(volume_lut[CommonData->MVOL]);
+	const int shift=CommonData->DAC18B?2:0;
+
+	for (int i=0;i<32;i+=8)
+	{
+		__m128i l0=_mm_srai_epi32(MasterVolume_SSE2(_mm_load_si128((__m128i*)&mixl[i]),val),shift);
+		__m128i l1=_mm_srai_epi32(MasterVolume_SSE2(_mm_load_si128((__m128i*)&mixl[i+4]),val),shift);
+		__m128i r0=_mm_srai_epi32(MasterVolume_SSE2(_mm_load_si128((__m128i*)&mixr[i]),val),shift);
+		__m128i r1=_mm_srai_epi32(MasterVolume_SSE2(_mm_load_si128((__m128i*)&mixr[i+4]),val),shift);
+
+		//packs saturates, same as clip16
+		_mm_store_si128((__m128i*)&outl[i],_mm_packs_epi32(l0,l1));
+		_mm_store_si128((__m128i*)&outr[i],_mm_packs_epi32(r0,r1));
+	}
+}
+
+SGC_AVX2 static void MixChannel_AVX2(u32 count, const ChannelBatch& cb, int32_t* mixl, int32_t* mixr, s32* dsp_send)
+{
+	const __m256i k1024=_mm256_set1_epi32(1024);
+	const __m256i zero=_mm256_setzero_si256();
+
+	for (u32 i=0;i<count;i+=8)
+	{
+		__m256i fp=_mm256_load_si256((__m256i*)&cb.fp[i]);
+		__m256i sample=_mm256_srai_epi32(_mm256_mullo_epi32(_mm256_load_si256((__m256i*)&cb.s0[i]),_mm256_sub_epi32(k1024,fp)),10);
+		sample=_mm256_add_epi32(sample,_mm256_srai_epi32(_mm256_mullo_epi32(_mm256_load_si256((__m256i*)&cb.s1[i]),fp),10));
+
+		__m256i l=_mm256_srai_epi32(_mm256_mullo_epi32(sample,_mm256_load_si256((__m256i*)&cb.attl[i])),15);
+		__m256i r=_mm256_srai_epi32(_mm256_mullo_epi32(sample,_mm256_load_si256((__m256i*)&cb.attr[i])),15);
+		__m256i d=_mm256_srai_epi32(_mm256_mullo_epi32(sample,_mm256_load_si256((__m256i*)&cb.attdsp[i])),15);
+
+		if (dsp_send)
+		{
+			_mm256_store_si256((__m256i*)&dsp_send[i],_mm256_add_epi32(_mm256_load_si256((__m256i*)&dsp_send[i]),d));
+		}
+		else
+		{
+			__m256i direct=_mm256_cmpeq_epi32(_mm256_add_epi32(l,r),zero);
+			l=_mm256_blendv_epi8(l,d,direct);
+			r=_mm256_blendv_epi8(r,d,direct);
+		}
+
+		_mm256_store_si256((__m256i*)&mixl[i],_mm256_add_epi32(_mm256_load_si256((__m256i*)&mixl[i]),l));
+		_mm256_store_si256((__m256i*)&mixr[i],_mm256_add_epi32(_mm256_load_si256((__m256i*)&mixr[i]),r));
+	}
+}
+
+SGC_AVX2 static __forceinline __m256i MasterVolume_AVX2(__m256i mix, __m256i val)
+{
+	__m256i hi=_mm256_mullo_epi32(_mm256_srai_epi32(mix,15),val);
+	__m256i lo=_mm256_srli_epi32(_mm256_mullo_epi32(_mm256_and_si256(mix,_mm256_set1_epi32(0x7FFF)),val),15);
+	return _mm256_add_epi32(hi,lo);
+}
+
+SGC_AVX2 static void FinalMix_AVX2(const int32_t* mixl, const int32_t* mixr, s16* outl, s16* outr)
+{
+	const __m256i val=_mm256_set1_epi32(volume_lut[CommonData->MVOL]);
+	const __m128i shift=_mm_cvtsi32_si128(CommonData->DAC18B?2:0);
+
+	for (int i=0;i<32;i+=16)
+	{
+		__m256i l0=_mm256_sra_epi32(MasterVolume_AVX2(_mm256_load_si256((__m256i*)&mixl[i]),val),shift);
+		__m256i l1=_mm256_sra_epi32(MasterVolume_AVX2(_mm256_load_si256((__m256i*)&mixl[i+8]),val),shift);
+		__m256i r0=_mm256_sra_epi32(MasterVolume_AVX2(_mm256_load_si256((__m256i*)&mixr[i]),val),shift);
+		__m256i r1=_mm256_sra_epi32(MasterVolume_AVX2(_mm256_load_si256((__m256i*)&mixr[i+8]),val),shift);
+
+		//packs works within the 128 bit lanes, the permute puts the samples back in order
+		_mm256_store_si256((__m256i*)&outl[i],_mm256_permute4x64_epi64(_mm256_packs_epi32(l0,l1),_MM_SHUFFLE(3,1,2,0)));
+		_mm256_store_si256((__m256i*)&outr[i],_mm256_permute4x64_epi64(_mm256_packs_epi32(r0,r1),_MM_SHUFFLE(3,1,2,0)));
+	}
+}
+
+static bool HostHasAVX2()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+
+	__cpuid(info, 1);
+	bool osxsave = (info[2] >> 27) & 1;
+	bool avx = (info[2] >> 28) & 1;
+
+	//the os has to save the ymm registers too
+	if (max_leaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6)
+	{
+		__cpuidex(info, 7, 0);
+		return (info[1] >> 5) & 1;
+	}
+	return false;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static void SelectMixKernels()
+{
+	if (HostHasAVX2())
+	{
+		MixChannel=MixChannel_AVX2;
+		FinalMix=FinalMix_AVX2;
+	}
+	else
+	{
+		MixChannel=MixChannel_SSE2;
+		FinalMix=FinalMix_SSE2;
+	}
+}
+#else
+static void SelectMixKernels() { }
+#endif
+
 void AICA_Sample32(void)
 {
 	if (settings.aica.NoBatch)
 		return;
 
-	memset(mxlr,0,sizeof(mxlr));
+	memset(mixl_buf,0,sizeof(mixl_buf));
+	memset(mixr_buf,0,sizeof(mixr_buf));
+	memset(mixs,0,sizeof(mixs));
 
 	//Generate 32 samples for each channel, before moving to next channel
 	//much more cache efficient !
-	u32 sg=0;
 	for (int ch = 0; ch < AICA_NUM_CHANNELS; ch++)
 	{
-		for (int i=0;i<32;i++)
-		{
-			int32_t oLeft,oRight,oDsp;
-			//stop working on this channel if its turned off ...
-			if (!Chans[ch].Step(oLeft, oRight, oDsp, mxlr[i*2+0],
-                  mxlr[i*2+1]))
-				break;
-
-			sg++;
+		u32 count=Chans[ch].StepBatch(chan_batch,mixl_buf,mixr_buf);
+		if (count==0)
+			continue;
 
-			if (0==(oLeft+oRight))
-			{
-				oLeft=oRight=oDsp;
-			}
+		//the kernels run in blocks of 8 samples, the ones past the end are attenuated to 0
+		for (u32 i=count;i<((count+7)&~7);i++)
+			chan_batch.attl[i]=chan_batch.attr[i]=chan_batch.attdsp[i]=0;
 
-			mxlr[i*2+0] += oLeft;
-			mxlr[i*2+1] += oRight;
-		}
+		s32* dsp_send=settings.aica.DSPEnabled?mixs[Chans[ch].VolMix.DSPOut-dsp.MIXS]:0;
+		MixChannel(count,chan_batch,mixl_buf,mixr_buf,dsp_send);
 	}
 
 	//OK , generated all Channels  , now DSP/ect + final mix ;p
@@ -1232,8 +1668,8 @@ void AICA_Sample32(void)
 	{
 		int32_t mixl,mixr;
 
-		mixl=mxlr[i*2+0];
-		mixr=mxlr[i*2+1];
+		mixl=mixl_buf[i];
+		mixr=mixr_buf[i];
 
 		if (cdda_index>=CDDA_SIZE)
 		{
@@ -1254,6 +1690,18 @@ void AICA_Sample32(void)
 			VOLPAN(EXTS0R,dsp_out_vol[17].EFSDL,dsp_out_vol[17].EFPAN,mixl,mixr);
 		}
 
+		if (settings.aica.DSPEnabled)
+		{
+			for (int j=0;j<16;j++)
+				dsp.MIXS[j]=mixs[j][i];
+			dsp_step();
+
+			for (int j=0;j<16;j++)
+			{
+				VOLPAN( (*(s16*)&DSPData->EFREG[j]) ,dsp_out_vol[j].EFSDL,dsp_out_vol[j].EFPAN,mixl,mixr);
+			}
+		}
+
 		//Mono !
 		if (CommonData->Mono)
 		{
@@ -1262,31 +1710,18 @@ void AICA_Sample32(void)
 			mixr=mixl;
 		}
 
-		//MVOL !
-		//we want to make sure mix* is *At least* 23 bits wide here, so 64 bit mul !
-		u32 mvol=CommonData->MVOL;
-		s32 val=volume_lut[mvol];
-		mixl=(s32)FPMul((s64)mixl,val,15);
-		mixr=(s32)FPMul((s64)mixr,val,15);
-
-
-		if (CommonData->DAC18B)
-		{
-			//If 18 bit output , make it 16b :p
-			mixl=FPs(mixl,2);
-			mixr=FPs(mixr,2);
-		}
-
-		//Sample is ready ! clip/saturate and store
+		mixl_buf[i]=mixl;
+		mixr_buf[i]=mixr;
+	}
 
-		clip16(mixl);
-		clip16(mixr);
+	//MVOL, 18 bit dac, clip/saturate
+	FinalMix(mixl_buf,mixr_buf,outl_buf,outr_buf);
 
-		pl=mixl;
-		pr=mixr;
+	for (int i=0;i<32;i++)
+		WriteSample(outr_buf[i],outl_buf[i]);
 
-		WriteSample(mixr,mixl);
-	}
+	pl=outl_buf[31];
+	pr=outr_buf[31];
 }
 
 void AICA_Sample(void)
@@ -1365,3 +1800,14 @@ void AICA_Sample(void)
 
 	WriteSample(mixr,mixl);
 }
+
+void channel_serialize(dc_state& st)
+{
+	for (int i = 0; i < AICA_NUM_CHANNELS; i++)
+		Chans[i].Serialize(st);
+
+	st(cdda_sector);
+	st(cdda_index);
+	st(pl);
+	st(pr);
+}
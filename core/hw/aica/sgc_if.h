@@ -10,6 +10,32 @@ void WriteChannelReg8(u32 channel,u32 reg);
 void sgc_Init();
 void sgc_Term();
 
+struct dc_state;
+//streams the channel state, after the aica regs have been loaded
+void channel_serialize(dc_state& st);
+
+struct audio_stats_t
+{
+	u32 written;      //frames mixed into the ring
+	u32 output;       //frames sent to the frontend
+	u32 dropped;      //frames dropped because the ring was full
+	u32 underruns;    //frames repeated because the ring was empty
+	u32 frames;       //video frames
+	u32 min_fill;     //ring fill, when the video frames ended
+	u32 max_fill;
+	double step_min;  //resampler rate
+	double step_max;
+};
+
+extern audio_stats_t audio_stats;
+//frames in the audio ring
+u32 audio_Fill();
+//sends a video frame worth of audio to the frontend, from the ring
+void audio_Output(double fps);
+//drops what the aica mixes, while set
+void audio_Discard(bool discard);
+void audio_print_stats();
+
 union fp_22_10
 {
 	struct
@@ -17,10 +17,19 @@
 // along with this program; if not, write to the Free Software Foundation,
 // Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
+#include "build.h"
+
+//xbyak has to come before sh4_core.h, the sh4 register macros break it
+#if FEAT_AREC == DYNAREC_JIT && HOST_CPU == CPU_X64 && !defined(TARGET_NO_JIT)
+#define ARM_REC
+#include "deps/xbyak/xbyak.h"
+#endif
+
 #include "arm7.h"
 #include "types.h"
 
 #include "hw/sh4/sh4_core.h"
+#include "serialize.h"
 
 #define update_armintc() arm_Reg[INTR_PEND].I=e68k_out && armFiqEnable
 
@@ -1301,8 +1310,44 @@ static bool e68k_out  = false;
 static u32 e68k_reg_L = 0;
 static u32 e68k_reg_M = 0; //constant ?
 
+#ifdef ARM_REC
+enum ArmJournalMode
+{
+	AJ_Off,
+	AJ_Record,   //accesses are done and logged
+	AJ_Replay,   //accesses are checked against the log, reads return the logged data
+};
+
+struct arm_access
+{
+	u32 addr;
+	u32 data;
+	u32 size;
+	bool write;
+};
+
+#define ARM_JOURNAL_SIZE 1024
+
+static struct
+{
+	ArmJournalMode mode;
+	u32 count;
+	u32 pos;
+	bool failed;    //the replay didn't match the log, or the log overflowed
+	arm_access log[ARM_JOURNAL_SIZE];
+} arm_journal;
+
+static u32 arm_JournalRead(u32 addr,u32 size);
+static void arm_JournalWrite(u32 addr,u32 data,u32 size);
+#endif
+
 static INLINE u8 DYNACALL ReadMemArm1(u32 addr)
 {
+#ifdef ARM_REC
+	if (unlikely(arm_journal.mode!=AJ_Off))
+		return arm_JournalRead(addr,1);
+#endif
+
 	addr&=0x00FFFFFF;
 	if (addr<0x800000)
 		return *(u8*)&aica_ram.data[addr&(ARAM_MASK)];
@@ -1324,6 +1369,11 @@ static INLINE u8 DYNACALL ReadMemArm1(u32 addr)
 
 static INLINE u16 DYNACALL ReadMemArm2(u32 addr)
 {
+#ifdef ARM_REC
+	if (unlikely(arm_journal.mode!=AJ_Off))
+		return arm_JournalRead(addr,2);
+#endif
+
 	addr&=0x00FFFFFF;
 	if (addr<0x800000)
 		return *(u16*)&aica_ram.data[addr&(ARAM_MASK-(1))];
@@ -1345,6 +1395,11 @@ static INLINE u16 DYNACALL ReadMemArm2(u32 addr)
 
 static INLINE u32 DYNACALL ReadMemArm4(u32 addr)
 {
+#ifdef ARM_REC
+	if (unlikely(arm_journal.mode!=AJ_Off))
+		return arm_JournalRead(addr,4);
+#endif
+
 	addr&=0x00FFFFFF;
 	if (addr<0x800000)
 	{
@@ -1416,6 +1471,14 @@ static void arm_WriteReg(u32 addr,T data)
 
 static INLINE void DYNACALL WriteMemArm1(u32 addr,u8 data)
 {
+#ifdef ARM_REC
+	if (unlikely(arm_journal.mode!=AJ_Off))
+	{
+		arm_JournalWrite(addr,data,1);
+		return;
+	}
+#endif
+
 	addr&=0x00FFFFFF;
 	if (addr<0x800000)
    {
@@ -1428,6 +1491,14 @@ static INLINE void DYNACALL WriteMemArm1(u32 addr,u8 data)
 
 static INLINE void DYNACALL WriteMemArm2(u32 addr,u16 data)
 {
+#ifdef ARM_REC
+	if (unlikely(arm_journal.mode!=AJ_Off))
+	{
+		arm_JournalWrite(addr,data,2);
+		return;
+	}
+#endif
+
 	addr&=0x00FFFFFF;
 	if (addr<0x800000)
    {
@@ -1440,6 +1511,14 @@ static INLINE void DYNACALL WriteMemArm2(u32 addr,u16 data)
 
 static INLINE void DYNACALL WriteMemArm4(u32 addr,u32 data)
 {
+#ifdef ARM_REC
+	if (unlikely(arm_journal.mode!=AJ_Off))
+	{
+		arm_JournalWrite(addr,data,4);
+		return;
+	}
+#endif
+
 	addr&=0x00FFFFFF;
 	if (addr<0x800000)
    {
@@ -1450,6 +1529,78 @@ static INLINE void DYNACALL WriteMemArm4(u32 addr,u32 data)
    arm_WriteReg<4,u32>(addr,data);
 }
 
+#ifdef ARM_REC
+//Validation: the accesses of a recompiled block are logged, and the interpreter's are checked
+//against them when it replays the block. Reads are served from the log, so the replay has no side effects
+static void arm_JournalAdd(u32 addr,u32 data,u32 size,bool write)
+{
+	if (arm_journal.count==ARM_JOURNAL_SIZE)
+	{
+		arm_journal.failed=true;
+		return;
+	}
+
+	arm_access& a=arm_journal.log[arm_journal.count++];
+	a.addr=addr;
+	a.data=data;
+	a.size=size;
+	a.write=write;
+}
+
+static arm_access* arm_JournalNext(u32 addr,u32 size,bool write)
+{
+	if (arm_journal.pos==arm_journal.count)
+	{
+		arm_journal.failed=true;
+		return 0;
+	}
+
+	arm_access* a=&arm_journal.log[arm_journal.pos++];
+	if (a->addr!=addr || a->size!=size || a->write!=write)
+		arm_journal.failed=true;
+
+	return a;
+}
+
+static NOINLINE u32 arm_JournalRead(u32 addr,u32 size)
+{
+	if (arm_journal.mode==AJ_Replay)
+	{
+		arm_access* a=arm_JournalNext(addr,size,false);
+		return a?a->data:0;
+	}
+
+	arm_journal.mode=AJ_Off;
+	u32 data=size==1?ReadMemArm1(addr):size==2?ReadMemArm2(addr):ReadMemArm4(addr);
+	arm_journal.mode=AJ_Record;
+
+	arm_JournalAdd(addr,data,size,false);
+	return data;
+}
+
+static NOINLINE void arm_JournalWrite(u32 addr,u32 data,u32 size)
+{
+	if (arm_journal.mode==AJ_Replay)
+	{
+		arm_access* a=arm_JournalNext(addr,size,true);
+		if (a && a->data!=data)
+			arm_journal.failed=true;
+		return;
+	}
+
+	arm_JournalAdd(addr,data,size,true);
+
+	arm_journal.mode=AJ_Off;
+	if (size==1)
+		WriteMemArm1(addr,data);
+	else if (size==2)
+		WriteMemArm2(addr,data);
+	else
+		WriteMemArm4(addr,data);
+	arm_journal.mode=AJ_Record;
+}
+#endif
+
 #define arm_ReadMem8 ReadMemArm1
 #define arm_ReadMem16 ReadMemArm2
 #define arm_ReadMem32 ReadMemArm4
@@ -1707,36 +1858,14 @@ static void CPUUndefinedException(void)
 }
 
 
-void arm_Run_(u32 CycleCount)
+//Runs one opcode, reg[15] and armNextPC must already point past it. Returns the cycles it took
+static INLINE u32 arm_ExecuteOp(u32 opcode)
 {
-	u32 clockTicks=0;
-
-	while (clockTicks<CycleCount)
-   {
-      if (reg[INTR_PEND].I)
-         CPUFiq();
-
-      reg[15].I = armNextPC + 8;
-
-#ifdef CPUReadMemoryQuick
-#ifndef NO_OPCODE_READ
-      u32 opcode = CPUReadMemoryQuick(armNextPC);
-      armNextPC += 4;
-#endif
-#endif
-
-      clockTicks += 6;
+      u32 clockTicks = 6;
 
       int cond = opcode >> 28;
       int opcode_hash=((opcode>>16)&0xFF0) | ((opcode>>4)&0x0F);
 
-#ifndef NO_OPCODE_READ
-
-#else
-      //int cond = static_opcode >> 28;
-      //int opcode_hash=((static_opcode>>16)&0xFF0) | ((static_opcode>>4)&0x0F);
-#endif
-
       // suggested optimization for frequent cases
       bool cond_res;
       if(cond == 0x0e) {
@@ -2792,7 +2921,7 @@ void arm_Run_(u32 CycleCount)
          reg[15].I -= 4;
          armNextPC -= 4;
          dbgSignal(5, (opcode & 0x0f)|((opcode>>4) & 0xfff0));
-         return;
+         return clockTicks;
 #endif
             case 0x320:
             case 0x321:
@@ -6784,13 +6913,870 @@ void arm_Run_(u32 CycleCount)
          // END
          }
       }
+
+      return clockTicks;
+}
+
+void arm_Run_(u32 CycleCount)
+{
+	u32 clockTicks=0;
+
+	while (clockTicks<CycleCount)
+   {
+      if (reg[INTR_PEND].I)
+         CPUFiq();
+
+      reg[15].I = armNextPC + 8;
+
+      u32 opcode = CPUReadMemoryQuick(armNextPC);
+      armNextPC += 4;
+
+      clockTicks += arm_ExecuteOp(opcode);
    }
 }
 
-void armt_init(void);
+#ifdef ARM_REC
+/*
+	ARM7 recompiler
+
+	Code is compiled to x64 in blocks of up to ARM_BLOCK_MAX opcodes, that end at the first opcode
+	that writes the pc. The arm registers stay in arm_Reg, the host registers only hold values within
+	an opcode. Data processing with an immediate or immediate shifted operand, LDR/STR(B) with an
+	immediate offset and B/BL are compiled, the rest is handed to the interpreter one opcode at a time.
+
+	A block compares the code it was compiled from with aram when it's entered, so it picks up writes
+	from anywhere (sh4, dma, the arm itself) without tracking them. The interrupt line is checked
+	between blocks, and after the opcodes that can change it (register accesses, interpreted opcodes).
+*/
+
+#define ARM_CODE_SIZE   (2*1024*1024)
+#define ARM_BLOCK_MAX   32
+#define ARM_BLOCK_BYTES (16*1024)    //worst case host code size of a block
+
+//returns the cycles it took, or 0 if the code has changed since it was compiled (nothing was run then)
+typedef u32 (*arm_block_t)();
+
+/* Naomi edit - allow for max possible ARAM_SIZE here */
+void* EntryPoints[(8*1024*1024) /4];
+
+static u8 ARM7_TCB[ARM_CODE_SIZE+4096];
+static u8* arm_code;
+static u32 arm_code_used;
+static u32 arm_entry_min;          //range of EntryPoints that is in use
+static u32 arm_entry_max;
+static u32 arm_rec_mode;           //settings.aica.ArmRec the blocks were compiled for
+static u32 arm_rec_excess;         //cycles the previous slice ran over
+static u32 arm_rec_ops;            //opcodes the last block ran, only set in validation mode
+
+static struct
+{
+	u32 blocks;
+	u32 stale;
+	u32 flushes;
+	u32 validated;
+	u32 mismatches;
+} arm_rec_stats;
+
+static u32 DYNACALL arm_rec_Interpret(u32 opcode)
+{
+	return arm_ExecuteOp(opcode);
+}
+
+static u32 DYNACALL arm_rec_ReadMem8(u32 addr) { return ReadMemArm1(addr); }
+static u32 DYNACALL arm_rec_ReadMem32(u32 addr) { return ReadMemArm4(addr); }
+static void DYNACALL arm_rec_WriteMem8(u32 addr,u32 data) { WriteMemArm1(addr,data); }
+static void DYNACALL arm_rec_WriteMem32(u32 addr,u32 data) { WriteMemArm4(addr,data); }
+
+static bool arm_WritesPC(u32 opcode)
+{
+	switch ((opcode>>25)&7)
+	{
+	case 0:
+	case 1:
+		//data processing (TST..CMN with rd=15 don't), BX
+		if ((opcode & 0x0FFFFFF0)==0x012FFF10)
+			return true;
+		return ((opcode>>12)&15)==15 && ((opcode>>21)&0xC)!=0x8;
+	case 2:
+	case 3:
+		return (opcode & (1<<20)) && ((opcode>>12)&15)==15;
+	case 4:
+		return (opcode & (1<<20)) && (opcode & (1<<15));
+	case 5:
+		return true;
+	case 7:
+		return (opcode & 0x0F000000)==0x0F000000;
+	default:
+		return false;
+	}
+}
+
+class Arm7Compiler : public Xbyak::CodeGenerator
+{
+	Xbyak::Reg32 arg0;
+	Xbyak::Reg32 arg1;
+	Xbyak::Label exit;
+	bool validate;      //all memory accesses go through the handlers, so they are logged
+	u32 ops;            //opcodes before the current one
+
+	Xbyak::Address armreg(u32 idx) { return dword[rbx+idx*sizeof(reg_pair)]; }
+
+	void LoadReg(const Xbyak::Reg32& dst,u32 idx,u32 pc)
+	{
+		if (idx==15)
+			mov(dst,pc+8);
+		else
+			mov(dst,armreg(idx));
+	}
+
+	void Call(const void* fn)
+	{
+		mov(rax,(size_t)fn);
+		call(rax);
+	}
+
+	//ends the block after the current opcode, armNextPC must be set
+	void Exit()
+	{
+		if (validate)
+		{
+			mov(rax,(size_t)&arm_rec_ops);
+			mov(dword[rax],ops+1);
+		}
+		jmp(exit,T_NEAR);
+	}
+
+	void ExitTo(u32 pc)
+	{
+		mov(armreg(R15_ARM_NEXT),pc);
+		Exit();
+	}
+
+	void CheckInterrupt(u32 next)
+	{
+		Xbyak::Label no_intr;
+		cmp(armreg(INTR_PEND),0);
+		je(no_intr);
+		ExitTo(next);
+		L(no_intr);
+	}
+
+	//jumps to skip if the condition fails
+	void CheckCondition(u32 cond,Xbyak::Label& skip)
+	{
+		const u32 N=0x80000000,Z=0x40000000,C=0x20000000,V=0x10000000;
+
+		mov(eax,armreg(RN_PSR_FLAGS));
+
+		switch (cond)
+		{
+		case 0x0: test(eax,Z); jz(skip,T_NEAR); break;     //EQ
+		case 0x1: test(eax,Z); jnz(skip,T_NEAR); break;    //NE
+		case 0x2: test(eax,C); jz(skip,T_NEAR); break;     //CS
+		case 0x3: test(eax,C); jnz(skip,T_NEAR); break;    //CC
+		case 0x4: test(eax,N); jz(skip,T_NEAR); break;     //MI
+		case 0x5: test(eax,N); jnz(skip,T_NEAR); break;    //PL
+		case 0x6: test(eax,V); jz(skip,T_NEAR); break;     //VS
+		case 0x7: test(eax,V); jnz(skip,T_NEAR); break;    //VC
+
+		case 0x8:   //HI, C && !Z
+		case 0x9:   //LS
+			and_(eax,C|Z);
+			cmp(eax,C);
+			if (cond==0x8)
+				jne(skip,T_NEAR);
+			else
+				je(skip,T_NEAR);
+			break;
+
+		case 0xA:   //GE, N==V
+		case 0xB:   //LT
+			mov(ecx,eax);
+			shr(ecx,3);
+			xor_(eax,ecx);
+			test(eax,V);
+			if (cond==0xA)
+				jnz(skip,T_NEAR);
+			else
+				jz(skip,T_NEAR);
+			break;
+
+		case 0xC:   //GT, !Z && N==V
+		case 0xD:   //LE
+			mov(ecx,eax);
+			shr(ecx,3);
+			xor_(ecx,eax);
+			and_(ecx,V);
+			and_(eax,Z);
+			or_(eax,ecx);
+			if (cond==0xC)
+				jnz(skip,T_NEAR);
+			else
+				jz(skip,T_NEAR);
+			break;
+		}
+	}
+
+	//N and Z from the host flags, C from r11b (or the host carry for arithmetic ops), V too for arithmetic ops
+	void StoreFlags(bool arithmetic,bool borrow)
+	{
+		sets(r9b);
+		setz(r10b);
+		if (arithmetic)
+		{
+			if (borrow)
+				setnc(r11b);
+			else
+				setc(r11b);
+			seto(cl);
+		}
+
+		movzx(r9d,r9b);
+		shl(r9d,31);
+		movzx(r10d,r10b);
+		shl(r10d,30);
+		or_(r9d,r10d);
+		movzx(r11d,r11b);
+		shl(r11d,29);
+		or_(r9d,r11d);
+
+		mov(r10d,armreg(RN_PSR_FLAGS));
+		if (arithmetic)
+		{
+			movzx(ecx,cl);
+			shl(ecx,28);
+			or_(r9d,ecx);
+			and_(r10d,0x0FFFFFFF);
+		}
+		else
+			and_(r10d,0x1FFFFFFF);
+		or_(r10d,r9d);
+		mov(armreg(RN_PSR_FLAGS),r10d);
+	}
+
+	void LoadCarry(const Xbyak::Reg32& dst)
+	{
+		mov(dst,armreg(RN_PSR_FLAGS));
+		shr(dst,29);
+		and_(dst,1);
+	}
+
+	//second operand of a data processing opcode to r8d, with carry the shifter carry out to r11b
+	void ShifterOperand(u32 opcode,u32 pc,bool carry)
+	{
+		if (opcode & (1<<25))
+		{
+			u32 imm=opcode&0xFF;
+			u32 rot=(opcode>>7)&0x1E;
+			u32 value=rot?(imm>>rot)|(imm<<(32-rot)):imm;
+
+			mov(r8d,value);
+			if (carry)
+			{
+				if (rot)
+					mov(r11d,value>>31);
+				else
+					LoadCarry(r11d);
+			}
+			return;
+		}
+
+		u32 shift=(opcode>>7)&31;
+
+		LoadReg(r8d,opcode&15,pc);
+
+		switch ((opcode>>5)&3)
+		{
+		case 0:     //LSL
+			if (shift==0)
+			{
+				if (carry)
+					LoadCarry(r11d);
+				return;
+			}
+			shl(r8d,shift);
+			break;
+
+		case 1:     //LSR, #0 is #32
+			if (shift==0)
+			{
+				bt(r8d,31);
+				if (carry)
+					setc(r11b);
+				mov(r8d,0);
+				return;
+			}
+			shr(r8d,shift);
+			break;
+
+		case 2:     //ASR, #0 is #32
+			if (shift==0)
+			{
+				bt(r8d,31);
+				if (carry)
+					setc(r11b);
+				sar(r8d,31);
+				return;
+			}
+			sar(r8d,shift);
+			break;
+
+		case 3:     //ROR, #0 is RRX
+			if (shift==0)
+			{
+				bt(armreg(RN_PSR_FLAGS),29);
+				rcr(r8d,1);
+			}
+			else
+				ror(r8d,shift);
+			break;
+		}
+
+		if (carry)
+			setc(r11b);
+	}
+
+	void DataProcessing(u32 opcode,u32 pc)
+	{
+		u32 op=(opcode>>21)&15;
+		bool s=(opcode>>20)&1;
+		u32 rn=(opcode>>16)&15;
+		u32 rd=(opcode>>12)&15;
+		bool logical=op<=1 || op==8 || op==9 || op>=12;
+
+		ShifterOperand(opcode,pc,s && logical);
+
+		if (op!=13 && op!=15)
+			LoadReg(eax,rn,pc);
+
+		switch (op)
+		{
+		case 0x0:   //AND
+		case 0x8:   //TST
+			and_(eax,r8d);
+			break;
+		case 0x1:   //EOR
+		case 0x9:   //TEQ
+			xor_(eax,r8d);
+			break;
+		case 0x2:   //SUB
+		case 0xA:   //CMP
+			sub(eax,r8d);
+			break;
+		case 0x3:   //RSB
+			sub(r8d,eax);
+			mov(eax,r8d);
+			break;
+		case 0x4:   //ADD
+		case 0xB:   //CMN
+			add(eax,r8d);
+			break;
+		case 0x5:   //ADC
+			bt(armreg(RN_PSR_FLAGS),29);
+			adc(eax,r8d);
+			break;
+		case 0x6:   //SBC
+			bt(armreg(RN_PSR_FLAGS),29);
+			cmc();
+			sbb(eax,r8d);
+			break;
+		case 0x7:   //RSC
+			bt(armreg(RN_PSR_FLAGS),29);
+			cmc();
+			sbb(r8d,eax);
+			mov(eax,r8d);
+			break;
+		case 0xC:   //ORR
+			or_(eax,r8d);
+			break;
+		case 0xD:   //MOV
+			mov(eax,r8d);
+			break;
+		case 0xE:   //BIC
+			not_(r8d);
+			and_(eax,r8d);
+			break;
+		case 0xF:   //MVN
+			mov(eax,r8d);
+			not_(eax);
+			break;
+		}
+
+		if (s)
+		{
+			if (logical)
+			{
+				test(eax,eax);
+				StoreFlags(false,false);
+			}
+			else
+				StoreFlags(true,op!=0x4 && op!=0x5 && op!=0xB);
+		}
+
+		if (op>=0x8 && op<=0xB)
+			return;
+
+		if (rd==15)
+		{
+			and_(eax,0xFFFFFFFC);
+			mov(armreg(R15_ARM_NEXT),eax);
+			Exit();
+		}
+		else
+			mov(armreg(rd),eax);
+	}
+
+	//address in arg0, result in eax
+	void ReadMem(bool byte_access)
+	{
+		Xbyak::Label slow,done;
+
+		if (!validate)
+		{
+			mov(eax,arg0);
+			and_(eax,0x00FFFFFF);
+			cmp(eax,0x800000);
+			jae(slow);
+			if (!byte_access)
+			{
+				test(al,3);
+				jnz(slow);
+			}
+			and_(eax,ARAM_MASK);
+			mov(r9,(size_t)aica_ram.data);
+			if (byte_access)
+				movzx(eax,byte[r9+rax]);
+			else
+				mov(eax,dword[r9+rax]);
+			jmp(done);
+		}
+
+		L(slow);
+		Call(byte_access?(const void*)arm_rec_ReadMem8:(const void*)arm_rec_ReadMem32);
+		L(done);
+	}
+
+	//address in arg0, data in arg1
+	void WriteMem(bool byte_access)
+	{
+		Xbyak::Label slow,done;
+
+		if (!validate)
+		{
+			mov(eax,arg0);
+			and_(eax,0x00FFFFFF);
+			cmp(eax,0x800000);
+			jae(slow);
+			and_(eax,byte_access?ARAM_MASK:ARAM_MASK-3);
+			mov(r9,(size_t)aica_ram.data);
+			if (byte_access)
+				mov(byte[r9+rax],arg1.cvt8());
+			else
+				mov(dword[r9+rax],arg1);
+			jmp(done);
+		}
+
+		L(slow);
+		Call(byte_access?(const void*)arm_rec_WriteMem8:(const void*)arm_rec_WriteMem32);
+		L(done);
+	}
+
+	//LDR, STR, LDRB, STRB with an immediate offset. Stores with pre-indexed writeback update the base
+	//first, loads only write back if rd!=rn, same as the interpreter
+	void LoadStore(u32 opcode,u32 pc)
+	{
+		bool p=(opcode>>24)&1;
+		bool byte_access=(opcode>>22)&1;
+		bool w=(opcode>>21)&1;
+		bool load=(opcode>>20)&1;
+		u32 rn=(opcode>>16)&15;
+		u32 rd=(opcode>>12)&15;
+		u32 offset=opcode&0xFFF;
+		s32 delta=(opcode & (1<<23))?(s32)offset:-(s32)offset;
+
+		LoadReg(arg0,rn,pc);
+		if (p && offset)
+			add(arg0,delta);
+
+		if (load)
+		{
+			ReadMem(byte_access);
+			mov(armreg(rd),eax);
+			if ((!p || w) && rd!=rn && offset)
+				add(armreg(rn),delta);
+		}
+		else
+		{
+			if (p && w)
+				mov(armreg(rn),arg0);
+			LoadReg(arg1,rd,pc);
+			WriteMem(byte_access);
+			if (!p && offset)
+				add(armreg(rn),delta);
+		}
+
+		CheckInterrupt(pc+4);
+	}
+
+	void Branch(u32 opcode,u32 pc)
+	{
+		s32 offset=(s32)(opcode<<8)>>6;
+
+		if (opcode & (1<<24))
+			mov(armreg(14),pc+4);
+
+		ExitTo(pc+8+offset);
+	}
+
+	void Interpret(u32 opcode,u32 pc)
+	{
+		Xbyak::Label branched,next;
+
+		mov(armreg(15),pc+8);
+		mov(armreg(R15_ARM_NEXT),pc+4);
+		mov(arg0,opcode);
+		Call((const void*)arm_rec_Interpret);
+		add(r12d,eax);
+
+		cmp(armreg(R15_ARM_NEXT),pc+4);
+		jne(branched);
+		cmp(armreg(INTR_PEND),0);
+		je(next);
+		L(branched);
+		Exit();
+		L(next);
+	}
+
+	//0 if it goes to the interpreter, otherwise the cycles it takes besides the base 6
+	static int NativeTicks(u32 opcode)
+	{
+		u32 rd=(opcode>>12)&15;
+		u32 rn=(opcode>>16)&15;
+
+		switch ((opcode>>25)&7)
+		{
+		case 0:
+			//register shifted operands, multiplies, halfword transfers
+			if (opcode & 0x10)
+				return 0;
+		case 1:
+			{
+				bool s=(opcode>>20)&1;
+				u32 op=(opcode>>21)&15;
+
+				//TST..CMN without S are MRS/MSR/BX/SWP, with S and rd=15 they are odd. S with rd=15 switches mode
+				if ((op>=0x8 && op<=0xB) ? (!s || rd==15) : (s && rd==15))
+					return 0;
+				return 1;
+			}
+
+		case 2:
+			if (rd==15 || (rn==15 && (!(opcode & (1<<24)) || (opcode & (1<<21)))))
+				return 0;
+			//the interpreter adds 1 for the access itself (CPUUpdateTicksAccess*)
+			return (opcode & (1<<20))?1+4:1+3;
+
+		case 5:
+			return 1+3;
+
+		default:
+			return 0;
+		}
+	}
+
+	void CompileOpcode(u32 opcode,u32 pc)
+	{
+		u32 cond=opcode>>28;
+		int ticks=NativeTicks(opcode);
+
+		if (cond==0xF)
+		{
+			add(r12d,6);
+			return;
+		}
+
+		if (ticks==0)
+		{
+			Interpret(opcode,pc);
+			return;
+		}
+
+		ticks--;
+
+		Xbyak::Label skip;
+		if (cond==0xE)
+			add(r12d,6+ticks);
+		else
+		{
+			add(r12d,6);
+			CheckCondition(cond,skip);
+			if (ticks)
+				add(r12d,ticks);
+		}
+
+		switch ((opcode>>25)&7)
+		{
+		case 0:
+		case 1:
+			DataProcessing(opcode,pc);
+			break;
+		case 2:
+			LoadStore(opcode,pc);
+			break;
+		case 5:
+			Branch(opcode,pc);
+			break;
+		}
+
+		L(skip);
+	}
+
+public:
+	Arm7Compiler(void* ptr,bool validate) : Xbyak::CodeGenerator(ARM_BLOCK_BYTES,ptr),validate(validate)
+	{
+#ifdef _WIN32
+		arg0=ecx;
+		arg1=edx;
+#else
+		arg0=edi;
+		arg1=esi;
+#endif
+	}
+
+	arm_block_t Compile(u32 start)
+	{
+		u32 opcodes[ARM_BLOCK_MAX];
+		u32 count=0;
+
+		for (u32 pc=start;count<ARM_BLOCK_MAX;)
+		{
+			u32 opcode=CPUReadMemoryQuick(pc);
+			opcodes[count++]=opcode;
+			pc+=4;
+
+			if (arm_WritesPC(opcode) || pc>=ARAM_SIZE)
+				break;
+		}
+
+		Xbyak::Label stale;
+
+		mov(rax,(size_t)&aica_ram.data[start]);
+		for (u32 i=0;i<count;i++)
+		{
+			cmp(dword[rax+i*4],opcodes[i]);
+			jne(stale,T_NEAR);
+		}
+
+		push(rbx);
+		push(r12);
+#ifdef _WIN32
+		sub(rsp,40);
+#else
+		sub(rsp,8);
+#endif
+		mov(rbx,(size_t)arm_Reg);
+		xor_(r12d,r12d);
+
+		for (ops=0;ops<count;ops++)
+			CompileOpcode(opcodes[ops],start+ops*4);
+
+		ops=count-1;
+		ExitTo(start+count*4);
+
+		L(exit);
+		mov(eax,r12d);
+#ifdef _WIN32
+		add(rsp,40);
+#else
+		add(rsp,8);
+#endif
+		pop(r12);
+		pop(rbx);
+		ret();
+
+		L(stale);
+		xor_(eax,eax);
+		ret();
+
+		ready();
+		return (arm_block_t)getCode();
+	}
+};
+
+static void FlushCache(void)
+{
+	if (arm_entry_min<=arm_entry_max)
+		memset(&EntryPoints[arm_entry_min],0,(arm_entry_max-arm_entry_min+1)*sizeof(EntryPoints[0]));
+
+	arm_entry_min=ARRAY_SIZE(EntryPoints);
+	arm_entry_max=0;
+	arm_code_used=0;
+	arm_rec_stats.flushes++;
+}
+
+static arm_block_t arm_Compile(u32 pc)
+{
+	if (arm_code_used+ARM_BLOCK_BYTES>ARM_CODE_SIZE)
+		FlushCache();
+
+	Arm7Compiler compiler(&arm_code[arm_code_used],arm_rec_mode==ARM_Validate);
+	arm_block_t code=compiler.Compile(pc);
+
+	arm_code_used=(arm_code_used+compiler.getSize()+15)&~15;
+
+	u32 entry=pc>>2;
+	EntryPoints[entry]=(void*)code;
+	arm_entry_min=min(arm_entry_min,entry);
+	arm_entry_max=max(arm_entry_max,entry);
+	arm_rec_stats.blocks++;
+
+	return code;
+}
+
+//Runs the block, then replays it on the interpreter with the same memory accesses and compares the
+//registers. The state of the recompiled run is kept, it's the one that did the accesses
+static u32 arm_Validate(arm_block_t code,u32 pc)
+{
+	reg_pair regs[RN_ARM_REG_COUNT];
+	memcpy(regs,arm_Reg,sizeof(regs));
+	bool irq=armIrqEnable;
+	bool fiq=armFiqEnable;
+	int mode=armMode;
+
+	arm_journal.mode=AJ_Record;
+	arm_journal.count=0;
+	arm_journal.failed=false;
+	u32 ticks=code();
+	arm_journal.mode=AJ_Off;
+
+	if (ticks==0)
+		return 0;
+
+	reg_pair rec_regs[RN_ARM_REG_COUNT];
+	memcpy(rec_regs,arm_Reg,sizeof(rec_regs));
+	bool rec_irq=armIrqEnable;
+	bool rec_fiq=armFiqEnable;
+	int rec_mode=armMode;
+
+	memcpy(arm_Reg,regs,sizeof(regs));
+	armIrqEnable=irq;
+	armFiqEnable=fiq;
+	armMode=mode;
+
+	bool overflow=arm_journal.failed;
+	u32 int_ticks=0;
+
+	arm_journal.mode=AJ_Replay;
+	arm_journal.pos=0;
+	for (u32 i=0;i<arm_rec_ops;i++)
+	{
+		reg[15].I=armNextPC+8;
+		u32 opcode=CPUReadMemoryQuick(armNextPC);
+		armNextPC+=4;
+		int_ticks+=arm_ExecuteOp(opcode);
+	}
+	arm_journal.mode=AJ_Off;
+
+	bool match=!arm_journal.failed && arm_journal.pos==arm_journal.count;
+	if (!match)
+		printf("arm7 rec: block %08X, %s\n",pc,overflow?"too many memory accesses to check":"memory accesses don't match");
+
+	for (int i=0;i<RN_ARM_REG_COUNT;i++)
+	{
+		//r15 is only set up for the opcodes that read it, the interrupt line is recomputed from the aica side
+		if (i==15 || i==INTR_PEND || i==CYCL_CNT)
+			continue;
+
+		if (arm_Reg[i].I!=rec_regs[i].I)
+		{
+			printf("arm7 rec: block %08X, reg %d is %08X, the interpreter has %08X\n",pc,i,rec_regs[i].I,arm_Reg[i].I);
+			match=false;
+		}
+	}
+
+	if (armIrqEnable!=rec_irq || armFiqEnable!=rec_fiq || armMode!=rec_mode || int_ticks!=ticks)
+	{
+		printf("arm7 rec: block %08X, mode %02X/%02X irq %d/%d fiq %d/%d cycles %d/%d\n",pc,rec_mode,armMode,
+			rec_irq,armIrqEnable,rec_fiq,armFiqEnable,ticks,int_ticks);
+		match=false;
+	}
+
+	arm_rec_stats.validated++;
+	if (!match)
+		arm_rec_stats.mismatches++;
+
+	memcpy(arm_Reg,rec_regs,sizeof(rec_regs));
+	armIrqEnable=rec_irq;
+	armFiqEnable=rec_fiq;
+	armMode=rec_mode;
+
+	return ticks;
+}
+
+static INLINE u32 arm_rec_Exec(arm_block_t code,u32 pc)
+{
+	return arm_rec_mode==ARM_Validate?arm_Validate(code,pc):code();
+}
+
+void arm_rec_Run(u32 CycleCount)
+{
+	if (arm_rec_mode!=settings.aica.ArmRec)
+	{
+		arm_rec_mode=settings.aica.ArmRec;
+		FlushCache();
+	}
+
+	u32 clockTicks=arm_rec_excess;
+
+	while (clockTicks<CycleCount)
+	{
+		if (reg[INTR_PEND].I)
+			CPUFiq();
+
+		u32 pc=armNextPC;
+
+		//code outside of aram (or misaligned) isn't compiled
+		if (pc>=ARAM_SIZE || (pc&3))
+		{
+			reg[15].I=pc+8;
+			armNextPC=pc+4;
+			clockTicks+=arm_ExecuteOp(CPUReadMemoryQuick(pc));
+			continue;
+		}
+
+		arm_block_t code=(arm_block_t)EntryPoints[pc>>2];
+		u32 ticks=code?arm_rec_Exec(code,pc):0;
+
+		if (ticks==0)
+		{
+			if (code)
+				arm_rec_stats.stale++;
+			ticks=arm_rec_Exec(arm_Compile(pc),pc);
+		}
+
+		clockTicks+=ticks;
+	}
+
+	arm_rec_excess=clockTicks-CycleCount;
+}
+
+static void arm_rec_Init(void)
+{
+	arm_code=(u8*)(((size_t)ARM7_TCB+4095)&~4095);
+	os_MakeExecutable(arm_code,ARM_CODE_SIZE);
+
+	arm_entry_min=0;
+	arm_entry_max=ARRAY_SIZE(EntryPoints)-1;
+	FlushCache();
+	memset(&arm_rec_stats,0,sizeof(arm_rec_stats));
+}
+#endif
 
 void arm_Init(void)
 {
+#ifdef ARM_REC
+	arm_rec_Init();
+#endif
 	arm_Reset();
 
 	for (int i = 0; i < 256; i++)
@@ -6804,11 +7790,13 @@ void arm_Init(void)
 	}
 }
 
-static void FlushCache(void);
-
 void arm_Reset(void)
 {
 	Arm7Enabled = false;
+#ifdef ARM_REC
+	FlushCache();
+	arm_rec_excess=0;
+#endif
 	// clean registers
 	memset(&arm_Reg[0], 0, sizeof(arm_Reg));
 
@@ -6900,6 +7888,11 @@ void arm_Run(u32 CycleCount)
    {
       for (i=0;i<32;i++)
       {
+#ifdef ARM_REC
+         if (settings.aica.ArmRec!=ARM_Interpreter)
+            arm_rec_Run(CycleCount/32);
+         else
+#endif
          arm_Run_(CycleCount/32);
          libAICA_TimeStep();
       }
@@ -6919,6 +7912,32 @@ void libARM_InterruptChange(u32 bits,u32 L)
 	update_e68k();
 }
 
+void arm_serialize(dc_state& st)
+{
+	st(arm_Reg);
+	st(armIrqEnable);
+	st(armFiqEnable);
+	st(armMode);
+	st(Arm7Enabled);
+	st(intState);
+	st(stopState);
+	st(holdState);
+
+	st(aica_interr);
+	st(aica_reg_L);
+	st(e68k_out);
+	st(e68k_reg_L);
+	st(e68k_reg_M);
+
+	if (st.load)
+	{
+		update_armintc();
+#ifdef ARM_REC
+		arm_rec_excess=0;
+#endif
+	}
+}
+
 
 //Reg reads from arm side ..
 template <u32 sz,class T>
@@ -6951,6 +7970,3 @@ template u32 arm_ReadReg<4,u32>(u32 adr);
 template void arm_WriteReg<1>(u32 adr,u8 data);
 template void arm_WriteReg<2>(u32 adr,u16 data);
 template void arm_WriteReg<4>(u32 adr,u32 data);
-
-/* Naomi edit - allow for max possible ARAM_SIZE here */
-void* EntryPoints[(8*1024*1024) /4];
@@ -87,6 +87,13 @@ typedef union
 	u32 I;
 } reg_pair;
 
+enum ArmRecMode
+{
+	ARM_Interpreter=0,
+	ARM_Recompiler=1,
+	ARM_Validate=2,    //every block is replayed on the interpreter and compared
+};
+
 extern bool armFiqEnable;
 
 extern DECL_ALIGN(8) reg_pair arm_Reg[RN_ARM_REG_COUNT];
@@ -96,6 +103,9 @@ void arm_Reset();
 void arm_Run(u32 uNumCycles);
 void arm_SetEnabled(bool enabled);
 
+struct dc_state;
+void arm_serialize(dc_state& st);
+
 u32 sh4_ReadMem_reg(u32 addr,u32 size);
 void sh4_WriteMem_reg(u32 addr,u32 data,u32 size);
 
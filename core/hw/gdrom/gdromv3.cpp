@@ -15,6 +15,7 @@
 
 #include "hw/sh4/sh4_mmr.h"
 #include "hw/sh4/sh4_sched.h"
+#include "serialize.h"
 
 int gdrom_sched;
 
@@ -1209,7 +1210,7 @@ void gdrom_reg_Init()
 	sb_regs[(SB_GDEN_addr-SB_BASE)>>2].writeFunction=GDROM_DmaEnable;
 	*/
 
-	gdrom_sched = sh4_sched_register(0, &GDRomschd);
+	gdrom_sched = sh4_sched_register(0, &GDRomschd, "gdrom");
 }
 
 void gdrom_reg_Term(void)
@@ -1222,3 +1223,36 @@ void gdrom_reg_Reset(bool Manual)
 	SB_GDST = 0;
 	SB_GDEN = 0;
 }
+
+void gdrom_serialize(dc_state& st)
+{
+	st(sns_asc);
+	st(sns_ascq);
+	st(sns_key);
+
+	st(read_params);
+	st(packet_cmd);
+
+	//FillReadBuffer reads up to 32 sectors at a time, the rest of the buffer is never used
+	st(read_buff.cache_index);
+	st(read_buff.cache_size);
+	st.array(read_buff.cache,32*2352);
+
+	st(pio_buff);
+	st(set_mode_offset);
+	st(ata_cmd);
+	st(cdda);
+
+	st(gd_state);
+	st(gd_disk_type);
+	st(data_write_mode);
+
+	st(DriveSel);
+	st(Error);
+	st(IntReason);
+	st(Features);
+	st(SecCount);
+	st(SecNumber);
+	st(GDStatus);
+	st(ByteCount);
+}
@@ -8,6 +8,9 @@ void gdrom_reg_Init();
 void gdrom_reg_Term();
 void gdrom_reg_Reset(bool Manual);
 
+struct dc_state;
+void gdrom_serialize(dc_state& st);
+
 u32 ReadMem_gdrom(u32 Addr, u32 sz);
 void WriteMem_gdrom(u32 Addr, u32 data, u32 sz);
 
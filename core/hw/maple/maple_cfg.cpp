@@ -99,6 +99,11 @@ void mcfg_CreateDevices()
 void mcfg_DestroyDevices()
 {
 	for (int i=0;i<=3;i++)
+	{
 		for (int j=0;j<=5;j++)
+		{
 			delete MapleDevices[i][j];
+			MapleDevices[i][j]=0;
+		}
+	}
 }
@@ -3,6 +3,7 @@
 #include "maple_helper.h"
 #include "maple_devs.h"
 #include "maple_cfg.h"
+#include "serialize.h"
 #include <time.h>
 
 #include "deps/zlib/zlib.h"
@@ -313,6 +314,30 @@ struct maple_sega_vmu: maple_base
 	{
 		if (file) fclose(file);
 	}
+	virtual void Serialize(dc_state& st)
+	{
+		if (st.load)
+		{
+			//the flash is backed by the save file, only rewrite it if the state has different contents
+			static u8 state_flash[sizeof(flash_data)];
+			st.raw(state_flash,sizeof(state_flash));
+
+			if (!st.failed && memcmp(state_flash,flash_data,sizeof(flash_data))!=0)
+			{
+				memcpy(flash_data,state_flash,sizeof(flash_data));
+				if (file)
+				{
+					fseek(file,0,SEEK_SET);
+					fwrite(flash_data,1,sizeof(flash_data),file);
+					fflush(file);
+				}
+			}
+		}
+		else
+			st.raw(flash_data,sizeof(flash_data));
+
+		st.raw(lcd_data,sizeof(lcd_data));
+	}
 	virtual u32 dma(u32 cmd)
 	{
 		//printf("maple_sega_vmu::dma Called for port 0x%X, Command %d\n",device_instance->port,Command);
@@ -667,6 +692,11 @@ struct maple_microphone: maple_base
 		memset(micdata,0,sizeof(micdata));
 	}
 
+	virtual void Serialize(dc_state& st)
+	{
+		st.raw(micdata,sizeof(micdata));
+	}
+
 	virtual u32 dma(u32 cmd)
 	{
 		//printf("maple_microphone::dma Called 0x%X;Command %d\n",this->maple_port,cmd);
@@ -841,6 +871,13 @@ struct maple_sega_purupuru : maple_base
    u16 AST, AST_ms;
    u32 VIBSET;
 
+   virtual void Serialize(dc_state& st)
+   {
+      st(AST);
+      st(AST_ms);
+      st(VIBSET);
+   }
+
    virtual u32 dma(u32 cmd)
    {
       switch (cmd)
@@ -990,6 +1027,12 @@ No error checking of any kind, but works just fine
 */
 struct maple_naomi_jamma : maple_sega_controller
 {
+	virtual void Serialize(dc_state& st)
+	{
+		st(State);
+		st.raw(EEPROM,sizeof(EEPROM));
+	}
+
 	virtual u32 dma(u32 cmd)
 	{
 		u32* buffer_in = (u32*)dma_buffer_in;
@@ -14,6 +14,7 @@ enum MapleDeviceType
 };
 
 struct IMapleConfigMap;
+struct dc_state;
 
 struct maple_device
 {
@@ -29,6 +30,8 @@ struct maple_device
 	virtual void OnSetup(){};
 	virtual ~maple_device();
 	virtual u32 Dma(u32 Command,u32* buffer_in,u32 buffer_in_len,u32* buffer_out,u32& buffer_out_len)=0;
+	//streams the device state for savestates, the same amount of data on save and load
+	virtual void Serialize(dc_state& st){};
 };
 
 maple_device* maple_Create(MapleDeviceType type);
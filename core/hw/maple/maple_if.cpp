@@ -198,7 +198,7 @@ void maple_Init()
 	sb_regs[(SB_MSHTCL_addr-SB_BASE)>>2].writeFunction=maple_SB_MSHTCL_Write;
 	*/
 
-	maple_sched=sh4_sched_register(0,&maple_schd);
+	maple_sched=sh4_sched_register(0,&maple_schd,"maple");
 }
 
 void maple_Reset(bool Manual)
@@ -9,6 +9,7 @@
 #include "naomi.h"
 #include "naomi_cart.h"
 #include "naomi_regs.h"
+#include "serialize.h"
 
 u32 naomi_updates;
 
@@ -811,3 +812,26 @@ void Update_naomi()
 	}
 #endif
 }
+
+void naomi_serialize(dc_state& st)
+{
+	st(RomPioOffset);
+	st(DmaOffset);
+	st(DmaCount);
+	st(BoardID);
+
+	st(GSerialBuffer); st(BSerialBuffer);
+	st(GBufPos); st(BBufPos);
+	st(GState); st(BState);
+	st(GOldClk); st(BOldClk);
+	st(BControl); st(BCmd); st(BLastCmd);
+	st(GControl); st(GCmd); st(GLastCmd);
+	st(SerStep); st(SerStep2);
+
+	st(reg_dimm_3c);
+	st(reg_dimm_40);
+	st(reg_dimm_44);
+	st(reg_dimm_48);
+	st(reg_dimm_4c);
+	st(NaomiDataRead);
+}
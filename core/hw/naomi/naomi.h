@@ -17,6 +17,9 @@ void NaomiBoardIDWrite(const u16 Data);
 void NaomiBoardIDWriteControl(const u16 Data);
 u16 NaomiBoardIDRead();
 
+struct dc_state;
+void naomi_serialize(dc_state& st);
+
 
 
 
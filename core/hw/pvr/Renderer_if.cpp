@@ -98,10 +98,11 @@ bool rend_single_frame(void)
    //wait render start only if no frame pending
    do
    {
+      _pvrrc = DequeueRender();
 #if !defined(TARGET_NO_THREADS)
-      rs.Wait();
+      if (!_pvrrc)
+         rs.Wait();
 #endif
-      _pvrrc = DequeueRender();
    }
    while (!_pvrrc);
    bool do_swp = rend_frame(_pvrrc, true);
@@ -233,6 +234,8 @@ bool rend_init(void)
 	renderer = rend_GLES2();
 #endif
 
+   tactx_Init();
+
 #if !defined(TARGET_NO_THREADS)
    rthd.Start();
 #else
@@ -158,9 +158,9 @@ int rend_end_sch(int tag, int cycl, int jitt)
 
 bool spg_Init()
 {
-   render_end_sched = sh4_sched_register(0,&rend_end_sch);
-   vblank_sched     = sh4_sched_register(0,&spg_line_sched);
-   time_sync        = sh4_sched_register(0,&elapse_time);
+   render_end_sched = sh4_sched_register(0,&rend_end_sch,"render end");
+   vblank_sched     = sh4_sched_register(0,&spg_line_sched,"spg line");
+   time_sync        = sh4_sched_register(0,&elapse_time,"time sync");
 
    sh4_sched_request(time_sync,8*1000*1000);
 
@@ -1,7 +1,9 @@
+#include <atomic>
 #include "ta.h"
 #include "ta_ctx.h"
 
 #include "hw/sh4/sh4_sched.h"
+#include "serialize.h"
 
 extern u32 fskip;
 extern u32 FrameCount;
@@ -99,10 +101,37 @@ void VDecEnd(void)
 	vd_ctx = 0;
 }
 
-cMutex mtx_rqueue;
-TA_context* rqueue;
+/*
+	Render queue
+
+	Single producer (the emulation thread queues on RENDER_START), single consumer
+	(the render thread), so a ring with the two indices is enough. The head is only
+	written by the renderer, once it is done with the frame, and the tail only by the
+	emulation thread.
+
+	With a depth of 1 a frame that starts while the previous one is still rendering
+	is dropped, which keeps latency low but makes the frame rate jittery when the
+	renderer is close to the frame time. Deeper queues let the renderer catch up,
+	and the throughput policy makes the emulation wait for a free slot instead of
+	dropping. Without threads the frame is rendered right away, the queue never fills.
+*/
+static TA_context* rqueue[RQUEUE_MAX];
+static std::atomic<u32> rqueue_head;
+static std::atomic<u32> rqueue_tail;
 cResetEvent frame_finished(false, true);
 
+rqueue_stats_t rqueue_stats;
+
+static u32 rqueue_Limit(void)
+{
+   return min(max(settings.pvr.RenderQueueDepth, 1u), (u32)RQUEUE_MAX);
+}
+
+u32 rqueue_Depth(void)
+{
+   return rqueue_tail.load(std::memory_order_acquire) - rqueue_head.load(std::memory_order_acquire);
+}
+
 bool QueueRender(TA_context* ctx)
 {
    verify(ctx != 0);
@@ -111,58 +140,75 @@ bool QueueRender(TA_context* ctx)
  		frameskip=1-frameskip;
 		tactx_Recycle(ctx);
 		fskip++;
+		rqueue_stats.skipped++;
 		return false;
  	}
 
-	if (rqueue)
+   u32 tail = rqueue_tail.load(std::memory_order_relaxed);
+
+   while (tail - rqueue_head.load(std::memory_order_acquire) >= rqueue_Limit())
    {
+#if !defined(TARGET_NO_THREADS)
+      if (settings.pvr.RenderQueuePolicy == RQP_Throughput)
+      {
+         rqueue_stats.waits++;
+         frame_finished.Wait();
+         continue;
+      }
+#endif
 		tactx_Recycle(ctx);
+		rqueue_stats.dropped++;
 		return false;
 	}
 
-   frame_finished.Reset();
-   mtx_rqueue.Lock();
-	TA_context* old = rqueue;
-	rqueue=ctx;
-   mtx_rqueue.Unlock();
+   rqueue[tail % RQUEUE_MAX] = ctx;
+   rqueue_tail.store(tail + 1, std::memory_order_release);
 
-   verify(!old);
+   rqueue_stats.queued++;
+   rqueue_stats.max_depth = max(rqueue_stats.max_depth, tail + 1 - rqueue_head.load(std::memory_order_acquire));
 
 	return true;
 }
 
 TA_context* DequeueRender(void)
 {
-   mtx_rqueue.Lock();
-	TA_context* rv = rqueue;
-   mtx_rqueue.Unlock();
+   u32 head = rqueue_head.load(std::memory_order_relaxed);
 
-	if (rv)
-		FrameCount++;
+   if (head == rqueue_tail.load(std::memory_order_acquire))
+      return 0;
 
-	return rv;
+   FrameCount++;
+
+	return rqueue[head % RQUEUE_MAX];
 }
 
 bool rend_framePending(void)
 {
-   mtx_rqueue.Lock();
-	TA_context* rv = rqueue;
-   mtx_rqueue.Unlock();
-
-	return rv != 0;
+	return rqueue_Depth() != 0;
 }
 
 void FinishRender(TA_context* ctx)
 {
-   verify(rqueue == ctx);
-   mtx_rqueue.Lock();
-	rqueue = 0;
-   mtx_rqueue.Unlock();
+   u32 head = rqueue_head.load(std::memory_order_relaxed);
+   verify(rqueue[head % RQUEUE_MAX] == ctx);
+
+   rqueue[head % RQUEUE_MAX] = 0;
+   rqueue_head.store(head + 1, std::memory_order_release);
 
 	tactx_Recycle(ctx);
    frame_finished.Set();
 }
 
+//frames queued/dropped since the last call
+void rqueue_print_stats(void)
+{
+   printf("rqueue: %d queued, %d dropped, %d frameskipped, %d waits, max depth %d/%d\n",
+      rqueue_stats.queued, rqueue_stats.dropped, rqueue_stats.skipped, rqueue_stats.waits,
+      rqueue_stats.max_depth, rqueue_Limit());
+
+   memset(&rqueue_stats, 0, sizeof(rqueue_stats));
+}
+
 cMutex mtx_pool;
 
 /* texture cache entry pool. */
@@ -199,7 +245,8 @@ TA_context* tactx_Alloc(void)
 void tactx_Recycle(TA_context* poped_ctx)
 {
    mtx_pool.Lock();
-   if (ctx_pool.size()>2)
+   //one for the TA, one per queued frame and a spare
+   if (ctx_pool.size()>rqueue_Limit()+1)
    {
       poped_ctx->Free();
       delete poped_ctx;
@@ -212,6 +259,18 @@ void tactx_Recycle(TA_context* poped_ctx)
    mtx_pool.Unlock();
 }
 
+//allocates the contexts up front, so they aren't allocated in the middle of a frame
+void tactx_Init(void)
+{
+   vector<TA_context*> list;
+
+   for (u32 i = 0; i < rqueue_Limit() + 2; i++)
+      list.push_back(tactx_Alloc());
+
+   for (size_t i = 0; i < list.size(); i++)
+      tactx_Recycle(list[i]);
+}
+
 TA_context* tactx_Find(u32 addr, bool allocnew)
 {
    for (size_t i=0; i<ctx_list.size(); i++)
@@ -250,3 +309,66 @@ TA_context* tactx_Pop(u32 addr)
    }
 	return 0;
 }
+
+/*
+	Only the context the TA is writing to is saved. The raw TA data is only decoded
+	when the frame is rendered, so nothing else about the frame is part of the state.
+	Contexts that are complete but not rendered yet belong to the replaced timeline,
+	and are dropped on load.
+*/
+void tactx_serialize(dc_state& st)
+{
+	u32 addr=ta_ctx?ta_ctx->Address:TACTX_NONE;
+	st(addr);
+
+	if (st.load && !st.failed)
+	{
+		if (ta_ctx)
+			SetCurrentTARC(TACTX_NONE);
+
+		while (ctx_list.size())
+		{
+			TA_context* ctx=ctx_list.back();
+			ctx_list.pop_back();
+			tactx_Recycle(ctx);
+		}
+
+		if (addr!=TACTX_NONE)
+			SetCurrentTARC(addr);
+	}
+
+	u8* root=ta_ctx?ta_tad.thd_root:0;
+	u32 data_offs=ta_ctx?ta_tad.thd_data-root:0;
+	u32 old_offs=ta_ctx?ta_tad.thd_old_data-root:0;
+	u32 pass_count=ta_ctx?ta_tad.render_pass_count:0;
+	u32 pass_offs[10]={0};
+
+	for (u32 i=0;i<pass_count && i<10;i++)
+		pass_offs[i]=ta_tad.render_passes[i]-root;
+
+	st(data_offs);
+	st(old_offs);
+	st(pass_count);
+	st(pass_offs);
+
+	u32 used=max(data_offs,old_offs);
+	if (used>TA_DATA_SIZE || pass_count>=10 || (!ta_ctx && used))
+	{
+		st.failed=true;
+		return;
+	}
+
+	if (used)
+		st.raw(root,used);
+	st.skip(TA_DATA_SIZE-used);
+
+	if (st.load && ta_ctx)
+	{
+		ta_tad.thd_data=root+data_offs;
+		ta_tad.thd_old_data=root+old_offs;
+		ta_tad.render_pass_count=pass_count;
+
+		for (u32 i=0;i<pass_count;i++)
+			ta_tad.render_passes[i]=root+pass_offs[i];
+	}
+}
@@ -60,6 +60,9 @@ struct ModTriangle
 	f32 x0,y0,z0,x1,y1,z1,x2,y2,z2;
 };
 
+//size of the raw ta data buffer of a context
+#define TA_DATA_SIZE (8*1024*1024)
+
 struct  tad_context
 {
 	u8* thd_data;
@@ -201,7 +204,7 @@ struct TA_context
 	void Alloc(bool have_oit)
 	{
       unsigned vert_size, idx_size, modtrig_size;
-      tad.Reset((u8*)OS_aligned_malloc(32, 8*1024*1024));
+      tad.Reset((u8*)OS_aligned_malloc(32, TA_DATA_SIZE));
 
       if (have_oit)
       {
@@ -289,9 +292,35 @@ void SetCurrentTARC(u32 addr);
 bool QueueRender(TA_context* ctx);
 TA_context* DequeueRender();
 void FinishRender(TA_context* ctx);
+void tactx_Init();
+
+#define RQUEUE_MAX 4
+
+//what QueueRender does when the queue is full
+enum RenderQueuePolicy
+{
+	RQP_Latency = 0,		//drop the new frame
+	RQP_Throughput = 1,		//wait for the renderer to finish a frame
+};
+
+struct rqueue_stats_t
+{
+	u32 queued;       //frames queued for rendering
+	u32 dropped;      //frames dropped because the queue was full
+	u32 skipped;      //frames dropped by frameskip
+	u32 waits;        //times the emulation waited for a free slot
+	u32 max_depth;    //most frames that were queued at once
+};
+
+extern rqueue_stats_t rqueue_stats;
+u32 rqueue_Depth();
+void rqueue_print_stats();
 bool TryDecodeTARC();
 void VDecEnd();
 
+struct dc_state;
+void tactx_serialize(dc_state& st);
+
 //must be moved to proper header
 void FillBGP(TA_context* ctx);
 bool UsingAutoSort(int pass_number);
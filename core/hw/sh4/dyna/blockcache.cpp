@@ -0,0 +1,254 @@
+/*
+	Persistent shil block cache
+
+	Decoding and analysing blocks is a good part of the dynarec warm up, and a game
+	runs pretty much the same code on every boot. The decoded & analysed oplists are
+	kept here, keyed by block address and the fpu config the decoder depends on,
+	and written to a (gzip'd) file on exit.
+
+	A cached block is only reused if the sha1 of the sh4 code it was decoded from still
+	matches memory. Immediates don't depend on anything outside the block (pc relative
+	loads are emitted as readm), so that is enough.
+
+	Host code is not cached. The x64/x86/arm emitters embed absolute host addresses
+	(context, memory handlers, etc) that change from run to run.
+*/
+
+#include <map>
+#include "blockcache.h"
+#include "decoder.h"
+#include "ngen.h"
+#include "hw/sh4/sh4_mem.h"
+#include "deps/crypto/sha1.h"
+#include "deps/zlib/zlib.h"
+
+#if FEAT_SHREC != DYNAREC_NONE
+
+#define BC_MAGIC   0x434C4853	//SHLC
+#define BC_VERSION 3
+
+struct bc_header
+{
+	u32 sh4_code_size;
+	u32 digest[5];
+
+	u32 guest_opcodes;
+	u32 guest_cycles;
+	u32 BlockType;
+	u32 BranchBlock;
+	u32 NextBlock;
+	u32 has_jcond;
+
+	u32 op_count;
+};
+
+struct bc_block
+{
+	bc_header hdr;
+	vector<shil_opcode> oplist;
+};
+
+typedef std::map<u64,bc_block> bc_map_t;
+
+static bc_map_t bc_blocks;
+static string bc_file;
+bc_stats_t bc_stats;
+
+static u64 bc_Key(RuntimeBlockInfo* blk)
+{
+	return ((u64)blk->addr<<32) | (blk->fpu_cfg.PR<<0) | (blk->fpu_cfg.SZ<<1) | (blk->fpu_cfg.RM<<2);
+}
+
+//everything the decoder and analyser output depends on, besides the code itself
+static u32 bc_Config()
+{
+	ngen_features features;
+	ngen_GetFeatures(&features);
+
+	return (sizeof(shil_opcode)<<16) |
+		(settings.System<<8) |
+		(settings.dynarec.idleskip<<0) |
+		(settings.dynarec.unstable_opt<<1) |
+		(settings.dynarec.DisableDivMatching<<2) |
+		(features.OnlyDynamicEnds<<3) |
+		(features.InterpreterFallback<<4) |
+		(settings.dynarec.OptPasses<<5);
+}
+
+static bool bc_Digest(u32 addr,u32 size,u32* digest)
+{
+	u8* ptr=GetMemPtr(addr,size);
+
+	if (!ptr || size==0)
+		return false;
+
+	sha1_ctx ctx;
+	sha1_init(&ctx);
+	sha1_update(&ctx,size,ptr);
+	sha1_final(&ctx);
+
+	memcpy(digest,ctx.digest,sizeof(ctx.digest));
+	return true;
+}
+
+static bool bc_Matches(const bc_block& cb,RuntimeBlockInfo* blk)
+{
+	return cb.hdr.guest_opcodes==blk->guest_opcodes && cb.hdr.guest_cycles==blk->guest_cycles &&
+		cb.hdr.BlockType==(u32)blk->BlockType && cb.hdr.BranchBlock==blk->BranchBlock &&
+		cb.hdr.NextBlock==blk->NextBlock && cb.hdr.has_jcond==(u32)blk->has_jcond &&
+		cb.oplist.size()==blk->oplist.size() &&
+		(cb.oplist.empty() || memcmp(&cb.oplist[0],&blk->oplist[0],cb.oplist.size()*sizeof(shil_opcode))==0);
+}
+
+bool bc_Load(RuntimeBlockInfo* blk)
+{
+	//in validation mode blocks are always decoded, and compared on store
+	if (settings.dynarec.BlockCache!=BCM_Enabled)
+		return false;
+
+	bc_map_t::iterator it=bc_blocks.find(bc_Key(blk));
+	u32 digest[5];
+
+	if (it==bc_blocks.end() || !bc_Digest(blk->addr,it->second.hdr.sh4_code_size,digest) ||
+		memcmp(digest,it->second.hdr.digest,sizeof(digest))!=0)
+	{
+		bc_stats.misses++;
+		return false;
+	}
+
+	const bc_block& cb=it->second;
+
+	blk->sh4_code_size=cb.hdr.sh4_code_size;
+	blk->guest_opcodes=cb.hdr.guest_opcodes;
+	blk->guest_cycles=cb.hdr.guest_cycles;
+	blk->BlockType=(BlockEndType)cb.hdr.BlockType;
+	blk->BranchBlock=cb.hdr.BranchBlock;
+	blk->NextBlock=cb.hdr.NextBlock;
+	blk->has_jcond=cb.hdr.has_jcond!=0;
+	blk->oplist=cb.oplist;
+
+	bc_stats.hits++;
+	return true;
+}
+
+void bc_Store(RuntimeBlockInfo* blk)
+{
+	if (settings.dynarec.BlockCache==BCM_Disabled)
+		return;
+
+	u32 digest[5];
+	if (!bc_Digest(blk->addr,blk->sh4_code_size,digest))
+		return;
+
+	bc_block& cb=bc_blocks[bc_Key(blk)];
+
+	if (settings.dynarec.BlockCache==BCM_Validate)
+	{
+		if (cb.hdr.sh4_code_size==blk->sh4_code_size && memcmp(digest,cb.hdr.digest,sizeof(digest))==0)
+		{
+			bc_stats.hits++;
+			if (bc_Matches(cb,blk))
+				return;
+
+			bc_stats.mismatches++;
+			printf("bc: cached block %08X doesn't match the decoder output\n",blk->addr);
+		}
+		else
+			bc_stats.misses++;
+	}
+
+	cb.hdr.sh4_code_size=blk->sh4_code_size;
+	memcpy(cb.hdr.digest,digest,sizeof(digest));
+	cb.hdr.guest_opcodes=blk->guest_opcodes;
+	cb.hdr.guest_cycles=blk->guest_cycles;
+	cb.hdr.BlockType=blk->BlockType;
+	cb.hdr.BranchBlock=blk->BranchBlock;
+	cb.hdr.NextBlock=blk->NextBlock;
+	cb.hdr.has_jcond=blk->has_jcond;
+	cb.hdr.op_count=blk->oplist.size();
+	cb.oplist=blk->oplist;
+
+	bc_stats.stored++;
+}
+
+void bc_Init(const string& file)
+{
+	bc_blocks.clear();
+	memset(&bc_stats,0,sizeof(bc_stats));
+	bc_file=file;
+
+	if (settings.dynarec.BlockCache==BCM_Disabled)
+		return;
+
+	gzFile f=gzopen(bc_file.c_str(),"rb");
+	if (!f)
+		return;
+
+	u32 header[4];
+	if (gzread(f,header,sizeof(header))!=sizeof(header) ||
+		header[0]!=BC_MAGIC || header[1]!=BC_VERSION || header[2]!=bc_Config())
+	{
+		printf("bc: %s is stale, ignoring it\n",bc_file.c_str());
+		gzclose(f);
+		return;
+	}
+
+	for (u32 i=0;i<header[3];i++)
+	{
+		u64 key;
+		bc_block cb;
+
+		if (gzread(f,&key,sizeof(key))!=sizeof(key) || gzread(f,&cb.hdr,sizeof(cb.hdr))!=sizeof(cb.hdr) ||
+			cb.hdr.op_count>BLOCK_MAX_SH_OPS_HARD)
+			break;
+
+		cb.oplist.resize(cb.hdr.op_count);
+		int size=cb.hdr.op_count*sizeof(shil_opcode);
+		if (size && gzread(f,&cb.oplist[0],size)!=size)
+			break;
+
+		bc_blocks[key]=cb;
+		bc_stats.loaded++;
+	}
+
+	gzclose(f);
+	printf("bc: loaded %d blocks from %s\n",bc_stats.loaded,bc_file.c_str());
+}
+
+void bc_Term()
+{
+	if (settings.dynarec.BlockCache!=BCM_Disabled)
+	{
+		printf("bc: %d hits, %d misses, %d validation failures, %d blocks stored\n",
+			bc_stats.hits,bc_stats.misses,bc_stats.mismatches,bc_stats.stored);
+	}
+
+	if (bc_blocks.empty() || bc_stats.stored==0)
+	{
+		bc_blocks.clear();
+		return;
+	}
+
+	gzFile f=gzopen(bc_file.c_str(),"wb");
+	if (f)
+	{
+		u32 header[4]={BC_MAGIC,BC_VERSION,bc_Config(),(u32)bc_blocks.size()};
+		gzwrite(f,header,sizeof(header));
+
+		for (bc_map_t::iterator it=bc_blocks.begin();it!=bc_blocks.end();it++)
+		{
+			gzwrite(f,&it->first,sizeof(it->first));
+			gzwrite(f,&it->second.hdr,sizeof(it->second.hdr));
+			if (!it->second.oplist.empty())
+				gzwrite(f,&it->second.oplist[0],it->second.oplist.size()*sizeof(shil_opcode));
+		}
+
+		gzclose(f);
+	}
+	else
+		printf("bc: failed to write %s\n",bc_file.c_str());
+
+	bc_blocks.clear();
+}
+
+#endif
@@ -0,0 +1,33 @@
+/*
+	Persistent cache of decoded & analysed shil blocks.
+	Blocks are keyed by address and fpu config, and validated against a sha1 of their sh4 code.
+*/
+#pragma once
+#include "types.h"
+#include "blockmanager.h"
+
+enum BlockCacheMode
+{
+	BCM_Disabled=0,
+	BCM_Enabled=1,
+	BCM_Validate=2,   //always decode, and compare with the cached copy
+};
+
+struct bc_stats_t
+{
+	u32 hits;
+	u32 misses;
+	u32 mismatches;   //validation failures
+	u32 loaded;
+	u32 stored;
+};
+
+extern bc_stats_t bc_stats;
+
+void bc_Init(const string& file);
+void bc_Term();
+
+//fills in the decoded/analysed block from the cache, returns false on a miss
+bool bc_Load(RuntimeBlockInfo* blk);
+//adds a freshly decoded/analysed block to the cache
+void bc_Store(RuntimeBlockInfo* blk);
@@ -6,6 +6,7 @@
 #include <algorithm>
 #include "blockmanager.h"
 #include "ngen.h"
+#include "ssa.h"
 
 #include "../sh4_interpreter.h"
 #include "../sh4_opcode_list.h"
@@ -37,57 +38,152 @@ bm_List blocks_page[/*BLOCKS_IN_PAGE_LIST_COUNT*/(32*1024*1024)/4096];
 
 bm_List all_blocks;
 bm_List del_blocks;
-#include <set>
 
-struct BlockMapCMP
+/*
+	Host code -> block lookups.
+	Blocks in CodeCache are listed on every BM_CODE_PAGE_SIZE slot their code overlaps, so a
+	lookup is an index plus a short scan. Blocks outside CodeCache (rec_cpp) are kept in a vector
+	sorted by code start.
+	The same structure is used for stale blocks, whose code may overlap the live ones.
+*/
+#define BM_CODE_PAGE_SHIFT 9
+#define BM_CODE_PAGE_SIZE (1<<BM_CODE_PAGE_SHIFT)
+#define BM_CODE_PAGE_COUNT (CODE_SIZE>>BM_CODE_PAGE_SHIFT)
+
+struct bm_CodeMap
 {
-	static bool is_code(RuntimeBlockInfo* blk)
+	bm_List pages[BM_CODE_PAGE_COUNT];
+	bm_List ext_blocks;
+
+	static bool is_code(void* ptr)
 	{
-		if ((unat)((u8*)blk-CodeCache)<CODE_SIZE)
-			return true;
-		else
-			return false;
+		return (unat)((u8*)ptr-CodeCache)<CODE_SIZE;
 	}
 
-	static unat get_blkstart(RuntimeBlockInfo* blk)
+	static bool code_lt(RuntimeBlockInfo* blkl, RuntimeBlockInfo* blkr)
 	{
-		if (is_code(blk)) 
-			return (unat)blk; 
-		else 
-			return (unat)blk->code;
+		return (unat)blkl->code<(unat)blkr->code;
 	}
 
-	static unat get_blkend(RuntimeBlockInfo* blk)
+	static void get_pages(RuntimeBlockInfo* blk,u32& first,u32& last)
 	{
-		if (is_code(blk)) 
-			return (unat)blk; 
-		else 
-			return (unat)blk->code+blk->host_code_size-1;
+		unat offs=(u8*)blk->code-CodeCache;
+		first=offs>>BM_CODE_PAGE_SHIFT;
+		last=min<unat>(offs+max(blk->host_code_size,1u)-1,CODE_SIZE-1)>>BM_CODE_PAGE_SHIFT;
 	}
 
-	//return true if blkl > blkr
-	bool operator()(RuntimeBlockInfo* blkl, RuntimeBlockInfo* blkr) const
+	void insert(RuntimeBlockInfo* blk)
 	{
-		if (!is_code(blkl) && !is_code(blkr))
-			return (unat)blkl->code<(unat)blkr->code;
+		if (is_code((void*)blk->code))
+		{
+			u32 first,last;
+			get_pages(blk,first,last);
+			for (u32 i=first;i<=last;i++)
+				pages[i].push_back(blk);
+		}
+		else
+		{
+			ext_blocks.insert(upper_bound(ext_blocks.begin(),ext_blocks.end(),blk,code_lt),blk);
+		}
+	}
 
-		unat blkr_start=get_blkstart(blkr),blkl_end=get_blkend(blkl);
+	void erase(RuntimeBlockInfo* blk)
+	{
+		if (is_code((void*)blk->code))
+		{
+			u32 first,last;
+			get_pages(blk,first,last);
+			for (u32 i=first;i<=last;i++)
+			{
+				bm_List::iterator it=std::find(pages[i].begin(),pages[i].end(),blk);
+				if (it!=pages[i].end())
+					pages[i].erase(it);
+			}
+		}
+		else
+		{
+			bm_List::iterator it=lower_bound(ext_blocks.begin(),ext_blocks.end(),blk,code_lt);
+			while (it!=ext_blocks.end() && (*it)->code==blk->code && *it!=blk)
+				it++;
+			if (it!=ext_blocks.end() && *it==blk)
+				ext_blocks.erase(it);
+		}
+	}
 
-		if (blkl_end<blkr_start)
+	RuntimeBlockInfo* find(void* code)
+	{
+		if (is_code(code))
 		{
-			return true;
+			bm_List& page=pages[((u8*)code-CodeCache)>>BM_CODE_PAGE_SHIFT];
+			for (size_t i=0;i<page.size();i++)
+			{
+				if (page[i]->contains_code((u8*)code))
+					return page[i];
+			}
 		}
 		else
 		{
-			return false;
+			//last block starting at or before code
+			size_t lo=0,hi=ext_blocks.size();
+			while (lo<hi)
+			{
+				size_t mid=(lo+hi)/2;
+				if ((unat)ext_blocks[mid]->code<=(unat)code)
+					lo=mid+1;
+				else
+					hi=mid;
+			}
+			if (lo>0 && (ext_blocks[lo-1]->code==code || ext_blocks[lo-1]->contains_code((u8*)code)))
+				return ext_blocks[lo-1];
 		}
+
+		return 0;
+	}
+
+	//blocks overlapping the CodeCache range [start,end), each listed once
+	void find_range(u8* start,u8* end,bm_List& rv)
+	{
+		if (!is_code(start))
+			return;
+
+		u32 first=(start-CodeCache)>>BM_CODE_PAGE_SHIFT;
+		u32 last=(min<unat>(end-CodeCache,CODE_SIZE)-1)>>BM_CODE_PAGE_SHIFT;
+
+		for (u32 i=first;i<=last;i++)
+		{
+			for (size_t j=0;j<pages[i].size();j++)
+			{
+				RuntimeBlockInfo* blk=pages[i][j];
+				u8* code=(u8*)blk->code;
+
+				if (code>=end || code+blk->host_code_size<=start)
+					continue;
+
+				//only report a block on the first scanned page it is listed on
+				u32 blk_first,blk_last;
+				get_pages(blk,blk_first,blk_last);
+				if (max(blk_first,first)==i)
+					rv.push_back(blk);
+			}
+		}
+	}
+
+	void clear()
+	{
+		for (u32 i=0;i<BM_CODE_PAGE_COUNT;i++)
+			pages[i].clear();
+		ext_blocks.clear();
 	}
 };
 
-typedef std::set<RuntimeBlockInfo*,BlockMapCMP> blkmap_t;
-blkmap_t blkmap;
+bm_CodeMap blkmap;
+bm_CodeMap del_blkmap;
 u32 bm_gc_luc,bm_gcf_luc;
 
+bm_stats_t bm_stats;
+u32 bm_discard_gen;
+ngen_ra_stats_t ra_stats;
+
 
 #define FPCA(x) ((DynarecCodeEntryPtr&)sh4rcb.fpcb[(x>>1)&FPCB_MASK])
 
@@ -116,11 +212,10 @@ RuntimeBlockInfo* DYNACALL bm_GetBlock(u32 addr)
 
 RuntimeBlockInfo* bm_GetBlock2(void* dynarec_code)
 {
-	blkmap_t::iterator iter=blkmap.find((RuntimeBlockInfo*)dynarec_code);
-	if (iter!=blkmap.end())
+	RuntimeBlockInfo* rbi=blkmap.find(dynarec_code);
+	if (rbi)
 	{
-		verify((*iter)->contains_code((u8*)dynarec_code));
-		return *iter;
+		return rbi;
 	}
 	else
 	{
@@ -131,27 +226,85 @@ RuntimeBlockInfo* bm_GetBlock2(void* dynarec_code)
 
 RuntimeBlockInfo* bm_GetStaleBlock(void* dynarec_code)
 {
-	for(u32 i=0;i<del_blocks.size();i++)
+	return del_blkmap.find(dynarec_code);
+}
+
+//sh4 ram pages some code spans, only blocks on ram are tracked per page
+static bool bm_GetPages(u32 addr,u32 size,u32& first,u32& last)
+{
+	if (!IsOnRam(addr))
+		return false;
+
+	first=(addr&RAM_MASK)/PAGE_SIZE;
+	last=((addr+max(size,2u)-1)&RAM_MASK)/PAGE_SIZE;
+
+	//don't wrap around the ram mirror
+	if (last<first)
+		last=first;
+
+	return true;
+}
+
+//all the pages a block is listed on, superblocks span several guest blocks
+static void bm_GetPages(RuntimeBlockInfo* blk,vector<u32>& pages)
+{
+	u32 first,last;
+
+	if (bm_GetPages(blk->addr,blk->sh4_code_size,first,last))
 	{
-		if (del_blocks[i]->contains_code((u8*)dynarec_code))
-			return del_blocks[i];
+		for (u32 i=first;i<=last;i++)
+			pages.push_back(i);
 	}
 
-	return 0;
+	for (size_t j=0;j<blk->trace.size();j++)
+	{
+		if (bm_GetPages(blk->trace[j].addr,blk->trace[j].sh4_code_size,first,last))
+		{
+			for (u32 i=first;i<=last;i++)
+			{
+				if (find(pages.begin(),pages.end(),i)==pages.end())
+					pages.push_back(i);
+			}
+		}
+	}
 }
 
-void bm_AddBlock(RuntimeBlockInfo* blk)
+//Unmaps a block. It is kept in del_blocks, as its code might still be on the stack
+static void bm_DiscardBlock(RuntimeBlockInfo* blk)
 {
-	/*
-	if (IsOnRam(blk->addr) && PageIsConst(blk->addr))
+	bm_discard_gen++;
+
+	if (bm_GetCode(blk->addr)==blk->code)
+		FPCA(blk->addr)=ngen_FailedToFindBlock;
+
+	blk->Discard();
+
+	vector<u32> pages;
+	bm_GetPages(blk,pages);
+	for (size_t i=0;i<pages.size();i++)
 	{
-		blocks_page[(blk->addr&RAM_MASK)/PAGE_SIZE].push_back(blk);
+		bm_List& list=blocks_page[pages[i]];
+		bm_List::iterator it=find(list.begin(),list.end(),blk);
+		if (it!=list.end())
+			list.erase(it);
 	}
-	*/
+
+	del_blocks.push_back(blk);
+	del_blkmap.insert(blk);
+}
+
+void bm_AddBlock(RuntimeBlockInfo* blk)
+{
+	vector<u32> pages;
+	bm_GetPages(blk,pages);
+	for (size_t i=0;i<pages.size();i++)
+		blocks_page[pages[i]].push_back(blk);
+
 	all_blocks.push_back(blk);
-	if (blkmap.find(blk)!=blkmap.end())
+	RuntimeBlockInfo* dup=blkmap.find((void*)blk->code);
+	if (dup)
 	{
-		printf("DUP: %08X %08X %08X %08X\n", (*blkmap.find(blk))->addr,(*blkmap.find(blk))->code,blk->addr,blk->code);
+		printf("DUP: %08X %08X %08X %08X\n", dup->addr,dup->code,blk->addr,blk->code);
 		verify(false);
 	}
 	blkmap.insert(blk);
@@ -176,6 +329,113 @@ void bm_AddBlock(RuntimeBlockInfo* blk)
 
 }
 
+/*
+	Evicts every block whose host code starts in [start,end).
+	Blocks linked to the evicted ones are unlinked and go back through the link stubs.
+	The evicted blocks are kept in del_blocks (like on bm_Reset) as stale code may still be on the stack.
+	Returns the end of the evicted host code, or start if nothing was evicted.
+*/
+u8* bm_EvictBlocks(u8* start,u8* end)
+{
+	u8* evicted_end=start;
+
+	if (start>=end)
+		return evicted_end;
+
+	bm_List victims;
+	blkmap.find_range(start,end,victims);
+
+	if (victims.empty())
+		return evicted_end;
+
+	u8* evict_start=end;
+	for (size_t i=0; i<victims.size(); i++)
+	{
+		RuntimeBlockInfo* blk=victims[i];
+
+		u8* blk_end=(u8*)blk->code+blk->host_code_size;
+		if (blk_end>evicted_end)
+			evicted_end=blk_end;
+		if ((u8*)blk->code<evict_start)
+			evict_start=(u8*)blk->code;
+
+		blkmap.erase(blk);
+		bm_DiscardBlock(blk);
+		bm_stats.evicted_blocks++;
+	}
+
+	std::sort(victims.begin(),victims.end());
+
+	size_t j=0;
+	for (size_t i=0; i<all_blocks.size(); i++)
+	{
+		if (!std::binary_search(victims.begin(),victims.end(),all_blocks[i]))
+			all_blocks[j++]=all_blocks[i];
+	}
+	all_blocks.resize(j);
+
+	bm_stats.evict_passes++;
+	bm_stats.evicted_bytes+=evicted_end-evict_start;
+
+	return evicted_end;
+}
+
+/*
+	Discards all the blocks with code on the ram pages overlapping [addr,addr+size).
+	Used when a block's code has been modified, the other blocks on the page are likely stale too.
+*/
+void bm_DiscardPages(u32 addr,u32 size)
+{
+	if (!IsOnRam(addr))
+		return;
+
+	u32 first=(addr&RAM_MASK)/PAGE_SIZE;
+	u32 last=((addr+max(size,1u)-1)&RAM_MASK)/PAGE_SIZE;
+	if (last<first)
+		last=first;
+
+	bm_List victims;
+	for (u32 i=first;i<=last;i++)
+	{
+		victims.insert(victims.end(),blocks_page[i].begin(),blocks_page[i].end());
+		bm_stats.discarded_pages++;
+	}
+
+	//blocks spanning two pages are listed on both
+	std::sort(victims.begin(),victims.end());
+	victims.erase(std::unique(victims.begin(),victims.end()),victims.end());
+
+	if (victims.empty())
+		return;
+
+	for (size_t i=0; i<victims.size(); i++)
+	{
+		blkmap.erase(victims[i]);
+		bm_DiscardBlock(victims[i]);
+	}
+
+	size_t j=0;
+	for (size_t i=0; i<all_blocks.size(); i++)
+	{
+		if (!std::binary_search(victims.begin(),victims.end(),all_blocks[i]))
+			all_blocks[j++]=all_blocks[i];
+	}
+	all_blocks.resize(j);
+
+	bm_stats.discarded_blocks+=victims.size();
+}
+
+//Unmaps a single block, eg. one that has been replaced by a superblock
+void bm_RemoveBlock(RuntimeBlockInfo* blk)
+{
+	blkmap.erase(blk);
+	bm_DiscardBlock(blk);
+
+	bm_List::iterator it=find(all_blocks.begin(),all_blocks.end(),blk);
+	if (it!=all_blocks.end())
+		all_blocks.erase(it);
+}
+
 /* Naomi edit - allow for max possible size */
 u32 PAGE_STATE[(32*1024*1024)/*RAM_SIZE*//32];
 
@@ -272,10 +532,43 @@ u32 rebuild_counter=20;
 void bm_Periodical_1s()
 {
 	for (u32 i=0;i<del_blocks.size();i++)
+	{
+		del_blkmap.erase(del_blocks[i]);
 		delete del_blocks[i];
+	}
 
 	del_blocks.clear();
 
+#ifndef NDEBUG
+	if (bm_stats.evict_passes || bm_stats.full_flushes || bm_stats.discarded_pages)
+	{
+		printf("bm: %d blocks compiled in %.2f ms, %d blocks (%d KB) evicted in %d passes, %d blocks discarded on %d smc pages, %d full flushes\n",
+			bm_stats.compiled_blocks,bm_stats.compile_time*1000,
+			bm_stats.evicted_blocks,bm_stats.evicted_bytes/1024,bm_stats.evict_passes,
+			bm_stats.discarded_blocks,bm_stats.discarded_pages,bm_stats.full_flushes);
+	}
+
+	if (bm_stats.traces)
+		printf("bm: %d superblocks formed from %d blocks\n",bm_stats.traces,bm_stats.trace_blocks);
+
+	if (ra_stats.blocks)
+	{
+		printf("regalloc: %d blocks, %.1f loads and %.1f stores saved per block (%d/%d loads, %d/%d stores left)\n",
+			ra_stats.blocks,(ra_stats.reads-(float)ra_stats.loads)/ra_stats.blocks,(ra_stats.writes-(float)ra_stats.stores)/ra_stats.blocks,
+			ra_stats.loads,ra_stats.reads,ra_stats.stores,ra_stats.writes);
+	}
+
+	if (ssa_stats.blocks)
+	{
+		printf("ssa: %d blocks, %d -> %d ops, %d const args, %d folded, %d sr.t, %d dead, %d/%d validation failures\n",
+			ssa_stats.blocks,ssa_stats.ops_in,ssa_stats.ops_out,ssa_stats.const_args,ssa_stats.folded,
+			ssa_stats.srt_removed,ssa_stats.dead_removed,ssa_stats.mismatches,ssa_stats.validated);
+	}
+#endif
+	memset(&bm_stats,0,sizeof(bm_stats));
+	memset(&ssa_stats,0,sizeof(ssa_stats));
+	memset(&ra_stats,0,sizeof(ra_stats));
+
 	if (rebuild_counter>0) rebuild_counter--;
 #if HOST_OS==OS_WINDOWS && 0
 	std::sort(all_blocks.begin(),all_blocks.end(),UDgreaterX);
@@ -377,6 +670,7 @@ void bm_vmem_pagefill(void** ptr,u32 PAGE_SZ)
 
 void bm_Reset()
 {
+	bm_discard_gen++;
 	ngen_ResetBlocks();
 	for (u32 i=0; i<BLOCKS_IN_PAGE_LIST_COUNT; i++)
 	{
@@ -394,6 +688,8 @@ void bm_Reset()
 	}
 
 	del_blocks.insert(del_blocks.begin(),all_blocks.begin(),all_blocks.end());
+	for (size_t i=0; i<all_blocks.size(); i++)
+		del_blkmap.insert(all_blocks[i]);
 
 	all_blocks.clear();
 	blkmap.clear();
@@ -581,6 +877,31 @@ void RuntimeBlockInfo::RemRef(RuntimeBlockInfo* other)
 	pre_refs.erase(find(pre_refs.begin(),pre_refs.end(),other)); 
 }
 
+void RuntimeBlockInfo::Discard()
+{
+	//unlink the blocks that jump here, they will relink through the stubs
+	for (size_t i=0;i<pre_refs.size();i++)
+	{
+		RuntimeBlockInfo* pre=pre_refs[i];
+
+		if (pre->pBranchBlock==this)
+			pre->pBranchBlock=0;
+		if (pre->pNextBlock==this)
+			pre->pNextBlock=0;
+
+		pre->Relink();
+	}
+	pre_refs.clear();
+
+	//and drop the references this block holds (a cond block linked to the same target holds a single one)
+	if (pBranchBlock)
+		pBranchBlock->RemRef(this);
+	if (pNextBlock && pNextBlock!=pBranchBlock)
+		pNextBlock->RemRef(this);
+
+	pBranchBlock=pNextBlock=0;
+}
+
 bool print_stats;
 
 void fprint_hex(FILE* d,const char* init,u8* ptr, u32& ofs, u32 limit)
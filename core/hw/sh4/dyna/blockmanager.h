@@ -14,9 +14,16 @@ struct RuntimeBlockInfo_Core
 	u32 lookups;
 };
 
+/* a guest block merged into a superblock, other than the first one */
+struct TraceBlockInfo
+{
+	u32 addr;
+	u32 sh4_code_size;
+};
+
 struct RuntimeBlockInfo: RuntimeBlockInfo_Core
 {
-	void Setup(u32 pc,fpscr_t fpu_cfg);
+	void Setup(u32 pc,fpscr_t fpu_cfg,u32 max_cycles=0);    //0: the default block size
 	const char* hash(bool full=true, bool reloc=false);
 
 	u32 host_code_size;	   /* in bytes */
@@ -47,6 +54,9 @@ struct RuntimeBlockInfo: RuntimeBlockInfo_Core
 
 	vector<shil_opcode> oplist;
 
+	/* superblocks only, the blocks merged after the first one (addr/sh4_code_size) */
+	vector<TraceBlockInfo> trace;
+
 	bool contains_code(u8* ptr)
 	{
 		return ((size_t)(ptr-(u8*)code)) < host_code_size;
@@ -75,6 +85,28 @@ struct CachedBlockInfo: RuntimeBlockInfo_Core
 	RuntimeBlockInfo* block;
 };
 
+/* code cache statistics, reported (and cleared) by bm_Periodical_1s */
+struct bm_stats_t
+{
+	u32 compiled_blocks;
+	double compile_time;	/* in seconds */
+
+	u32 evict_passes;
+	u32 evicted_blocks;
+	u32 evicted_bytes;
+	u32 discarded_pages;
+	u32 discarded_blocks;
+	u32 full_flushes;
+
+	u32 traces;          /* superblocks formed */
+	u32 trace_blocks;    /* guest blocks merged into them */
+};
+
+extern bm_stats_t bm_stats;
+
+/* bumped when blocks are discarded, code pointers kept outside of the fpcb table are checked against it */
+extern u32 bm_discard_gen;
+
 void bm_WriteBlockMap(const string& file);
 
 #ifdef __cplusplus
@@ -89,6 +121,9 @@ RuntimeBlockInfo* bm_GetStaleBlock(void* dynarec_code);
 RuntimeBlockInfo* DYNACALL bm_GetBlock(u32 addr);
 
 void bm_AddBlock(RuntimeBlockInfo* blk);
+u8* bm_EvictBlocks(u8* start,u8* end);
+void bm_DiscardPages(u32 addr,u32 size);
+void bm_RemoveBlock(RuntimeBlockInfo* blk);
 void bm_Reset();
 void bm_Periodical_1s();
 void bm_Periodical_14k();
@@ -15,9 +15,6 @@
 #include "hw/sh4/sh4_mem.h"
 #include "decoder_opcodes.h"
 
-#define BLOCK_MAX_SH_OPS_SOFT 500
-#define BLOCK_MAX_SH_OPS_HARD 511
-
 RuntimeBlockInfo* blk;
 
 const char idle_hash[] = 
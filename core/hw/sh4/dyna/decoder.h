@@ -2,6 +2,9 @@
 #include "shil.h"
 #include "../sh4_if.h"
 
+#define BLOCK_MAX_SH_OPS_SOFT 500
+#define BLOCK_MAX_SH_OPS_HARD 511
+
 #define mkbet(c,s,v) ((c<<3)|(s<<1)|v)
 #define BET_GET_CLS(x) (x>>3)
 
@@ -23,8 +23,10 @@
 #include <float.h>
 
 #include "blockmanager.h"
+#include "blockcache.h"
 #include "ngen.h"
 #include "decoder.h"
+#include "ssa.h"
 
 #if FEAT_SHREC != DYNAREC_NONE
 //uh uh
@@ -48,6 +50,7 @@ u8* CodeCache;
 
 u32 LastAddr;
 u32 LastAddr_min;
+u32 LastAddr_max=CODE_SIZE; //end of the free space after LastAddr, the cache is used as a ring buffer
 u32* emit_ptr=0;
 
 void* emit_GetCCPtr(void)
@@ -66,13 +69,16 @@ void emit_SetBaseAddr(void)
 void RASDASD()
 {
 	LastAddr=LastAddr_min;
+	LastAddr_max=CODE_SIZE;
 	memset(emit_GetCCPtr(),0xCC,emit_FreeSpace());
 }
 
 static void recSh4_ClearCache(void)
 {
 	LastAddr=LastAddr_min;
+	LastAddr_max=CODE_SIZE;
 	bm_Reset();
+	bm_stats.full_flushes++;
 
 #ifndef NDEBUG
 	printf("recSh4:Dynarec Cache clear at %08X\n",curr_pc);
@@ -109,7 +115,29 @@ void emit_Skip(u32 sz)
 }
 u32 emit_FreeSpace()
 {
-	return CODE_SIZE-LastAddr;
+	return LastAddr_max-LastAddr;
+}
+
+#define CODE_EVICT_SIZE (CODE_SIZE/16)
+
+/*
+	Makes room for new blocks by evicting the oldest code only.
+	The cache is filled in order, so the code right after LastAddr is always the oldest one.
+	When the end is reached, whatever is left there is evicted and emission wraps back to LastAddr_min.
+*/
+static void recSh4_EvictCache(void)
+{
+	if (CODE_SIZE-LastAddr<CODE_BLOCK_MAX)
+	{
+		bm_EvictBlocks(&CodeCache[LastAddr],&CodeCache[CODE_SIZE]);
+		LastAddr=LastAddr_min;
+		LastAddr_max=LastAddr_min;
+	}
+
+	u32 evict_end=min(LastAddr+CODE_EVICT_SIZE,(u32)CODE_SIZE);
+	u32 evicted_end=bm_EvictBlocks(&CodeCache[LastAddr_max],&CodeCache[evict_end])-CodeCache;
+
+	LastAddr_max=max(evict_end,evicted_end);
 }
 
 
@@ -187,7 +215,7 @@ const char* RuntimeBlockInfo::hash(bool full, bool relocable)
 	return block_hash;
 }
 
-void RuntimeBlockInfo::Setup(u32 rpc,fpscr_t rfpu_cfg)
+void RuntimeBlockInfo::Setup(u32 rpc,fpscr_t rfpu_cfg,u32 max_cycles)
 {
 	staging_runs=addr=lookups=runs=host_code_size=0;
 	guest_cycles=guest_opcodes=host_opcodes=0;
@@ -201,17 +229,48 @@ void RuntimeBlockInfo::Setup(u32 rpc,fpscr_t rfpu_cfg)
 	fpu_cfg=rfpu_cfg;
 	
 	oplist.clear();
+	trace.clear();
 
-	dec_DecodeBlock(this,SH4_TIMESLICE/2);
-	AnalyseBlock(this);
+	//the block cache only has blocks of the default size
+	if (max_cycles!=0 || !bc_Load(this))
+	{
+		dec_DecodeBlock(this,max_cycles!=0?max_cycles:SH4_TIMESLICE/2);
+		AnalyseBlock(this);
+		if (max_cycles==0)
+			bc_Store(this);
+	}
+}
+
+static void rdv_MakeRoom(void)
+{
+	if (emit_FreeSpace()<CODE_BLOCK_MAX)
+	{
+		ngen_features features;
+		ngen_GetFeatures(&features);
+
+		if (features.IncrementalFlush)
+			recSh4_EvictCache();
+		else
+			recSh4_ClearCache();
+	}
+
+	//eviction works in whole blocks, make sure the space is there in any build
+	if (emit_FreeSpace()<CODE_BLOCK_MAX)
+		recSh4_ClearCache();
 }
 
 DynarecCodeEntryPtr rdv_CompilePC(void)
 {
 	u32 pc=next_pc;
 
-	if (emit_FreeSpace()<16*1024 || pc==0x8c0000e0 || pc==0xac010000 || pc==0xac008300)
+	if (pc==0x8c0000e0 || pc==0xac010000 || pc==0xac008300)
 		recSh4_ClearCache();
+	else
+		rdv_MakeRoom();
+
+#ifndef NDEBUG
+	double compile_start=os_GetSeconds();
+#endif
 
 	RuntimeBlockInfo* rv=0;
 	do
@@ -220,12 +279,24 @@ DynarecCodeEntryPtr rdv_CompilePC(void)
 		if (rv==0)
          rv=rbi;
 
-		rbi->Setup(pc,fpscr);
+		bool do_opts=((pc&0x3FFFFFFF)>0x0C010100);
+		bool reset=(pc&0xFFFFFF)==0x08300 || (pc&0xFFFFFF)==0x10000;
 
-		bool do_opts=((rbi->addr&0x3FFFFFFF)>0x0C010100);
-		rbi->staging_runs=do_opts?100:-100;
-		ngen_Compile(rbi,DoCheck(rbi->addr),(pc&0xFFFFFF)==0x08300 || (pc&0xFFFFFF)==0x10000,false,do_opts);
-		verify(rbi->code!=0);
+		//a block whose host code doesn't fit in CODE_BLOCK_MAX is split, by decoding less of it
+		for (u32 max_cycles=0;;)
+		{
+			rbi->Setup(pc,fpscr,max_cycles);
+			rbi->staging_runs=do_opts?100:-100;
+			ngen_Compile(rbi,DoCheck(rbi->addr),reset,false,do_opts);
+
+			if (rbi->code!=0)
+				break;
+
+			if (max_cycles==1)
+				die("rdv_CompilePC: a single opcode doesn't fit in CODE_BLOCK_MAX");
+
+			max_cycles=max_cycles==0?SH4_TIMESLICE/4:max_cycles/2;
+		}
 
 		bm_AddBlock(rbi);
 
@@ -235,9 +306,216 @@ DynarecCodeEntryPtr rdv_CompilePC(void)
 			pc=0;
 	} while(false && pc);
 
+	bm_stats.compiled_blocks++;
+#ifndef NDEBUG
+	bm_stats.compile_time+=os_GetSeconds()-compile_start;
+#endif
+
 	return rv->code;
 }
 
+/*
+	Superblocks
+
+	A block that has run TRACE_HOT_RUNS times is recompiled together with the blocks
+	that usually follow it, as a single block. Static branches are followed, and on
+	conditional ones the path that has been taken the most is kept in line, with a
+	side exit (jexit) for the other one. The trace ends at dynamic branches, on
+	anything that changes sr or fpscr (the following blocks are decoded with the
+	current fpu config), and when it loops back into itself.
+
+	The superblock replaces the head block at the same pc. The other blocks keep
+	their own code, as they can still be reached from elsewhere.
+
+	The code of the members, as they were compiled on their own, must fit in half of
+	CODE_BLOCK_MAX: the backend emits the whole trace into that much space, and the
+	side exits and the cross block register allocation can make it bigger.
+*/
+#define TRACE_MAX_BLOCKS 8
+#define TRACE_MAX_HOST_SIZE (CODE_BLOCK_MAX/2)
+
+//true if the code after this block can't be decoded with the same sr/fpscr
+static bool rdv_EndsTrace(RuntimeBlockInfo* blk)
+{
+	for (size_t i=0;i<blk->oplist.size();i++)
+	{
+		shil_opcode& op=blk->oplist[i];
+
+		if (op.op==shop_sync_sr || op.op==shop_sync_fpscr)
+			return true;
+
+		if (op.op==shop_ifb && (OPCODE_SETSR(OpDesc[op.rs3._imm]->type) || OPCODE_SETFPSCR(OpDesc[op.rs3._imm]->type)))
+			return true;
+
+		if (op.rd.is_reg() && (op.rd._reg==reg_sr_status || op.rd._reg==reg_fpscr))
+			return true;
+	}
+
+	return false;
+}
+
+static bool rdv_InTrace(RuntimeBlockInfo* blk,u32 addr)
+{
+	if (blk->addr==addr)
+		return true;
+
+	for (size_t i=0;i<blk->trace.size();i++)
+	{
+		if (blk->trace[i].addr==addr)
+			return true;
+	}
+
+	return false;
+}
+
+static u32 rdv_BlockRuns(u32 addr)
+{
+	RuntimeBlockInfo* rbi=bm_GetBlock(addr);
+	return rbi?rbi->runs:0;
+}
+
+//host code of the block at addr, a block that isn't compiled gets its share of the limit
+static u32 rdv_BlockHostSize(u32 addr)
+{
+	RuntimeBlockInfo* rbi=bm_GetBlock(addr);
+	return rbi?rbi->host_code_size:TRACE_MAX_HOST_SIZE/TRACE_MAX_BLOCKS;
+}
+
+void DYNACALL rdv_HotBlock(u32 pc)
+{
+#ifndef NDEBUG
+	double compile_start=os_GetSeconds();
+#endif
+
+	RuntimeBlockInfo* sb=ngen_AllocateBlock();
+	RuntimeBlockInfo* blk=ngen_AllocateBlock();
+
+	sb->Setup(pc,fpscr);
+
+	//the jexit ops, and the cycles of the blocks up to each of them
+	vector<size_t> exits;
+	vector<u32> exit_cycles;
+
+	bool check=DoCheck(pc);
+	bool ended=rdv_EndsTrace(sb);
+	u32 host_size=rdv_BlockHostSize(pc);
+
+	while (!ended && sb->trace.size()+1<TRACE_MAX_BLOCKS)
+	{
+		u32 npc;
+		u32 exit_pc=0;
+		u32 exit_value=0;
+
+		if (sb->BlockType==BET_StaticJump || sb->BlockType==BET_StaticCall)
+			npc=sb->BranchBlock;
+		else if (sb->BlockType==BET_Cond_0 || sb->BlockType==BET_Cond_1)
+		{
+			//only follow a branch that is clearly the most taken one
+			u32 taken=rdv_BlockRuns(sb->BranchBlock);
+			u32 not_taken=rdv_BlockRuns(sb->NextBlock);
+
+			if (taken>not_taken*2)
+			{
+				npc=sb->BranchBlock;
+				exit_pc=sb->NextBlock;
+				exit_value=(sb->BlockType&1)^1;
+			}
+			else if (not_taken>taken*2)
+			{
+				npc=sb->NextBlock;
+				exit_pc=sb->BranchBlock;
+				exit_value=sb->BlockType&1;
+			}
+			else
+				break;
+		}
+		else
+			break;
+
+		if (rdv_InTrace(sb,npc))
+			break;
+
+		blk->Setup(npc,fpscr);
+
+		if (sb->guest_opcodes+blk->guest_opcodes>BLOCK_MAX_SH_OPS_SOFT ||
+			sb->guest_cycles+blk->guest_cycles>SH4_TIMESLICE/2 ||
+			host_size+rdv_BlockHostSize(npc)>TRACE_MAX_HOST_SIZE)
+			break;
+
+		host_size+=rdv_BlockHostSize(npc);
+
+		if (exit_pc)
+		{
+			shil_opcode op;
+			op.op=shop_jexit;
+			op.rd=shil_param();
+			op.rd2=shil_param();
+			op.rs1=shil_param(sb->has_jcond?reg_pc_dyn:reg_sr_T);
+			op.rs2=shil_param(FMT_IMM,exit_value);
+			op.rs3=shil_param(FMT_IMM,exit_pc);
+			op.Flow=op.flags=op.flags2=0;
+			op.host_offs=0;
+			op.guest_offs=sb->oplist.empty()?0:sb->oplist.back().guest_offs;
+
+			exits.push_back(sb->oplist.size());
+			exit_cycles.push_back(sb->guest_cycles);
+			sb->oplist.push_back(op);
+		}
+
+		sb->oplist.insert(sb->oplist.end(),blk->oplist.begin(),blk->oplist.end());
+
+		sb->guest_opcodes+=blk->guest_opcodes;
+		sb->guest_cycles+=blk->guest_cycles;
+		sb->BlockType=blk->BlockType;
+		sb->BranchBlock=blk->BranchBlock;
+		sb->NextBlock=blk->NextBlock;
+		sb->has_jcond=blk->has_jcond;
+
+		TraceBlockInfo tbi={blk->addr,blk->sh4_code_size};
+		sb->trace.push_back(tbi);
+
+		check|=DoCheck(npc);
+		ended=rdv_EndsTrace(blk);
+	}
+
+	delete blk;
+
+	if (sb->trace.empty())
+	{
+		delete sb;
+		return;
+	}
+
+	//the whole trace is charged on entry, the side exits give back what they skip
+	for (size_t i=0;i<exits.size();i++)
+		sb->oplist[exits[i]].flags=sb->guest_cycles-exit_cycles[i];
+
+	ssa_Optimise(sb);
+
+	rdv_MakeRoom();
+
+	//a trace that doesn't fit in CODE_BLOCK_MAX is dropped, the head block stays
+	ngen_Compile(sb,check,false,false,false);
+	if (sb->code==0)
+	{
+		delete sb;
+		return;
+	}
+
+	//making room might have evicted it already
+	RuntimeBlockInfo* head=bm_GetBlock(pc);
+	if (head)
+		bm_RemoveBlock(head);
+
+	bm_AddBlock(sb);
+
+	bm_stats.traces++;
+	bm_stats.trace_blocks+=sb->trace.size()+1;
+#ifndef NDEBUG
+	bm_stats.compile_time+=os_GetSeconds()-compile_start;
+#endif
+}
+
 DynarecCodeEntryPtr DYNACALL rdv_FailedToFindBlock(u32 pc)
 {
 	//printf("rdv_FailedToFindBlock ~ %08X\n",pc);
@@ -267,7 +545,22 @@ u32 DYNACALL rdv_DoInterrupts(void* block_cpde)
 DynarecCodeEntryPtr DYNACALL rdv_BlockCheckFail(u32 pc)
 {
 	next_pc=pc;
-	recSh4_ClearCache();
+
+	//only drop the blocks on the modified page(s), the rest still check themselves on entry.
+	//With unstable_opt most blocks have no check, a failing one is the only hint that code
+	//changed anywhere, so everything goes
+	RuntimeBlockInfo* rbi=bm_GetBlock(pc);
+	if (rbi && IsOnRam(pc) && !settings.dynarec.unstable_opt)
+	{
+		bm_DiscardPages(rbi->addr,rbi->sh4_code_size);
+
+		//a superblock may have failed on any of its blocks
+		for (size_t i=0;i<rbi->trace.size();i++)
+			bm_DiscardPages(rbi->trace[i].addr,rbi->trace[i].sh4_code_size);
+	}
+	else
+		recSh4_ClearCache();
+
 	return rdv_CompilePC();
 }
 
@@ -395,6 +688,9 @@ static void recSh4_Init(void)
 	bm_Init();
 	bm_Reset();
 
+	extern char g_base_name[128];
+	bc_Init(get_writable_data_path("data/")+(g_base_name[0]?g_base_name:"bios")+".shil");
+
 #if 0
 	verify(rcb_noffs(p_sh4rcb->fpcb) == FPCB_OFFSET);
 #endif
@@ -444,6 +740,7 @@ static void recSh4_Init(void)
 static void recSh4_Term(void)
 {
 	printf("recSh4 Term\n");
+	bc_Term();
 	bm_Term();
 	Sh4_int_Term();
 }
@@ -47,6 +47,8 @@
 
 
 #define CODE_SIZE   (16*1024*1024)
+//largest block the backends emit, rdv_MakeRoom keeps at least this much free space
+#define CODE_BLOCK_MAX (64*1024)
 
 //alternative emit ptr, set to 0 to use the main buffer
 extern u32* emit_ptr;
@@ -66,6 +68,9 @@ void emit_SetBaseAddr();
 DynarecCodeEntryPtr DYNACALL rdv_FailedToFindBlock(u32 pc);
 //Called when a block check failed, and the block needs to be invalidated
 DynarecCodeEntryPtr DYNACALL rdv_BlockCheckFail(u32 pc);
+//Called when a block has run TRACE_HOT_RUNS times, before it modifies any state.
+//The block's code must not be on the stack, it may be replaced with a superblock
+void DYNACALL rdv_HotBlock(u32 pc);
 //Called to compile code @pc
 DynarecCodeEntryPtr rdv_CompilePC();
 //Returns 0 if there is no code @pc, code ptr otherwise
@@ -83,7 +88,7 @@ u32 DYNACALL rdv_DoInterrupts_pc(u32 pc);
 
 void ngen_init();
 
-//Called to compile a block
+//Called to compile a block. block->code is left 0 if the host code doesn't fit in CODE_BLOCK_MAX
 void ngen_Compile(RuntimeBlockInfo* block,bool force_checks, bool reset, bool staging,bool optimise);
 
 //Called when blocks are reseted
@@ -98,8 +103,25 @@ struct ngen_features
 {
 	bool OnlyDynamicEnds;     //if set the block endings aren't handled natively and only Dynamic block end type is used
 	bool InterpreterFallback; //if set all the non-branch opcodes are handled with the ifb opcode
+	bool IncrementalFlush;    //if set blocks live in CodeCache and can be evicted one by one, instead of resetting the whole cache
+	bool SideExits;           //if set shop_jexit is supported, and blocks call rdv_HotBlock so superblocks can be formed
 };
 
+//runs after which a block calls rdv_HotBlock
+#define TRACE_HOT_RUNS 512
+
+//register allocation of the backends that use RegAlloc, reported (and cleared) by bm_Periodical_1s
+struct ngen_ra_stats_t
+{
+	u32 blocks;
+	u32 reads;    //register operands read from/written to a host register
+	u32 writes;
+	u32 loads;    //context loads/stores emitted for them (preloads, writebacks, around calls)
+	u32 stores;
+};
+
+extern ngen_ra_stats_t ra_stats;
+
 void ngen_GetFeatures(ngen_features* dst);
 
 //Canonical callback interface
@@ -368,7 +368,7 @@ struct RegAlloc
 		verify(opid>=0 && opid<block->oplist.size());
 		shil_opcode* op=&block->oplist[opid];
 
-		return op->op == shop_sync_fpscr || op->op == shop_sync_sr || op->op == shop_ifb;
+		return op->op == shop_sync_fpscr || op->op == shop_sync_sr || op->op == shop_ifb || op->op == shop_jexit;
 	}
 
 	bool IsRegWallOp(RuntimeBlockInfo* block, int opid, bool is_fpr)
@@ -500,6 +500,12 @@ struct RegAlloc
 				{
 					fp=true;
 				}
+				else if (op->op==shop_jexit)
+				{
+					//side exit of a superblock, the context must be up to date there
+					all=true;
+					fp=true;
+				}
 
 				if (all)
 				{
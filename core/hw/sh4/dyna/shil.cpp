@@ -9,6 +9,7 @@
 #include "decoder.h"
 #include "hw/sh4/sh4_mem.h"
 #include "blockmanager.h"
+#include "ssa.h"
 
 u32 RegisterWrite[sh4_reg_count];
 u32 RegisterRead[sh4_reg_count];
@@ -963,6 +964,8 @@ void AnalyseBlock(RuntimeBlockInfo* blk)
 	*/
 	if (settings.dynarec.unstable_opt)
 		sq_pref(blk);
+
+	ssa_Optimise(blk);
 	//constprop(blk); // crashes on ip
 #if HOST_CPU==CPU_X86
 //	rdgrp(blk);
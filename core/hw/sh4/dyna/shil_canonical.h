@@ -192,6 +192,11 @@ shil_opc(jcond)
 shil_recimp()
 shil_opc_end()
 
+//superblock side exit: if (rs1==rs2) { next_pc=rs3; cycle_counter+=flags; leave the block }
+shil_opc(jexit)
+shil_recimp()
+shil_opc_end()
+
 //shop_ifb
 shil_opc(ifb)
 shil_recimp()
@@ -869,12 +874,8 @@ shil_opc(fipr)
 shil_canonical
 (
 f32,f1,(float* fn, float* fm),
-	float idp;
-
-	idp=fn[0]*fm[0];
-	idp+=fn[1]*fm[1];
-	idp+=fn[2]*fm[2];
-	idp+=fn[3]*fm[3];
+	//summed pairwise, the order the x64 recompiler's SSE version uses
+	float idp=(fn[0]*fm[0]+fn[2]*fm[2])+(fn[1]*fm[1]+fn[3]*fm[3]);
 
    return fixNaN(idp);
 )
@@ -896,30 +897,23 @@ shil_opc(ftrv)
 shil_canonical
 (
 void,f1,(float* fd,float* fn, float* fm),
+	//each sum as (0+3)+(1+2), the order the x64 recompiler's SSE version uses
 	float v1;
 	float v2;
 	float v3;
 	float v4;
 
-	v1 = fm[0]  * fn[0] +
-		 fm[4]  * fn[1] +
-		 fm[8]  * fn[2] +
-		 fm[12] * fn[3];
-
-	v2 = fm[1]  * fn[0] +
-		 fm[5]  * fn[1] +
-		 fm[9]  * fn[2] +
-		 fm[13] * fn[3];
-
-	v3 = fm[2]  * fn[0] +
-		 fm[6]  * fn[1] +
-		 fm[10] * fn[2] +
-		 fm[14] * fn[3];
-
-	v4 = fm[3]  * fn[0] +
-		 fm[7]  * fn[1] +
-		 fm[11] * fn[2] +
-		 fm[15] * fn[3];
+	v1 = (fm[0]  * fn[0] + fm[12] * fn[3]) +
+		 (fm[4]  * fn[1] + fm[8] * fn[2]);
+
+	v2 = (fm[1]  * fn[0] + fm[13] * fn[3]) +
+		 (fm[5]  * fn[1] + fm[9] * fn[2]);
+
+	v3 = (fm[2]  * fn[0] + fm[14] * fn[3]) +
+		 (fm[6]  * fn[1] + fm[10] * fn[2]);
+
+	v4 = (fm[3]  * fn[0] + fm[15] * fn[3]) +
+		 (fm[7]  * fn[1] + fm[11] * fn[2]);
 
    fd[0] = fixNaN(v1);
 	fd[1] = fixNaN(v2);
@@ -0,0 +1,597 @@
+/*
+	SSA based shil optimiser
+
+	Every register write in a block gets a value number, and every register read is
+	linked to the value it sees (or to the block input of that register). The passes
+	work on those use/def chains:
+
+	- constant propagation: known constants become immediates on the ops that all
+	  backends accept them on (mov32, and rs2 of the simple alu ops), and ops with
+	  only constant inputs are folded into a mov32 imm, using the canonical impls.
+	- redundant SR.T: a T write that recomputes the value T already holds (same op on
+	  the same values) is dropped.
+	- dead code: pure ops whose results are overwritten before being read are dropped.
+	  All registers are live at the end of the block.
+
+	ifb, sync_sr and sync_fpscr read and write the whole context, so nothing is
+	tracked across them. The side exits of superblocks (jexit) read the whole context.
+
+	In validation mode the optimised oplist is run against the original one on a
+	synthetic context. Foldable ops are evaluated for real, everything else as a hash
+	of its inputs (and of the side effects before it, for the ops that have any).
+	On a mismatch the block keeps its original oplist.
+*/
+
+#include "ssa.h"
+#include "shil.h"
+#include "decoder.h"
+
+#if FEAT_SHREC != DYNAREC_NONE
+
+void UpdateFPSCR();
+bool UpdateSR();
+#include "hw/sh4/modules/ccn.h"
+#include "ngen.h"
+#include "hw/sh4/sh4_core.h"
+#include "hw/sh4/sh4_mmr.h"
+
+//the canonical implementations, used for folding
+#define SHIL_MODE 1
+#include "shil_canonical.h"
+
+#define SSA_INPUT 0x80000000	//value ids with this bit set are the block inputs, (SSA_INPUT|reg)
+
+ssa_stats_t ssa_stats;
+
+struct ssa_block
+{
+	vector<u32> def_op;      //op that defines each value
+	vector<u32> def_uses;    //reads of each value in the block
+	vector<bool> def_live;   //value is still in its register at the end of the block
+
+	vector<u32> reads;       //values read, rs1 rs2 rs3 order
+	vector<u32> writes;      //values written, rd rd2 order
+	vector<u32> op_reads;    //first entry in reads, per op (plus one at the end)
+	vector<u32> op_writes;   //first entry in writes, per op (plus one at the end)
+};
+
+//ops that only compute rd/rd2 from their sources, and can go if those are never read
+static bool ssa_IsPure(shilop op)
+{
+	switch (op)
+	{
+	case shop_mov32: case shop_mov64:
+	case shop_and: case shop_or: case shop_xor: case shop_not:
+	case shop_add: case shop_sub: case shop_neg:
+	case shop_shl: case shop_shr: case shop_sar: case shop_ror:
+	case shop_adc: case shop_sbc: case shop_rocl: case shop_rocr:
+	case shop_swaplb: case shop_swap: case shop_shld: case shop_shad:
+	case shop_ext_s8: case shop_ext_s16:
+	case shop_mul_u16: case shop_mul_s16: case shop_mul_i32: case shop_mul_u64: case shop_mul_s64:
+	case shop_div32u: case shop_div32s: case shop_div32p2:
+	case shop_cvt_f2i_t: case shop_cvt_i2f_n: case shop_cvt_i2f_z:
+	case shop_test: case shop_seteq: case shop_setge: case shop_setgt: case shop_setae: case shop_setab: case shop_setpeq:
+	case shop_fadd: case shop_fsub: case shop_fmul: case shop_fdiv: case shop_fabs: case shop_fneg: case shop_fsqrt:
+	case shop_fipr: case shop_ftrv: case shop_fmac: case shop_fsrra: case shop_fsca: case shop_fseteq: case shop_fsetgt:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+//ops that read and write the whole context
+static bool ssa_IsBarrier(shilop op)
+{
+	return op==shop_ifb || op==shop_sync_sr || op==shop_sync_fpscr;
+}
+
+//ops that may leave the block, everything must be up to date before them
+static bool ssa_IsExit(shilop op)
+{
+	return op==shop_jexit;
+}
+
+//ops that every backend accepts an immediate rs2 on
+static bool ssa_HasImmRs2(shilop op)
+{
+	switch (op)
+	{
+	case shop_and: case shop_or: case shop_xor: case shop_add: case shop_sub:
+	case shop_test: case shop_seteq: case shop_setge: case shop_setgt: case shop_setae: case shop_setab:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+//evaluates the ops with a single 32 bit result, with the canonical implementations
+static bool ssa_Fold(shilop op,u32 r1,u32 r2,u32& rv)
+{
+	switch (op)
+	{
+	case shop_and: rv=shil_opcl_and::f1::impl(r1,r2); break;
+	case shop_or:  rv=shil_opcl_or::f1::impl(r1,r2); break;
+	case shop_xor: rv=shil_opcl_xor::f1::impl(r1,r2); break;
+	case shop_not: rv=shil_opcl_not::f1::impl(r1); break;
+	case shop_add: rv=shil_opcl_add::f1::impl(r1,r2); break;
+	case shop_sub: rv=shil_opcl_sub::f1::impl(r1,r2); break;
+	case shop_neg: rv=shil_opcl_neg::f1::impl(r1); break;
+
+	case shop_shl: if (r2>31) return false; rv=shil_opcl_shl::f1::impl(r1,r2); break;
+	case shop_shr: if (r2>31) return false; rv=shil_opcl_shr::f1::impl(r1,r2); break;
+	case shop_sar: if (r2>31) return false; rv=shil_opcl_sar::f1::impl(r1,r2); break;
+	case shop_ror: if (r2==0 || r2>31) return false; rv=shil_opcl_ror::f1::impl(r1,r2); break;
+	case shop_shld: rv=shil_opcl_shld::f1::impl(r1,r2); break;
+	case shop_shad: rv=shil_opcl_shad::f1::impl(r1,r2); break;
+
+	case shop_swaplb: rv=shil_opcl_swaplb::f1::impl(r1); break;
+	case shop_swap:   rv=shil_opcl_swap::f1::impl(r1); break;
+	case shop_ext_s8:  rv=shil_opcl_ext_s8::f1::impl(r1); break;
+	case shop_ext_s16: rv=shil_opcl_ext_s16::f1::impl(r1); break;
+
+	case shop_mul_u16: rv=shil_opcl_mul_u16::f1::impl(r1,r2); break;
+	case shop_mul_s16: rv=shil_opcl_mul_s16::f1::impl(r1,r2); break;
+	case shop_mul_i32: rv=shil_opcl_mul_i32::f1::impl(r1,r2); break;
+
+	case shop_test:   rv=shil_opcl_test::f1::impl(r1,r2); break;
+	case shop_seteq:  rv=shil_opcl_seteq::f1::impl(r1,r2); break;
+	case shop_setge:  rv=shil_opcl_setge::f1::impl(r1,r2); break;
+	case shop_setgt:  rv=shil_opcl_setgt::f1::impl(r1,r2); break;
+	case shop_setae:  rv=shil_opcl_setae::f1::impl(r1,r2); break;
+	case shop_setab:  rv=shil_opcl_setab::f1::impl(r1,r2); break;
+	case shop_setpeq: rv=shil_opcl_setpeq::f1::impl(r1,r2); break;
+
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+//ops ssa_Fold can evaluate, in the form it expects
+static bool ssa_IsFoldable(const shil_opcode& op)
+{
+	u32 rv;
+	return op.rd.is_r32i() && op.rd2.is_null() && op.rs3.is_null() &&
+		(op.rs1.is_r32i() || op.rs1.is_imm()) &&
+		(op.rs2.is_null() || op.rs2.is_r32i() || op.rs2.is_imm()) &&
+		ssa_Fold(op.op,1,1,rv);
+}
+
+static void ssa_Read(ssa_block& ssa,u32* cur,const shil_param& prm)
+{
+	if (!prm.is_reg())
+		return;
+
+	for (u32 rn=prm._reg;rn<prm._reg+prm.count();rn++)
+	{
+		ssa.reads.push_back(cur[rn]);
+		if (!(cur[rn]&SSA_INPUT))
+			ssa.def_uses[cur[rn]]++;
+	}
+}
+
+static void ssa_Write(ssa_block& ssa,u32* cur,const shil_param& prm,u32 op)
+{
+	if (!prm.is_reg())
+		return;
+
+	for (u32 rn=prm._reg;rn<prm._reg+prm.count();rn++)
+	{
+		cur[rn]=ssa.def_op.size();
+		ssa.writes.push_back(cur[rn]);
+		ssa.def_op.push_back(op);
+		ssa.def_uses.push_back(0);
+	}
+}
+
+static void ssa_Build(RuntimeBlockInfo* blk,ssa_block& ssa)
+{
+	u32 cur[sh4_reg_count];
+
+	for (u32 rn=0;rn<sh4_reg_count;rn++)
+		cur[rn]=SSA_INPUT|rn;
+
+	for (size_t i=0;i<blk->oplist.size();i++)
+	{
+		shil_opcode& op=blk->oplist[i];
+
+		ssa.op_reads.push_back(ssa.reads.size());
+		ssa.op_writes.push_back(ssa.writes.size());
+
+		if (ssa_IsBarrier(op.op))
+		{
+			shil_param all(FMT_I32,0);
+			for (u32 rn=0;rn<sh4_reg_count;rn++)
+			{
+				all._reg=(Sh4RegType)rn;
+				ssa_Read(ssa,cur,all);
+			}
+			for (u32 rn=0;rn<sh4_reg_count;rn++)
+			{
+				all._reg=(Sh4RegType)rn;
+				ssa_Write(ssa,cur,all,i);
+			}
+			continue;
+		}
+
+		if (ssa_IsExit(op.op))
+		{
+			shil_param all(FMT_I32,0);
+			for (u32 rn=0;rn<sh4_reg_count;rn++)
+			{
+				all._reg=(Sh4RegType)rn;
+				ssa_Read(ssa,cur,all);
+			}
+			continue;
+		}
+
+		ssa_Read(ssa,cur,op.rs1);
+		ssa_Read(ssa,cur,op.rs2);
+		ssa_Read(ssa,cur,op.rs3);
+
+		ssa_Write(ssa,cur,op.rd,i);
+		ssa_Write(ssa,cur,op.rd2,i);
+	}
+
+	ssa.op_reads.push_back(ssa.reads.size());
+	ssa.op_writes.push_back(ssa.writes.size());
+
+	ssa.def_live.resize(ssa.def_op.size(),false);
+	for (u32 rn=0;rn<sh4_reg_count;rn++)
+	{
+		if (!(cur[rn]&SSA_INPUT))
+			ssa.def_live[cur[rn]]=true;
+	}
+}
+
+static void ssa_Kill(bool* known,const shil_param& prm)
+{
+	if (!prm.is_reg())
+		return;
+
+	for (u32 rn=prm._reg;rn<prm._reg+prm.count();rn++)
+		known[rn]=false;
+}
+
+static bool ssa_Const(const shil_param& prm,const bool* known,const u32* val,u32& rv)
+{
+	if (prm.is_imm())
+		rv=prm._imm;
+	else if (prm.is_r32i() && known[prm._reg])
+		rv=val[prm._reg];
+	else
+		return false;
+
+	return true;
+}
+
+static void ssa_ConstProp(RuntimeBlockInfo* blk)
+{
+	bool known[sh4_reg_count]={0};
+	u32 val[sh4_reg_count];
+
+	for (size_t i=0;i<blk->oplist.size();i++)
+	{
+		shil_opcode& op=blk->oplist[i];
+
+		if (ssa_IsBarrier(op.op))
+		{
+			memset(known,0,sizeof(known));
+			continue;
+		}
+
+		if (op.op==shop_mov32 && op.rd.is_r32i() && op.rs1.is_r32i() && known[op.rs1._reg])
+		{
+			op.rs1=shil_param(FMT_IMM,val[op.rs1._reg]);
+			ssa_stats.const_args++;
+		}
+		else if (ssa_HasImmRs2(op.op) && op.rs2.is_r32i() && known[op.rs2._reg])
+		{
+			op.rs2=shil_param(FMT_IMM,val[op.rs2._reg]);
+			ssa_stats.const_args++;
+		}
+
+		u32 r1,r2=0,rv;
+		if (ssa_IsFoldable(op) && ssa_Const(op.rs1,known,val,r1) &&
+			(op.rs2.is_null() || ssa_Const(op.rs2,known,val,r2)) && ssa_Fold(op.op,r1,r2,rv))
+		{
+			op.op=shop_mov32;
+			op.flags=0;
+			op.rs1=shil_param(FMT_IMM,rv);
+			op.rs2=shil_param();
+			ssa_stats.folded++;
+		}
+
+		ssa_Kill(known,op.rd);
+		ssa_Kill(known,op.rd2);
+
+		if (op.op==shop_mov32 && op.rd.is_r32i() && op.rs1.is_imm())
+		{
+			known[op.rd._reg]=true;
+			val[op.rd._reg]=op.rs1._imm;
+		}
+	}
+}
+
+//value of a source operand: an ssa value, or an immediate
+static u64 ssa_Operand(const ssa_block& ssa,const shil_param& prm,u32 read)
+{
+	if (prm.is_reg())
+		return ssa.reads[read];
+	else if (prm.is_imm())
+		return (1ULL<<32)|prm._imm;
+	else
+		return 2ULL<<32;
+}
+
+static void ssa_RedundantSRT(RuntimeBlockInfo* blk)
+{
+	ssa_block ssa;
+	ssa_Build(blk,ssa);
+
+	//what the current value of T was computed from
+	bool t_valid=false;
+	shilop t_op=shop_max;
+	u64 t_rs1=0,t_rs2=0;
+
+	vector<bool> removed(blk->oplist.size(),false);
+	u32 count=0;
+
+	for (size_t i=0;i<blk->oplist.size();i++)
+	{
+		shil_opcode& op=blk->oplist[i];
+
+		bool writes_t=ssa_IsBarrier(op.op) || (op.rd.is_reg() && op.rd._reg==reg_sr_T) ||
+			(op.rd2.is_reg() && op.rd2._reg==reg_sr_T);
+
+		if (!writes_t)
+			continue;
+
+		bool simple=(op.op==shop_mov32 || ssa_IsFoldable(op)) && op.rd._reg==reg_sr_T;
+		if (!simple)
+		{
+			t_valid=false;
+			continue;
+		}
+
+		u32 rd=ssa.op_reads[i];
+		u64 rs1=ssa_Operand(ssa,op.rs1,rd);
+		u64 rs2=ssa_Operand(ssa,op.rs2,rd+(op.rs1.is_reg()?op.rs1.count():0));
+
+		if (t_valid && t_op==op.op && t_rs1==rs1 && t_rs2==rs2)
+		{
+			removed[i]=true;
+			count++;
+			continue;
+		}
+
+		t_valid=true;
+		t_op=op.op;
+		t_rs1=rs1;
+		t_rs2=rs2;
+	}
+
+	if (!count)
+		return;
+
+	size_t j=0;
+	for (size_t i=0;i<blk->oplist.size();i++)
+	{
+		if (!removed[i])
+			blk->oplist[j++]=blk->oplist[i];
+	}
+	blk->oplist.resize(j);
+
+	ssa_stats.srt_removed+=count;
+}
+
+static void ssa_DeadCode(RuntimeBlockInfo* blk)
+{
+	ssa_block ssa;
+	ssa_Build(blk,ssa);
+
+	vector<bool> removed(blk->oplist.size(),false);
+	u32 count=0;
+
+	//reads only refer to earlier ops, so a single backwards sweep removes whole dead chains
+	for (size_t i=blk->oplist.size();i-->0;)
+	{
+		if (!ssa_IsPure(blk->oplist[i].op) || ssa.op_writes[i]==ssa.op_writes[i+1])
+			continue;
+
+		bool dead=true;
+		for (u32 w=ssa.op_writes[i];w<ssa.op_writes[i+1];w++)
+		{
+			u32 def=ssa.writes[w];
+			if (ssa.def_uses[def] || ssa.def_live[def])
+				dead=false;
+		}
+
+		if (!dead)
+			continue;
+
+		for (u32 rn=ssa.op_reads[i];rn<ssa.op_reads[i+1];rn++)
+		{
+			if (!(ssa.reads[rn]&SSA_INPUT))
+				ssa.def_uses[ssa.reads[rn]]--;
+		}
+
+		removed[i]=true;
+		count++;
+	}
+
+	if (!count)
+		return;
+
+	size_t j=0;
+	for (size_t i=0;i<blk->oplist.size();i++)
+	{
+		if (!removed[i])
+			blk->oplist[j++]=blk->oplist[i];
+	}
+	blk->oplist.resize(j);
+
+	ssa_stats.dead_removed+=count;
+}
+
+static u32 ssa_Mix(u32 h,u32 v)
+{
+	h^=v;
+	h*=0x01000193;
+	return h^(h>>15);
+}
+
+struct ssa_context
+{
+	u32 regs[sh4_reg_count];
+	u32 effects;
+};
+
+static u32 ssa_EvalParam(ssa_context& ctx,const shil_param& prm,u32 h)
+{
+	if (prm.is_imm())
+		return ssa_Mix(h,prm._imm);
+
+	if (prm.is_reg())
+	{
+		for (u32 rn=prm._reg;rn<prm._reg+prm.count();rn++)
+			h=ssa_Mix(h,ctx.regs[rn]);
+	}
+
+	return h;
+}
+
+static void ssa_EvalWrite(ssa_context& ctx,const shil_param& prm,u32 h,u32& slot)
+{
+	if (!prm.is_reg())
+		return;
+
+	for (u32 rn=prm._reg;rn<prm._reg+prm.count();rn++)
+		ctx.regs[rn]=ssa_Mix(h,++slot);
+}
+
+//runs an oplist on the synthetic context, see the top of the file
+static void ssa_Eval(const vector<shil_opcode>& oplist,ssa_context& ctx)
+{
+	for (size_t i=0;i<oplist.size();i++)
+	{
+		const shil_opcode& op=oplist[i];
+
+		if (op.op==shop_mov32 || op.op==shop_mov64)
+		{
+			for (u32 k=0;k<op.rd.count();k++)
+			{
+				if (op.rs1.is_imm())
+					ctx.regs[op.rd._reg+k]=k==0?op.rs1._imm:0;
+				else
+					ctx.regs[op.rd._reg+k]=ctx.regs[op.rs1._reg+k];
+			}
+			continue;
+		}
+
+		u32 rv;
+		if (ssa_IsFoldable(op) && ssa_Fold(op.op,
+			op.rs1.is_imm()?op.rs1._imm:ctx.regs[op.rs1._reg],
+			op.rs2.is_null()?0:op.rs2.is_imm()?op.rs2._imm:ctx.regs[op.rs2._reg],rv))
+		{
+			ctx.regs[op.rd._reg]=rv;
+			continue;
+		}
+
+		u32 h=ssa_Mix(op.op,op.flags);
+		h=ssa_EvalParam(ctx,op.rs1,h);
+		h=ssa_EvalParam(ctx,op.rs2,h);
+		h=ssa_EvalParam(ctx,op.rs3,h);
+
+		if (ssa_IsBarrier(op.op))
+		{
+			for (u32 rn=0;rn<sh4_reg_count;rn++)
+				h=ssa_Mix(h,ctx.regs[rn]);
+			ctx.effects=ssa_Mix(ctx.effects,h);
+			h=ssa_Mix(h,ctx.effects);
+			for (u32 rn=0;rn<sh4_reg_count;rn++)
+				ctx.regs[rn]=ssa_Mix(h,rn);
+			continue;
+		}
+
+		if (ssa_IsExit(op.op))
+		{
+			for (u32 rn=0;rn<sh4_reg_count;rn++)
+				h=ssa_Mix(h,ctx.regs[rn]);
+			ctx.effects=ssa_Mix(ctx.effects,h);
+			continue;
+		}
+
+		if (!ssa_IsPure(op.op))
+		{
+			ctx.effects=ssa_Mix(ctx.effects,h);
+			h=ssa_Mix(h,ctx.effects);
+		}
+
+		u32 slot=0;
+		ssa_EvalWrite(ctx,op.rd,h,slot);
+		ssa_EvalWrite(ctx,op.rd2,h,slot);
+	}
+}
+
+static bool ssa_Validate(RuntimeBlockInfo* blk,const vector<shil_opcode>& original)
+{
+	ssa_context ref,opt;
+
+	for (u32 rn=0;rn<sh4_reg_count;rn++)
+		ref.regs[rn]=ssa_Mix(0x9E3779B9,rn);
+	ref.effects=0;
+	opt=ref;
+
+	ssa_Eval(original,ref);
+	ssa_Eval(blk->oplist,opt);
+
+	ssa_stats.validated++;
+
+	if (ref.effects==opt.effects && memcmp(ref.regs,opt.regs,sizeof(ref.regs))==0)
+		return true;
+
+	ssa_stats.mismatches++;
+	printf("ssa: optimised block %08X doesn't match the original, passes 0x%X\n",blk->addr,settings.dynarec.OptPasses);
+#ifndef NDEBUG
+	for (size_t i=0;i<original.size();i++)
+		printf("\t%s\n",((shil_opcode&)original[i]).dissasm().c_str());
+	puts("->");
+	for (size_t i=0;i<blk->oplist.size();i++)
+		printf("\t%s\n",blk->oplist[i].dissasm().c_str());
+#endif
+
+	return false;
+}
+
+void ssa_Optimise(RuntimeBlockInfo* blk)
+{
+	u32 passes=settings.dynarec.OptPasses;
+
+	if (!passes || blk->oplist.empty())
+		return;
+
+	vector<shil_opcode> original;
+	if (settings.dynarec.OptValidate)
+		original=blk->oplist;
+
+	ssa_stats.blocks++;
+	ssa_stats.ops_in+=blk->oplist.size();
+
+	if (passes&SSA_ConstProp)
+		ssa_ConstProp(blk);
+	if (passes&SSA_SRT)
+		ssa_RedundantSRT(blk);
+	if (passes&SSA_DeadCode)
+		ssa_DeadCode(blk);
+
+	if (settings.dynarec.OptValidate && !ssa_Validate(blk,original))
+		blk->oplist=original;
+
+	ssa_stats.ops_out+=blk->oplist.size();
+}
+
+#endif
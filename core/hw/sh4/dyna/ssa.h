@@ -0,0 +1,35 @@
+/*
+	SSA based shil optimiser.
+	Blocks are straight line code, so the SSA form is kept implicit as use/def chains
+	over the oplist, and the oplist itself stays in register form for the backends.
+*/
+#pragma once
+#include "types.h"
+#include "blockmanager.h"
+
+enum SSAOptPass
+{
+	SSA_ConstProp=1,    //constant propagation and folding
+	SSA_SRT=2,          //redundant SR.T writes
+	SSA_DeadCode=4,     //dead code elimination
+
+	SSA_AllPasses=7,
+};
+
+struct ssa_stats_t
+{
+	u32 blocks;
+	u32 ops_in;
+	u32 ops_out;
+	u32 const_args;    //register sources turned into immediates
+	u32 folded;        //ops folded into a mov32 imm
+	u32 srt_removed;   //redundant SR.T writes
+	u32 dead_removed;  //dead ops
+	u32 validated;
+	u32 mismatches;    //blocks where the optimised oplist didn't match the original one
+};
+
+extern ssa_stats_t ssa_stats;
+
+//runs the passes enabled in settings.dynarec.OptPasses, and checks the result if settings.dynarec.OptValidate is set
+void ssa_Optimise(RuntimeBlockInfo* blk);
@@ -11,6 +11,7 @@
 #include "../sh4_if.h"
 #include "hw/pvr/pvr_mem.h"
 #include "hw/aica/aica.h"
+#include "hw/aica/sgc_if.h"
 #include "../modules/dmac.h"
 #include "hw/gdrom/gdrom_if.h"
 #include "hw/maple/maple_if.h"
@@ -20,6 +21,7 @@
 #include "../modules/ccn.h"
 #include "../dyna/blockmanager.h"
 #include "../sh4_sched.h"
+#include "hw/pvr/ta_ctx.h"
 
 #include <time.h>
 #include <float.h>
@@ -244,6 +246,12 @@ static int DreamcastSecond(int tag, int c, int j)
 	bm_Periodical_1s();
 #endif
 
+#ifndef NDEBUG
+	sh4_sched_print_stats();
+	rqueue_print_stats();
+	audio_print_stats();
+#endif
+
 	//printf("%d ticks\n",sh4_sched_intr);
 	sh4_sched_intr=0;
 	return SH4_MAIN_CLOCK;
@@ -273,10 +281,10 @@ void Sh4_int_Init()
 {
 	verify(sizeof(Sh4cntx)==448);
 
-	aica_sched=sh4_sched_register(0,&AicaUpdate);
+	aica_sched=sh4_sched_register(0,&AicaUpdate,"aica");
 	sh4_sched_request(aica_sched,AICA_TICK);
 
-	rtc_sched=sh4_sched_register(0,&DreamcastSecond);
+	rtc_sched=sh4_sched_register(0,&DreamcastSecond,"rtc");
 	sh4_sched_request(rtc_sched,SH4_MAIN_CLOCK);
 	memset(&p_sh4rcb->cntx, 0, sizeof(p_sh4rcb->cntx));
 }
@@ -8,6 +8,7 @@
 #include "../sh4_core.h"
 #include "hw/pvr/pvr_mem.h"
 #include "hw/mem/_vmem.h"
+#include "mmu.h"
 
 
 //Types
@@ -60,6 +61,11 @@ void CCN_MMUCR_write(u32 addr, u32 value)
 		temp.TI=0;
 	}
 	CCN_MMUCR=temp;
+
+#ifndef NO_MMU
+	//AT and SV change the translations
+	mmu_flush_tlb_cache();
+#endif
 }
 void CCN_CCR_write(u32 addr, u32 value)
 {
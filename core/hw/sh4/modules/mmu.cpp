@@ -110,10 +110,129 @@ const u32 ITLB_LRU_AND[4] =
 };
 u32 ITLB_LRU_USE[64];
 
+/*
+Software TLB, a direct mapped cache of the translated 4 kb pages, so the accesses that hit it
+skip the UTLB/ITLB scan. Instruction fetches, data reads and data writes have their own table
+(indexed by translation type), a page is only added once an access of that type passed the
+protection checks. The tag has sr.MD and the ASID, so mode and process switches don't flush it.
+Each page also remembers the TLB entry it came from and that entry's generation, UTLB_Sync and
+ITLB_Sync bump the generation, which drops all the pages of the entry, and drop the pages the new
+entry covers. 1 kb pages are not cached, nor are the 4 kb pages that have a 1 kb entry in them.
+host points to the page for memory, it is 0 for the areas that go through handlers
+*/
+#define TLB_CACHE_SIZE 1024
+
+struct TLB_CacheEntry
+{
+	u32 tag;
+	u32 pa;       //physical page
+	u8* host;
+	u32 entry;    //UTLB (or ITLB, for fetches) entry
+	u32 gen;
+};
+
+TLB_CacheEntry TLB_Cache[3][TLB_CACHE_SIZE];
+u32 UTLB_gen[64];
+u32 ITLB_gen[4];
+
+static INLINE u32 mmu_tlb_cache_tag(u32 va)
+{
+	return (va & ~0xFFF) | (CCN_PTEH.ASID << 2) | (sr.MD << 1) | 1;
+}
+
+template<u32 translation_type>
+static INLINE TLB_CacheEntry* mmu_tlb_cache_lookup(u32 va)
+{
+	TLB_CacheEntry* e = &TLB_Cache[translation_type][(va >> 12) & (TLB_CACHE_SIZE - 1)];
+
+	if (e->tag != mmu_tlb_cache_tag(va))
+		return 0;
+
+	if (translation_type == MMU_TT_IREAD)
+	{
+		if (e->gen != ITLB_gen[e->entry])
+			return 0;
+
+		//same as an ITLB hit
+		CCN_MMUCR.LRUI &= ITLB_LRU_AND[e->entry];
+		CCN_MMUCR.LRUI |= ITLB_LRU_OR[e->entry];
+	}
+	else
+	{
+		if (e->gen != UTLB_gen[e->entry])
+			return 0;
+
+		//same as a UTLB lookup
+		CCN_MMUCR.URC++;
+		if (CCN_MMUCR.URB == CCN_MMUCR.URC)
+			CCN_MMUCR.URC = 0;
+	}
+
+	return e;
+}
+
+template<u32 translation_type>
+static void mmu_tlb_cache_add(u32 va, u32 pa, u32 entry, CCN_PTEL_type Data)
+{
+	if (Data.SZ1 == 0 && Data.SZ0 == 0)
+		return;
+
+	//a 1 kb entry would match only part of the page
+	TLB_Entry* tlb = translation_type == MMU_TT_IREAD ? ITLB : UTLB;
+	u32 count = translation_type == MMU_TT_IREAD ? 4 : 64;
+
+	for (u32 i = 0; i < count; i++)
+	{
+		if (tlb[i].Data.V && tlb[i].Data.SZ1 == 0 && tlb[i].Data.SZ0 == 0 && (((u32)tlb[i].Address.VPN << 10) & ~0xFFF) == (va & ~0xFFF))
+			return;
+	}
+
+	TLB_CacheEntry* e = &TLB_Cache[translation_type][(va >> 12) & (TLB_CACHE_SIZE - 1)];
+
+	e->tag = mmu_tlb_cache_tag(va);
+	e->pa = pa & ~0xFFF;
+	e->entry = entry;
+	e->gen = translation_type == MMU_TT_IREAD ? ITLB_gen[entry] : UTLB_gen[entry];
+
+	u32 mask;
+	u8* ptr = (u8*)_vmem_get_ptr2(e->pa, mask);
+	e->host = ptr ? ptr + (e->pa & mask) : 0;
+}
+
+//the pages a new entry covers could be multiple hits now, they are dropped so they are looked up again
+static void mmu_tlb_cache_drop(TLB_Entry& tlb)
+{
+	if (tlb.Data.V == 0)
+		return;
+
+	u32 mask = mmu_mask[tlb.Data.SZ1 * 2 + tlb.Data.SZ0];
+	u32 start = ((u32)tlb.Address.VPN << 10) & mask & ~0xFFF;
+	u32 size = max(~mask + 1, 0x1000u);
+
+	for (u32 page = 0; page < size >> 12 && page < TLB_CACHE_SIZE; page++)
+	{
+		for (u32 tt = 0; tt < 3; tt++)
+		{
+			TLB_CacheEntry* e = &TLB_Cache[tt][((start >> 12) + page) & (TLB_CACHE_SIZE - 1)];
+			if ((e->tag & ~0xFFF) - start < size)
+				e->tag = 0;
+		}
+	}
+}
+
+//drops all the cached pages, for the changes that aren't tied to a TLB entry (MMUCR)
+void mmu_flush_tlb_cache()
+{
+	memset(TLB_Cache, 0, sizeof(TLB_Cache));
+}
+
 //sync mem mapping to mmu , suspend compiled blocks if needed.entry is a UTLB entry # , -1 is for full sync
 bool UTLB_Sync(u32 entry)
 {
 	printf_mmu("UTLB MEM remap %d : 0x%X to 0x%X : %d\n", entry, UTLB[entry].Address.VPN << 10, UTLB[entry].Data.PPN << 10, UTLB[entry].Data.V);
+	UTLB_gen[entry]++;
+	mmu_tlb_cache_drop(UTLB[entry]);
+
 	if (UTLB[entry].Data.V == 0)
 		return true;
 
@@ -143,6 +262,8 @@ bool UTLB_Sync(u32 entry)
 void ITLB_Sync(u32 entry)
 {
 	printf_mmu("ITLB MEM remap %d : 0x%X to 0x%X : %d\n", entry, ITLB[entry].Address.VPN << 10, ITLB[entry].Data.PPN << 10, ITLB[entry].Data.V);
+	ITLB_gen[entry]++;
+	mmu_tlb_cache_drop(ITLB[entry]);
 }
 
 void RaiseException(u32 expEvnt, u32 callVect) {
@@ -240,7 +361,7 @@ void mmu_raise_exeption(u32 mmu_error, u32 address, u32 am)
 		break;
 	}
 
-	__debugbreak();
+	dbgbreak;
 }
 
 bool mmu_match(u32 va, CCN_PTEH_type Address, CCN_PTEL_type Data)
@@ -427,6 +548,8 @@ u32 mmu_data_translation(u32 va, u32& rv)
 		else if (UTLB[entry].Data.D == 0)
 			return MMU_ERROR_FIRSTWRITE;
 	}
+
+	mmu_tlb_cache_add<translation_type>(va, rv, entry, UTLB[entry].Data);
 	return MMU_ERROR_NONE;
 }
 
@@ -510,6 +633,7 @@ retry_ITLB_Match:
 		return MMU_ERROR_PROTECTED;
 	}
 
+	mmu_tlb_cache_add<MMU_TT_IREAD>(va, rv, entry, ITLB[entry].Data);
 	return MMU_ERROR_NONE;
 }
 void MMU_init()
@@ -535,14 +659,64 @@ void MMU_reset()
 {
 	memset(UTLB, 0, sizeof(UTLB));
 	memset(ITLB, 0, sizeof(ITLB));
+	mmu_flush_tlb_cache();
 }
 
 void MMU_term()
 {
 }
 
+//the accesses check the software TLB first, a cached memory page is accessed directly
+template<u32 translation_type, typename T>
+static INLINE bool mmu_cached_read(u32 adr, T& data)
+{
+	TLB_CacheEntry* e = mmu_tlb_cache_lookup<translation_type>(adr);
+	if (!e)
+		return false;
+
+	u32 addr = e->pa | (adr & 0xFFF);
+	if (e->host)
+		data = *(T*)&e->host[adr & 0xFFF];
+	else if (sizeof(T) == 1)
+		data = _vmem_ReadMem8(addr);
+	else if (sizeof(T) == 2)
+		data = _vmem_ReadMem16(addr);
+	else if (sizeof(T) == 4)
+		data = _vmem_ReadMem32(addr);
+	else
+		data = _vmem_ReadMem64(addr);
+
+	return true;
+}
+
+template<typename T>
+static INLINE bool mmu_cached_write(u32 adr, T data)
+{
+	TLB_CacheEntry* e = mmu_tlb_cache_lookup<MMU_TT_DWRITE>(adr);
+	if (!e)
+		return false;
+
+	u32 addr = e->pa | (adr & 0xFFF);
+	if (e->host)
+		*(T*)&e->host[adr & 0xFFF] = data;
+	else if (sizeof(T) == 1)
+		_vmem_WriteMem8(addr, data);
+	else if (sizeof(T) == 2)
+		_vmem_WriteMem16(addr, data);
+	else if (sizeof(T) == 4)
+		_vmem_WriteMem32(addr, data);
+	else
+		_vmem_WriteMem64(addr, data);
+
+	return true;
+}
+
 u8 DYNACALL mmu_ReadMem8(u32 adr)
 {
+	u8 data;
+	if (mmu_cached_read<MMU_TT_DREAD>(adr, data))
+		return data;
+
 	u32 addr;
 	u32 tv = mmu_data_translation<MMU_TT_DREAD>(adr, addr);
 	if (tv == 0)
@@ -560,6 +734,10 @@ u16 DYNACALL mmu_ReadMem16(u32 adr)
 		mmu_raise_exeption(MMU_ERROR_BADADDR, adr, MMU_TT_DREAD);
 		return 0;
 	}
+	u16 data;
+	if (mmu_cached_read<MMU_TT_DREAD>(adr, data))
+		return data;
+
 	u32 addr;
 	u32 tv = mmu_data_translation<MMU_TT_DREAD>(adr, addr);
 	if (tv == 0)
@@ -576,6 +754,10 @@ u16 DYNACALL mmu_IReadMem16(u32 adr)
 		mmu_raise_exeption(MMU_ERROR_BADADDR, adr, MMU_TT_IREAD);
 		return 0;
 	}
+	u16 data;
+	if (mmu_cached_read<MMU_TT_IREAD>(adr, data))
+		return data;
+
 	u32 addr;
 	u32 tv = mmu_instruction_translation(adr, addr);
 	if (tv == 0)
@@ -593,6 +775,10 @@ u32 DYNACALL mmu_ReadMem32(u32 adr)
 		mmu_raise_exeption(MMU_ERROR_BADADDR, adr, MMU_TT_DREAD);
 		return 0;
 	}
+	u32 data;
+	if (mmu_cached_read<MMU_TT_DREAD>(adr, data))
+		return data;
+
 	u32 addr;
 	u32 tv = mmu_data_translation<MMU_TT_DREAD>(adr, addr);
 	if (tv == 0)
@@ -609,6 +795,10 @@ u64 DYNACALL mmu_ReadMem64(u32 adr)
 		mmu_raise_exeption(MMU_ERROR_BADADDR, adr, MMU_TT_DREAD);
 		return 0;
 	}
+	u64 data;
+	if (mmu_cached_read<MMU_TT_DREAD>(adr, data))
+		return data;
+
 	u32 addr;
 	u32 tv = mmu_data_translation<MMU_TT_DREAD>(adr, addr);
 	if (tv == 0)
@@ -623,6 +813,9 @@ u64 DYNACALL mmu_ReadMem64(u32 adr)
 
 void DYNACALL mmu_WriteMem8(u32 adr, u8 data)
 {
+	if (mmu_cached_write(adr, data))
+		return;
+
 	u32 addr;
 	u32 tv = mmu_data_translation<MMU_TT_DWRITE>(adr, addr);
 	if (tv == 0)
@@ -641,6 +834,9 @@ void DYNACALL mmu_WriteMem16(u32 adr, u16 data)
 		mmu_raise_exeption(MMU_ERROR_BADADDR, adr, MMU_TT_DWRITE);
 		return;
 	}
+	if (mmu_cached_write(adr, data))
+		return;
+
 	u32 addr;
 	u32 tv = mmu_data_translation<MMU_TT_DWRITE>(adr, addr);
 	if (tv == 0)
@@ -658,6 +854,9 @@ void DYNACALL mmu_WriteMem32(u32 adr, u32 data)
 		mmu_raise_exeption(MMU_ERROR_BADADDR, adr, MMU_TT_DWRITE);
 		return;
 	}
+	if (mmu_cached_write(adr, data))
+		return;
+
 	u32 addr;
 	u32 tv = mmu_data_translation<MMU_TT_DWRITE>(adr, addr);
 	if (tv == 0)
@@ -675,6 +874,9 @@ void DYNACALL mmu_WriteMem64(u32 adr, u64 data)
 		mmu_raise_exeption(MMU_ERROR_BADADDR, adr, MMU_TT_DWRITE);
 		return;
 	}
+	if (mmu_cached_write(adr, data))
+		return;
+
 	u32 addr;
 	u32 tv = mmu_data_translation<MMU_TT_DWRITE>(adr, addr);
 	if (tv == 0)
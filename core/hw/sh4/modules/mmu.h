@@ -36,4 +36,7 @@ bool mmu_match(u32 va, CCN_PTEH_type Address, CCN_PTEL_type Data);
 	void DYNACALL mmu_WriteMem64(u32 addr, u64 data);
 	
 	bool mmu_TranslateSQW(u32 addr, u32* mapped);
+
+	//drops the software TLB, UTLB_Sync/ITLB_Sync drop the pages of their entry
+	void mmu_flush_tlb_cache();
 #endif
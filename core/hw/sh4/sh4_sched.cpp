@@ -3,6 +3,7 @@
 #include "sh4_interrupts.h"
 #include "sh4_core.h"
 #include "sh4_sched.h"
+#include "serialize.h"
 
 
 //sh4 scheduler
@@ -23,58 +24,159 @@
 u64 sh4_sched_ffb;
 u32 sh4_sched_intr;
 
+#define SCHED_IDLE ((u64)-1)
+
+//savestates keep room for this many events, so their size is known before anything registers
+#define SCHED_STATE_EVENTS 16
+
 struct sched_list
 {
 	sh4_sched_callback* cb;
+	const char* name;
 	int tag;
-	int start;
-	int end;
+	u64 start;
+	u64 end;       //SCHED_IDLE when not scheduled
+	int heap_pos;  //index in sched_heap, -1 when not scheduled
+
+	u32 requests;
+	u32 fired;
 };
 
 vector<sched_list> list;
 
+/*
+	Binary min-heap of the scheduled ids, ordered by end time. Ids know their position
+	in the heap, so rescheduling/cancelling an id is O(log n) and the next event is
+	always at the top. The end time is kept in the heap too, so sifting doesn't have
+	to look at the list
+*/
+struct sched_entry
+{
+	u64 end;
+	int id;
+};
+
+static vector<sched_entry> sched_heap;
+static vector<int> sched_due;
+
 int sh4_sched_next_id=-1;
 
-u32 sh4_sched_remaining(int id, u32 reference)
+//ties are broken by id, so the firing order doesn't depend on the heap layout (savestates rebuild it)
+static bool sched_before(const sched_entry& a, const sched_entry& b)
 {
-	if (list[id].end != -1)
-      return list[id].end - reference;
-   return -1;
+	return a.end < b.end || (a.end == b.end && a.id < b.id);
 }
 
-u32 sh4_sched_remaining(int id)
+static void sched_place(int pos, const sched_entry& e)
 {
-	return sh4_sched_remaining(id, sh4_sched_now());
+	sched_heap[pos]=e;
+	list[e.id].heap_pos=pos;
 }
 
-void sh4_sched_ffts(void)
+static void sched_sift_up(int pos)
 {
-	u32 diff=-1;
-	int slot=-1;
+	sched_entry e=sched_heap[pos];
 
-	for (size_t i=0;i<list.size();i++)
+	while (pos>0)
 	{
-		if (sh4_sched_remaining(i)<diff)
-		{
-			slot=i;
-			diff=sh4_sched_remaining(i);
-		}
+		int parent=(pos-1)/2;
+		if (!sched_before(e,sched_heap[parent]))
+			break;
+
+		sched_place(pos,sched_heap[parent]);
+		pos=parent;
 	}
 
+	sched_place(pos,e);
+}
+
+static void sched_sift_down(int pos)
+{
+	sched_entry e=sched_heap[pos];
+	int count=sched_heap.size();
+
+	for (;;)
+	{
+		int child=pos*2+1;
+		if (child>=count)
+			break;
+
+		if (child+1<count && sched_before(sched_heap[child+1],sched_heap[child]))
+			child++;
+
+		if (!sched_before(sched_heap[child],e))
+			break;
+
+		sched_place(pos,sched_heap[child]);
+		pos=child;
+	}
+
+	sched_place(pos,e);
+}
+
+static void sched_remove(int id)
+{
+	int pos=list[id].heap_pos;
+	if (pos==-1)
+		return;
+
+	list[id].heap_pos=-1;
+
+	sched_entry last=sched_heap.back();
+	sched_heap.pop_back();
+
+	if (last.id!=id)
+	{
+		sched_place(pos,last);
+		sched_sift_up(pos);
+		sched_sift_down(list[last.id].heap_pos);
+	}
+}
+
+//list[id].end has to be set, the id is inserted or moved to its new place
+static void sched_update(int id)
+{
+	int pos=list[id].heap_pos;
+
+	if (pos==-1)
+	{
+		sched_entry e={list[id].end,id};
+		sched_heap.push_back(e);
+		pos=sched_heap.size()-1;
+		sched_place(pos,e);
+	}
+	else
+		sched_heap[pos].end=list[id].end;
+
+	//it can only move one way
+	sched_sift_up(pos);
+	sched_sift_down(list[id].heap_pos);
+}
+
+void sh4_sched_ffts(void)
+{
 	sh4_sched_ffb-=Sh4cntx.sh4_sched_next;
 
-	sh4_sched_next_id=slot;
-   if (slot!=-1)
-      Sh4cntx.sh4_sched_next=diff;
-   else
-      Sh4cntx.sh4_sched_next=SH4_MAIN_CLOCK;
+	u64 now=sh4_sched_ffb;
+
+	if (sched_heap.empty())
+	{
+		sh4_sched_next_id=-1;
+		Sh4cntx.sh4_sched_next=SH4_MAIN_CLOCK;
+	}
+	else
+	{
+		sh4_sched_next_id=sched_heap[0].id;
+		u64 end=sched_heap[0].end;
+		Sh4cntx.sh4_sched_next=end>now ? min(end-now,(u64)SH4_MAIN_CLOCK) : 0;
+	}
 
 	sh4_sched_ffb+=Sh4cntx.sh4_sched_next;
 }
 
-int sh4_sched_register(int tag, sh4_sched_callback* ssc)
+int sh4_sched_register(int tag, sh4_sched_callback* ssc, const char* name)
 {
-	sched_list t={ssc,tag,-1,-1};
+	sched_list t={ssc,name,tag,0,SCHED_IDLE,-1,0,0};
 
 	list.push_back(t);
 
@@ -96,41 +198,40 @@ u64 sh4_sched_now64(void)
 {
 	return sh4_sched_ffb-Sh4cntx.sh4_sched_next;
 }
+
 void sh4_sched_request(int id, int cycles)
 {
 	verify(cycles== -1 || (cycles >= 0 && cycles <= SH4_MAIN_CLOCK));
 
-	list[id].start = sh4_sched_now();
-   list[id].end   = -1;
+	list[id].requests++;
+	list[id].start = sh4_sched_now64();
 
 	if (cycles != -1)
 	{
 		list[id].end = list[id].start + cycles;
-		if (list[id].end == -1)
-			list[id].end++;
+		sched_update(id);
+	}
+	else
+	{
+		sched_remove(id);
+		list[id].end = SCHED_IDLE;
 	}
 
 	sh4_sched_ffts();
 }
 
-/* Returns how much time has passed for this callback */
-static int sh4_sched_elapsed(int id)
-{
-   if (list[id].end == -1)
-      return -1;
-
-   int rv=sh4_sched_now()-list[id].start;
-   list[id].start=sh4_sched_now();
-   return rv;
-}
-
 static void handle_cb(int id)
 {
+	u64 now=sh4_sched_now64();
+
 	int remain=list[id].end-list[id].start;
-	int elapsd=sh4_sched_elapsed(id);
-	int jitter=elapsd-remain;
+	int jitter=now-list[id].end;
+
+	sched_remove(id);
+	list[id].start=now;
+	list[id].end=SCHED_IDLE;
+	list[id].fired++;
 
-	list[id].end=-1;
 	int re_sch=list[id].cb(list[id].tag,remain,jitter);
 
 	if (re_sch>0)	sh4_sched_request(id,re_sch-jitter);
@@ -138,26 +239,81 @@ static void handle_cb(int id)
 
 void sh4_sched_tick(int cycles)
 {
-	/*
-	Sh4cntx.sh4_sched_time+=cycles;
-	Sh4cntx.sh4_sched_next-=cycles;
-	*/
-
 	if (Sh4cntx.sh4_sched_next<0)
 	{
-		u32 fztime=sh4_sched_now()-cycles;
+		u64 now=sh4_sched_now64();
 		sh4_sched_intr++;
-		if (sh4_sched_next_id!=-1)
+
+		//everything that is due is taken off first, so callbacks that reschedule
+		//themselves within this slice run on the next one
+		sched_due.clear();
+		while (!sched_heap.empty() && sched_heap[0].end<=now)
 		{
-         unsigned i;
-			for (i=0;i<list.size();i++)
-			{
-				int remaining = sh4_sched_remaining(i, fztime);
-				verify(remaining >= 0 || remaining == -1);
-				if (remaining >= 0 && remaining <= (u32)cycles)
-					handle_cb(i);
-			}
+			sched_due.push_back(sched_heap[0].id);
+			sched_remove(sched_heap[0].id);
 		}
+
+		for (size_t i=0;i<sched_due.size();i++)
+		{
+			int id=sched_due[i];
+
+			//rescheduled or cancelled by one of the callbacks before it
+			if (list[id].heap_pos==-1 && list[id].end!=SCHED_IDLE)
+				handle_cb(id);
+		}
+
 		sh4_sched_ffts();
 	}
 }
+
+//number of times each callback was requested and fired since the last call
+void sh4_sched_print_stats(void)
+{
+	for (size_t i=0;i<list.size();i++)
+	{
+		printf("sched: %-12s %d: %6d requests, %6d fired\n",
+			list[i].name?list[i].name:"?",list[i].tag,list[i].requests,list[i].fired);
+
+		list[i].requests=0;
+		list[i].fired=0;
+	}
+}
+
+/*
+	The callbacks are registered in the same order on every boot, so only the
+	timing of each slot is part of the state
+*/
+void sh4_sched_serialize(dc_state& st)
+{
+	st(sh4_sched_ffb);
+	st(sh4_sched_intr);
+	st(sh4_sched_next_id);
+
+	u32 count=list.size();
+	st(count);
+
+	if (count!=list.size() || count>SCHED_STATE_EVENTS)
+	{
+		st.failed=true;
+		return;
+	}
+
+	if (st.load)
+	{
+		for (size_t i=0;i<list.size();i++)
+			list[i].heap_pos=-1;
+		sched_heap.clear();
+	}
+
+	for (size_t i=0;i<list.size();i++)
+	{
+		st(list[i].tag);
+		st(list[i].start);
+		st(list[i].end);
+
+		if (st.load && list[i].end!=SCHED_IDLE)
+			sched_update(i);
+	}
+
+	st.skip((SCHED_STATE_EVENTS-list.size())*(sizeof(int)+sizeof(u64)*2));
+}
@@ -9,9 +9,10 @@ typedef int sh4_sched_callback(int tag, int sch_cycl, int jitter);
 
 /*
 	Registed a callback to the scheduler. The returned id 
-	is used for sh4_sched_request and sh4_sched_elapsed calls
+	is used for sh4_sched_request and sh4_sched_elapsed calls.
+	name is only used for the stats
 */
-int sh4_sched_register(int tag, sh4_sched_callback* ssc);
+int sh4_sched_register(int tag, sh4_sched_callback* ssc, const char* name=0);
 
 /*
 	current time in SH4 cycles, referenced to boot.
@@ -29,8 +30,9 @@ u64 sh4_sched_now64();
 	Schedule a callback to be called sh4 *cycles* after the
 	invocation of this function. *Cycles* range is (0, 200M].
 	
-	Passing a value of 0 disables the callback.
-	If called multiple times, only the last call is in effect
+	Passing a value of -1 disables the callback.
+	If called multiple times, only the last call is in effect.
+	O(log n) on the number of registered callbacks
 */
 void sh4_sched_request(int id, int cycles);
 
@@ -39,4 +41,13 @@ void sh4_sched_request(int id, int cycles);
 */
 void sh4_sched_tick(int cycles);
 
+/*
+	Prints and resets the number of requests and callbacks per registered id
+*/
+void sh4_sched_print_stats();
+
 extern u32 sh4_sched_intr;
+
+struct dc_state;
+//streams the scheduler state, see serialize.h
+void sh4_sched_serialize(dc_state& st);
@@ -2,32 +2,237 @@
 
 #include "deps/chdr/chd.h"
 
+/*
+	Hunk cache
+
+	Sectors are compressed a hunk (usually 8 sectors) at a time, so reading a sector means
+	decompressing its whole hunk. The last few hunks are kept, least recently used goes
+	first, so sequential reads and the seeks back and forth between two files that FMVs
+	do (video & audio streams) don't decompress the same hunks again.
+
+	With threads, a prefetch thread decompresses the hunks that follow the one just read
+	while the gdrom dma drains the read buffer. chd_read isn't thread safe, chd_lock is
+	held around it. cache_lock only protects the slots and is never held while
+	decompressing, so reading a cached hunk doesn't wait on the prefetch thread.
+	Lock order is chd_lock, then cache_lock.
+*/
+#define CHD_CACHE_MAX      64
+#define CHD_PREFETCH_HUNKS 2
+
+struct chd_hunk_slot
+{
+	u32 hunk;        //0xFFFFFFFF when empty, or while being filled
+	u32 last_used;
+	u8* mem;
+};
+
 struct CHDDisc : Disc
 {
 	chd_file* chd;
-	u8* hunk_mem;
-	u32 old_hunk;
 
 	u32 hunkbytes;
+	u32 hunkcount;
 	u32 sph;
-	
+
+	chd_hunk_slot cache[CHD_CACHE_MAX];
+	u32 cache_size;
+	u32 cache_clock;
+
+	u32 hits;        //hunks found in the cache
+	u32 misses;      //hunks the reader had to decompress, or wait for
+	u32 prefetched;  //hunks decompressed by the prefetch thread
+
+	cMutex chd_lock;
+	cMutex cache_lock;
+
+#if !defined(TARGET_NO_THREADS)
+	cThread* prefetch_thread;
+	cResetEvent prefetch_event;
+	u32 prefetch_hunk;
+	bool prefetch_quit;
+#endif
+
 	CHDDisc()
+#if !defined(TARGET_NO_THREADS)
+		: prefetch_event(false,true)
+#endif
 	{
 		chd=0;
-		hunk_mem=0;
+		cache_size=0;
+		cache_clock=0;
+		hits=misses=prefetched=0;
+#if !defined(TARGET_NO_THREADS)
+		prefetch_thread=0;
+		prefetch_hunk=0;
+		prefetch_quit=false;
+#endif
 	}
 
 	bool TryOpen(const wchar* file);
+	void ReadHunk(u32 hunk,u32 offset,u8* dst,u32 len);
 
-	~CHDDisc() 
-	{ 
-		if (hunk_mem)
-			delete [] hunk_mem;
+	chd_hunk_slot* FindHunk(u32 hunk);
+	chd_hunk_slot* LoadHunk(u32 hunk);
+	void Prefetch(u32 hunk);
+	void PrefetchHunks();
+
+	~CHDDisc()
+	{
+#if !defined(TARGET_NO_THREADS)
+		if (prefetch_thread)
+		{
+			cache_lock.Lock();
+			prefetch_quit=true;
+			cache_lock.Unlock();
+
+			prefetch_event.Set();
+			prefetch_thread->WaitToEnd();
+			delete prefetch_thread;
+		}
+#endif
+
+#ifndef NDEBUG
+		if (cache_size)
+			printf("chd: %d hits, %d misses, %d hunks prefetched\n",hits,misses,prefetched);
+#endif
+
+		for (u32 i=0;i<cache_size;i++)
+			delete [] cache[i].mem;
 		if (chd)
 			chd_close(chd);
 	}
 };
 
+//cache_lock must be held
+chd_hunk_slot* CHDDisc::FindHunk(u32 hunk)
+{
+	for (u32 i=0;i<cache_size;i++)
+	{
+		if (cache[i].hunk==hunk)
+			return &cache[i];
+	}
+
+	return 0;
+}
+
+//decompresses a hunk that isn't cached over the least recently used one
+//chd_lock and cache_lock must be held, cache_lock is released while decompressing
+chd_hunk_slot* CHDDisc::LoadHunk(u32 hunk)
+{
+	chd_hunk_slot* slot=&cache[0];
+	for (u32 i=1;i<cache_size;i++)
+	{
+		if (cache[i].last_used<slot->last_used)
+			slot=&cache[i];
+	}
+
+	//nobody else fills slots without chd_lock, so the slot stays ours
+	slot->hunk=0xFFFFFFFF;
+	cache_lock.Unlock();
+
+	chd_error err=chd_read(chd,hunk,slot->mem);
+	if (err!=CHDERR_NONE)
+	{
+		printf("chd: failed to read hunk %d, %d\n",hunk,err);
+		memset(slot->mem,0,hunkbytes);
+	}
+
+	cache_lock.Lock();
+	slot->hunk=hunk;
+	slot->last_used=++cache_clock;
+
+	return slot;
+}
+
+void CHDDisc::ReadHunk(u32 hunk,u32 offset,u8* dst,u32 len)
+{
+	cache_lock.Lock();
+
+	chd_hunk_slot* slot=FindHunk(hunk);
+
+	if (slot)
+		hits++;
+	else
+	{
+		misses++;
+		cache_lock.Unlock();
+
+		//if the prefetch thread is decompressing this hunk, this waits for it
+		chd_lock.Lock();
+		cache_lock.Lock();
+
+		slot=FindHunk(hunk);
+		if (!slot)
+			slot=LoadHunk(hunk);
+
+		chd_lock.Unlock();
+	}
+
+	slot->last_used=++cache_clock;
+	memcpy(dst,slot->mem+offset,len);
+
+	cache_lock.Unlock();
+
+	Prefetch(hunk+1);
+}
+
+#if !defined(TARGET_NO_THREADS)
+static void* chd_prefetch_thread(void* param)
+{
+	CHDDisc* disc=(CHDDisc*)param;
+
+	for (;;)
+	{
+		disc->prefetch_event.Wait();
+
+		if (disc->prefetch_quit)
+			break;
+
+		disc->PrefetchHunks();
+	}
+
+	return 0;
+}
+#endif
+
+//queues up the hunks from hunk on for the prefetch thread
+void CHDDisc::Prefetch(u32 hunk)
+{
+#if !defined(TARGET_NO_THREADS)
+	if (!prefetch_thread)
+		return;
+
+	cache_lock.Lock();
+	prefetch_hunk=hunk;
+	cache_lock.Unlock();
+
+	prefetch_event.Set();
+#endif
+}
+
+void CHDDisc::PrefetchHunks()
+{
+#if !defined(TARGET_NO_THREADS)
+	for (u32 i=0;i<CHD_PREFETCH_HUNKS;i++)
+	{
+		chd_lock.Lock();
+		cache_lock.Lock();
+
+		//the reader might have moved on already, always follow the latest request
+		u32 hunk=prefetch_hunk+i;
+
+		if (!prefetch_quit && hunk<hunkcount && !FindHunk(hunk))
+		{
+			LoadHunk(hunk);
+			prefetched++;
+		}
+
+		cache_lock.Unlock();
+		chd_lock.Unlock();
+	}
+#endif
+}
+
 struct CHDTrack : TrackFile
 {
 	CHDDisc* disc;
@@ -47,14 +252,9 @@ struct CHDTrack : TrackFile
 	{
 		u32 fad_offs=FAD-StartFAD;
 		u32 hunk=(fad_offs)/disc->sph + StartHunk;
-		if (disc->old_hunk!=hunk)
-		{
-			chd_read(disc->chd,hunk,disc->hunk_mem); //CHDERR_NONE
-		}
-
 		u32 hunk_ofs=fad_offs%disc->sph;
 
-		memcpy(dst,disc->hunk_mem+hunk_ofs*(2352+96),fmt);
+		disc->ReadHunk(hunk,hunk_ofs*(2352+96),dst,fmt);
 		
 		*sector_type=fmt==2352?SECFMT_2352:SECFMT_2048_MODE1;
 		
@@ -76,8 +276,15 @@ bool CHDDisc::TryOpen(const wchar* file)
 	const chd_header* head = chd_get_header(chd);
 
 	hunkbytes = head->hunkbytes;
-	hunk_mem = new u8[hunkbytes];
-	old_hunk=0xFFFFFFF;
+	hunkcount = head->totalhunks;
+
+	cache_size = min(max(settings.imgread.ChdCacheHunks,1u),(u32)CHD_CACHE_MAX);
+	for (u32 i=0;i<cache_size;i++)
+	{
+		cache[i].hunk=0xFFFFFFFF;
+		cache[i].last_used=0;
+		cache[i].mem=new u8[hunkbytes];
+	}
 
 	sph = hunkbytes/(2352+96);
 
@@ -149,6 +356,15 @@ bool CHDDisc::TryOpen(const wchar* file)
 
 	FillGDSession();
 
+#if !defined(TARGET_NO_THREADS)
+	//the prefetched hunks shouldn't push out the one being read
+	if (cache_size>CHD_PREFETCH_HUNKS+1)
+	{
+		prefetch_thread=new cThread(chd_prefetch_thread,this);
+		prefetch_thread->Start();
+	}
+#endif
+
 	return true;
 }
 
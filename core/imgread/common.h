@@ -109,6 +109,8 @@ struct Session
 struct TrackFile
 {
 	virtual void Read(u32 FAD,u8* dst,SectorFormat* sector_type,u8* subcode,SubcodeFormat* subcode_type)=0;
+	//the sectors FAD..FAD+count-1 straight from the image, if it is memory mapped
+	virtual const u8* Map(u32 FAD,u32 count,SectorFormat* sector_type,u32* sector_size) { return 0; }
 	virtual ~TrackFile() {};
 };
 
@@ -148,18 +150,114 @@ struct Disc
 	Track LeadOut;				//info for lead out track (can't read from here)
 	u32 EndFAD;					//Last valid disc sector
 	DiscType type;
+	vector<u8> fad_track;		//track index+1 for each FAD, 0 if none. Built on the first read
 
 	//functions !
-	bool ReadSector(u32 FAD,u8* dst,SectorFormat* sector_type,u8* subcode,SubcodeFormat* subcode_type)
+
+	//the track FAD is read from, later tracks win where they overlap
+	Track* FindTrack(u32 FAD)
 	{
+		if (fad_track.empty())
+			BuildTrackLookup();
+
+		if (FAD<fad_track.size())
+			return fad_track[FAD]?&tracks[fad_track[FAD]-1]:0;
+
+		//past the last track end, only open ended tracks (EndFAD==0) get here
 		for (size_t i=tracks.size();i-->0;)
 		{
-			*subcode_type=SUBFMT_NONE;
-			if (tracks[i].Read(FAD,dst,sector_type,subcode,subcode_type))
-				return true;
+			if (tracks[i].file && FAD>=tracks[i].StartFAD && (FAD<=tracks[i].EndFAD || tracks[i].EndFAD==0))
+				return &tracks[i];
+		}
+
+		return 0;
+	}
+
+	void BuildTrackLookup()
+	{
+		verify(tracks.size()<255);
+
+		u32 size=1;
+		for (size_t i=0;i<tracks.size();i++)
+			size=max(size,max(tracks[i].StartFAD,tracks[i].EndFAD)+1);
+
+		fad_track.assign(size,0);
+
+		for (size_t i=0;i<tracks.size();i++)
+		{
+			if (!tracks[i].file)
+				continue;
+
+			u32 end=tracks[i].EndFAD==0?size-1:tracks[i].EndFAD;
+			for (u32 fad=tracks[i].StartFAD;fad<=end;fad++)
+				fad_track[fad]=i+1;
 		}
+	}
+
+	bool ReadSector(u32 FAD,u8* dst,SectorFormat* sector_type,u8* subcode,SubcodeFormat* subcode_type)
+	{
+		Track* track=FindTrack(FAD);
 
-		return false;
+		*subcode_type=SUBFMT_NONE;
+		return track && track->Read(FAD,dst,sector_type,subcode,subcode_type);
+	}
+
+	static void ConvertSectorFormat(const u8* src,SectorFormat secfmt,u8* dst,u32 fmt,u32 FAD)
+	{
+		//TODO: Proper sector conversions
+		if (secfmt==SECFMT_2352)
+		{
+			ConvertSector((u8*)src,dst,2352,fmt,FAD);
+		}
+		else if (fmt == 2048 && secfmt==SECFMT_2336_MODE2)
+			memcpy(dst,src+8,2048);
+		else if (fmt==2048 && (secfmt==SECFMT_2048_MODE1 || secfmt==SECFMT_2048_MODE2_FORM1 ))
+		{
+			memcpy(dst,src,2048);
+		}
+		else if (fmt==2352 && (secfmt==SECFMT_2048_MODE1 || secfmt==SECFMT_2048_MODE2_FORM1 ))
+		{
+			printf("GDR:fmt=2352;secfmt=2048\n");
+			memcpy(dst,src,2048);
+		}
+		else
+		{
+			printf("ERROR: UNABLE TO CONVERT SECTOR. THIS IS FATAL.");
+			//verify(false);
+		}
+	}
+
+	//copies the sectors of a memory mapped track, up to count. returns how many, 0 if it isn't mapped
+	u32 MapSectors(u32 FAD,u32 count,u8* dst,u32 fmt)
+	{
+		Track* track=FindTrack(FAD);
+
+		if (!track || !track->file)
+			return 0;
+
+		//up to where the next track takes over
+		u32 run=1;
+		while (run<count && FAD+run<fad_track.size() && fad_track[FAD+run]==fad_track[FAD])
+			run++;
+		count=run;
+
+		SectorFormat secfmt;
+		u32 size;
+		const u8* src=track->file->Map(FAD,count,&secfmt,&size);
+
+		if (!src)
+			return 0;
+
+		//the common case, same format on the disc and the read, is a single copy
+		if (size==fmt)
+			memcpy(dst,src,count*fmt);
+		else
+		{
+			for (u32 i=0;i<count;i++)
+				ConvertSectorFormat(src+i*size,secfmt,dst+i*fmt,fmt,FAD+i);
+		}
+
+		return count;
 	}
 
 	void ReadSectors(u32 FAD,u32 count,u8* dst,u32 fmt)
@@ -170,30 +268,17 @@ struct Disc
 
 		while(count)
 		{
-			if (ReadSector(FAD,temp,&secfmt,q_subchannel,&subfmt))
+			u32 mapped=MapSectors(FAD,count,dst,fmt);
+			if (mapped)
 			{
-				//TODO: Proper sector conversions
-				if (secfmt==SECFMT_2352)
-				{
-					ConvertSector(temp,dst,2352,fmt,FAD);
-				}
-				else if (fmt == 2048 && secfmt==SECFMT_2336_MODE2)
-					memcpy(dst,temp+8,2048);
-				else if (fmt==2048 && (secfmt==SECFMT_2048_MODE1 || secfmt==SECFMT_2048_MODE2_FORM1 ))
-				{
-					memcpy(dst,temp,2048);
-				}
-				else if (fmt==2352 && (secfmt==SECFMT_2048_MODE1 || secfmt==SECFMT_2048_MODE2_FORM1 ))
-				{
-					printf("GDR:fmt=2352;secfmt=2048\n");
-					memcpy(dst,temp,2048);
-				}
-				else
-				{
-					printf("ERROR: UNABLE TO CONVERT SECTOR. THIS IS FATAL.");
-					//verify(false);
-				}
+				dst+=mapped*fmt;
+				FAD+=mapped;
+				count-=mapped;
+				continue;
 			}
+
+			if (ReadSector(FAD,temp,&secfmt,q_subchannel,&subfmt))
+				ConvertSectorFormat(temp,secfmt,dst,fmt,FAD);
 			else
 			{
 				printf("Sector Read miss FAD: %d\n", FAD);
@@ -264,6 +349,10 @@ struct RawTrackFile : TrackFile
 	u32 fmt;
 	bool cleanup;
 
+	//the whole image file, mapped when possible so sectors can be copied out without any io calls
+	u8* map;
+	size_t map_size;
+
 	RawTrackFile(core_file* file,u32 file_offs,u32 first_fad,u32 secfmt)
 	{
 		verify(file!=0);
@@ -271,32 +360,52 @@ struct RawTrackFile : TrackFile
 		this->offset=file_offs-first_fad*secfmt;
 		this->fmt=secfmt;
 		this->cleanup=true;
+		this->map=(u8*)core_fmap(file,&map_size);
 	}
 
-	virtual void Read(u32 FAD,u8* dst,SectorFormat* sector_type,u8* subcode,SubcodeFormat* subcode_type)
+	SectorFormat Format()
 	{
 		//for now hackish
       switch (fmt)
       {
          case 2352:
-            *sector_type=SECFMT_2352;
-            break;
+            return SECFMT_2352;
          case 2048:
-            *sector_type=SECFMT_2048_MODE2_FORM1;
-            break;
+            return SECFMT_2048_MODE2_FORM1;
          case 2336:
-            *sector_type=SECFMT_2336_MODE2;
-            break;
+            return SECFMT_2336_MODE2;
          default:
             verify(false);
-            break;
+            return SECFMT_2352;
       }
+	}
+
+	virtual void Read(u32 FAD,u8* dst,SectorFormat* sector_type,u8* subcode,SubcodeFormat* subcode_type)
+	{
+		*sector_type=Format();
 
 		core_fseek(file,offset+FAD*fmt,SEEK_SET);
 		core_fread(file, dst, fmt);
 	}
+
+	virtual const u8* Map(u32 FAD,u32 count,SectorFormat* sector_type,u32* sector_size)
+	{
+		s64 start=offset+(s64)FAD*fmt;
+
+		//reads past the end of the file go through Read, as before
+		if (!map || start<0 || start+(s64)count*fmt>(s64)map_size)
+			return 0;
+
+		*sector_type=Format();
+		*sector_size=fmt;
+
+		return map+start;
+	}
+
 	virtual ~RawTrackFile()
 	{
+		if (map)
+			core_funmap(map,map_size);
 		if (cleanup && file)
 			core_fclose(file);
 	}
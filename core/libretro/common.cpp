@@ -78,6 +78,14 @@ int protect_pages(void *ptr, size_t size, enum page_access access)
 #endif
 }
 
+double os_GetSeconds(void)
+{
+	timeval a;
+	gettimeofday(&a,0);
+	static u64 tvs_base=a.tv_sec;
+	return a.tv_sec-tvs_base+a.tv_usec/1000000.0;
+}
+
 void os_MakeExecutable(void* ptr, u32 sz)
 {
    protect_pages(ptr, sz, ACC_READWRITEEXEC);
@@ -126,6 +134,9 @@ static LONG ExceptionHandler(EXCEPTION_POINTERS *ExceptionInfo)
       ep->ContextRecord->Ecx=ep->ContextRecord->Eax;
       return EXCEPTION_CONTINUE_EXECUTION;
    }
+#elif FEAT_SHREC == DYNAREC_JIT && HOST_CPU == CPU_X64
+   if (ngen_Rewrite((size_t&)ep->ContextRecord->Rip, 0, (size_t)address))
+      return EXCEPTION_CONTINUE_EXECUTION;
 #endif
    else
    {
@@ -381,7 +392,11 @@ printf("mprot hit @ ptr 0x%08X @@ code: %08X, %d\n", ctx.pc, dyna_cde);
       context_to_segfault(&ctx, segfault_ctx);
    }
 #elif HOST_CPU == CPU_X64
-   //x64 has no rewrite support
+   if (dyna_cde && ngen_Rewrite((size_t&)ctx.pc, 0, (size_t)si->si_addr))
+   {
+      //the site now calls the slow path, run it again from its start
+      context_to_segfault(&ctx, segfault_ctx);
+   }
 #else
 #error JIT: Not supported arch
 #endif
@@ -482,7 +497,7 @@ cThread::cThread(ThreadEntryFP* function,void* prm)
 
 void cThread::Start()
 {
-   hThread = sthread_create(Entry, 0);
+   hThread = sthread_create(Entry, param);
 }
 
 void cThread::WaitToEnd()
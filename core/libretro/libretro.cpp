@@ -10,6 +10,10 @@
 #include <glsm/glsm.h>
 #endif
 #include "../rend/rend.h"
+#include "../hw/sh4/dyna/ssa.h"
+#include "../serialize.h"
+#include "../hw/maple/maple_cfg.h"
+#include "../hw/aica/sgc_if.h"
 
 #include "libretro.h"
 
@@ -43,6 +47,13 @@ bool enable_purupuru = true;
 bool inside_loop     = true;
 static bool first_run = true;
 
+//dc_init sets up the renderer, it has to wait for the context on the gl builds
+#if defined(HAVE_OPENGL) || defined(HAVE_OPENGLES)
+static bool context_ready = false;
+#else
+static bool context_ready = true;
+#endif
+
 enum DreamcastController
 {
    DC_BTN_C       = 1,
@@ -176,6 +187,43 @@ void retro_set_environment(retro_environment_t cb)
 #endif
             ,
       },
+#endif
+      {
+         "reicast_dynarec_block_cache",
+         "Dynarec block cache; disabled|enabled|validate",
+      },
+      {
+         "reicast_dynarec_optimizer",
+         "Dynarec optimizer; enabled|disabled|validate|no constant propagation|no SR.T elimination|no dead code elimination",
+      },
+      {
+         "reicast_dynarec_superblocks",
+         "Dynarec superblocks; enabled|disabled",
+      },
+#if FEAT_AREC == DYNAREC_JIT && HOST_CPU == CPU_X64
+      {
+         "reicast_arm7_recompiler",
+         "ARM7 recompiler; enabled|disabled|validate",
+      },
+#endif
+#if FEAT_DSPREC == DYNAREC_JIT
+      {
+         "reicast_enable_dsp",
+         "Enable AICA DSP; enabled|disabled",
+      },
+      {
+         "reicast_dsp_recompiler",
+#ifndef NDEBUG
+         "AICA DSP recompiler; enabled|disabled|validate",
+#else
+         "AICA DSP recompiler; enabled|disabled",
+#endif
+      },
+#else
+      {
+         "reicast_enable_dsp",
+         "Enable AICA DSP; disabled|enabled",
+      },
 #endif
       {
          "reicast_boot_to_bios",
@@ -265,6 +313,24 @@ void retro_set_environment(retro_environment_t cb)
          "reicast_allow_service_buttons",
          "Allow Naomi service buttons; disabled|enabled"
       },
+      {
+         "reicast_runahead",
+         "Run-ahead frames; disabled|1|2|3|4"
+      },
+      {
+         "reicast_chd_cache_size",
+         "CHD hunk cache (restart); 16|4|8|32|64"
+      },
+#if !defined(TARGET_NO_THREADS)
+      {
+         "reicast_render_queue_depth",
+         "Render queue depth; 1|2|3|4"
+      },
+      {
+         "reicast_render_queue_policy",
+         "Render queue full; drop frame|wait for renderer"
+      },
+#endif
       { NULL, NULL },
    };
 
@@ -306,6 +372,68 @@ void retro_deinit(void)
 
 static bool is_dupe = false;
 extern int GDROM_TICK;
+static double retro_fps(void);
+//fps reported in retro_get_system_av_info, the frontend paces the audio with it
+static double av_info_fps = 60.00;
+
+/*
+	Run-ahead: the frame is emulated as usual and snapshotted, then runahead_frames
+	more frames are emulated with the same input and no audio, and the last one is
+	shown. The machine is rolled back to the snapshot afterwards, so the frames that
+	are shown react to the input runahead_frames earlier.
+	The snapshot and the rollback each compare all of ram, vram and aram with the state
+	(see serialize.cpp), which costs a few ms per frame on top of the frames run.
+*/
+static unsigned runahead_frames = 0;
+static void* runahead_state = NULL;
+static u32 runahead_state_size = 0;
+
+static void runahead_term(void)
+{
+   if (runahead_state)
+      free(runahead_state);
+   runahead_state = NULL;
+   runahead_state_size = 0;
+}
+
+static void runahead_run_frame(bool audio)
+{
+   audio_Discard(!audio);
+
+   dc_run();
+   inside_loop = true;
+
+   audio_Discard(false);
+}
+
+static bool runahead_run(void)
+{
+   if (!runahead_state)
+   {
+      runahead_state_size = dc_serialize_size();
+      runahead_state = calloc(1, runahead_state_size);
+      if (!runahead_state)
+         return false;
+   }
+
+   runahead_run_frame(true);
+
+   if (!dc_serialize(runahead_state, runahead_state_size))
+   {
+      if (log_cb)
+         log_cb(RETRO_LOG_WARN, "runahead: failed to save the state, disabling run-ahead\n");
+      runahead_frames = 0;
+      runahead_term();
+      return true;
+   }
+
+   for (unsigned i = 0; i < runahead_frames; i++)
+      runahead_run_frame(false);
+
+   dc_unserialize(runahead_state, runahead_state_size);
+
+   return true;
+}
 
 static void update_variables(bool first_startup)
 {
@@ -368,6 +496,77 @@ static void update_variables(bool first_startup)
          settings.dynarec.Type = 1;
    }
 
+   var.key = "reicast_dynarec_block_cache";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "enabled"))
+         settings.dynarec.BlockCache = 1;
+      else if (!strcmp(var.value, "validate"))
+         settings.dynarec.BlockCache = 2;
+      else
+         settings.dynarec.BlockCache = 0;
+   }
+   else
+      settings.dynarec.BlockCache = 0;
+
+   var.key = "reicast_dynarec_optimizer";
+
+   settings.dynarec.OptPasses = SSA_AllPasses;
+   settings.dynarec.OptValidate = false;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "disabled"))
+         settings.dynarec.OptPasses = 0;
+      else if (!strcmp(var.value, "validate"))
+         settings.dynarec.OptValidate = true;
+      else if (!strcmp(var.value, "no constant propagation"))
+         settings.dynarec.OptPasses &= ~SSA_ConstProp;
+      else if (!strcmp(var.value, "no SR.T elimination"))
+         settings.dynarec.OptPasses &= ~SSA_SRT;
+      else if (!strcmp(var.value, "no dead code elimination"))
+         settings.dynarec.OptPasses &= ~SSA_DeadCode;
+   }
+
+   var.key = "reicast_dynarec_superblocks";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      settings.dynarec.Superblocks = !strcmp(var.value, "enabled");
+   else
+      settings.dynarec.Superblocks = true;
+
+   var.key = "reicast_arm7_recompiler";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "disabled"))
+         settings.aica.ArmRec = 0;
+      else if (!strcmp(var.value, "validate"))
+         settings.aica.ArmRec = 2;
+      else
+         settings.aica.ArmRec = 1;
+   }
+   else
+      settings.aica.ArmRec = 1;
+
+   var.key = "reicast_enable_dsp";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      settings.aica.DSPEnabled = !strcmp(var.value, "enabled");
+
+   var.key = "reicast_dsp_recompiler";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "disabled"))
+         settings.aica.DSPRec = 0;
+      else if (!strcmp(var.value, "validate"))
+         settings.aica.DSPRec = 2;
+      else
+         settings.aica.DSPRec = 1;
+   }
+
    var.key = "reicast_boot_to_bios";
 
    if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
@@ -596,6 +795,46 @@ static void update_variables(bool first_startup)
    }
    else
       allow_service_buttons = false;
+
+   var.key = "reicast_runahead";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value && strcmp("disabled", var.value))
+      runahead_frames = atoi(var.value);
+   else
+      runahead_frames = 0;
+
+   var.key = "reicast_chd_cache_size";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      settings.imgread.ChdCacheHunks = atoi(var.value);
+   else
+      settings.imgread.ChdCacheHunks = 16;
+
+#if !defined(TARGET_NO_THREADS)
+   var.key = "reicast_render_queue_depth";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      settings.pvr.RenderQueueDepth = atoi(var.value);
+   else
+      settings.pvr.RenderQueueDepth = 1;
+
+   var.key = "reicast_render_queue_policy";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value && !strcmp("wait for renderer", var.value))
+      settings.pvr.RenderQueuePolicy = RQP_Throughput;
+   else
+      settings.pvr.RenderQueuePolicy = RQP_Latency;
+#endif
+}
+
+//dc_init is left for the first frame, or the first savestate if that comes earlier
+static void dc_start(void)
+{
+   if (!first_run)
+      return;
+
+   dc_init(co_argc,co_argv);
+   first_run = false;
 }
 
 void retro_run (void)
@@ -606,13 +845,14 @@ void retro_run (void)
 
    if (first_run)
    {
-      dc_init(co_argc,co_argv);
+      dc_start();
       dc_run();
-      first_run = false;
       return;
    }
 
-   dc_run();
+   if (!runahead_frames || !runahead_run())
+      dc_run();
+   audio_Output(av_info_fps);
 #if defined(HAVE_OPENGL) || defined(HAVE_OPENGLES)
    video_cb(is_dupe ? 0 : RETRO_HW_FRAME_BUFFER_VALID, screen_width, screen_height, 0);
 #endif
@@ -623,6 +863,7 @@ void retro_run (void)
 void retro_reset (void)
 {
    //TODO
+   runahead_term();
    dc_term();
    first_run = true;
    settings.dreamcast.cable = 3;
@@ -634,11 +875,13 @@ static void context_reset(void)
 {
    printf("context_reset.\n");
    glsm_ctl(GLSM_CTL_STATE_CONTEXT_RESET, NULL);
+   context_ready = true;
 }
 
 static void context_destroy(void)
 {
    glsm_ctl(GLSM_CTL_STATE_CONTEXT_DESTROY, NULL);
+   context_ready = false;
 }
 #endif
 
@@ -933,9 +1176,11 @@ void retro_unload_game(void)
       free(game_data);
    game_data = NULL;
 
+   runahead_term();
    rend_terminate();
    ngen_terminate();
    dc_term();
+   mcfg_DestroyDevices();
 }
 
 
@@ -950,19 +1195,29 @@ size_t retro_get_memory_size(unsigned type)
    return 0; //TODO
 }
 
+//the size is known once retro_load_game has set up the config, the states themselves
+//need the machine, which can only be started once the renderer has a context
 size_t retro_serialize_size (void)
 {
-   return 0; //TODO
+   return dc_serialize_size();
 }
 
 bool retro_serialize(void *data, size_t size)
 {
-   return false; //TODO
+   if (first_run && !context_ready)
+      return false;
+
+   dc_start();
+   return dc_serialize(data, size);
 }
 
 bool retro_unserialize(const void * data, size_t size)
 {
-   return false; //TODO
+   if (first_run && !context_ready)
+      return false;
+
+   dc_start();
+   return dc_unserialize(data, size);
 }
 
 // Cheats
@@ -1000,37 +1255,39 @@ void retro_get_system_info(struct retro_system_info *info)
    info->block_extract = false;
 }
 
-void retro_get_system_av_info(struct retro_system_av_info *info)
+//refresh rate reported to the frontend
+static double retro_fps(void)
 {
    /*                        00=VGA    01=NTSC   10=PAL,   11=illegal/undocumented */
    const int spg_clks[4] = { 26944080, 13458568, 13462800, 26944080 };
    u32 pixel_clock= spg_clks[(SPG_CONTROL.full >> 6) & 3];
 
-   info->geometry.base_width   = screen_width;
-   info->geometry.base_height  = screen_height;
-   info->geometry.max_width    = screen_width;
-   info->geometry.max_height   = screen_height;
-   info->geometry.aspect_ratio = settings.rend.WideScreen ? (16.0 / 9.0) : (4.0 / 3.0);
-
    switch (pixel_clock)
    {
-      case 26944080:
-         info->timing.fps = 60.00; /* (VGA  480 @ 60.00) */
-         break;
       case 26917135:
-         info->timing.fps = 59.94; /* (NTSC 480 @ 59.94) */
-         break;
+         return 59.94; /* (NTSC 480 @ 59.94) */
       case 13462800:
-         info->timing.fps = 50.00; /* (PAL 240  @ 50.00) */
-         break;
+         return 50.00; /* (PAL 240  @ 50.00) */
       case 13458568:
-         info->timing.fps = 59.94; /* (NTSC 240 @ 59.94) */
-         break;
+         return 59.94; /* (NTSC 240 @ 59.94) */
       case 25925600:
-         info->timing.fps = 50.00; /* (PAL 480  @ 50.00) */
-         break;
+         return 50.00; /* (PAL 480  @ 50.00) */
+      case 26944080:
+      default:
+         return 60.00; /* (VGA  480 @ 60.00) */
    }
+}
+
+void retro_get_system_av_info(struct retro_system_av_info *info)
+{
+   info->geometry.base_width   = screen_width;
+   info->geometry.base_height  = screen_height;
+   info->geometry.max_width    = screen_width;
+   info->geometry.max_height   = screen_height;
+   info->geometry.aspect_ratio = settings.rend.WideScreen ? (16.0 / 9.0) : (4.0 / 3.0);
 
+   av_info_fps = retro_fps();
+   info->timing.fps = av_info_fps;
    info->timing.sample_rate = 44100.0;
 }
 
@@ -328,6 +328,10 @@ void dc_prepare_system(void)
    RAM_MASK         = (RAM_SIZE-1);
    ARAM_MASK        = (ARAM_SIZE-1);
    VRAM_MASK        = (VRAM_SIZE-1);
+
+   //the maple devices come from the config too, creating them here (they stay across
+   //resets) is what lets the savestate size be known before dc_init
+   mcfg_CreateDevices();
 }
 
 int dc_init(int argc,wchar* argv[])
@@ -381,8 +385,6 @@ int dc_init(int argc,wchar* argv[])
 	
 	mem_map_default();
 
-	mcfg_CreateDevices();
-
 	plugins_Reset(false);
 	mem_Reset(false);
 	
@@ -432,6 +434,13 @@ void LoadSettings(void)
 	settings.aica.NoBatch			= 0;
    settings.aica.NoSound			= 0;
    settings.aica.EGHack          = 0;
+   settings.aica.ArmRec          = 1;
+#if FEAT_DSPREC == DYNAREC_JIT
+   settings.aica.DSPEnabled      = 1;
+#else
+   settings.aica.DSPEnabled      = 0;
+#endif
+   settings.aica.DSPRec          = 1;
 	settings.pvr.subdivide_transp	= 0;
 	settings.pvr.ta_skip			   = 0;
 	settings.pvr.rend				   = 0;
@@ -453,6 +462,9 @@ void LoadSettings(void)
    settings.rend.ModifierVolumes        = true;
    settings.rend.TranslucentPolygonDepthMask = false;
 	settings.pvr.SynchronousRendering	 = 0;
+   settings.pvr.RenderQueueDepth       = 1;
+   settings.pvr.RenderQueuePolicy      = 0;
+   settings.imgread.ChdCacheHunks      = 16;
 
 	settings.debug.SerialConsole         = 0;
 
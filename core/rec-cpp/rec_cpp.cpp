@@ -1617,7 +1617,7 @@ BlockCompilercpp *compilercpp_data;
 
 void ngen_Compile_cpp(RuntimeBlockInfo* block, bool force_checks, bool reset, bool staging, bool optimise)
 {
-	verify(emit_FreeSpace() >= 16 * 1024);
+	verify(emit_FreeSpace() >= CODE_BLOCK_MAX);
 
 	compilercpp_data = new BlockCompilercpp();
 
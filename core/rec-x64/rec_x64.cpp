@@ -10,15 +10,26 @@
 #include "hw/sh4/sh4_core.h"
 #include "hw/sh4/dyna/ngen.h"
 #include "hw/sh4/sh4_mem.h"
+#include "hw/sh4/sh4_rom.h"
 #include "hw/sh4/dyna/regalloc.h"
+#include "hw/mem/_vmem.h"
+
+//a direct (fastmem) access of a block, offsets are from the start of its code
+struct FastmemSite
+{
+	u32 start;   //first byte of the sequence, the rewrite goes here
+	u32 fault;   //the instruction that accesses the memory
+	u8 size;     //bytes in the sequence
+	u8 thunk;    //index in mem_thunks
+};
 
 struct DynaRBI : RuntimeBlockInfo
 {
-   virtual u32 Relink() {
-      //verify(false);
-      return 0;
-   }
+   vector<FastmemSite> fastmem_sites;
+
+   virtual u32 Relink();
 
+   //blocks are compiled in place and never moved, the code isn't position independent
    virtual void Relocate(void* dst) {
       verify(false);
    }
@@ -28,33 +39,40 @@ extern int cycle_counter;
 unsigned int ngen_required = true;
 extern bool inside_loop;
 
-extern "C" {
-
-void ngen_FailedToFindBlock_internal(void)
+/*
+	The dispatcher and the stubs the blocks jump to, made by ngen_init_x64. The blocks run on the
+	dispatcher's frame: it saves all the callee saved registers, and the blocks are entered and left
+	with jumps, with rsp 16 byte aligned and the shadow space below it. So blocks don't need a
+	prologue, and a linked block jumps straight to the next one.
+	ngen_FailedToFindBlock is the first stub, bm fills the fpcb table with it before ngen_init runs
+*/
+static u8 DECL_ALIGN(4096) ngen_stubs[4096];
+
+void(*ngen_FailedToFindBlock)() = (void(*)())ngen_stubs;
+
+static void* dispatcher;        //ngen_mainloop
+static void* no_update;         //jumps to the block for next_pc
+static void* intc_sched;        //called from the block entry when the timeslice has run out, pc in call_regs[0]
+static void* hot_block;         //rdv_HotBlock, then dispatch. pc in call_regs[0]
+static void* block_check_fail;  //pc in call_regs[0]
+static void* link_generic;      //called from a block exit that isn't linked, eax is the pc for dynamic ones
+static void* link_cond_branch;
+static void* link_cond_next;
+
+//return stack cache, the calls push the pc they return to and its code, a ret that finds it there
+//doesn't need the lookup. The code is only used if no blocks were discarded since the push
+#define RET_CACHE_SIZE 16
+static struct
 {
-	rdv_FailedToFindBlock(Sh4cntx.pc);
-}
-
-};
-
-void(*ngen_FailedToFindBlock)() = &ngen_FailedToFindBlock_internal;
+	u32 pc;
+	u32 gen;    //bm_discard_gen
+	DynarecCodeEntryPtr code;
+} ret_cache[RET_CACHE_SIZE];
+static u32 ret_cache_idx;
 
 void ngen_mainloop(void* v_cntx)
 {
-	Sh4RCB* ctx = (Sh4RCB*)((u8*)v_cntx - sizeof(Sh4RCB));
-
-   do
-   {
-      cycle_counter = SH4_TIMESLICE;
-      do {
-         DynarecCodeEntryPtr rcb = bm_GetCode(ctx->cntx.pc);
-         rcb();
-      } while (cycle_counter > 0);
-
-      if (UpdateSystem()) {
-         rdv_DoInterrupts_pc(ctx->cntx.pc);
-      }
-   }while (inside_loop && ngen_required);
+	((void (*)())dispatcher)();
 }
 
 void ngen_terminate(void)
@@ -72,19 +90,236 @@ u32* GetRegPtr(u32 reg)
 	return Sh4_int_GetRegisterPtr((Sh4RegType)reg);
 }
 
-void ngen_blockcheckfail(u32 pc) {
+static DynarecCodeEntryPtr ngen_blockcheckfail(u32 pc) {
 	printf("X64 JIT: SMC invalidation at %08X\n", pc);
-	rdv_BlockCheckFail(pc);
+	return rdv_BlockCheckFail(pc);
 }
 
+//the timeslice ran out on the entry of the block at pc, before it runs. Returns 0 if the block can go
+//on, 1 to continue from next_pc (an interrupt was taken), 2 to leave the dispatcher
+static u32 ngen_IntcSched(u32 pc)
+{
+	cycle_counter += SH4_TIMESLICE;
+	next_pc = pc;
+
+	u32 rv = 0;
+	if (UpdateSystem()) {
+		rdv_DoInterrupts_pc(pc);
+		rv = 1;
+	}
+
+	if (!inside_loop || !ngen_required)
+		rv = 2;
+
+	return rv;
+}
+
+//jumps to the code for the pc in eax, through the fpcb table (see bm_GetCode)
+static void GenLookup(Xbyak::CodeGenerator& c)
+{
+	using namespace Xbyak::util;
+
+	c.mov(ecx, eax);
+	c.shr(ecx, 1);
+	c.and_(ecx, FPCB_MASK);
+	c.mov(rdx, (size_t)p_sh4rcb->fpcb);
+	c.jmp(qword[rdx + rcx * 8]);
+}
+
+//the dynamic exits take the same space with a linked block and with the lookup
+#define DYNAMIC_EXIT_SIZE 48
+
+//end of a block, from relink_offset. Relink() emits it again when the linked blocks change, the
+//versions for a block type must have the same size
+static void GenBlockExit(Xbyak::CodeGenerator& c, RuntimeBlockInfo* block)
+{
+	using namespace Xbyak::util;
+
+	size_t start = c.getSize();
+
+	switch (block->BlockType) {
+
+	case BET_StaticJump:
+	case BET_StaticCall:
+		if (block->pBranchBlock)
+			c.jmp((void*)block->pBranchBlock->code, Xbyak::CodeGenerator::T_NEAR);
+		else
+			c.call(link_generic);
+		break;
+
+	case BET_Cond_0:
+	case BET_Cond_1:
+		{
+			Xbyak::Label next;
+
+			if (block->has_jcond)
+				c.mov(rax, (size_t)&Sh4cntx.jdyn);
+			else
+				c.mov(rax, (size_t)&sr.T);
+
+			c.cmp(dword[rax], block->BlockType & 1);
+			c.jne(next, Xbyak::CodeGenerator::T_SHORT);
+
+			if (block->pBranchBlock)
+				c.jmp((void*)block->pBranchBlock->code, Xbyak::CodeGenerator::T_NEAR);
+			else
+				c.call(link_cond_branch);
+
+			c.L(next);
+
+			if (block->pNextBlock)
+				c.jmp((void*)block->pNextBlock->code, Xbyak::CodeGenerator::T_NEAR);
+			else
+				c.call(link_cond_next);
+		}
+		break;
+
+	case BET_DynamicJump:
+	case BET_DynamicCall:
+	case BET_DynamicRet:
+		c.mov(rax, (size_t)&Sh4cntx.jdyn);
+		c.mov(eax, dword[rax]);
+		c.mov(rdx, (size_t)&next_pc);
+		c.mov(dword[rdx], eax);
+
+		if (block->BlockType == BET_DynamicRet) {
+			//not linked, the ret cache (or the lookup) handles them
+			Xbyak::Label miss;
+
+			c.mov(rdx, (size_t)&ret_cache_idx);
+			c.mov(ecx, dword[rdx]);
+			c.mov(r8d, ecx);
+			c.shl(r8d, 4);
+			c.mov(r9, (size_t)ret_cache);
+			c.cmp(dword[r9 + r8], eax);
+			c.jne(miss, Xbyak::CodeGenerator::T_SHORT);
+			c.mov(r10, (size_t)&bm_discard_gen);
+			c.mov(r10d, dword[r10]);
+			c.cmp(dword[r9 + r8 + 4], r10d);
+			c.jne(miss, Xbyak::CodeGenerator::T_SHORT);
+			c.dec(ecx);
+			c.and_(ecx, RET_CACHE_SIZE - 1);
+			c.mov(dword[rdx], ecx);
+			c.jmp(qword[r9 + r8 + 8]);
+			c.L(miss);
+			GenLookup(c);
+		}
+		else {
+			//linked to the first target. If another one shows up, it goes to the lookup for good (relink_data)
+			if (block->relink_data == 0 && block->pBranchBlock) {
+				Xbyak::Label miss;
+
+				c.cmp(eax, block->pBranchBlock->addr);
+				c.jne(miss, Xbyak::CodeGenerator::T_SHORT);
+				c.jmp((void*)block->pBranchBlock->code, Xbyak::CodeGenerator::T_NEAR);
+				c.L(miss);
+				c.call(link_generic);
+			}
+			else if (block->relink_data == 0)
+				c.call(link_generic);
+			else
+				GenLookup(c);
+
+			verify(c.getSize() - start <= DYNAMIC_EXIT_SIZE);
+			c.nop(DYNAMIC_EXIT_SIZE - (c.getSize() - start));
+		}
+		break;
+
+	case BET_DynamicIntr:
+	case BET_StaticIntr:
+		if (block->BlockType == BET_DynamicIntr) {
+			c.mov(rax, (size_t)&Sh4cntx.jdyn);
+			c.mov(eax, dword[rax]);
+			c.mov(rdx, (size_t)&next_pc);
+			c.mov(dword[rdx], eax);
+		}
+		else {
+			c.mov(rax, (size_t)&next_pc);
+			c.mov(dword[rax], block->NextBlock);
+		}
+
+		c.call((void*)UpdateINTC);
+		c.jmp(no_update, Xbyak::CodeGenerator::T_NEAR);
+		break;
+
+	default:
+		die("Invalid block end type");
+	}
+}
+
+u32 DynaRBI::Relink()
+{
+	Xbyak::CodeGenerator c(host_code_size - relink_offset, (u8*)code + relink_offset);
+
+	GenBlockExit(c, this);
+	c.ready();
+
+	return c.getSize();
+}
+
+class BlockCompilerx64;
+
+/*
+	Slow paths of the fastmem accesses. A site that faults (mmio, or anything else that isn't
+	ram/vram/aram in the nvmem mapping) is rewritten to call one of these, so they take the same
+	registers as the fast path: address in call_regs[0], data in call_regs[1], result in ecx/rcx.
+	The block keeps sh4 registers in xmm8-15, the fast path doesn't save them so the thunk does.
+	[0][size] are the reads, [1][size] the writes, size is 1,2,4,8 bytes as 0..3
+*/
+static void* mem_thunks[2][4];
+
+static u32 fastmem_rewrites;
+
+//RegAlloc for the x64 host. The gprs it hands out are callee saved, so they survive the calls. The xmms
+//aren't (on linux), the live ones are written back before the calls and reloaded after them
+struct X64RegAlloc : RegAlloc<Xbyak::Operand::Code, s8>
+{
+	BlockCompilerx64* compiler;
+
+	u32 reads, writes;            //operands read/written from the host registers
+	u32 call_loads, call_stores;  //context loads/stores emitted around the calls
+
+	//the span holds the value of its register at the current op, before the op runs
+	bool IsLive(RegSpan* spn) {
+		return spn->contains(current_opid) && (spn->preload || spn->start < current_opid);
+	}
+
+	//the span was written before the current op. Not the same as writeback, a span that is
+	//overwritten later (killed) has none but its value can still differ from the context here
+	bool IsDirty(RegSpan* spn) {
+		for (size_t i = 0; i < spn->accesses.size(); i++) {
+			if (spn->accesses[i].pos < current_opid && (spn->accesses[i].am & AM_WRITE))
+				return true;
+		}
+		return false;
+	}
+
+	virtual void Preload(u32 reg, Xbyak::Operand::Code nreg);
+	virtual void Writeback(u32 reg, Xbyak::Operand::Code nreg);
+	virtual void Preload_FPU(u32 reg, s8 nreg);
+	virtual void Writeback_FPU(u32 reg, s8 nreg);
+};
+
+#ifdef _WIN32
+static const Xbyak::Operand::Code alloc_regs[] = { Xbyak::Operand::RBX, Xbyak::Operand::RBP, Xbyak::Operand::RSI, Xbyak::Operand::RDI,
+	Xbyak::Operand::R12, Xbyak::Operand::R13, Xbyak::Operand::R14, Xbyak::Operand::R15, (Xbyak::Operand::Code)-1 };
+#else
+static const Xbyak::Operand::Code alloc_regs[] = { Xbyak::Operand::RBX, Xbyak::Operand::RBP,
+	Xbyak::Operand::R12, Xbyak::Operand::R13, Xbyak::Operand::R14, Xbyak::Operand::R15, (Xbyak::Operand::Code)-1 };
+#endif
+//xmm0-5 are the scratch registers of the ops
+static const s8 xmm_alloc_regs[] = { 8, 9, 10, 11, 12, 13, 14, 15, -1 };
+
 class BlockCompilerx64 : public Xbyak::CodeGenerator{
 public:
 
+	X64RegAlloc regalloc;
+
 	vector<Xbyak::Reg32> call_regs;
 	vector<Xbyak::Reg64> call_regs64;
 	vector<Xbyak::Xmm> call_regsxmm;
 
-	BlockCompilerx64() : Xbyak::CodeGenerator(64 * 1024, emit_GetCCPtr()) {
+	BlockCompilerx64() : Xbyak::CodeGenerator(CODE_BLOCK_MAX, emit_GetCCPtr()) {
 #ifdef _WIN32
       call_regs.push_back(ecx);
       call_regs.push_back(edx);
@@ -111,12 +346,18 @@ public:
 		call_regsxmm.push_back(xmm1);
 		call_regsxmm.push_back(xmm2);
 		call_regsxmm.push_back(xmm3);
+
+		regalloc.compiler = this;
 	}
 
 #define sh_to_reg(prm, op, rd) \
          do {                          \
 			   if (prm.is_imm()) {			\
 				   op(rd, prm._imm);	      \
+            }                          \
+			   else if (regalloc.IsAllocAny(prm)) \
+            {                          \
+				   op(rd, MappedReg(prm, rd));	\
             }                          \
 			   else if (prm.is_reg())     \
             {							      \
@@ -130,7 +371,9 @@ public:
 
 #define sh_to_reg_noimm(prm, op, rd) \
    do {                                         \
-			if (prm.is_reg()) {							\
+			if (regalloc.IsAllocAny(prm))				\
+				op(rd, MappedReg(prm, rd));		\
+			else if (prm.is_reg()) {					\
 				mov(rax, (size_t)prm.reg_ptr());	\
 				op(rd, dword[rax]);				\
 				}                             \
@@ -141,22 +384,544 @@ public:
 
 #define reg_to_sh(prm, rs) \
    do { \
-   mov(rax, (size_t)prm.reg_ptr()); \
-   mov(dword[rax], rs); \
+   if (regalloc.IsAllocg(prm)) { \
+      regalloc.writes++; \
+      mov(Xbyak::Reg32(regalloc.mapg(prm)), rs); \
+   } \
+   else if (regalloc.IsAllocf(prm)) { \
+      regalloc.writes++; \
+      movd(Xbyak::Xmm(regalloc.mapf(prm)), rs); \
+   } \
+   else { \
+      mov(rax, (size_t)prm.reg_ptr()); \
+      mov(dword[rax], rs); \
+   } \
    } while (0)
 
 #define reg_to_sh_ss(prm, rs) \
    do { \
-   mov(rax, (size_t)prm.reg_ptr()); \
-   movss(dword[rax], rs); \
+   if (regalloc.IsAllocf(prm)) { \
+      regalloc.writes++; \
+      movaps(Xbyak::Xmm(regalloc.mapf(prm)), rs); \
+   } \
+   else if (regalloc.IsAllocg(prm)) { \
+      regalloc.writes++; \
+      movd(Xbyak::Reg32(regalloc.mapg(prm)), rs); \
+   } \
+   else { \
+      mov(rax, (size_t)prm.reg_ptr()); \
+      movss(dword[rax], rs); \
+   } \
    } while (0)
 
+	//host register of an allocated operand. If it is allocated to the other kind of register it's
+	//moved to eax/xmm5 first
+	Xbyak::Reg32 MappedReg(const shil_param& prm, const Xbyak::Reg32& rd) {
+		regalloc.reads++;
+		if (regalloc.IsAllocg(prm))
+			return Xbyak::Reg32(regalloc.mapg(prm));
+
+		movd(eax, Xbyak::Xmm(regalloc.mapf(prm)));
+		return eax;
+	}
+
+	Xbyak::Xmm MappedReg(const shil_param& prm, const Xbyak::Xmm& rd) {
+		regalloc.reads++;
+		if (regalloc.IsAllocf(prm))
+			return Xbyak::Xmm(regalloc.mapf(prm));
+
+		movd(xmm5, Xbyak::Reg32(regalloc.mapg(prm)));
+		return xmm5;
+	}
+
+	//part i of a 64 bit operand (the pairs are allocated as two singles)
+	static shil_param ParamPart(const shil_param& prm, u32 i) {
+		verify(prm.count() == 2);
+		shil_param rv = prm;
+		rv.type = FMT_F32;
+		rv._reg = (Sh4RegType)(prm._reg + i);
+		return rv;
+	}
+
+	//the allocated xmms are written back before the calls (the callee might look at the context too),
+	//and reloaded after them, the callee might have changed the context. r11 is free around calls
+	void FreezeXMM() {
+		for (size_t sid = 0; sid < regalloc.all_spans.size(); sid++) {
+			X64RegAlloc::RegSpan* spn = regalloc.all_spans[sid];
+			if (spn->fpr && regalloc.IsLive(spn) && regalloc.IsDirty(spn)) {
+				regalloc.call_stores++;
+				mov(r11, (size_t)GetRegPtr(spn->regstart));
+				movss(dword[r11], Xbyak::Xmm(spn->nregf));
+			}
+		}
+	}
+
+	void ThawXMM() {
+		for (size_t sid = 0; sid < regalloc.all_spans.size(); sid++) {
+			X64RegAlloc::RegSpan* spn = regalloc.all_spans[sid];
+			if (spn->fpr && regalloc.IsLive(spn)) {
+				regalloc.call_loads++;
+				mov(r11, (size_t)GetRegPtr(spn->regstart));
+				movss(Xbyak::Xmm(spn->nregf), dword[r11]);
+			}
+		}
+	}
+
+	//calls push the pc they return to, and its code as it is now (see ret_cache)
+	void GenRetCachePush(RuntimeBlockInfo* block) {
+		mov(rdx, (size_t)&ret_cache_idx);
+		mov(ecx, dword[rdx]);
+		inc(ecx);
+		and_(ecx, RET_CACHE_SIZE - 1);
+		mov(dword[rdx], ecx);
+		shl(ecx, 4);
+
+		mov(rdx, (size_t)ret_cache);
+		mov(dword[rdx + rcx], block->NextBlock);
+		mov(rax, (size_t)&p_sh4rcb->fpcb[(block->NextBlock >> 1) & FPCB_MASK]);
+		mov(rax, qword[rax]);
+		mov(qword[rdx + rcx + 8], rax);
+		mov(rax, (size_t)&bm_discard_gen);
+		mov(eax, dword[rax]);
+		mov(dword[rdx + rcx + 4], eax);
+	}
+
+	//sh4 result of an fpu op that made a NaN, see fixNaN
+	static u32 FixedNaN() {
+		u32 qnan = 0x7fc00000;
+		f32 rv = fixNaN(*(f32*)&qnan);
+		return *(u32*)&rv;
+	}
+
+	void FixNaN(const Xbyak::Xmm& x) {
+		Xbyak::Label ordered;
+		ucomiss(x, x);
+		jnp(ordered);
+		mov(eax, FixedNaN());
+		movd(x, eax);
+		L(ordered);
+	}
+
+	//same for the 4 lanes of x, the result is in xmm1
+	void FixNaN4(const Xbyak::Xmm& x) {
+		movaps(xmm1, x);
+		cmpunordps(xmm1, xmm1);
+		mov(eax, FixedNaN());
+		movd(xmm2, eax);
+		shufps(xmm2, xmm2, 0);
+		andps(xmm2, xmm1);
+		andnps(xmm1, x);
+		orps(xmm1, xmm2);
+	}
+
+#define bin_op(x86op) \
+   do { \
+   sh_to_reg(op.rs1, mov, ecx); \
+   sh_to_reg(op.rs2, x86op, ecx); \
+   reg_to_sh(op.rd, ecx); \
+   } while (0)
+
+#define shift_op(x86op) \
+   do { \
+   sh_to_reg(op.rs1, mov, edx); \
+   if (op.rs2.is_imm()) \
+      x86op(edx, op.rs2._imm & 0x1f); \
+   else { \
+      sh_to_reg(op.rs2, mov, ecx); \
+      x86op(edx, cl); \
+   } \
+   reg_to_sh(op.rd, edx); \
+   } while (0)
+
+#define set_op(x86set) \
+   do { \
+   sh_to_reg(op.rs1, mov, ecx); \
+   sh_to_reg(op.rs2, cmp, ecx); \
+   x86set(cl); \
+   movzx(ecx, cl); \
+   reg_to_sh(op.rd, ecx); \
+   } while (0)
+
+#define fbin_op(x86op) \
+   do { \
+   sh_to_reg_noimm(op.rs1, movss, xmm0); \
+   sh_to_reg_noimm(op.rs2, x86op, xmm0); \
+   FixNaN(xmm0); \
+   reg_to_sh_ss(op.rd, xmm0); \
+   } while (0)
+
+	//Emits the op inline. Returns false for the ones that are left to their canonical
+	//implementation. The results are the same as the canonical ones, bit for bit (see
+	//tests/x64_ops_diff), as long as the compiler keeps the canonical fipr/ftrv sum order
+	bool GenNativeOp(shil_opcode& op) {
+		switch (op.op)
+		{
+		case shop_and: bin_op(and_); break;
+		case shop_or:  bin_op(or_); break;
+		case shop_xor: bin_op(xor_); break;
+		case shop_add: bin_op(add); break;
+		case shop_sub: bin_op(sub); break;
+
+		case shop_not:
+		case shop_neg:
+			sh_to_reg(op.rs1, mov, ecx);
+			if (op.op == shop_not)
+				not_(ecx);
+			else
+				neg(ecx);
+			reg_to_sh(op.rd, ecx);
+			break;
+
+		case shop_shl: shift_op(shl); break;
+		case shop_shr: shift_op(shr); break;
+		case shop_sar: shift_op(sar); break;
+		case shop_ror: shift_op(ror); break;
+
+		//rd: result, rd2: carry/borrow out, rs3: carry/borrow in
+		case shop_adc:
+		case shop_sbc:
+			sh_to_reg(op.rs1, mov, ecx);
+			sh_to_reg(op.rs2, mov, edx);
+			if (op.op == shop_adc)
+				add(rcx, rdx);
+			else
+				sub(rcx, rdx);
+			sh_to_reg(op.rs3, mov, edx);
+			if (op.op == shop_adc)
+				add(rcx, rdx);
+			else
+				sub(rcx, rdx);
+			reg_to_sh(op.rd, ecx);
+			shr(rcx, 32);
+			if (op.op == shop_sbc)
+				and_(ecx, 1);
+			reg_to_sh(op.rd2, ecx);
+			break;
+
+		case shop_rocl:
+		case shop_rocr:
+			sh_to_reg(op.rs1, mov, ecx);
+			sh_to_reg(op.rs2, mov, edx);
+			mov(r8d, ecx);
+			if (op.op == shop_rocl) {
+				shl(ecx, 1);
+				or_(ecx, edx);
+				shr(r8d, 31);
+			}
+			else {
+				shr(ecx, 1);
+				shl(edx, 31);
+				or_(ecx, edx);
+				and_(r8d, 1);
+			}
+			reg_to_sh(op.rd, ecx);
+			reg_to_sh(op.rd2, r8d);
+			break;
+
+		case shop_swaplb:
+			sh_to_reg(op.rs1, mov, ecx);
+			rol(cx, 8);
+			reg_to_sh(op.rd, ecx);
+			break;
+
+		//positive amounts shift left, negative ones right, -32 clears (or fills with the sign)
+		case shop_shld:
+		case shop_shad:
+			{
+				Xbyak::Label right, full, done;
+
+				sh_to_reg(op.rs1, mov, edx);
+				sh_to_reg(op.rs2, mov, ecx);
+				test(ecx, ecx);
+				js(right);
+				shl(edx, cl);
+				jmp(done);
+				L(right);
+				and_(ecx, 0x1f);
+				jz(full);
+				neg(ecx);
+				if (op.op == shop_shld)
+					shr(edx, cl);
+				else
+					sar(edx, cl);
+				jmp(done);
+				L(full);
+				if (op.op == shop_shld)
+					xor_(edx, edx);
+				else
+					sar(edx, 31);
+				L(done);
+				reg_to_sh(op.rd, edx);
+			}
+			break;
+
+		case shop_ext_s8:
+		case shop_ext_s16:
+			sh_to_reg(op.rs1, mov, ecx);
+			if (op.op == shop_ext_s8)
+				movsx(ecx, cl);
+			else
+				movsx(ecx, cx);
+			reg_to_sh(op.rd, ecx);
+			break;
+
+		case shop_mul_u16:
+		case shop_mul_s16:
+		case shop_mul_i32:
+			sh_to_reg(op.rs1, mov, ecx);
+			sh_to_reg(op.rs2, mov, edx);
+			if (op.op == shop_mul_u16) {
+				movzx(ecx, cx);
+				movzx(edx, dx);
+			}
+			else if (op.op == shop_mul_s16) {
+				movsx(ecx, cx);
+				movsx(edx, dx);
+			}
+			imul(ecx, edx);
+			reg_to_sh(op.rd, ecx);
+			break;
+
+		//rd: low, rd2: high
+		case shop_mul_u64:
+		case shop_mul_s64:
+			sh_to_reg(op.rs1, mov, ecx);
+			sh_to_reg(op.rs2, mov, r8d);
+			mov(rax, rcx);
+			if (op.op == shop_mul_u64)
+				mul(r8d);
+			else
+				imul(r8d);
+			mov(ecx, eax);
+			mov(r8d, edx);
+			reg_to_sh(op.rd, ecx);
+			reg_to_sh(op.rd2, r8d);
+			break;
+
+		//rd: quotient, rd2: remainder
+		case shop_div32u:
+		case shop_div32s:
+			sh_to_reg(op.rs1, mov, ecx);
+			sh_to_reg(op.rs2, mov, r8d);
+			mov(eax, ecx);
+			if (op.op == shop_div32u) {
+				xor_(edx, edx);
+				div(r8d);
+			}
+			else {
+				cdq();
+				idiv(r8d);
+			}
+			mov(ecx, eax);
+			mov(r8d, edx);
+			reg_to_sh(op.rd, ecx);
+			reg_to_sh(op.rd2, r8d);
+			break;
+
+		//rd = T ? rs1 : rs1-rs2
+		case shop_div32p2:
+			sh_to_reg(op.rs1, mov, ecx);
+			mov(edx, ecx);
+			sh_to_reg(op.rs2, sub, edx);
+			sh_to_reg(op.rs3, mov, r8d);
+			test(r8d, r8d);
+			cmovz(ecx, edx);
+			reg_to_sh(op.rd, ecx);
+			break;
+
+		case shop_test:
+			sh_to_reg(op.rs1, mov, ecx);
+			sh_to_reg(op.rs2, mov, edx);
+			test(ecx, edx);
+			setz(cl);
+			movzx(ecx, cl);
+			reg_to_sh(op.rd, ecx);
+			break;
+
+		case shop_seteq: set_op(sete); break;
+		case shop_setge: set_op(setge); break;
+		case shop_setgt: set_op(setg); break;
+		case shop_setae: set_op(setae); break;
+		case shop_setab: set_op(seta); break;
+
+		//any byte of rs1^rs2 zero, (x-0x01010101) & ~x & 0x80808080 is non zero exactly then
+		case shop_setpeq:
+			sh_to_reg(op.rs1, mov, ecx);
+			sh_to_reg(op.rs2, xor_, ecx);
+			lea(edx, ptr[rcx - 0x01010101]);
+			not_(ecx);
+			and_(ecx, edx);
+			test(ecx, 0x80808080);
+			setnz(cl);
+			movzx(ecx, cl);
+			reg_to_sh(op.rd, ecx);
+			break;
+
+		case shop_fadd: fbin_op(addss); break;
+		case shop_fsub: fbin_op(subss); break;
+		case shop_fmul: fbin_op(mulss); break;
+		case shop_fdiv: fbin_op(divss); break;
+
+		case shop_fabs:
+		case shop_fneg:
+			sh_to_reg_noimm(op.rs1, mov, ecx);
+			if (op.op == shop_fabs)
+				and_(ecx, 0x7fffffff);
+			else
+				xor_(ecx, 0x80000000);
+			reg_to_sh(op.rd, ecx);
+			break;
+
+		case shop_fsqrt:
+			sh_to_reg_noimm(op.rs1, sqrtss, xmm0);
+			reg_to_sh_ss(op.rd, xmm0);
+			break;
+
+		case shop_fsrra:
+			sh_to_reg_noimm(op.rs1, sqrtss, xmm1);
+			mov(eax, 0x3f800000);	//1.0f
+			movd(xmm0, eax);
+			divss(xmm0, xmm1);
+			reg_to_sh_ss(op.rd, xmm0);
+			break;
+
+		//rd = rs1 + rs2*rs3
+		case shop_fmac:
+			sh_to_reg_noimm(op.rs2, movss, xmm0);
+			sh_to_reg_noimm(op.rs3, mulss, xmm0);
+			sh_to_reg_noimm(op.rs1, addss, xmm0);
+			FixNaN(xmm0);
+			reg_to_sh_ss(op.rd, xmm0);
+			break;
+
+		//unordered compares are false
+		case shop_fseteq:
+		case shop_fsetgt:
+			sh_to_reg_noimm(op.rs1, movss, xmm0);
+			sh_to_reg_noimm(op.rs2, ucomiss, xmm0);
+			if (op.op == shop_fseteq) {
+				sete(cl);
+				setnp(dl);
+				and_(cl, dl);
+			}
+			else
+				seta(cl);
+			movzx(ecx, cl);
+			reg_to_sh(op.rd, ecx);
+			break;
+
+		//saturates positive overflows, NaNs and negative overflows give 0x80000000
+		case shop_cvt_f2i_t:
+			sh_to_reg_noimm(op.rs1, movss, xmm0);
+			cvttss2si(ecx, xmm0);
+			mov(eax, 0x4effffff);	//2147483520.0f
+			movd(xmm1, eax);
+			mov(edx, 0x7fffffff);
+			ucomiss(xmm0, xmm1);
+			cmova(ecx, edx);
+			reg_to_sh(op.rd, ecx);
+			break;
+
+		case shop_cvt_i2f_n:
+		case shop_cvt_i2f_z:
+			sh_to_reg(op.rs1, mov, ecx);
+			cvtsi2ss(xmm0, ecx);
+			reg_to_sh_ss(op.rd, xmm0);
+			break;
+
+		//the products are summed pairwise, (0+2)+(1+3), the order the canonical code writes out.
+		//-ffast-math lets gcc reorder the canonical one, so there they can differ in the last bits
+		case shop_fipr:
+			mov(rax, (size_t)op.rs1.reg_ptr());
+			movups(xmm0, xword[rax]);
+			mov(rax, (size_t)op.rs2.reg_ptr());
+			movups(xmm1, xword[rax]);
+			mulps(xmm0, xmm1);
+			movhlps(xmm1, xmm0);
+			addps(xmm0, xmm1);
+			pshufd(xmm1, xmm0, 0x55);
+			addss(xmm0, xmm1);
+			FixNaN(xmm0);
+			reg_to_sh_ss(op.rd, xmm0);
+			break;
+
+		//rd = rs2 (column major matrix) * rs1, one column at a time. Summed as (0+3)+(1+2), again
+		//the order of the canonical code
+		case shop_ftrv:
+			mov(rax, (size_t)op.rs2.reg_ptr());
+			movups(xmm0, xword[rax]);
+			movups(xmm1, xword[rax + 16]);
+			movups(xmm2, xword[rax + 32]);
+			movups(xmm3, xword[rax + 48]);
+			mov(rax, (size_t)op.rs1.reg_ptr());
+			for (int i = 0; i < 4; i++) {
+				Xbyak::Xmm col(i);
+				movss(xmm4, dword[rax + i * 4]);
+				shufps(xmm4, xmm4, 0);
+				mulps(col, xmm4);
+			}
+			addps(xmm0, xmm3);
+			addps(xmm1, xmm2);
+			addps(xmm0, xmm1);
+			FixNaN4(xmm0);
+			mov(rax, (size_t)op.rd.reg_ptr());
+			movups(xword[rax], xmm1);
+			break;
+
+		//rd[0] = sin, rd[1] = cos, from the table
+		case shop_fsca:
+			verify(sizeof(sin_table[0]) == 8);
+			sh_to_reg(op.rs1, mov, ecx);
+			movzx(ecx, cx);
+			mov(rax, (size_t)sin_table);
+			mov(rcx, qword[rax + rcx * 8]);
+			reg_to_sh(ParamPart(op.rd, 0), ecx);
+			shr(rcx, 32);
+			reg_to_sh(ParamPart(op.rd, 1), ecx);
+			break;
+
+		//rd = rs1, rd2 = rs2 (16 floats each), in two halves as xmm6/7 are callee saved on win64
+		case shop_frswap:
+			for (int i = 0; i < 64; i += 32) {
+				mov(rax, (size_t)op.rs1.reg_ptr());
+				movups(xmm0, xword[rax + i]);
+				movups(xmm1, xword[rax + i + 16]);
+				mov(rax, (size_t)op.rs2.reg_ptr());
+				movups(xmm2, xword[rax + i]);
+				movups(xmm3, xword[rax + i + 16]);
+				mov(rax, (size_t)op.rd.reg_ptr());
+				movups(xword[rax + i], xmm0);
+				movups(xword[rax + i + 16], xmm1);
+				mov(rax, (size_t)op.rd2.reg_ptr());
+				movups(xword[rax + i], xmm2);
+				movups(xword[rax + i + 16], xmm3);
+			}
+			break;
+
+		//sync_sr/sync_fpscr, pref, debug, swap (not a plain bswap, and not emitted by the decoder)
+		default:
+			return false;
+		}
+
+		return true;
+	}
+
+#undef bin_op
+#undef shift_op
+#undef set_op
+#undef fbin_op
+
    void CheckBlock(RuntimeBlockInfo* block) {
 		mov(call_regs[0],block->addr);
 
-		s32 sz=block->sh4_code_size;
-		u32 sa=block->addr;
+		CheckCode(block->addr,block->sh4_code_size);
+
+		//superblocks check the code of all their blocks
+		for (size_t i=0;i<block->trace.size();i++)
+			CheckCode(block->trace[i].addr,block->trace[i].sh4_code_size);
+	}
 
+	void CheckCode(u32 sa,s32 sz) {
 		while(sz>0) {
 			void* ptr=(void*)GetMemPtr(sa,4);
 			if (ptr) {
@@ -170,29 +935,123 @@ public:
 					mov(edx, *(u32*)ptr);
 					cmp(dword[rax],edx);
 				}
-				jne(reinterpret_cast<const void*>(&ngen_blockcheckfail));
+				jne(block_check_fail);
 			}
 			sz-=4;
 			sa+=4;
 		}
-		
+	}
+
+	//constant addresses outside of ram are mmio most of the time, those go straight to the call
+	static bool UseFastmem(const shil_opcode& op) {
+		if (!_nvmem_enabled())
+			return false;
+
+#ifndef NO_MMU
+		//the fast path doesn't translate, the mmu_* calls go through the software TLB
+		if (settings.MMUEnabled)
+			return false;
+#endif
+
+		if (op.rs1.is_imm() && !op.rs3.is_reg())
+			return IsOnRam(op.rs1._imm + (op.rs3.is_imm() ? op.rs3._imm : 0));
+
+		return true;
+	}
+
+	//access through the nvmem mapping, address in call_regs[0]. The site is recorded so ngen_Rewrite
+	//can patch it to call the thunk if it faults. Nothing before the access has side effects, the
+	//rewritten site runs again from the start
+	void GenFastmem(RuntimeBlockInfo* block, u32 size, bool write) {
+		FastmemSite site;
+
+		site.start = getSize();
+
+		mov(eax, call_regs[0]);
+		and_(eax, 0x1FFFFFFF);
+		mov(r11, (size_t)virt_ram_base);
+
+		site.fault = getSize();
+
+		if (!write) {
+			if (size == 1)
+				movsx(ecx, byte[r11 + rax]);
+			else if (size == 2)
+				movsx(ecx, word[r11 + rax]);
+			else if (size == 4)
+				mov(ecx, dword[r11 + rax]);
+			else if (size == 8)
+				mov(rcx, qword[r11 + rax]);
+			else
+				die("1..8 bytes");
+		}
+		else {
+			if (size == 1)
+				mov(byte[r11 + rax], call_regs[1].cvt8());
+			else if (size == 2)
+				mov(word[r11 + rax], call_regs[1].cvt16());
+			else if (size == 4)
+				mov(dword[r11 + rax], call_regs[1]);
+			else if (size == 8)
+				mov(qword[r11 + rax], call_regs64[1]);
+			else
+				die("1..8 bytes");
+		}
+
+		site.size = getSize() - site.start;
+		site.thunk = write * 4 + (size == 1 ? 0 : size == 2 ? 1 : size == 4 ? 2 : 3);
+
+		((DynaRBI*)block)->fastmem_sites.push_back(site);
 	}
 
 	void compile(RuntimeBlockInfo* block, bool force_checks, bool reset, bool staging, bool optimise)
    {
+      ((DynaRBI*)block)->fastmem_sites.clear();
+
       if (force_checks) {
 			CheckBlock(block);
 		}
 
-		mov(rax, (size_t)&cycle_counter);
+		ngen_features features;
+		ngen_GetFeatures(&features);
+
+		//count the runs, a hot block is handed to rdv_HotBlock before it touches anything.
+		//It is a jump, so the block isn't on the stack if it gets replaced
+		if (features.SideExits && optimise && block->trace.empty()) {
+			Xbyak::Label cold;
+
+			mov(rax, (size_t)&block->runs);
+			add(dword[rax], 1);
+			cmp(dword[rax], TRACE_HOT_RUNS);
+			jne(cold);
+			mov(call_regs[0], block->addr);
+			mov(rax, (size_t)&next_pc);
+			mov(dword[rax], block->addr);
+			jmp(hot_block, T_NEAR);
+			L(cold);
+		}
+
+		//the timeslice is checked on the entry of every block, linked ones don't go through the dispatcher
+		Xbyak::Label run;
 
+		mov(rax, (size_t)&cycle_counter);
 		sub(dword[rax], block->guest_cycles);
+		jg(run, T_SHORT);
+		mov(call_regs[0], block->addr);
+		call(intc_sched);
+		L(run);
 
-		sub(rsp, 0x28);
+		//run register allocator
+		regalloc.DoAlloc(block, alloc_regs, xmm_alloc_regs);
+		regalloc.reads = regalloc.writes = 0;
+		regalloc.call_loads = regalloc.call_stores = 0;
 
 		for (size_t i = 0; i < block->oplist.size(); i++)
       {
          shil_opcode& op  = block->oplist[i];
+
+         regalloc.OpBegin(&op, i);
+
          switch (op.op)
          {
 
@@ -205,22 +1064,44 @@ public:
 
                mov(call_regs[0], op.rs3._imm);
 
+               FreezeXMM();
                call((void*)OpDesc[op.rs3._imm]->oph);
+               ThawXMM();
                break;
 
             case shop_jcond:
             case shop_jdyn:
                {
-                  mov(rax, (size_t)op.rs1.reg_ptr());
-
-                  mov(ecx, dword[rax]);
+                  sh_to_reg(op.rs1, mov, ecx);
 
                   if (op.rs2.is_imm()) {
                      add(ecx, op.rs2._imm);
                   }
 
-                  mov(rdx, (size_t)op.rd.reg_ptr());
-                  mov(dword[rdx], ecx);
+                  reg_to_sh(op.rd, ecx);
+               }
+               break;
+
+            case shop_jexit:
+               {
+                  //side exit of a superblock
+                  Xbyak::Label stay;
+
+                  mov(rax, (size_t)op.rs1.reg_ptr());
+                  cmp(dword[rax], op.rs2._imm);
+                  jne(stay, T_NEAR);
+
+                  mov(rax, (size_t)&next_pc);
+                  mov(dword[rax], op.rs3._imm);
+
+                  if (op.flags) {
+                     mov(rax, (size_t)&cycle_counter);
+                     add(dword[rax], op.flags);
+                  }
+
+                  //nothing is allocated across it (see RegAlloc::IsFlushOp), the context is up to date
+                  jmp(no_update, T_NEAR);
+                  L(stay);
                }
                break;
 
@@ -230,18 +1111,35 @@ public:
 
                   verify(op.rs1.is_reg() || op.rs1.is_imm());
 
-                  sh_to_reg(op.rs1, mov, ecx);
+                  if (regalloc.IsAllocg(op.rd) && regalloc.IsAllocg(op.rs1)) {
+                     regalloc.reads++;
+                     regalloc.writes++;
+                     mov(Xbyak::Reg32(regalloc.mapg(op.rd)), Xbyak::Reg32(regalloc.mapg(op.rs1)));
+                  }
+                  else if (regalloc.IsAllocf(op.rd) && regalloc.IsAllocf(op.rs1)) {
+                     regalloc.reads++;
+                     regalloc.writes++;
+                     movaps(Xbyak::Xmm(regalloc.mapf(op.rd)), Xbyak::Xmm(regalloc.mapf(op.rs1)));
+                  }
+                  else {
+                     sh_to_reg(op.rs1, mov, ecx);
 
-                  reg_to_sh(op.rd, ecx);
+                     reg_to_sh(op.rd, ecx);
+                  }
                }
                break;
 
+            //the pairs are allocated as two singles, moved one half at a time
             case shop_mov64:
                {
                   verify(op.rd.is_reg());
-                  verify(op.rs1.is_reg() || op.rs1.is_imm());
-                  sh_to_reg(op.rs1, mov, rcx);
-                  reg_to_sh(op.rd, rcx);
+                  verify(op.rs1.is_reg());
+                  for (u32 i = 0; i < 2; i++) {
+                     shil_param rs1 = ParamPart(op.rs1, i);
+                     shil_param rd = ParamPart(op.rd, i);
+                     sh_to_reg_noimm(rs1, movss, xmm0);
+                     reg_to_sh_ss(rd, xmm0);
+                  }
                }
                break;
 
@@ -252,6 +1150,21 @@ public:
 
                   u32 size = op.flags & 0x7f;
 
+                  if (UseFastmem(op)) {
+                     GenFastmem(block, size, false);
+
+                     if (size != 8)
+                        reg_to_sh(op.rd, ecx);
+                     else {
+                        reg_to_sh(ParamPart(op.rd, 0), ecx);
+                        shr(rcx, 32);
+                        reg_to_sh(ParamPart(op.rd, 1), ecx);
+                     }
+                     break;
+                  }
+
+                  FreezeXMM();
+
                   if (size == 1) {
                      call((void*)ReadMem8);
                      movsx(rcx, al);
@@ -272,10 +1185,15 @@ public:
                      die("1..8 bytes");
                   }
 
+                  ThawXMM();
+
                   if (size != 8)
                      reg_to_sh(op.rd, ecx);
-                  else
-                     reg_to_sh(op.rd, rcx);
+                  else {
+                     reg_to_sh(ParamPart(op.rd, 0), ecx);
+                     shr(rcx, 32);
+                     reg_to_sh(ParamPart(op.rd, 1), ecx);
+                  }
                }
                break;
 
@@ -287,8 +1205,19 @@ public:
 
                   if (size != 8)
                      sh_to_reg(op.rs2, mov, call_regs[1]);
-                  else
-                     sh_to_reg(op.rs2, mov, call_regs64[1]);
+                  else {
+                     sh_to_reg_noimm(ParamPart(op.rs2, 1), mov, call_regs[1]);
+                     shl(call_regs64[1], 32);
+                     sh_to_reg_noimm(ParamPart(op.rs2, 0), mov, r8d);
+                     or_(call_regs64[1], r8);
+                  }
+
+                  if (UseFastmem(op)) {
+                     GenFastmem(block, size, true);
+                     break;
+                  }
+
+                  FreezeXMM();
 
                   if (size == 1)
                      call((void*)WriteMem8);
@@ -301,84 +1230,37 @@ public:
                   else {
                      die("1..8 bytes");
                   }
+
+                  ThawXMM();
                }
                break;
 
             default:
-               shil_chf[op.op](&op);
+               if (!GenNativeOp(op))
+                  shil_chf[op.op](&op);
                break;
          }
-      }
 
-		mov(rax, (size_t)&next_pc);
-
-		switch (block->BlockType) {
-
-		case BET_StaticJump:
-		case BET_StaticCall:
-			//next_pc = block->BranchBlock;
-			mov(dword[rax], block->BranchBlock);
-			break;
-
-		case BET_Cond_0:
-		case BET_Cond_1:
-			{
-				//next_pc = next_pc_value;
-				//if (*jdyn == 0)
-				//next_pc = branch_pc_value;
-
-				mov(dword[rax], block->NextBlock);
-
-				if (block->has_jcond)
-					mov(rdx, (size_t)&Sh4cntx.jdyn);
-				else
-					mov(rdx, (size_t)&sr.T);
-
-				cmp(dword[rdx], block->BlockType & 1);
-				Xbyak::Label branch_not_taken;
-
-				jne(branch_not_taken, T_SHORT);
-				mov(dword[rax], block->BranchBlock);
-				L(branch_not_taken);
-			}
-			break;
+         regalloc.OpEnd(&op);
+      }
 
-		case BET_DynamicJump:
-		case BET_DynamicCall:
-		case BET_DynamicRet:
-			//next_pc = *jdyn;
-			mov(rdx, (size_t)&Sh4cntx.jdyn);
-			mov(edx, dword[rdx]);
-			mov(dword[rax], edx);
-			break;
+		ra_stats.blocks++;
+		ra_stats.reads += regalloc.reads;
+		ra_stats.writes += regalloc.writes;
+		ra_stats.loads += regalloc.preload_gpr + regalloc.preload_fpu + regalloc.call_loads;
+		ra_stats.stores += regalloc.writeback_gpr + regalloc.writeback_fpu + regalloc.call_stores;
 
-		case BET_DynamicIntr:
-		case BET_StaticIntr:
-			if (block->BlockType == BET_DynamicIntr) {
-				//next_pc = *jdyn;
-				mov(rdx, (size_t)&Sh4cntx.jdyn);
-				mov(edx, dword[rdx]);
-				mov(dword[rax], edx);
-			}
-			else {
-				//next_pc = next_pc_value;
-				mov(dword[rax], block->NextBlock);
-			}
-
-			call((void*)UpdateINTC);
-			break;
+		if (block->BlockType == BET_StaticCall || block->BlockType == BET_DynamicCall)
+			GenRetCachePush(block);
 
-		default:
-			die("Invalid block end type");
-		}
-
-
-		add(rsp, 0x28);
-		ret();
+		block->relink_offset = getSize();
+		block->relink_data = 0;
+		GenBlockExit(*this, block);
 
 		ready();
 
 		block->code = (DynarecCodeEntryPtr)getCode();
+		block->host_code_size = getSize();
 
 		emit_Skip(getSize());
 	}
@@ -442,16 +1324,22 @@ public:
             //push the contents
 
             case CPT_u32:
-               sh_to_reg(prm, mov, call_regs[regused++]);
+               {
+                  const Xbyak::Reg32& reg = call_regs[regused++];
+                  sh_to_reg(prm, mov, reg);
+               }
                break;
 
             case CPT_f32:
-               sh_to_reg_noimm(prm, movss, call_regsxmm[xmmused++]);
+               {
+                  const Xbyak::Xmm& reg = call_regsxmm[xmmused++];
+                  sh_to_reg_noimm(prm, movss, reg);
+               }
                break;
 
-               //push the ptr itself
+               //push the ptr itself, the callee works on the context
             case CPT_ptr:
-               verify(prm.is_reg());
+               verify(prm.is_reg() && !regalloc.IsAllocAny(prm));
 
                mov(call_regs64[regused++], (size_t)prm.reg_ptr());
 
@@ -460,22 +1348,272 @@ public:
                break;
          }
 		}
+
+		FreezeXMM();
+		call(function);
+		ThawXMM();
+	}
+
+};
+
+void X64RegAlloc::Preload(u32 reg, Xbyak::Operand::Code nreg)
+{
+	compiler->mov(compiler->rax, (size_t)GetRegPtr(reg));
+	compiler->mov(Xbyak::Reg32(nreg), compiler->dword[compiler->rax]);
+}
+
+void X64RegAlloc::Writeback(u32 reg, Xbyak::Operand::Code nreg)
+{
+	compiler->mov(compiler->rax, (size_t)GetRegPtr(reg));
+	compiler->mov(compiler->dword[compiler->rax], Xbyak::Reg32(nreg));
+}
+
+void X64RegAlloc::Preload_FPU(u32 reg, s8 nreg)
+{
+	compiler->mov(compiler->rax, (size_t)GetRegPtr(reg));
+	compiler->movss(Xbyak::Xmm(nreg), compiler->dword[compiler->rax]);
+}
+
+void X64RegAlloc::Writeback_FPU(u32 reg, s8 nreg)
+{
+	compiler->mov(compiler->rax, (size_t)GetRegPtr(reg));
+	compiler->movss(compiler->dword[compiler->rax], Xbyak::Xmm(nreg));
+}
+
+class StubCompiler : public Xbyak::CodeGenerator
+{
+	vector<Xbyak::Reg32> call_regs;
+	vector<Xbyak::Reg64> call_regs64;
+	vector<Xbyak::Reg64> saved_regs;
+
+public:
+	StubCompiler() : Xbyak::CodeGenerator(sizeof(ngen_stubs), ngen_stubs) {
+#ifdef _WIN32
+		call_regs.push_back(ecx);
+		call_regs.push_back(edx);
+		call_regs64.push_back(rcx);
+		call_regs64.push_back(rdx);
+#else
+		call_regs.push_back(edi);
+		call_regs.push_back(esi);
+		call_regs64.push_back(rdi);
+		call_regs64.push_back(rsi);
+#endif
+
+		for (int i = 0; alloc_regs[i] != -1; i++)
+			saved_regs.push_back(Xbyak::Reg64(alloc_regs[i]));
+	}
+
+	//the thunks save the xmms the allocator hands out, on win32 they are callee saved anyway
+	void* GenThunk(void* function, u32 size, bool write) {
+		void* rv = (void*)getCurr();
+
+		//entry is 8 off, 0x20 of shadow space and 8 xmms
+		sub(rsp, 0xA8);
+		for (int i = 0; i < 8; i++)
+			movaps(xword[rsp + 0x20 + i * 16], Xbyak::Xmm(8 + i));
+
 		call(function);
+
+		if (!write) {
+			if (size == 1)
+				movsx(ecx, al);
+			else if (size == 2)
+				movsx(ecx, ax);
+			else
+				mov(rcx, rax);
+		}
+
+		for (int i = 0; i < 8; i++)
+			movaps(Xbyak::Xmm(8 + i), xword[rsp + 0x20 + i * 16]);
+		add(rsp, 0xA8);
+		ret();
+
+		align(16);
+		return rv;
 	}
 
+	void Gen() {
+		Xbyak::Label exit_loop, link_shared;
+
+		//ngen_FailedToFindBlock, must be first. The ret cache can get here for a block that was
+		//compiled since, so it looks again before compiling
+		call((void*)rdv_FindOrCompile);
+		jmp(rax);
+		align(16);
+
+		//the dispatcher. Saves what the blocks use, the frame is 16 byte aligned with shadow space
+		dispatcher = (void*)getCurr();
+		for (size_t i = 0; i < saved_regs.size(); i++)
+			push(saved_regs[i]);
+#ifdef _WIN32
+		sub(rsp, 0x28 + 10 * 16);
+		for (int i = 0; i < 10; i++)
+			movaps(xword[rsp + 0x20 + i * 16], Xbyak::Xmm(6 + i));
+#else
+		sub(rsp, 0x28);
+#endif
+		mov(rax, (size_t)&cycle_counter);
+		mov(dword[rax], SH4_TIMESLICE);
+
+		no_update = (void*)getCurr();
+		mov(rax, (size_t)&next_pc);
+		mov(eax, dword[rax]);
+		GenLookup(*this);
+
+		L(exit_loop);
+#ifdef _WIN32
+		for (int i = 0; i < 10; i++)
+			movaps(Xbyak::Xmm(6 + i), xword[rsp + 0x20 + i * 16]);
+		add(rsp, 0x28 + 10 * 16);
+#else
+		add(rsp, 0x28);
+#endif
+		for (size_t i = saved_regs.size(); i-- > 0;)
+			pop(saved_regs[i]);
+		ret();
+		align(16);
+
+		//called, the block goes on if ngen_IntcSched says so. Otherwise the return address is dropped
+		intc_sched = (void*)getCurr();
+		{
+			Xbyak::Label leave;
+
+			sub(rsp, 0x28);
+			call((void*)ngen_IntcSched);
+			add(rsp, 0x28);
+			test(eax, eax);
+			jnz(leave);
+			ret();
+
+			L(leave);
+			add(rsp, 8);
+			cmp(eax, 1);
+			je(no_update);
+			jmp(exit_loop, T_NEAR);
+		}
+		align(16);
+
+		//jumped to, the frame is the dispatcher's
+		hot_block = (void*)getCurr();
+		call((void*)rdv_HotBlock);
+		jmp(no_update, T_NEAR);
+		align(16);
+
+		block_check_fail = (void*)getCurr();
+		call((void*)ngen_blockcheckfail);
+		jmp(rax);
+		align(16);
+
+		//called from the exit, rdv_LinkBlock relinks it and returns the code to go on with
+		link_generic = (void*)getCurr();
+		mov(call_regs[1], eax);
+		jmp(link_shared);
+		align(16);
+
+		link_cond_branch = (void*)getCurr();
+		mov(call_regs[1], 1);
+		jmp(link_shared);
+		align(16);
+
+		link_cond_next = (void*)getCurr();
+		mov(call_regs[1], 0);
+
+		L(link_shared);
+		pop(call_regs64[0]);
+		sub(call_regs64[0], 5);
+		call((void*)rdv_LinkBlock);
+		jmp(rax);
+		align(16);
+
+		mem_thunks[0][0] = GenThunk((void*)ReadMem8, 1, false);
+		mem_thunks[0][1] = GenThunk((void*)ReadMem16, 2, false);
+		mem_thunks[0][2] = GenThunk((void*)ReadMem32, 4, false);
+		mem_thunks[0][3] = GenThunk((void*)ReadMem64, 8, false);
+
+		mem_thunks[1][0] = GenThunk((void*)WriteMem8, 1, true);
+		mem_thunks[1][1] = GenThunk((void*)WriteMem16, 2, true);
+		mem_thunks[1][2] = GenThunk((void*)WriteMem32, 4, true);
+		mem_thunks[1][3] = GenThunk((void*)WriteMem64, 8, true);
+
+		ready();
+
+#ifndef NDEBUG
+		printf("x64: dispatcher and stubs, %d bytes\n", (int)getSize());
+#endif
+	}
 };
 
+void ngen_init_x64(void)
+{
+	os_MakeExecutable(ngen_stubs, sizeof(ngen_stubs));
+
+	StubCompiler stubs;
+	stubs.Gen();
+
+	verify((void*)ngen_FailedToFindBlock == (void*)ngen_stubs);
+
+	fastmem_rewrites = 0;
+	memset(ret_cache, 0, sizeof(ret_cache));
+}
+
+//called from the fault handler. addr is the host pc, acc the host address that faulted. If it is a
+//fastmem site the site is patched to call the slow path, and addr is moved back to its start
+bool ngen_Rewrite(size_t& addr, size_t retadr, size_t acc)
+{
+	if ((u8*)addr < CodeCache || (u8*)addr >= CodeCache + CODE_SIZE)
+		return false;
+
+	DynaRBI* block = (DynaRBI*)bm_GetBlock2((void*)addr);
+	if (!block)
+		return false;
+
+	u32 offs = (u8*)addr - (u8*)block->code;
+
+	for (size_t i = 0; i < block->fastmem_sites.size(); i++) {
+		FastmemSite& site = block->fastmem_sites[i];
+		if (site.fault != offs)
+			continue;
+
+		u8* start = (u8*)block->code + site.start;
+
+		Xbyak::CodeGenerator patch(site.size, start);
+		patch.call(mem_thunks[site.thunk / 4][site.thunk % 4]);
+		patch.nop(site.size - patch.getSize());
+		patch.ready();
+
+		addr = (size_t)start;
+
+		fastmem_rewrites++;
+#ifndef NDEBUG
+		printf("x64 fastmem: %d sites rewritten, access to %08X from block %08X\n", fastmem_rewrites,
+			(u32)((u8*)acc - virt_ram_base), block->addr);
+#endif
+		return true;
+	}
+
+	return false;
+}
+
 BlockCompilerx64 *compilerx64_data;
 
 void ngen_Compile_x64(RuntimeBlockInfo* block, bool force_checks, bool reset, bool staging, bool optimise)
 {
-   verify(emit_FreeSpace() >= 16 * 1024);
+   verify(emit_FreeSpace() >= CODE_BLOCK_MAX);
 
 	compilerx64_data = new BlockCompilerx64();
 
    BlockCompilerx64 *compiler = compilerx64_data;
 	
-	compiler->compile(block, force_checks, reset, staging, optimise);
+	try {
+		compiler->compile(block, force_checks, reset, staging, optimise);
+	}
+	catch (const Xbyak::Error& e) {
+		//nothing was committed to the cache, the caller makes the block shorter or drops it
+		if ((int)e != Xbyak::ERR_CODE_IS_TOO_BIG)
+			die(e.what());
+		block->code = 0;
+	}
 
 	delete compiler;
 }
@@ -23,6 +23,9 @@ void ngen_init(void)
 #elif FEAT_SHREC == DYNAREC_JIT && HOST_CPU == CPU_ARM
          extern void ngen_init_arm(void);
          ngen_init_arm();
+#elif FEAT_SHREC == DYNAREC_JIT && HOST_CPU == CPU_X64
+         extern void ngen_init_x64(void);
+         ngen_init_x64();
 #endif
          break;
       case 1: /* rec_cpp */
@@ -37,6 +40,13 @@ void ngen_GetFeatures(ngen_features* dst)
 {
 	dst->InterpreterFallback = false;
 	dst->OnlyDynamicEnds = false;
+#if FEAT_SHREC == DYNAREC_JIT && !defined(TARGET_NO_JIT)
+	dst->IncrementalFlush = settings.dynarec.Type == 0;
+	dst->SideExits = HOST_CPU == CPU_X64 && settings.dynarec.Type == 0 && settings.dynarec.Superblocks;
+#else
+	dst->IncrementalFlush = false;
+	dst->SideExits = false;
+#endif
 }
 
 int idxnxx = 0;
@@ -104,6 +104,20 @@ void palette_update(void)
 
 using namespace std;
 
+/*
+	VRAM write tracking
+
+	Textures lock the vram range they were converted from. The pages are write
+	protected and each page has the list of blocks on it, a write to a protected page
+	notifies every block on the page and unprotects it, since later writes to it can't
+	be seen anymore.
+
+	That is only page granular, a palette or sprite streamed next to a big texture
+	invalidates it on every frame. So the renderers keep a hash of the vram range
+	each texture was converted from, and a texture that was invalidated but whose
+	bytes are still the same is only locked again, not converted.
+*/
+
 /* Naomi edit - allow for max possible VRAM_SIZE here */
 vector<vram_block*> VramLocks[/*VRAM_SIZE*/(16*1024*1024)/PAGE_SIZE];
 //vram 32-64b
@@ -155,6 +169,75 @@ added_it:
  
 cMutex vramlist_lock;
 
+//blocks are locked on every texture upload and freed on every write to them, keep them in a pool
+//the pool is guarded by vramlist_lock, like the lists
+#define VRAMLOCK_CHUNK 256
+static vram_block* vramlock_pool;	//free list, linked through userdata
+
+static vram_block* vramlock_alloc()
+{
+	if (!vramlock_pool)
+	{
+		vram_block* chunk=(vram_block*)malloc(sizeof(vram_block)*VRAMLOCK_CHUNK);
+		verify(chunk!=0);
+
+		for (u32 i=0;i<VRAMLOCK_CHUNK;i++)
+		{
+			chunk[i].userdata=vramlock_pool;
+			vramlock_pool=&chunk[i];
+		}
+	}
+
+	vram_block* block=vramlock_pool;
+	vramlock_pool=(vram_block*)block->userdata;
+
+	return block;
+}
+
+static void vramlock_release(vram_block* block)
+{
+	block->userdata=vramlock_pool;
+	vramlock_pool=block;
+}
+
+//4 lane multiply/xorshift hash, every step is a bijection so any single word change is detected
+u64 vram_Hash(u32 start,u32 len)
+{
+	const u64 k=0x9E3779B97F4A7C15ULL;
+	const u8* p=&vram.data[start];
+
+	u64 h[4]={len,k,~k,(u64)len*k};
+	u32 i=0;
+
+	for (;i+32<=len;i+=32)
+	{
+		u64 w[4];
+		memcpy(w,p+i,32);
+
+		for (int l=0;l<4;l++)
+		{
+			h[l]=(h[l]^w[l])*k;
+			h[l]^=h[l]>>31;
+		}
+	}
+
+	for (;i<len;i++)
+	{
+		h[0]=(h[0]^p[i])*k;
+		h[0]^=h[0]>>31;
+	}
+
+	u64 rv=h[0];
+	for (int l=1;l<4;l++)
+	{
+		rv=(rv^h[l])*k;
+		rv^=rv>>29;
+	}
+
+	//0 is reserved for "no hash"
+	return rv|1;
+}
+
 //simple IsInRange test
 static INLINE bool IsInRange(vram_block* block,u32 offset)
 {
@@ -164,8 +247,6 @@ static INLINE bool IsInRange(vram_block* block,u32 offset)
 vram_block* libCore_vramlock_Lock(u32 start_offset64,
       u32 end_offset64,void* userdata)
 {
-	vram_block* block=(vram_block* )malloc(sizeof(vram_block));
-
 	if (end_offset64>(VRAM_SIZE-1))
 	{
 		msgboxf("vramlock_Lock_64: end_offset64>(VRAM_SIZE-1) \n Tried to lock area out of vram , possibly bug on the pvr plugin",MBX_OK);
@@ -178,15 +259,19 @@ vram_block* libCore_vramlock_Lock(u32 start_offset64,
 		start_offset64=0;
 	}
 
-	block->end=end_offset64;
-	block->start=start_offset64;
-	block->len=end_offset64-start_offset64+1;
-	block->userdata=userdata;
-	block->type=64;
+	vram_block* block;
 
    {
       vramlist_lock.Lock();
 
+      block=vramlock_alloc();
+
+      block->end=end_offset64;
+      block->start=start_offset64;
+      block->len=end_offset64-start_offset64+1;
+      block->userdata=userdata;
+      block->type=64;
+
       vram.LockRegion(block->start,block->len);
 
       //TODO: Fix this for 32M wrap as well
@@ -263,7 +348,6 @@ void libCore_vramlock_Unlock_block_wb(vram_block* block)
    else
 	{
 		vramlock_list_remove(block);
-		//more work needed
-		free(block);
+		vramlock_release(block);
 	}
 }
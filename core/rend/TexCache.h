@@ -481,3 +481,224 @@ vram_block* vramlock_Lock_32(u32 start_offset32,u32 end_offset32,void* userdata)
 vram_block* vramlock_Lock_64(u32 start_offset64,u32 end_offset64,void* userdata);
 
 void vram_LockedWrite(u32 offset64);
+u64 vram_Hash(u32 start,u32 len);
+
+/*
+	Texture cache container, shared by the renderers.
+
+	Entries live in slots that are allocated in chunks and never move, so pointers to
+	them stay valid until the entry is removed. The slots are found through an open
+	addressing (linear probing) hash table on the tcw/tsp key, and are kept on an LRU
+	list, most recently used first, with the size each one takes on the host so the
+	renderer can keep the cache within a memory budget.
+*/
+#define TEXCACHE_BUDGET (256*1024*1024)
+
+template<class T>
+class TexCacheTable
+{
+	enum { CHUNK_SLOTS=256, NIL=0xFFFFFFFF };
+
+	struct Slot
+	{
+		T data;
+		u64 key;
+		u32 bytes;
+		u32 prev;    //towards the most recently used
+		u32 next;    //towards the least recently used
+		u32 self;
+		bool used;
+	};
+
+	vector<Slot*> chunks;
+	vector<u32> free_slots;
+	vector<u32> index;   //slot+1, 0 for empty
+	u32 index_mask;
+
+	u32 mru;
+	u32 lru;
+
+	Slot& slot(u32 i) { return chunks[i/CHUNK_SLOTS][i%CHUNK_SLOTS]; }
+
+	//data is the first member of the slot
+	u32 SlotOf(T* entry) { return ((Slot*)entry)->self; }
+
+	u32 Hash(u64 key)
+	{
+		return (u32)((key*0x9E3779B97F4A7C15ull)>>32) & index_mask;
+	}
+
+	void Unlink(u32 i)
+	{
+		Slot& s=slot(i);
+
+		if (s.prev!=NIL) slot(s.prev).next=s.next; else mru=s.next;
+		if (s.next!=NIL) slot(s.next).prev=s.prev; else lru=s.prev;
+	}
+
+	void LinkFront(u32 i)
+	{
+		Slot& s=slot(i);
+
+		s.prev=NIL;
+		s.next=mru;
+		if (mru!=NIL) slot(mru).prev=i; else lru=i;
+		mru=i;
+	}
+
+	void Rehash(u32 size)
+	{
+		index.assign(size,0);
+		index_mask=size-1;
+
+		for (u32 i=0;i<chunks.size()*CHUNK_SLOTS;i++)
+		{
+			if (!slot(i).used)
+				continue;
+
+			u32 h=Hash(slot(i).key);
+			while (index[h])
+				h=(h+1)&index_mask;
+			index[h]=i+1;
+		}
+	}
+
+public:
+	u32 count;
+	u64 total_bytes;
+
+	TexCacheTable()
+	{
+		mru=lru=NIL;
+		count=0;
+		total_bytes=0;
+		Rehash(1024);
+	}
+
+	~TexCacheTable()
+	{
+		for (u32 c=0;c<chunks.size();c++)
+			delete[] chunks[c];
+	}
+
+	//returns the entry, or 0. Found entries become the most recently used
+	T* Find(u64 key)
+	{
+		for (u32 h=Hash(key);index[h];h=(h+1)&index_mask)
+		{
+			u32 i=index[h]-1;
+			if (slot(i).key==key)
+			{
+				if (mru!=i)
+				{
+					Unlink(i);
+					LinkFront(i);
+				}
+				return &slot(i).data;
+			}
+		}
+
+		return 0;
+	}
+
+	//adds a zeroed entry for key, which must not be in the table
+	T* Insert(u64 key)
+	{
+		if ((count+1)*2>index.size())
+			Rehash(index.size()*2);
+
+		if (free_slots.empty())
+		{
+			u32 base=chunks.size()*CHUNK_SLOTS;
+			chunks.push_back(new Slot[CHUNK_SLOTS]);
+			for (u32 i=CHUNK_SLOTS;i-->0;)
+			{
+				chunks.back()[i].used=false;
+				chunks.back()[i].self=base+i;
+				free_slots.push_back(base+i);
+			}
+		}
+
+		u32 i=free_slots.back();
+		free_slots.pop_back();
+
+		Slot& s=slot(i);
+		memset(&s.data,0,sizeof(s.data));
+		s.key=key;
+		s.bytes=0;
+		s.used=true;
+		LinkFront(i);
+
+		u32 h=Hash(key);
+		while (index[h])
+			h=(h+1)&index_mask;
+		index[h]=i+1;
+
+		count++;
+		return &s.data;
+	}
+
+	void Remove(T* entry)
+	{
+		u32 i=SlotOf(entry);
+		Slot& s=slot(i);
+
+		u32 h=Hash(s.key);
+		while (index[h]!=i+1)
+			h=(h+1)&index_mask;
+
+		//backward shift deletion, so no tombstones are needed
+		for (u32 next=(h+1)&index_mask;index[next];next=(next+1)&index_mask)
+		{
+			u32 home=Hash(slot(index[next]-1).key);
+			if (((next-home)&index_mask) >= ((next-h)&index_mask))
+			{
+				index[h]=index[next];
+				h=next;
+			}
+		}
+		index[h]=0;
+
+		Unlink(i);
+		total_bytes-=s.bytes;
+		s.used=false;
+		free_slots.push_back(i);
+		count--;
+	}
+
+	//host memory used by the entry, for the budget
+	void SetBytes(T* entry,u32 bytes)
+	{
+		Slot& s=slot(SlotOf(entry));
+		total_bytes+=bytes;
+		total_bytes-=s.bytes;
+		s.bytes=bytes;
+	}
+
+	u64 KeyOf(T* entry) { return slot(SlotOf(entry)).key; }
+
+	//LRU walk, from the least recently used
+	T* Oldest() { return lru==NIL?0:&slot(lru).data; }
+	T* Newer(T* entry)
+	{
+		u32 prev=slot(SlotOf(entry)).prev;
+		return prev==NIL?0:&slot(prev).data;
+	}
+
+	//walk in any order, Remove is allowed on the current entry
+	u32 Slots() { return chunks.size()*CHUNK_SLOTS; }
+	T* At(u32 i) { return slot(i).used?&slot(i).data:0; }
+
+	void Clear()
+	{
+		for (u32 c=0;c<chunks.size();c++)
+			delete[] chunks[c];
+
+		chunks.clear();
+		free_slots.clear();
+		mru=lru=NIL;
+		count=0;
+		total_bytes=0;
+		Rehash(1024);
+	}
+};
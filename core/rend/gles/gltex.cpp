@@ -1,5 +1,4 @@
 #include <math.h>
-#include <map>
 
 #include <memalign.h>
 
@@ -122,6 +121,9 @@ struct TextureCacheData
 	vram_block* lock_block;
 
 	u32 Updates;
+	u32 last_used;       /* FrameCount of the last lookup */
+	u32 host_size;       /* Bytes used by the converted texture, for the cache budget */
+	u64 vram_hash;       /* vram_Hash of the data it was converted from, 0 if none */
 
 	/* Used for palette updates */
 	u32  pal_local_rev;         /* Local palette rev */
@@ -156,6 +158,7 @@ struct TextureCacheData
 		h          = 8 << tsp.TexV;                              /* texture height */
 
       pal_table_rev = 0;
+      vram_hash     = 0;
 
 		/* PAL texture */
       if (tex->bpp == 4)
@@ -249,6 +252,17 @@ struct TextureCacheData
    {
       GLuint textype;
 
+      /* Only locked again if the data it was converted from is still the same,
+       * the write was to something else on the same page or didn't change anything. */
+      if (dirty && lock_block == 0 && vram_hash != 0 &&
+            (pal_table_rev == 0 || *pal_table_rev == pal_local_rev) &&
+            vram_Hash(sa_tex, sa + size - sa_tex) == vram_hash)
+      {
+         dirty      = 0;
+         lock_block = libCore_vramlock_Lock(sa_tex,sa+size-1,this);
+         return;
+      }
+
       Updates++;                                   /* texture state tracking stuff */
       dirty              = 0;
       textype            = tex->type;
@@ -306,14 +320,19 @@ struct TextureCacheData
 		}
       /* lock the texture to detect changes in it. */
       lock_block = libCore_vramlock_Lock(sa_tex,sa+size-1,this);
+      vram_hash  = vram_Hash(sa_tex, sa + size - sa_tex);
 
       if (texID)
       {
          glcache.BindTexture(GL_TEXTURE_2D, texID);
          GLuint comps=textype==GL_UNSIGNED_SHORT_5_6_5?GL_RGB:GL_RGBA;
          glTexImage2D(GL_TEXTURE_2D, 0,comps , w, h, 0, comps, textype, temp_tex_buffer);
+         host_size = w * h * (textype == GL_UNSIGNED_INT_8_8_8_8 ? 4 : 2);
          if (tcw.MipMapped && settings.rend.UseMipmaps)
+         {
             glGenerateMipmap(GL_TEXTURE_2D);
+            host_size += host_size / 3;
+         }
       }
       else
       {
@@ -339,6 +358,7 @@ struct TextureCacheData
 #else
          pData = (u16*)memalign_alloc(16, w * h * 16);
 #endif
+         host_size = w * h * 16;
          for (int y = 0; y < h; y++)
          {
             for (int x = 0; x < w; x++)
@@ -382,9 +402,7 @@ struct TextureCacheData
 	}
 };
 
-#include <map>
-map<u64,TextureCacheData> TexCache;
-typedef map<u64,TextureCacheData>::iterator TexCacheIter;
+TexCacheTable<TextureCacheData> TexCache;
 
 TextureCacheData *getTextureCacheData(TSP tsp, TCW tcw);
 
@@ -467,10 +485,11 @@ void BindRTT(u32 addy, u32 fbw, u32 fbh, u32 channels, u32 fmt)
 
 void ReadRTTBuffer(void)
 {
-	for (TexCacheIter i = TexCache.begin(); i != TexCache.end(); i++)
+	for (u32 i = 0; i < TexCache.Slots(); i++)
 	{
-		if (i->second.sa_tex == fb_rtt.TexAddr << 3)
-			i->second.dirty = FrameCount;
+		TextureCacheData* tf = TexCache.At(i);
+		if (tf && tf->sa_tex == fb_rtt.TexAddr << 3)
+			tf->dirty = FrameCount;
 	}
 
 	u32 w = pvrrc.fb_X_CLIP.max - pvrrc.fb_X_CLIP.min + 1;
@@ -493,13 +512,14 @@ void ReadRTTBuffer(void)
 
       // Manually mark textures as dirty and remove all vram locks before calling glReadPixels
       // (deadlock on rpi)
-      for (TexCacheIter i = TexCache.begin(); i != TexCache.end(); i++)
+      for (u32 i = 0; i < TexCache.Slots(); i++)
       {
-         if (i->second.sa_tex <= tex_addr + size - 1 && i->second.sa + i->second.size - 1 >= tex_addr) {
-            i->second.dirty = FrameCount;
-            if (i->second.lock_block != NULL) {
-               libCore_vramlock_Unlock_block(i->second.lock_block);
-               i->second.lock_block = NULL;
+         TextureCacheData* tf = TexCache.At(i);
+         if (tf && tf->sa_tex <= tex_addr + size - 1 && tf->sa + tf->size - 1 >= tex_addr) {
+            tf->dirty = FrameCount;
+            if (tf->lock_block != NULL) {
+               libCore_vramlock_Unlock_block(tf->lock_block);
+               tf->lock_block = NULL;
             }
          }
       }
@@ -566,14 +586,15 @@ void ReadRTTBuffer(void)
       }
 
       // Restore VRAM locks
-      for (TexCacheIter i = TexCache.begin(); i != TexCache.end(); i++)
+      for (u32 i = 0; i < TexCache.Slots(); i++)
       {
-         if (i->second.lock_block != NULL) {
-            vram.LockRegion(i->second.sa_tex, i->second.sa + i->second.size - i->second.sa_tex);
+         TextureCacheData* tf = TexCache.At(i);
+         if (tf && tf->lock_block != NULL) {
+            vram.LockRegion(tf->sa_tex, tf->sa + tf->size - tf->sa_tex);
 
             //TODO: Fix this for 32M wrap as well
             if (_nvmem_enabled() && VRAM_SIZE == 0x800000) {
-               vram.LockRegion(i->second.sa_tex + VRAM_SIZE, i->second.sa + i->second.size - i->second.sa_tex);
+               vram.LockRegion(tf->sa_tex + VRAM_SIZE, tf->sa + tf->size - tf->sa_tex);
             }
          }
       }
@@ -616,6 +637,9 @@ void ReadRTTBuffer(void)
       }
       texture_data->texID = fb_rtt.tex;
       texture_data->dirty = 0;
+      texture_data->last_used = FrameCount;
+      texture_data->vram_hash = 0;
+      TexCache.SetBytes(texture_data, (8 << tsp.TexU) * (8 << tsp.TexV) * 4);
    }
    fb_rtt.tex = 0;
 
@@ -643,23 +667,17 @@ TextureCacheData *getTextureCacheData(TSP tsp, TCW tcw) {
 	else
 		key |= (u64)(tcw.full & TCWTextureCacheMask.full) << 32;
 
-	TexCacheIter tx = TexCache.find(key);
+	TextureCacheData* tf = TexCache.Find(key);
 
-	TextureCacheData* tf;
-	if (tx != TexCache.end())
+	if (tf)
 	{
-		tf = &tx->second;
       // Needed if the texture is updated
 		tf->tcw.StrideSel = tcw.StrideSel;
 		tf->tcw.ScanOrder = tcw.ScanOrder;
 	}
 	else //create if not existing
 	{
-		TextureCacheData tfc={0};
-		TexCache[key] = tfc;
-
-		tx=TexCache.find(key);
-		tf=&tx->second;
+		tf = TexCache.Insert(key);
 
 		tf->tsp = tsp;
 		tf->tcw = tcw;
@@ -680,12 +698,16 @@ GLuint gl_GetTexture(TSP tsp, TCW tcw)
 
 	/* Update if needed */
 	if (tf->NeedsUpdate())
+	{
 		tf->Update();
+		TexCache.SetBytes(tf, tf->host_size);
+	}
    else
       TexCacheHits++;
 
 	/* Update state for opts/stuff */
 	tf->Lookups++;
+	tf->last_used = FrameCount;
 
 	/* Return gl texture */
 	return tf->texID;
@@ -696,34 +718,21 @@ text_info raw_GetTexture(TSP tsp, TCW tcw)
 	text_info rv = { 0 };
 
 	//lookup texture
-	TextureCacheData* tf;
-	u64 key = ((u64)(tcw.full & TCWTextureCacheMask.full) << 32) | (tsp.full & TSPTextureCacheMask.full);
+	TextureCacheData* tf = getTextureCacheData(tsp, tcw);
 
-	TexCacheIter tx = TexCache.find(key);
-
-	if (tx != TexCache.end())
-	{
-		tf = &tx->second;
-	}
-	else //create if not existing
-	{
-		TextureCacheData tfc = { 0 };
-		TexCache[key] = tfc;
-
-		tx = TexCache.find(key);
-		tf = &tx->second;
-
-		tf->tsp = tsp;
-		tf->tcw = tcw;
+	if (tf->tex == NULL)
 		tf->Create(false);
-	}
 
 	//update if needed
 	if (tf->NeedsUpdate())
+	{
 		tf->Update();
+		TexCache.SetBytes(tf, tf->host_size);
+	}
 
 	//update state for opts/stuff
 	tf->Lookups++;
+	tf->last_used = FrameCount;
 
 	//return gl texture
 	rv.height = tf->h;
@@ -735,34 +744,47 @@ text_info raw_GetTexture(TSP tsp, TCW tcw)
 	return rv;
 }
 
+/*
+	Walks the cache from the least recently used texture. Textures that have been
+	overwritten in vram and not used for 120 frames are deleted, and so are the least
+	recently used ones while the cache is over budget. Textures used by the frame
+	that is being rendered are never deleted.
+*/
 void CollectCleanup(void)
 {
-   vector<u64> list;
-
    u32 TargetFrame = max((u32)120,FrameCount) - 120;
 
-   for (TexCacheIter i=TexCache.begin();i!=TexCache.end();i++)
+   TextureCacheData* tf = TexCache.Oldest();
+
+   while (tf != NULL && tf->last_used + 1 < FrameCount)
    {
-      if ( i->second.dirty &&  i->second.dirty < TargetFrame)
-         list.push_back(i->first);
+      TextureCacheData* next = TexCache.Newer(tf);
 
-      if (list.size() > 5)
-         break;
-   }
+      bool stale = tf->dirty && tf->dirty < TargetFrame;
+      bool over_budget = TexCache.total_bytes > TEXCACHE_BUDGET;
 
-   for (size_t i=0; i<list.size(); i++)
-   {
-      TexCache[list[i]].Delete();
-      TexCache.erase(list[i]);
+      if (stale || over_budget)
+      {
+         tf->Delete();
+         TexCache.Remove(tf);
+      }
+      else if (tf->last_used >= TargetFrame)
+         break;      /* everything after this one is recent and under budget */
+
+      tf = next;
    }
 }
 
 void killtex(void)
 {
-	for (TexCacheIter i=TexCache.begin();i!=TexCache.end();i++)
-		i->second.Delete();
+	for (u32 i = 0; i < TexCache.Slots(); i++)
+	{
+		TextureCacheData* tf = TexCache.At(i);
+		if (tf)
+			tf->Delete();
+	}
 
-	TexCache.clear();
+	TexCache.Clear();
 }
 
 void rend_text_invl(vram_block* bl)
@@ -18,6 +18,10 @@
 #ifdef __SSE4_1__
 #include <smmintrin.h>
 #endif
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 #include <cmath>
 #include <algorithm>
 
@@ -286,6 +290,13 @@ struct IPs
 #define TPL_PRMS_pixel(useoldmsk) <useoldmsk, alpha_mode, pp_UseAlpha, pp_Texture, pp_IgnoreTexA, pp_ShadInstr, pp_Offset >
 #define TPL_PRMS_triangle <alpha_mode, pp_UseAlpha, pp_Texture, pp_IgnoreTexA, pp_ShadInstr, pp_Offset >
 
+//the same, for the SSE2/SSE4.1 kernels (see SSE41Ops)
+#define TPL_DECL_pixel_ops template<class Ops, bool useoldmsk, int alpha_mode, bool pp_UseAlpha, bool pp_Texture, bool pp_IgnoreTexA, int pp_ShadInstr, bool pp_Offset >
+#define TPL_DECL_triangle_ops template<class Ops, int alpha_mode, bool pp_UseAlpha, bool pp_Texture, bool pp_IgnoreTexA, int pp_ShadInstr, bool pp_Offset >
+
+#define TPL_PRMS_pixel_ops(useoldmsk) <Ops, useoldmsk, alpha_mode, pp_UseAlpha, pp_Texture, pp_IgnoreTexA, pp_ShadInstr, pp_Offset >
+#define TPL_PRMS_triangle_ops(ops) <ops, alpha_mode, pp_UseAlpha, pp_Texture, pp_IgnoreTexA, pp_ShadInstr, pp_Offset >
+
 
 //<alpha_blend, pp_UseAlpha, pp_Texture, pp_IgnoreTexA, pp_ShadInstr, pp_Offset >
 typedef void(*RendtriangleFn)(PolyParam* pp, int vertex_offset, const Vertex &v1, const Vertex &v2, const Vertex &v3, u32* colorBuffer, RECT* area);
@@ -295,7 +306,116 @@ RendtriangleFn RendtriangleFns[3][2][2][2][4][2];
 __m128i const_setAlpha;
 __m128i shuffle_alpha;
 
-TPL_DECL_pixel
+/*
+	SSE4.1 and SSE2 kernels
+
+	PixelFlush only needs SSE4.1 for a few operations, they are in SSE41Ops and SSE2Ops,
+	and the 4x4 block (FlushBlock4) is built with each of them. The SSE2 versions give
+	the same output, with more instructions.
+
+	Like the AVX2 kernels, the SSE4.1 ones are compiled for SSE4.1 with a target
+	attribute instead of for the whole file. FlushBlockSSE41 is flattened, so the
+	pipeline and the ops are all inlined in it, and built for SSE4.1 too.
+*/
+#if defined(_MSC_VER)
+#define SR_SSE41
+#define SR_FLATTEN
+#else
+#define SR_SSE41 __attribute__((target("sse4.1")))
+#define SR_FLATTEN __attribute__((flatten))
+#endif
+
+struct SSE41Ops
+{
+	//the channels of the low/high two pixels, as 16 bits
+	SR_SSE41 static __m128i WidenLo(__m128i v)
+	{
+		return _mm_cvtepu8_epi16(v);
+	}
+
+	SR_SSE41 static __m128i WidenHi(__m128i v)
+	{
+		return _mm_cvtepu8_epi16(_mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+	}
+
+	//alpha of widened pixels, on all the channels (see shuffle_alpha)
+	SR_SSE41 static __m128i Alpha(__m128i v)
+	{
+		return _mm_shuffle_epi8(v, shuffle_alpha);
+	}
+
+	//bilinear filter of a texel, the 4 pixels used for filtering
+	SR_SSE41 static u32 Filter(__m128i px, __m128i mufi_, __m128i mufi_n, __m128i mvfi_, __m128i mvfi_n)
+	{
+		__m128i tex_00 = _mm_cvtepu8_epi32(px);
+		__m128i tex_01 = _mm_cvtepu8_epi32(_mm_shuffle_epi32(px, _MM_SHUFFLE(0, 0, 0, 1)));
+		__m128i tex_10 = _mm_cvtepu8_epi32(_mm_shuffle_epi32(px, _MM_SHUFFLE(0, 0, 0, 2)));
+
+		tex_00 = _mm_add_epi32(_mm_mullo_epi32(tex_00, mufi_), _mm_mullo_epi32(tex_01, mufi_n));
+		tex_10 = _mm_add_epi32(_mm_mullo_epi32(tex_10, mufi_), _mm_mullo_epi32(tex_10, mufi_n));
+
+		tex_00 = _mm_add_epi32(_mm_mullo_epi32(tex_00, mvfi_), _mm_mullo_epi32(tex_10, mvfi_n));
+		tex_00 = _mm_srli_epi32(tex_00, 16);
+
+		tex_00 = _mm_packus_epi32(tex_00, tex_00);
+		tex_00 = _mm_packus_epi16(tex_00, tex_00);
+		return _mm_cvtsi128_si32(tex_00);
+	}
+};
+
+struct SSE2Ops
+{
+	static __forceinline __m128i WidenLo(__m128i v)
+	{
+		return _mm_unpacklo_epi8(v, _mm_setzero_si128());
+	}
+
+	static __forceinline __m128i WidenHi(__m128i v)
+	{
+		return _mm_unpackhi_epi8(v, _mm_setzero_si128());
+	}
+
+	//shuffle_alpha gives each pixel the alpha of the other one, so the halves are swapped first
+	static __forceinline __m128i Alpha(__m128i v)
+	{
+		v = _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+		return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xFF), 0xFF);
+	}
+
+	//low 32 bits of the products, as _mm_mullo_epi32
+	static __forceinline __m128i MulLo32(__m128i a, __m128i b)
+	{
+		__m128i even = _mm_mul_epu32(a, b);
+		__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+		return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+	}
+
+	static __forceinline u32 Filter(__m128i px, __m128i mufi_, __m128i mufi_n, __m128i mvfi_, __m128i mvfi_n)
+	{
+		__m128i zero = _mm_setzero_si128();
+		__m128i px_lo = _mm_unpacklo_epi8(px, zero);
+
+		__m128i tex_00 = _mm_unpacklo_epi16(px_lo, zero);
+		__m128i tex_01 = _mm_unpackhi_epi16(px_lo, zero);
+		__m128i tex_10 = _mm_unpacklo_epi16(_mm_unpackhi_epi8(px, zero), zero);
+
+		tex_00 = _mm_add_epi32(MulLo32(tex_00, mufi_), MulLo32(tex_01, mufi_n));
+		tex_10 = _mm_add_epi32(MulLo32(tex_10, mufi_), MulLo32(tex_10, mufi_n));
+
+		tex_00 = _mm_add_epi32(MulLo32(tex_00, mvfi_), MulLo32(tex_10, mvfi_n));
+		tex_00 = _mm_srli_epi32(tex_00, 16);
+
+		//the values fit in 16 bits, so a signed pack of their sign extended low halves is the
+		//same as _mm_packus_epi32
+		tex_00 = _mm_srai_epi32(_mm_slli_epi32(tex_00, 16), 16);
+		tex_00 = _mm_packs_epi32(tex_00, tex_00);
+		tex_00 = _mm_packus_epi16(tex_00, tex_00);
+		return _mm_cvtsi128_si32(tex_00);
+	}
+};
+
+TPL_DECL_pixel_ops
 static void PixelFlush(PolyParam* pp, text_info* texture, __m128 x, __m128 y, u8* cb, __m128 oldmask, IPs& ip)
 {
 	x = _mm_shuffle_ps(x, x, 0);
@@ -355,13 +475,9 @@ static void PixelFlush(PolyParam* pp, text_info* texture, __m128 x, __m128 y, u8
 			__m128i vfi = _mm_cvttps_epi32(_mm_mul_ps(vf, _mm_set1_ps(256)));
 
 			//(int)v<<x+(int)u
-         __m128i textadr;
-#ifdef __SSE4_1__
+			m128i textadr;
 			textadr.mm = _mm_add_epi32(_mm_slli_epi32(vi, 16), ui);//texture addresses ! 4x of em !
-#else
-			textadr    = _mm_add_epi32(_mm_slli_epi32(vi, 16), ui);//texture addresses ! 4x of em !
-#endif
-			__m128i textel;
+			m128i textel;
 
 			for (int i = 0; i < 4; i++) {
 				u32 u = textadr.m128i_i16[i * 2 + 0];
@@ -398,20 +514,7 @@ static void PixelFlush(PolyParam* pp, text_info* texture, __m128 x, __m128 y, u8
 
 
 				
-				__m128i tex_00 = _mm_cvtepu8_epi32(px);
-				__m128i tex_01 = _mm_cvtepu8_epi32(_mm_shuffle_epi32(px, _MM_SHUFFLE(0, 0, 0, 1)));
-				__m128i tex_10 = _mm_cvtepu8_epi32(_mm_shuffle_epi32(px, _MM_SHUFFLE(0, 0, 0, 2)));
-				__m128i tex_11 = _mm_cvtepu8_epi32(_mm_shuffle_epi32(px, _MM_SHUFFLE(0, 0, 0, 3)));
-
-				tex_00 = _mm_add_epi32(_mm_mullo_epi32(tex_00, mufi_), _mm_mullo_epi32(tex_01, mufi_n));
-				tex_10 = _mm_add_epi32(_mm_mullo_epi32(tex_10, mufi_), _mm_mullo_epi32(tex_10, mufi_n));
-				
-				tex_00 = _mm_add_epi32(_mm_mullo_epi32(tex_00, mvfi_), _mm_mullo_epi32(tex_10, mvfi_n));
-				tex_00 = _mm_srli_epi32(tex_00, 16);
-
-				tex_00 = _mm_packus_epi32(tex_00, tex_00);
-				tex_00 = _mm_packus_epi16(tex_00, tex_00);
-				pixel = _mm_cvtsi128_si32(tex_00);
+				pixel = Ops::Filter(px, mufi_, mufi_n, mvfi_, mvfi_n);
 #if 0
 				//top    = c0 * a + c1 * (1-a)
 				//bottom = c2 * a + c3 * (1-a)
@@ -440,21 +543,13 @@ static void PixelFlush(PolyParam* pp, text_info* texture, __m128 x, __m128 y, u8
 			}
 
 			if (pp_IgnoreTexA) {
-#ifdef __SSE4_1__
-            textel.mm = _mm_or_si128(textel.mm, const_setAlpha);
-#else
-				textel = _mm_or_si128(textel, const_setAlpha);
-#endif
+				textel.mm = _mm_or_si128(textel.mm, const_setAlpha);
 			}
 
 			if (pp_ShadInstr == 0){
 					//color.rgb = texcol.rgb;
 					//color.a = texcol.a;
-#ifdef __SSE4_1__
-            rv = textel.mm;
-#else
-            rv = textel;
-#endif
+				rv = textel.mm;
 			}
 			else if (pp_ShadInstr == 1) {
 				//color.rgb *= texcol.rgb;
@@ -464,16 +559,11 @@ static void PixelFlush(PolyParam* pp, text_info* texture, __m128 x, __m128 y, u8
 				rv = _mm_or_si128(rv, const_setAlpha);
 
 				//color *= texcol
-				__m128i lo_rv = _mm_cvtepu8_epi16(rv);
-				__m128i hi_rv = _mm_cvtepu8_epi16(_mm_shuffle_epi32(rv, _MM_SHUFFLE(1, 0, 3, 2)));
+				__m128i lo_rv = Ops::WidenLo(rv);
+				__m128i hi_rv = Ops::WidenHi(rv);
 
-#ifdef __SSE4_1__
-            __m128i lo_fb = _mm_cvtepu8_epi16(textel.mm);
-            __m128i hi_fb = _mm_cvtepu8_epi16(_mm_shuffle_epi32(textel.mm, _MM_SHUFFLE(1, 0, 3, 2)));
-#else
-				__m128i lo_fb = _mm_cvtepu8_epi16(textel);
-				__m128i hi_fb = _mm_cvtepu8_epi16(_mm_shuffle_epi32(textel, _MM_SHUFFLE(1, 0, 3, 2)));
-#endif
+				__m128i lo_fb = Ops::WidenLo(textel.mm);
+				__m128i hi_fb = Ops::WidenHi(textel.mm);
 
 
 				lo_rv = _mm_mullo_epi16(lo_rv, lo_fb);
@@ -485,20 +575,15 @@ static void PixelFlush(PolyParam* pp, text_info* texture, __m128 x, __m128 y, u8
 				//color.rgb=mix(color.rgb,texcol.rgb,texcol.a);
 
 				// a bit wrong atm, as it also mixes alphas
-				__m128i lo_rv = _mm_cvtepu8_epi16(rv);
-				__m128i hi_rv = _mm_cvtepu8_epi16(_mm_shuffle_epi32(rv, _MM_SHUFFLE(1, 0, 3, 2)));
+				__m128i lo_rv = Ops::WidenLo(rv);
+				__m128i hi_rv = Ops::WidenHi(rv);
 
 
-#ifdef __SSE4_1__
-				__m128i lo_fb = _mm_cvtepu8_epi16(textel.mm);
-				__m128i hi_fb = _mm_cvtepu8_epi16(_mm_shuffle_epi32(textel.mm, _MM_SHUFFLE(1, 0, 3, 2)));
-#else
-				__m128i lo_fb = _mm_cvtepu8_epi16(textel);
-				__m128i hi_fb = _mm_cvtepu8_epi16(_mm_shuffle_epi32(textel, _MM_SHUFFLE(1, 0, 3, 2)));
-#endif
+				__m128i lo_fb = Ops::WidenLo(textel.mm);
+				__m128i hi_fb = Ops::WidenHi(textel.mm);
 
-				__m128i lo_rv_alpha = _mm_shuffle_epi8(lo_fb, shuffle_alpha);
-				__m128i hi_rv_alpha = _mm_shuffle_epi8(hi_fb, shuffle_alpha);
+				__m128i lo_rv_alpha = Ops::Alpha(lo_fb);
+				__m128i hi_rv_alpha = Ops::Alpha(hi_fb);
 
 				__m128i lo_fb_alpha = _mm_sub_epi16(_mm_set1_epi16(255), lo_rv_alpha);
 				__m128i hi_fb_alpha = _mm_sub_epi16(_mm_set1_epi16(255), hi_rv_alpha);
@@ -514,12 +599,12 @@ static void PixelFlush(PolyParam* pp, text_info* texture, __m128 x, __m128 y, u8
 			}
 			else if (pp_ShadInstr == 3) {
 				//color*=texcol
-				__m128i lo_rv = _mm_cvtepu8_epi16(rv);
-				__m128i hi_rv = _mm_cvtepu8_epi16(_mm_shuffle_epi32(rv, _MM_SHUFFLE(1, 0, 3, 2)));
+				__m128i lo_rv = Ops::WidenLo(rv);
+				__m128i hi_rv = Ops::WidenHi(rv);
 
 
-				__m128i lo_fb = _mm_cvtepu8_epi16(textel);
-				__m128i hi_fb = _mm_cvtepu8_epi16(_mm_shuffle_epi32(textel, _MM_SHUFFLE(1, 0, 3, 2)));
+				__m128i lo_fb = Ops::WidenLo(textel.mm);
+				__m128i hi_fb = Ops::WidenHi(textel.mm);
 
 
 				lo_rv = _mm_mullo_epi16(lo_rv, lo_fb);
@@ -534,11 +619,7 @@ static void PixelFlush(PolyParam* pp, text_info* texture, __m128 x, __m128 y, u8
 			
 
 			//textadr = _mm_add_epi32(textadr, _mm_setr_epi32(tex_addr, tex_addr, tex_addr, tex_addr));
-#ifdef __SSE4_1__
 			//rv = textel.mm; // _mm_xor_si128(rv, textadr);
-#else
-			//rv = textel; // _mm_xor_si128(rv, textadr);
-#endif
 		}
 	}
 
@@ -549,26 +630,18 @@ static void PixelFlush(PolyParam* pp, text_info* texture, __m128 x, __m128 y, u8
 		__m128i fb = *(__m128i*)cb;
 
 #if 1
-#ifdef __SSE4_1__
-      m128i mm_rv, mm_fb;
-      mm_rv.mm = rv;
-      mm_fb.mm = fb;
-#endif
+		m128i mm_rv, mm_fb;
+		mm_rv.mm = rv;
+		mm_fb.mm = fb;
+
 		//ALPHA_TEST
 		for (int i = 0; i < 4; i++)
-      {
-#ifdef __SSE4_1__
+		{
 			if (mm_rv.m128i_i8[i * 4 + 3] < PT_ALPHA_REF)
 				mm_rv.m128i_u32[i] = mm_fb.m128i_u32[i];
-#else
-			if (rv.m128i_i8[i * 4 + 3] < PT_ALPHA_REF)
-				rv.m128i_u32[i] = fb.m128i_u32[i];
-#endif
 		}
 
-#ifdef __SSE4_1__
 		rv = mm_rv.mm;
-#endif
 #else
 		__m128i ALPHA_TEST = _mm_set1_epi8(PT_ALPHA_REF);
 		__m128i mask = _mm_cmplt_epi8(_mm_subs_epu16(ALPHA_TEST, rv), _mm_setzero_si128());
@@ -592,15 +665,15 @@ static void PixelFlush(PolyParam* pp, text_info* texture, __m128 x, __m128 y, u8
 #else
 
 
-		__m128i lo_rv = _mm_cvtepu8_epi16(rv);
-		__m128i hi_rv = _mm_cvtepu8_epi16(_mm_shuffle_epi32(rv, _MM_SHUFFLE(1, 0, 3, 2)));
+		__m128i lo_rv = Ops::WidenLo(rv);
+		__m128i hi_rv = Ops::WidenHi(rv);
 
 
-		__m128i lo_fb = _mm_cvtepu8_epi16(fb);
-		__m128i hi_fb = _mm_cvtepu8_epi16(_mm_shuffle_epi32(fb, _MM_SHUFFLE(1, 0, 3, 2)));
+		__m128i lo_fb = Ops::WidenLo(fb);
+		__m128i hi_fb = Ops::WidenHi(fb);
 
-		__m128i lo_rv_alpha = _mm_shuffle_epi8(lo_rv, shuffle_alpha);
-		__m128i hi_rv_alpha = _mm_shuffle_epi8(hi_rv, shuffle_alpha);
+		__m128i lo_rv_alpha = Ops::Alpha(lo_rv);
+		__m128i hi_rv_alpha = Ops::Alpha(hi_rv);
 
 		__m128i lo_fb_alpha = _mm_sub_epi16(_mm_set1_epi16(255), lo_rv_alpha);
 		__m128i hi_fb_alpha = _mm_sub_epi16(_mm_set1_epi16(255), hi_rv_alpha);
@@ -629,6 +702,428 @@ static void PixelFlush(PolyParam* pp, text_info* texture, __m128 x, __m128 y, u8
 	*(__m128i*)cb = rv;
 }
 
+/*
+	AVX2 kernels
+
+	The same pipeline as PixelFlush, on two rows of a 4x4 block at once. The rows of a
+	block are next to each other in render_buffer, so the 8 pixels are a single 256 bit
+	load. The unpacks, shuffles and packs used here all work within each 128 bit half,
+	so every row stays in its own half and goes through exactly the same math as in the
+	SSE version. The output is the same, down to the float rounding the compiler is free
+	to change with -ffast-math.
+
+	They are only used if the host supports AVX2 (see DetectISA), so they are compiled
+	for AVX2 with a target attribute instead of for the whole file, like the SSE4.1 ones.
+*/
+#if defined(_MSC_VER)
+#define SR_AVX2
+#else
+#define SR_AVX2 __attribute__((target("avx2")))
+#endif
+
+enum SoftrendISA
+{
+	ISA_SSE2,
+	ISA_SSE41,
+	ISA_AVX2,
+};
+
+static SoftrendISA softrend_isa;
+
+static SoftrendISA DetectISA()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+
+	__cpuid(info, 1);
+	bool sse41 = (info[2] >> 19) & 1;
+	bool osxsave = (info[2] >> 27) & 1;
+	bool avx = (info[2] >> 28) & 1;
+	bool avx2 = false;
+
+	//the os has to save the ymm registers too
+	if (max_leaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] >> 5) & 1;
+	}
+#else
+	__builtin_cpu_init();
+	bool sse41 = __builtin_cpu_supports("sse4.1");
+	bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+	if (avx2 && sse41)
+		return ISA_AVX2;
+	else if (sse41)
+		return ISA_SSE41;
+	else
+		return ISA_SSE2;
+}
+
+struct PlaneStepper8
+{
+	__m256 ddx, ddy;
+	__m256 c;
+
+	SR_AVX2 void Setup(const PlaneStepper& ps)
+	{
+		ddx = _mm256_broadcast_ps(&ps.ddx);
+		ddy = _mm256_broadcast_ps(&ps.ddy);
+		c = _mm256_broadcast_ps(&ps.c);
+	}
+
+	SR_AVX2 __forceinline __m256 Ip(__m256 x, __m256 y) const
+	{
+		__m256 p1 = _mm256_mul_ps(x, ddx);
+		__m256 p2 = _mm256_mul_ps(y, ddy);
+
+		__m256 s1 = _mm256_add_ps(p1, p2);
+		return _mm256_add_ps(s1, c);
+	}
+
+	SR_AVX2 __forceinline __m256 InStep(__m256 bas) const
+	{
+		return _mm256_add_ps(bas, ddx);
+	}
+};
+
+struct IPs8
+{
+	PlaneStepper8 ZUV;
+	PlaneStepper8 Col;
+};
+
+//color = a * rb + b * (255 - rb), rb is the alpha of the pixels in rb
+SR_AVX2 __forceinline static __m256i BlendAlpha8(__m256i a, __m256i b, __m256i rb)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i shuffle = _mm256_broadcastsi128_si256(shuffle_alpha);
+
+	__m256i lo_a = _mm256_unpacklo_epi8(a, zero);
+	__m256i hi_a = _mm256_unpackhi_epi8(a, zero);
+
+	__m256i lo_b = _mm256_unpacklo_epi8(b, zero);
+	__m256i hi_b = _mm256_unpackhi_epi8(b, zero);
+
+	__m256i lo_a_alpha = _mm256_shuffle_epi8(_mm256_unpacklo_epi8(rb, zero), shuffle);
+	__m256i hi_a_alpha = _mm256_shuffle_epi8(_mm256_unpackhi_epi8(rb, zero), shuffle);
+
+	__m256i lo_b_alpha = _mm256_sub_epi16(_mm256_set1_epi16(255), lo_a_alpha);
+	__m256i hi_b_alpha = _mm256_sub_epi16(_mm256_set1_epi16(255), hi_a_alpha);
+
+	lo_a = _mm256_mullo_epi16(lo_a, lo_a_alpha);
+	hi_a = _mm256_mullo_epi16(hi_a, hi_a_alpha);
+
+	lo_b = _mm256_mullo_epi16(lo_b, lo_b_alpha);
+	hi_b = _mm256_mullo_epi16(hi_b, hi_b_alpha);
+
+	return _mm256_packus_epi16(_mm256_srli_epi16(_mm256_adds_epu16(lo_a, lo_b), 8), _mm256_srli_epi16(_mm256_adds_epu16(hi_a, hi_b), 8));
+}
+
+//color = a * b, per channel
+SR_AVX2 __forceinline static __m256i Modulate8(__m256i a, __m256i b)
+{
+	__m256i zero = _mm256_setzero_si256();
+
+	__m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+	__m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+
+	return _mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8));
+}
+
+SR_AVX2 __forceinline static __m256i TextureFetch8(text_info* texture, __m256 u, __m256 v)
+{
+	__m256i ui = _mm256_cvttps_epi32(u);
+	__m256i vi = _mm256_cvttps_epi32(v);
+
+	__m256 uf = _mm256_sub_ps(u, _mm256_cvtepi32_ps(ui));
+	__m256 vf = _mm256_sub_ps(v, _mm256_cvtepi32_ps(vi));
+
+	__m256i ufi = _mm256_cvttps_epi32(_mm256_mul_ps(uf, _mm256_set1_ps(256)));
+	__m256i vfi = _mm256_cvttps_epi32(_mm256_mul_ps(vf, _mm256_set1_ps(256)));
+
+	__m256i ufi_n = _mm256_sub_epi32(_mm256_set1_epi32(255), ufi);
+	__m256i vfi_n = _mm256_sub_epi32(_mm256_set1_epi32(255), vfi);
+
+	//the SSE version takes u and v from the 16 bit halves of (v<<16)+u, textures are
+	//powers of two up to 1024 so only the low bits of each half matter
+	__m256i textadr = _mm256_add_epi32(_mm256_slli_epi32(vi, 16), ui);
+	__m256i tu = _mm256_and_si256(textadr, _mm256_set1_epi32(texture->width - 1));
+	__m256i tv = _mm256_and_si256(_mm256_srai_epi32(textadr, 16), _mm256_set1_epi32(texture->height - 1));
+
+	//each texel is 16 bytes, the 4 pixels needed for filtering
+	__m256i idx = _mm256_slli_epi32(_mm256_add_epi32(tu, _mm256_mullo_epi32(tv, _mm256_set1_epi32(texture->width))), 2);
+
+	const int* base = (const int*)texture->pdata;
+	__m256i px00 = _mm256_i32gather_epi32(base, idx, 4);
+	__m256i px01 = _mm256_i32gather_epi32(base, _mm256_add_epi32(idx, _mm256_set1_epi32(1)), 4);
+	__m256i px10 = _mm256_i32gather_epi32(base, _mm256_add_epi32(idx, _mm256_set1_epi32(2)), 4);
+
+	__m256i mask = _mm256_set1_epi32(0xFF);
+	__m256i rv = _mm256_setzero_si256();
+
+	for (int i = 0; i < 4; i++)
+	{
+		__m256i tex_00 = _mm256_and_si256(_mm256_srli_epi32(px00, i * 8), mask);
+		__m256i tex_01 = _mm256_and_si256(_mm256_srli_epi32(px01, i * 8), mask);
+		__m256i tex_10 = _mm256_and_si256(_mm256_srli_epi32(px10, i * 8), mask);
+
+		tex_00 = _mm256_add_epi32(_mm256_mullo_epi32(tex_00, ufi), _mm256_mullo_epi32(tex_01, ufi_n));
+		tex_10 = _mm256_add_epi32(_mm256_mullo_epi32(tex_10, ufi), _mm256_mullo_epi32(tex_10, ufi_n));
+
+		tex_00 = _mm256_add_epi32(_mm256_mullo_epi32(tex_00, vfi), _mm256_mullo_epi32(tex_10, vfi_n));
+		tex_00 = _mm256_srli_epi32(tex_00, 16);
+
+		//saturate the way the 32 -> 16 -> 8 bit packs of the SSE version do
+		__m256i negative = _mm256_cmpgt_epi32(tex_00, _mm256_set1_epi32(32767));
+		tex_00 = _mm256_andnot_si256(negative, _mm256_min_epi32(tex_00, mask));
+
+		rv = _mm256_or_si256(rv, _mm256_slli_epi32(tex_00, i * 8));
+	}
+
+	return rv;
+}
+
+TPL_DECL_pixel
+SR_AVX2 __forceinline static void PixelFlush8(PolyParam* pp, text_info* texture, __m256 x, __m256 y, u8* cb, __m256 oldmask, const IPs8& ip)
+{
+	__m256 invW = ip.ZUV.Ip(x, y);
+	__m256 u = ip.ZUV.InStep(invW);
+	__m256 v = ip.ZUV.InStep(u);
+	__m256 ws = ip.ZUV.InStep(v);
+
+	//_MM_TRANSPOSE4_PS on each row
+	__m256 t0 = _mm256_unpacklo_ps(invW, u);
+	__m256 t1 = _mm256_unpacklo_ps(v, ws);
+	__m256 t2 = _mm256_unpackhi_ps(invW, u);
+	__m256 t3 = _mm256_unpackhi_ps(v, ws);
+
+	invW = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+	u = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+	v = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+
+	u = _mm256_div_ps(u, invW);
+	v = _mm256_div_ps(v, invW);
+
+	float* zb = (float*)&cb[Z_BUFFER_PIXEL_OFFSET * 4];
+	__m256 zold = _mm256_loadu_ps(zb);
+
+	__m256 ZMask = _mm256_cmp_ps(invW, zold, _CMP_GE_OS);
+	if (useoldmsk)
+		ZMask = _mm256_and_ps(oldmask, ZMask);
+	u32 msk = _mm256_movemask_ps(ZMask);//0xFF
+
+	if (msk == 0)
+		return;
+
+	__m256i const_alpha = _mm256_set1_epi32(0xFF000000);
+	__m256i fb = _mm256_loadu_si256((__m256i*)cb);
+	__m256i rv;
+
+	{
+		__m256 a = ip.Col.Ip(x, y);
+		__m256 b = ip.Col.InStep(a);
+		__m256 c = ip.Col.InStep(b);
+		__m256 d = ip.Col.InStep(c);
+
+		__m256i ab = _mm256_packs_epi32(_mm256_cvttps_epi32(a), _mm256_cvttps_epi32(b));
+		__m256i cd = _mm256_packs_epi32(_mm256_cvttps_epi32(c), _mm256_cvttps_epi32(d));
+
+		rv = _mm256_packus_epi16(ab, cd);
+
+		if (!pp_UseAlpha) {
+			rv = _mm256_or_si256(rv, const_alpha);
+		}
+
+		if (pp_Texture) {
+			__m256i textel = TextureFetch8(texture, u, v);
+
+			if (pp_IgnoreTexA) {
+				textel = _mm256_or_si256(textel, const_alpha);
+			}
+
+			if (pp_ShadInstr == 0) {
+				//color.rgb = texcol.rgb;
+				//color.a = texcol.a;
+				rv = textel;
+			}
+			else if (pp_ShadInstr == 1) {
+				//color.rgb *= texcol.rgb;
+				//color.a = texcol.a;
+				rv = Modulate8(_mm256_or_si256(rv, const_alpha), textel);
+			}
+			else if (pp_ShadInstr == 2) {
+				//color.rgb=mix(color.rgb,texcol.rgb,texcol.a);
+				rv = BlendAlpha8(rv, textel, textel);
+			}
+			else if (pp_ShadInstr == 3) {
+				//color*=texcol
+				rv = Modulate8(rv, textel);
+			}
+		}
+	}
+
+	//Alpha test
+	if (alpha_mode == 1) {
+		//the alpha is compared as a signed byte, promoted to unsigned
+		__m256i alpha = _mm256_srai_epi32(rv, 24);
+		__m256i ref = _mm256_set1_epi32(PT_ALPHA_REF);
+		__m256i not_less = _mm256_cmpeq_epi32(_mm256_max_epu32(alpha, ref), alpha);
+
+		rv = _mm256_blendv_epi8(fb, rv, not_less);
+	}
+	else if (alpha_mode == 2) {
+		rv = BlendAlpha8(rv, fb, rv);
+	}
+
+	if (msk != 0xFF)
+	{
+		__m256i zmask = _mm256_castps_si256(ZMask);
+
+		rv = _mm256_or_si256(_mm256_and_si256(rv, zmask), _mm256_andnot_si256(zmask, fb));
+		invW = _mm256_or_ps(_mm256_and_ps(invW, ZMask), _mm256_andnot_ps(ZMask, zold));
+	}
+
+	_mm256_storeu_ps(zb, invW);
+	_mm256_storeu_si256((__m256i*)cb, rv);
+}
+
+//edges of the three half spaces for the rows of the block, the whole block is covered if null
+struct BlockEdges
+{
+	float cy[3];
+	float fdx[3];
+	float fdy[3];
+};
+
+//a 4x4 block, as two pairs of rows
+TPL_DECL_triangle
+SR_AVX2 static void FlushBlock8(PolyParam* pp, text_info* texture, __m128 x_ps, __m128 y_ps, u8* cb, IPs& ip, const BlockEdges* edges)
+{
+	IPs8 ip8;
+	ip8.ZUV.Setup(ip.ZUV);
+	ip8.Col.Setup(ip.Col);
+
+	__m128 ones = _mm_set1_ps(1);
+	__m128 y[4];
+	y[0] = y_ps;
+	for (int i = 1; i < 4; i++)
+		y[i] = _mm_add_ps(y[i - 1], ones);
+
+	__m256 x = _mm256_set1_ps(_mm_cvtss_f32(x_ps));
+	__m256 y01 = _mm256_insertf128_ps(_mm256_castps128_ps256(y[0]), y[1], 1);
+	__m256 y23 = _mm256_insertf128_ps(_mm256_castps128_ps256(y[2]), y[3], 1);
+
+	if (!edges)
+	{
+		PixelFlush8 TPL_PRMS_pixel(false) (pp, texture, x, y01, cb, x, ip8);
+		PixelFlush8 TPL_PRMS_pixel(false) (pp, texture, x, y23, cb + 2 * sizeof(__m128), x, ip8);
+		return;
+	}
+
+	//the rows are stepped the same way as in Rendtriangle, so the coverage is the same
+	__m128 pcy[3][4];
+	for (int e = 0; e < 3; e++)
+	{
+		pcy[e][0] = _mm_load_scaled_float(edges->cy[e], -edges->fdy[e]);
+		for (int i = 1; i < 4; i++)
+			pcy[e][i] = _mm_add_ps(pcy[e][i - 1], _mm_broadcast_float(edges->fdx[e]));
+	}
+
+	for (int i = 0; i < 4; i += 2)
+	{
+		__m256 summary = _mm256_setzero_ps();
+		for (int e = 0; e < 3; e++)
+		{
+			__m256 cy = _mm256_insertf128_ps(_mm256_castps128_ps256(pcy[e][i]), pcy[e][i + 1], 1);
+			summary = _mm256_or_ps(summary, _mm256_cmp_ps(cy, _mm256_setzero_ps(), _CMP_LE_OS));
+		}
+
+		__m256 covered = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_castps_si256(summary), _mm256_setzero_si256()));
+		int msk = _mm256_movemask_ps(covered);
+
+		if (msk == 0xFF)
+			PixelFlush8 TPL_PRMS_pixel(false) (pp, texture, x, i ? y23 : y01, cb + i * sizeof(__m128), covered, ip8);
+		else if (msk != 0)
+			PixelFlush8 TPL_PRMS_pixel(true) (pp, texture, x, i ? y23 : y01, cb + i * sizeof(__m128), covered, ip8);
+	}
+}
+
+//a 4x4 block, one row at a time
+TPL_DECL_triangle_ops
+static void FlushBlock4(PolyParam* pp, text_info* texture, __m128 x_ps, __m128 y_ps, u8* cb, IPs& ip, const BlockEdges* edges)
+{
+	static DECL_ALIGN(16) float ones_ps[4] = { 1, 1, 1, 1 };
+	const int q = 4;
+
+	// Accept whole block when totally covered
+	if (!edges)
+	{
+		__m128 yl_ps = y_ps;
+		for (int iy = q; iy > 0; iy--)
+		{
+			PixelFlush TPL_PRMS_pixel_ops(false) (pp, texture, x_ps, yl_ps, cb, x_ps, ip);
+			yl_ps = _mm_add_ps(yl_ps, *(__m128*)ones_ps);
+			cb += sizeof(__m128);
+		}
+	}
+	else // Partially covered block
+	{
+		__m128 pfdx12 = _mm_broadcast_float(edges->fdx[0]);
+		__m128 pfdx23 = _mm_broadcast_float(edges->fdx[1]);
+		__m128 pfdx31 = _mm_broadcast_float(edges->fdx[2]);
+
+		__m128 pcy1 = _mm_load_scaled_float(edges->cy[0], -edges->fdy[0]);
+		__m128 pcy2 = _mm_load_scaled_float(edges->cy[1], -edges->fdy[1]);
+		__m128 pcy3 = _mm_load_scaled_float(edges->cy[2], -edges->fdy[2]);
+
+		__m128 pzero = _mm_setzero_ps();
+
+		__m128 yl_ps = y_ps;
+
+		for (int iy = q; iy > 0; iy--)
+		{
+			__m128 mask1 = _mm_cmple_ps(pcy1, pzero);
+			__m128 mask2 = _mm_cmple_ps(pcy2, pzero);
+			__m128 mask3 = _mm_cmple_ps(pcy3, pzero);
+			__m128 summary = _mm_or_ps(mask3, _mm_or_ps(mask2, mask1));
+
+			__m128i a = _mm_cmpeq_epi32((__m128i&)summary, (__m128i&)pzero);
+			int msk = _mm_movemask_ps((__m128&)a);
+
+			if (msk != 0)
+			{
+				if (msk != 0xF)
+					PixelFlush TPL_PRMS_pixel_ops(true) (pp, texture, x_ps, yl_ps, cb, *(__m128*)&a, ip);
+				else
+					PixelFlush TPL_PRMS_pixel_ops(false) (pp, texture, x_ps, yl_ps, cb, *(__m128*)&a, ip);
+			}
+
+			yl_ps = _mm_add_ps(yl_ps, *(__m128*)ones_ps);
+			cb += sizeof(__m128);
+
+			pcy1 = _mm_add_ps(pcy1, pfdx12);
+			pcy2 = _mm_add_ps(pcy2, pfdx23);
+			pcy3 = _mm_add_ps(pcy3, pfdx31);
+		}
+	}
+}
+
+TPL_DECL_triangle
+SR_SSE41 SR_FLATTEN static void FlushBlockSSE41(PolyParam* pp, text_info* texture, __m128 x_ps, __m128 y_ps, u8* cb, IPs& ip, const BlockEdges* edges)
+{
+	FlushBlock4 TPL_PRMS_triangle_ops(SSE41Ops) (pp, texture, x_ps, y_ps, cb, ip, edges);
+}
+
+TPL_DECL_triangle
+static void FlushBlockSSE2(PolyParam* pp, text_info* texture, __m128 x_ps, __m128 y_ps, u8* cb, IPs& ip, const BlockEdges* edges)
+{
+	FlushBlock4 TPL_PRMS_triangle_ops(SSE2Ops) (pp, texture, x_ps, y_ps, cb, ip, edges);
+}
+
 //u32 nok,fok;
 TPL_DECL_triangle
 static void Rendtriangle(PolyParam* pp, int vertex_offset, const Vertex &v1, const Vertex &v2, const Vertex &v3, u32* colorBuffer, RECT* area)
@@ -772,7 +1267,6 @@ static void Rendtriangle(PolyParam* pp, int vertex_offset, const Vertex &v1, con
 	
 	__m128 y_ps = _mm_broadcast_float(miny);
 	__m128 minx_ps = _mm_load_scaled_float(minx - q, 1);
-	static DECL_ALIGN(16) float ones_ps[4] = { 1, 1, 1, 1 };
 	static DECL_ALIGN(16) float q_ps[4] = { q, q, q, q };
 
 	// Loop through blocks
@@ -802,74 +1296,22 @@ static void Rendtriangle(PolyParam* pp, int vertex_offset, const Vertex &v1, con
 
 			bool all = EvalHalfSpaceFAll(Xhs12, Xhs23, Xhs31, MAX_12, MAX_23, MAX_31);
 
-			// Accept whole block when totally covered
-			if (all)
-			{
-				__m128 yl_ps = y_ps;
-				for (int iy = q; iy > 0; iy--)
-				{
-					PixelFlush TPL_PRMS_pixel(false) (pp, &texture, x_ps, yl_ps, cb_x, x_ps, ip);
-					yl_ps = _mm_add_ps(yl_ps, *(__m128*)ones_ps);
-					cb_x += sizeof(__m128);
-				}
-			}
-			else // Partially covered block
-			{
-				float CY1 = C1_pm + Xhs12;
-				float CY2 = C2_pm + Xhs23;
-				float CY3 = C3_pm + Xhs31;
-
-				__m128 pfdx12 = _mm_broadcast_float(FDX12);
-				__m128 pfdx23 = _mm_broadcast_float(FDX23);
-				__m128 pfdx31 = _mm_broadcast_float(FDX31);
-
-				__m128 pcy1 = _mm_load_scaled_float(CY1, -FDY12);
-				__m128 pcy2 = _mm_load_scaled_float(CY2, -FDY23);
-				__m128 pcy3 = _mm_load_scaled_float(CY3, -FDY31);
-
-				__m128 pzero = _mm_setzero_ps();
-
-				//bool ok=false;
-				__m128 yl_ps = y_ps;
-
-				for (int iy = q; iy > 0; iy--)
-				{
-					__m128 mask1 = _mm_cmple_ps(pcy1, pzero);
-					__m128 mask2 = _mm_cmple_ps(pcy2, pzero);
-					__m128 mask3 = _mm_cmple_ps(pcy3, pzero);
-					__m128 summary = _mm_or_ps(mask3, _mm_or_ps(mask2, mask1));
-
-					__m128i a = _mm_cmpeq_epi32((__m128i&)summary, (__m128i&)pzero);
-					int msk = _mm_movemask_ps((__m128&)a);
-
-					if (msk != 0)
-					{
-						if (msk != 0xF)
-							PixelFlush TPL_PRMS_pixel(true) (pp, &texture, x_ps, yl_ps, cb_x, *(__m128*)&a, ip);
-						else
-							PixelFlush TPL_PRMS_pixel(false) (pp, &texture, x_ps, yl_ps, cb_x, *(__m128*)&a, ip);
-					}
-
-					yl_ps = _mm_add_ps(yl_ps, *(__m128*)ones_ps);
-					cb_x += sizeof(__m128);
-
-					//CY1 += FDX12mq;
-					//CY2 += FDX23mq;
-					//CY3 += FDX31mq;
-					pcy1 = _mm_add_ps(pcy1, pfdx12);
-					pcy2 = _mm_add_ps(pcy2, pfdx23);
-					pcy3 = _mm_add_ps(pcy3, pfdx31);
-				}
-				/*
-				if (!ok)
-				{
-				nok++;
-				}
-				else
-				{
-				fok++;
-				}*/
-			}
+			// Accept whole block when totally covered, else the edges give the coverage of each pixel
+			BlockEdges edges = {
+				{ C1_pm + Xhs12, C2_pm + Xhs23, C3_pm + Xhs31 },
+				{ FDX12, FDX23, FDX31 },
+				{ FDY12, FDY23, FDY31 }
+			};
+			const BlockEdges* block_edges = all ? 0 : &edges;
+
+			if (softrend_isa == ISA_AVX2)
+				FlushBlock8 TPL_PRMS_triangle (pp, &texture, x_ps, y_ps, cb_x, ip, block_edges);
+			else if (softrend_isa == ISA_SSE41)
+				FlushBlockSSE41 TPL_PRMS_triangle (pp, &texture, x_ps, y_ps, cb_x, ip, block_edges);
+			else
+				FlushBlockSSE2 TPL_PRMS_triangle (pp, &texture, x_ps, y_ps, cb_x, ip, block_edges);
+
+			cb_x += q*q * 4;
 		}
 	next_y:
 		hs12 += FDqX12;
@@ -881,6 +1323,28 @@ static void Rendtriangle(PolyParam* pp, int vertex_offset, const Vertex &v1, con
 }
 
 
+/*
+	Tile binning
+
+	The frame is split in 32x32 tiles, like the PVR does it. The triangles of each list
+	are binned in submission order to the tiles their bounding box touches, and then
+	the tiles are rendered in parallel, each one only going through its own bins. A
+	tile only writes to its own part of render_buffer, and sees the triangles in the
+	same order as a single threaded render would, so the result doesn't depend on the
+	number of threads.
+*/
+#define TILE_SIZE 32
+#define TILES_X (MAX_RENDER_WIDTH / TILE_SIZE)
+#define TILES_Y (MAX_RENDER_HEIGHT / TILE_SIZE)
+
+struct TileTri
+{
+	u32 param;		//index in the param list
+	u32 vtx;		//triangle in the strip
+};
+
+static vector<TileTri> tile_bins[3][TILES_X * TILES_Y];
+
 struct softrend : Renderer
 {
 	virtual bool Process(TA_context* ctx) {
@@ -898,15 +1362,18 @@ struct softrend : Renderer
 
 	
 
-	template <int alpha_mode>
-	void RenderParamList(List<PolyParam>* param_list, RECT* area) {
-		
+	//adds the triangles of a list to the bins of the tiles they overlap
+	void BinParamList(List<PolyParam>* param_list, vector<TileTri>* bins) {
+
 		Vertex* verts = pvrrc.verts.head();
 		u16* idx = pvrrc.idx.head();
 
 		PolyParam* params = param_list->head();
 		int param_count = param_list->used();
 
+		for (int i = 0; i < TILES_X * TILES_Y; i++)
+			bins[i].clear();
+
 		for (int i = 0; i < param_count; i++)
 		{
 			int vertex_count = params[i].count - 2;
@@ -914,13 +1381,55 @@ struct softrend : Renderer
 			u16* poly_idx = &idx[params[i].first];
 
 			for (int v = 0; v < vertex_count; v++) {
-				////<alpha_blend, pp_UseAlpha, pp_Texture, pp_IgnoreTexA, pp_ShadInstr, pp_Offset >
-				RendtriangleFn fn = RendtriangleFns[alpha_mode][params[i].tsp.UseAlpha][params[i].pcw.Texture][params[i].tsp.IgnoreTexA][params[i].tsp.ShadInstr][params[i].pcw.Offset];
-
-				fn(&params[i], v, verts[poly_idx[v]], verts[poly_idx[v + 1]], verts[poly_idx[v + 2]], render_buffer, area);
+				const Vertex &v1 = verts[poly_idx[v]];
+				const Vertex &v2 = verts[poly_idx[v + 1]];
+				const Vertex &v3 = verts[poly_idx[v + 2]];
+
+				float minx = min(v1.x, min(v2.x, v3.x));
+				float miny = min(v1.y, min(v2.y, v3.y));
+				float maxx = max(v1.x, max(v2.x, v3.x)) + 0.5f;
+				float maxy = max(v1.y, max(v2.y, v3.y)) + 0.5f;
+
+				//also rejects NaNs
+				if (!(maxx >= 0 && maxy >= 0 && minx < MAX_RENDER_WIDTH && miny < MAX_RENDER_HEIGHT))
+					continue;
+
+				//clamped before converting, like Rendtriangle does
+				int tx0 = iround(max(minx, 0.f)) / TILE_SIZE;
+				int ty0 = iround(max(miny, 0.f)) / TILE_SIZE;
+				int tx1 = iround(min(maxx, MAX_RENDER_WIDTH - 1.f)) / TILE_SIZE;
+				int ty1 = iround(min(maxy, MAX_RENDER_HEIGHT - 1.f)) / TILE_SIZE;
+
+				TileTri tt = { (u32)i, (u32)v };
+
+				for (int ty = ty0; ty <= ty1; ty++)
+					for (int tx = tx0; tx <= tx1; tx++)
+						bins[ty * TILES_X + tx].push_back(tt);
 			}
 		}
 	}
+
+	template <int alpha_mode>
+	void RenderTileList(List<PolyParam>* param_list, vector<TileTri>& bin, RECT* area) {
+		
+		Vertex* verts = pvrrc.verts.head();
+		u16* idx = pvrrc.idx.head();
+
+		PolyParam* params = param_list->head();
+
+		for (size_t i = 0; i < bin.size(); i++)
+		{
+			PolyParam* pp = &params[bin[i].param];
+			int v = bin[i].vtx;
+
+			u16* poly_idx = &idx[pp->first];
+
+			////<alpha_blend, pp_UseAlpha, pp_Texture, pp_IgnoreTexA, pp_ShadInstr, pp_Offset >
+			RendtriangleFn fn = RendtriangleFns[alpha_mode][pp->tsp.UseAlpha][pp->pcw.Texture][pp->tsp.IgnoreTexA][pp->tsp.ShadInstr][pp->pcw.Offset];
+
+			fn(pp, v, verts[poly_idx[v]], verts[poly_idx[v + 1]], verts[poly_idx[v + 2]], render_buffer, area);
+		}
+	}
 	virtual bool Render() {
 		bool is_rtt = pvrrc.isRTT;
 
@@ -932,21 +1441,25 @@ struct softrend : Renderer
       if (pvrrc.render_passes.head()[0].autosort)
 			SortPParams(0, pvrrc.global_param_tr.used());
 
+		BinParamList(&pvrrc.global_param_op, tile_bins[0]);
+		BinParamList(&pvrrc.global_param_pt, tile_bins[1]);
+		BinParamList(&pvrrc.global_param_tr, tile_bins[2]);
+
 		int tcount = omp_get_num_procs() - 1;
 		if (tcount == 0) tcount = 1;
 		if (tcount > settings.pvr.MaxThreads) tcount = settings.pvr.MaxThreads;
-#pragma omp parallel num_threads(tcount)
+
+		//tiles cost very different amounts of work, so they are handed out one by one
+#pragma omp parallel for num_threads(tcount) schedule(dynamic, 1)
+		for (int tile = 0; tile < TILES_X * TILES_Y; tile++)
 		{
-			int thd = omp_get_thread_num();
-			int y_offs = 480 % omp_get_num_threads();
-			int y_thd = 480 / omp_get_num_threads();
-			int y_start = (!!thd) * y_offs + y_thd * thd;
-			int y_end =  y_offs + y_thd * (thd + 1);
-
-			RECT area = { 0, y_start, 640, y_end };
-			RenderParamList<0>(&pvrrc.global_param_op, &area);
-			RenderParamList<1>(&pvrrc.global_param_pt, &area);
-			RenderParamList<2>(&pvrrc.global_param_tr, &area);
+			int tx = tile % TILES_X;
+			int ty = tile / TILES_X;
+
+			RECT area = { tx * TILE_SIZE, ty * TILE_SIZE, (tx + 1) * TILE_SIZE, (ty + 1) * TILE_SIZE };
+			RenderTileList<0>(&pvrrc.global_param_op, tile_bins[0][tile], &area);
+			RenderTileList<1>(&pvrrc.global_param_pt, tile_bins[1][tile], &area);
+			RenderTileList<2>(&pvrrc.global_param_tr, tile_bins[2][tile], &area);
 		}
 
 		
@@ -969,6 +1482,8 @@ struct softrend : Renderer
 
 
 	virtual bool Init() {
+		softrend_isa = DetectISA();
+
 		const_setAlpha = _mm_set1_epi32(0xFF000000);
 		u8 ushuffle[] = { 0x0E, 0x80, 0x0E, 0x80, 0x0E, 0x80, 0x0E, 0x80, 0x06, 0x80, 0x06, 0x80, 0x06, 0x80, 0x06, 0x80};
 		memcpy(&shuffle_alpha, ushuffle, sizeof(shuffle_alpha));
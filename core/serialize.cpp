@@ -0,0 +1,356 @@
+/*
+	Savestates
+
+	Loading a state is also what run-ahead and rewind do every frame, so it tries to
+	disturb as little as possible: ram, vram and aram are compared page by page with
+	the state and only the pages that differ are written. The dynarec only drops the
+	blocks on those pages, and the texture cache only the textures on them (writes to
+	locked vram pages go through the usual VramLockedWrite path).
+
+	Saving does the same against the destination buffer, so saving every frame to the
+	same buffer only writes the pages that were modified since the last save.
+
+	This is a diff, not dirty page tracking: every save and load still reads all of
+	the memory (26 MB) to compare it, what it saves is the writes and the
+	invalidations. Tracking the modified pages would need every write path to mark
+	them, and too many of them don't go through a common function: the fastmem stores
+	of the recompilers (through any of the ram mirrors), the direct pointers of the
+	_vmem handlers, DMA, the arm7 on aram and the renderers on vram. Write protection
+	can't stand in for them, the mirrors map the same memory so each one would need
+	protecting, and the vram protection already belongs to the texture cache.
+*/
+#include "types.h"
+#include "serialize.h"
+
+#include "hw/sh4/sh4_if.h"
+#include "hw/sh4/sh4_mem.h"
+#include "hw/sh4/sh4_mmr.h"
+#include "hw/sh4/sh4_sched.h"
+#include "hw/sh4/modules/mmu.h"
+#include "hw/sh4/dyna/blockmanager.h"
+#include "hw/holly/sb.h"
+#include "hw/pvr/pvr_mem.h"
+#include "hw/pvr/pvr_regs.h"
+#include "hw/pvr/ta_ctx.h"
+#include "hw/aica/aica.h"
+#include "hw/arm7/arm7.h"
+#include "hw/gdrom/gdromv3.h"
+#include "hw/maple/maple_if.h"
+#include "hw/maple/maple_devs.h"
+#include "hw/naomi/naomi.h"
+#include "hw/flashrom/flashrom.h"
+#include "rend/TexCache.h"
+
+//sh4
+extern Array<u8> OnChipRAM;
+extern Array<RegisterStruct> SCI;
+extern Array<RegisterStruct> SCIF;
+extern u32 CCN_QACR_TR[2];
+extern u32 sq_remap[64];
+
+extern u32 tmu_shift[3];
+extern u32 tmu_mask[3];
+extern u64 tmu_mask64[3];
+extern u32 old_mode[3];
+extern u32 tmu_ch_base[3];
+extern u64 tmu_ch_base64[3];
+
+extern u16 IRLPriority;
+extern u16 InterruptEnvId[32];
+extern u32 InterruptBit[32];
+extern u32 InterruptLevelBit[16];
+extern u32 interrupt_vpend;
+extern u32 interrupt_vmask;
+extern u32 decoded_srimask;
+
+extern u32 old_rm;
+extern u32 old_dn;
+void SetFloatStatusReg();
+
+//holly
+extern u32 SB_FFST_rc;
+
+//pvr
+extern u32 in_vblank;
+extern u32 clc_pvr_scanline;
+extern u32 pvr_numscanlines;
+extern u32 prv_cur_scanline;
+extern u32 vblk_cnt;
+extern u32 Line_Cycles;
+extern u32 Frame_Cycles;
+
+extern u32 YUV_tempdata[512/4];
+extern u32 YUV_dest;
+extern u32 YUV_blockcount;
+extern u32 YUV_x_curr;
+extern u32 YUV_y_curr;
+extern u32 YUV_x_size;
+extern u32 YUV_y_size;
+
+extern u8 ta_fsm[2049];
+extern u32 ta_fsm_cl;
+
+//aica
+extern u32 ARMRST;
+extern u32 rtc_EN;
+extern s32 aica_pending_dma;
+
+//maple
+extern u32 dmacount;
+extern bool maple_ddt_pending_reset;
+
+//flash/sram
+extern SRamChip sys_nvmem_sram;
+extern DCFlashChip sys_nvmem_flash;
+
+//sh4 mmr arrays keep the register values in data32, unless there is a read handler
+static void serialize_regs(dc_state& st,Array<RegisterStruct>& regs)
+{
+	for (u32 i=0;i<regs.Size;i++)
+	{
+		bool has_data=!(regs.data[i].flags & REG_RF);
+		u32 data=has_data?regs.data[i].data32:0;
+
+		st(data);
+
+		if (st.load && has_data)
+			regs.data[i].data32=data;
+	}
+}
+
+//compares all of mem with the state, only the pages that differ are copied. ram_base is the
+//sh4 address of the ram for the dynarec
+static void serialize_mem_diff(dc_state& st,u8* mem,u32 size,u32 ram_base)
+{
+	if (!st.data)
+	{
+		st.size+=size;
+		return;
+	}
+
+	if (st.failed || st.size+size>st.limit)
+	{
+		st.failed=true;
+		return;
+	}
+
+	u8* buf=st.data+st.size;
+
+	for (u32 offs=0;offs<size;offs+=PAGE_SIZE)
+	{
+		if (memcmp(mem+offs,buf+offs,PAGE_SIZE)==0)
+			continue;
+
+		if (!st.load)
+		{
+			memcpy(buf+offs,mem+offs,PAGE_SIZE);
+			continue;
+		}
+
+		memcpy(mem+offs,buf+offs,PAGE_SIZE);
+
+#if FEAT_SHREC != DYNAREC_NONE
+		if (ram_base)
+			bm_DiscardPages(ram_base+offs,PAGE_SIZE);
+#endif
+	}
+
+	st.size+=size;
+}
+
+static void serialize_maple(dc_state& st)
+{
+	st(dmacount);
+	st(maple_ddt_pending_reset);
+
+	for (int bus=0;bus<4;bus++)
+	{
+		for (int port=0;port<6;port++)
+		{
+			u8 present=MapleDevices[bus][port]!=0;
+			u8 saved=present;
+			st(saved);
+
+			//the devices come from the config, a state from another config can't be loaded
+			if (saved!=present)
+			{
+				st.failed=true;
+				return;
+			}
+
+			if (present)
+				MapleDevices[bus][port]->Serialize(st);
+		}
+	}
+}
+
+static void serialize_all(dc_state& st)
+{
+	u32 header[6]={SS_MAGIC,SS_VERSION,settings.System,RAM_SIZE,VRAM_SIZE,ARAM_SIZE};
+	u32 saved[6];
+
+	memcpy(saved,header,sizeof(header));
+	st(saved);
+
+	if (memcmp(saved,header,sizeof(header))!=0)
+	{
+		printf("dc_unserialize: state is from a different version or system\n");
+		st.failed=true;
+		return;
+	}
+
+	//sh4, p_sh4rcb and OnChipRAM are only set up in dc_init, the size can be measured before that
+	st(p_sh4rcb->cntx);
+	st(p_sh4rcb->sq_buffer);
+	st.array(OnChipRAM.data,OnChipRAM_SIZE);
+
+	serialize_regs(st,CCN);
+	serialize_regs(st,UBC);
+	serialize_regs(st,BSC);
+	serialize_regs(st,DMAC);
+	serialize_regs(st,CPG);
+	serialize_regs(st,RTC);
+	serialize_regs(st,INTC);
+	serialize_regs(st,TMU);
+	serialize_regs(st,SCI);
+	serialize_regs(st,SCIF);
+
+	st(CCN_QACR_TR);
+	st(UTLB);
+	st(ITLB);
+	st(sq_remap);
+	st(BSC_PDTRA);
+
+	st(tmu_shift);
+	st(tmu_mask);
+	st(tmu_mask64);
+	st(old_mode);
+	st(tmu_ch_base);
+	st(tmu_ch_base64);
+
+	st(IRLPriority);
+	st(InterruptEnvId);
+	st(InterruptBit);
+	st(InterruptLevelBit);
+	st(interrupt_vpend);
+	st(interrupt_vmask);
+	st(decoded_srimask);
+
+	sh4_sched_serialize(st);
+
+	//memory
+	serialize_mem_diff(st,mem_b.data,RAM_SIZE,0x0C000000);
+	serialize_mem_diff(st,vram.data,VRAM_SIZE,0);
+	serialize_mem_diff(st,aica_ram.data,ARAM_SIZE,0);
+
+	//holly
+	serialize_regs(st,sb_regs);
+	st(SB_ISTNRM);
+	st(SB_FFST_rc);
+	st(SB_FFST);
+
+	//pvr
+	st.raw(pvr_regs,pvr_RegSize);
+
+	st(in_vblank);
+	st(clc_pvr_scanline);
+	st(pvr_numscanlines);
+	st(prv_cur_scanline);
+	st(vblk_cnt);
+	st(Line_Cycles);
+	st(Frame_Cycles);
+
+	st(YUV_tempdata);
+	st(YUV_dest);
+	st(YUV_blockcount);
+	st(YUV_x_curr);
+	st(YUV_y_curr);
+	st(YUV_x_size);
+	st(YUV_y_size);
+
+	st(ta_fsm);
+	st(ta_fsm_cl);
+	tactx_serialize(st);
+
+	//aica
+	st(VREG);
+	st(ARMRST);
+	st(rtc_EN);
+	st(aica_pending_dma);
+	st(settings.dreamcast.RTC);
+	aica_serialize(st);
+	arm_serialize(st);
+
+	//everything else
+	gdrom_serialize(st);
+	serialize_maple(st);
+
+	if (settings.System==DC_PLATFORM_NAOMI)
+	{
+		naomi_serialize(st);
+		st.raw(sys_nvmem_sram.data,sys_nvmem_sram.size);
+	}
+	else if (sys_nvmem_flash.data)
+	{
+		st.raw(sys_nvmem_flash.data,sys_nvmem_flash.size);
+		st(sys_nvmem_flash.state);
+	}
+}
+
+//derived state that isn't part of the stream
+static void serialize_fixup()
+{
+	//the sq write handler depends on the area the QACRs point to
+	u32 qacr0=CCN.data[(CCN_QACR0_addr&255)/4].data32;
+	u32 qacr1=CCN.data[(CCN_QACR1_addr&255)/4].data32;
+	CCN.data[(CCN_QACR0_addr&255)/4].writeFunctionAddr(CCN_QACR0_addr,qacr0);
+	CCN.data[(CCN_QACR1_addr&255)/4].writeFunctionAddr(CCN_QACR1_addr,qacr1);
+
+	old_rm=0xFF;
+	old_dn=0xFF;
+	SetFloatStatusReg();
+
+#ifndef NO_MMU
+	//the software TLB caches the UTLB/ITLB
+	mmu_flush_tlb_cache();
+#endif
+
+	pal_needs_update=true;
+	fog_needs_update=true;
+}
+
+u32 dc_serialize_size()
+{
+	dc_state st(0,0,false);
+	serialize_all(st);
+
+	return st.size;
+}
+
+bool dc_serialize(void* data,u32 size)
+{
+	dc_state st(data,size,false);
+	serialize_all(st);
+
+	return !st.failed;
+}
+
+bool dc_unserialize(const void* data,u32 size)
+{
+	if (size<dc_serialize_size())
+		return false;
+
+	dc_state st((void*)data,size,true);
+	serialize_all(st);
+
+	//the header is checked first, nothing has been touched if that failed
+	if (st.failed && st.size<=sizeof(u32)*6)
+		return false;
+
+	serialize_fixup();
+
+	if (st.failed)
+		printf("dc_unserialize: state is corrupted\n");
+
+	return !st.failed;
+}
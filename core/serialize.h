@@ -0,0 +1,76 @@
+/*
+	Savestates
+
+	The emulator state is streamed to (or from) a flat buffer in a fixed order, one
+	module after the other. Each module streams its own state with the same code for
+	saving and loading, so the two can't get out of sync.
+
+	The size only depends on the system config (ram sizes, maple devices), never on
+	what is running, so frontends can rely on it for rewind and run-ahead. It is known
+	as soon as dc_prepare_system has run, before dc_init.
+*/
+#pragma once
+#include "types.h"
+
+#define SS_MAGIC   0x54534352	//RCST
+#define SS_VERSION 2
+
+struct dc_state
+{
+	u8* data;     //null when only measuring the size
+	u32 size;     //bytes streamed so far
+	u32 limit;    //size of the buffer
+	bool load;
+	bool failed;
+
+	dc_state(void* buffer,u32 buffer_size,bool loading)
+	{
+		data=(u8*)buffer;
+		size=0;
+		limit=buffer_size;
+		load=loading;
+		failed=false;
+	}
+
+	//copies len bytes in/out of the stream, the position is advanced even when measuring
+	void raw(void* ptr,u32 len)
+	{
+		if (data)
+		{
+			if (failed || size+len>limit)
+			{
+				failed=true;
+				return;
+			}
+
+			if (load)
+				memcpy(ptr,data+size,len);
+			else
+				memcpy(data+size,ptr,len);
+		}
+
+		size+=len;
+	}
+
+	//reserves len bytes, zero filled on save, used for the unused part of variable sized blocks
+	void skip(u32 len)
+	{
+		if (data && !load && !failed && size+len<=limit)
+			memset(data+size,0,len);
+		else if (data && size+len>limit)
+			failed=true;
+
+		size+=len;
+	}
+
+	template<typename T>
+	void operator()(T& v) { raw(&v,sizeof(T)); }
+
+	template<typename T>
+	void array(T* v,u32 count) { raw(v,sizeof(T)*count); }
+};
+
+//size of a savestate, stays the same for the whole session
+u32 dc_serialize_size();
+bool dc_serialize(void* data,u32 size);
+bool dc_unserialize(const void* data,u32 size);
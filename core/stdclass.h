@@ -223,7 +223,7 @@ public :
 	void Unlock()
 	{
 #ifndef TARGET_NO_THREADS
-      slock_lock(mutx);
+      slock_unlock(mutx);
 #endif
 	}
 };
@@ -526,6 +526,10 @@ struct settings_t
 		bool unstable_opt;
 		bool disable_nvmem;
       bool DisableDivMatching;
+      u32 BlockCache;      //0 -> disabled, 1 -> enabled, 2 -> validate (see BlockCacheMode)
+      u32 OptPasses;       //shil optimiser passes, see SSAOptPass
+      bool OptValidate;    //check the optimised blocks against the original ones
+      bool Superblocks;    //merge hot chains of blocks, if the backend supports it
 	} dynarec;
 	
 	struct
@@ -556,6 +560,8 @@ struct settings_t
       bool InterruptHack;
       bool AegStepHack;
       bool EGHack;
+      u32 ArmRec;         //0 -> interpreter, 1 -> recompiler, 2 -> validate (see ArmRecMode)
+      u32 DSPRec;         //0 -> interpreter, 1 -> recompiler, 2 -> validate (see DspRecMode)
    } aica;
 
 	struct
@@ -564,6 +570,7 @@ struct settings_t
 		bool LoadDefaultImage;
 		char DefaultImage[512];
 		char LastImage[512];
+		u32 ChdCacheHunks;    //chd hunks kept decompressed, 1..CHD_CACHE_MAX
 	} imgread;
 
 	struct
@@ -605,6 +612,8 @@ struct settings_t
 		
 		u32 MaxThreads;
 		u32 SynchronousRendering;
+		u32 RenderQueueDepth;      //frames that can be queued for the render thread, 1..RQUEUE_MAX
+		u32 RenderQueuePolicy;     //what to do when it is full, see RenderQueuePolicy
 	} pvr;
 
    unsigned UpdateMode;
@@ -753,6 +762,7 @@ void os_MakeExecutable(void* ptr, u32 sz);
 
 void os_DoEvents();
 void os_CreateWindow();
+double os_GetSeconds(void);
 
 #ifdef _MSC_VER
 #include <intrin.h>
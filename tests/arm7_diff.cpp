@@ -0,0 +1,308 @@
+/*
+	arm7 recompiler differential test
+
+	Fills aram with random blocks of the opcodes the recompiler handles itself (data
+	processing with immediate and immediate shifted operands, ldr/str with immediate
+	offsets, branches, data processing to pc) mixed with some it hands to the interpreter
+	(register shifted operands, mul), all with random conditions. Each block is compiled
+	for the fast path and run on random registers and flags, then the same opcodes run on
+	the interpreter from the same state, and the registers, flags, mode, next pc, cycles,
+	the aram they use and the aica register writes are compared.
+
+	Then random programs, branches and all, run through arm_rec_Run in the validation mode,
+	which replays every block on the interpreter as it goes.
+*/
+#include "hw/arm7/arm7.cpp"
+#include <sys/mman.h>
+#include "test_common.h"
+
+#define BLOCKS   30000
+#define PROGRAMS 20000
+
+//where the loads and stores go, r12 and r13 point in there and offsets are kept small
+#define DATA_START 0x0F0000
+#define DATA_END   0x120000
+#define CODE_START 0x080000
+
+VArray2 aica_ram;
+settings_t settings;
+unsigned ARAM_SIZE=2*1024*1024, ARAM_MASK=ARAM_SIZE-1;
+
+static vector<u32> reg_writes;
+
+u32 libAICA_ReadReg(u32 addr,u32 size)
+{
+	return (addr*2654435761u)>>(size==1 ? 24 : size==2 ? 16 : 0);
+}
+
+void libAICA_WriteReg(u32 addr,u32 data,u32 size)
+{
+	reg_writes.push_back(addr^(data<<8)^size);
+}
+
+void libAICA_TimeStep() { }
+
+void os_MakeExecutable(void* ptr,u32 sz)
+{
+	mprotect(ptr,sz,PROT_READ|PROT_WRITE|PROT_EXEC);
+}
+
+//mostly always, so the blocks do something
+static u32 gen_cond()
+{
+	return (rnd()%3 ? 0xE : rnd()%15)<<28;
+}
+
+static u32 gen_dp_op(u32& s)
+{
+	u32 op=rnd()%16;
+	s=rnd()&1;
+	if (op>=8 && op<=11)
+		s=1;  //tst teq cmp cmn
+	return op;
+}
+
+//r0..r10 are free for results, r11 points to the aica registers, r12 and r13 to data, r14 is lr
+static u32 gen_rd()
+{
+	return rnd()%11;
+}
+
+#define GEN_STRAIGHT 12   //no opcode that writes pc
+#define GEN_BRANCHES 15   //plus b, bl, data processing to pc
+#define GEN_ALL      16   //plus ldr pc, it can go anywhere
+
+static u32 gen_opcode(u32 kinds)
+{
+	u32 c=gen_cond();
+	u32 rn=rnd()%16,rm=rnd()%16,rd=gen_rd();
+	u32 s;
+
+	switch (rnd()%kinds)
+	{
+	case 0: case 1: case 2: case 3:                                       //data processing, immediate shift
+		{
+			u32 op=gen_dp_op(s);
+			return c|(op<<21)|(s<<20)|(rn<<16)|(rd<<12)|((rnd()%32)<<7)|((rnd()%4)<<5)|rm;
+		}
+	case 4: case 5: case 6:                                               //data processing, immediate
+		{
+			u32 op=gen_dp_op(s);
+			return c|(1<<25)|(op<<21)|(s<<20)|(rn<<16)|(rd<<12)|(rnd()&0xFFF);
+		}
+	case 7: case 8: case 9:                                               //ldr/str/ldrb/strb, immediate offset
+		{
+			u32 base=11+rnd()%3;
+			u32 p=rnd()&1,u=rnd()&1,b=rnd()&1,w=rnd()&1,l=rnd()&1;
+			if (base==11 && rnd()%2)
+				base=12;
+			if (rnd()%8==0)
+				base=15,p=1,w=0,l=1;                                       //literal pool
+			return c|(1<<26)|(p<<24)|(u<<23)|(b<<22)|(w<<21)|(l<<20)|(base<<16)|(gen_rd()<<12)|(rnd()&0x3FF);
+		}
+	case 10:                                                              //data processing, register shift
+		{
+			u32 op=gen_dp_op(s);
+			return c|(op<<21)|(s<<20)|(rn<<16)|(rd<<12)|((rnd()%16)<<8)|((rnd()%4)<<5)|0x10|rm;
+		}
+	case 11:                                                              //mul mla
+		return c|0x90|(gen_rd()<<16)|((rnd()%16)<<12)|((rnd()%16)<<8)|(rnd()%16)|((rnd()&3)<<20);
+	case 12: case 13:                                                     //b bl
+		return c|(0xA<<24)|((rnd()&1)<<24)|((rnd()%512-256)&0xFFFFFF);
+	case 14:                                                              //add(s)/sub(s) pc,lr,#imm
+		{
+			u32 op=rnd()%2 ? 2 : 4;
+			return c|(1<<25)|(op<<21)|((rnd()%4==0)<<20)|(14<<16)|(15<<12)|(rnd()&0xFC);
+		}
+	default:                                                              //ldr pc
+		return c|(1<<26)|(1<<24)|(1<<23)|(1<<20)|(13<<16)|(15<<12)|(rnd()&0x3FC);
+	}
+}
+
+static void gen_regs()
+{
+	for (u32 i=0;i<16;i++)
+		arm_Reg[i].I=rnd()%4 ? rnd() : rnd()%64;
+
+	arm_Reg[11].I=0x808000+(rnd()&0x3FFC);     //stays above aram with the offsets and writebacks
+	arm_Reg[12].I=0x100000+(rnd()&0x3FFC);
+	arm_Reg[13].I=0x108000+(rnd()&0x3FFC);
+	arm_Reg[14].I=CODE_START+(rnd()&0x1FFFC);
+	arm_Reg[RN_PSR_FLAGS].I=rnd()&0xF0000000;
+
+	arm_Reg[R13_USR].I=arm_Reg[R13_SVC].I=arm_Reg[R13_IRQ].I=arm_Reg[R13_FIQ].I=arm_Reg[R13_ABT].I=arm_Reg[R13_UND].I=0x110000;
+	arm_Reg[RN_SPSR].I=arm_Reg[SPSR_SVC].I=arm_Reg[SPSR_IRQ].I=arm_Reg[SPSR_FIQ].I=arm_Reg[SPSR_ABT].I=arm_Reg[SPSR_UND].I=0x1F|(rnd()&0xF0000000);
+	arm_Reg[R11_FIQ].I=0x808000;
+	arm_Reg[R12_FIQ].I=0x100000;
+}
+
+struct arm_state
+{
+	reg_pair regs[RN_ARM_REG_COUNT];
+	u32 arm_pc;
+	int mode;
+	bool irq;
+	bool fiq;
+	u32 ticks;
+	vector<u32> writes;
+	vector<u8> data;
+
+	void save(u32 cycles)
+	{
+		memcpy(regs,arm_Reg,sizeof(regs));
+		arm_pc=armNextPC;
+		mode=armMode;
+		irq=armIrqEnable;
+		fiq=armFiqEnable;
+		ticks=cycles;
+		writes=reg_writes;
+		data.assign(&aica_ram.data[DATA_START],&aica_ram.data[DATA_END]);
+	}
+
+	void load()
+	{
+		memcpy(arm_Reg,regs,sizeof(regs));
+		armNextPC=arm_pc;
+		armMode=mode;
+		armIrqEnable=irq;
+		armFiqEnable=fiq;
+		reg_writes=writes;
+		memcpy(&aica_ram.data[DATA_START],&data[0],data.size());
+	}
+};
+
+static bool compare(const arm_state& rec,const arm_state& ref,u32 pc)
+{
+	bool match=true;
+
+	//r15 is only set up for the opcodes that read it, as in arm_Validate
+	for (u32 i=0;i<RN_ARM_REG_COUNT;i++)
+	{
+		if (i!=15 && i!=INTR_PEND && i!=CYCL_CNT && rec.regs[i].I!=ref.regs[i].I)
+		{
+			printf("block %08X: reg %d is %08X, the interpreter has %08X\n",pc,i,rec.regs[i].I,ref.regs[i].I);
+			match=false;
+		}
+	}
+
+	if (rec.arm_pc!=ref.arm_pc || rec.mode!=ref.mode || rec.irq!=ref.irq || rec.fiq!=ref.fiq || rec.ticks!=ref.ticks)
+	{
+		printf("block %08X: pc %08X/%08X mode %02X/%02X irq %d/%d fiq %d/%d cycles %d/%d\n",pc,rec.arm_pc,ref.arm_pc,
+			rec.mode,ref.mode,rec.irq,ref.irq,rec.fiq,ref.fiq,rec.ticks,ref.ticks);
+		match=false;
+	}
+
+	if (rec.writes!=ref.writes || rec.data!=ref.data)
+	{
+		printf("block %08X: memory writes don't match\n",pc);
+		match=false;
+	}
+
+	return match;
+}
+
+static void reset_mode()
+{
+	if (armMode!=0x1F)
+		CPUSwitchMode(0x1F,false,false);
+	armIrqEnable=armFiqEnable=true;
+}
+
+//compiled blocks against the interpreter, one block at a time
+static u32 test_blocks()
+{
+	settings.aica.ArmRec=ARM_Recompiler;
+	arm_rec_mode=ARM_Recompiler;
+	FlushCache();
+
+	u32 bad=0;
+	u32 ops=0;
+	arm_state start,rec,ref;
+
+	for (u32 b=0;b<BLOCKS;b++)
+	{
+		u32 pc=CODE_START+(rnd()%1024)*(ARM_BLOCK_MAX+1)*4;
+		u32 len=1+rnd()%ARM_BLOCK_MAX;
+
+		//pc writes only at the end, the other blocks run into a b .
+		for (u32 i=0;i<len;i++)
+			*(u32*)&aica_ram.data[pc+i*4]=gen_opcode(i!=len-1 || rnd()%2 ? GEN_STRAIGHT : GEN_ALL);
+		*(u32*)&aica_ram.data[pc+len*4]=0xEAFFFFFE;
+
+		reset_mode();
+		gen_regs();
+		reg_writes.clear();
+		armNextPC=pc;
+		start.save(0);
+
+		u32 ticks=arm_Compile(pc)();
+		rec.save(ticks);
+
+		start.load();
+		ticks=0;
+		for (u32 i=0;i<ARM_BLOCK_MAX;i++)
+		{
+			u32 opcode=CPUReadMemoryQuick(armNextPC);
+			reg[15].I=armNextPC+8;
+			armNextPC+=4;
+			ticks+=arm_ExecuteOp(opcode);
+			ops++;
+
+			if (arm_WritesPC(opcode))
+				break;
+		}
+		ref.save(ticks);
+
+		if (!compare(rec,ref,pc) && bad++<4)
+		{
+			for (u32 i=0;i<=len;i++)
+				printf("\t%08X\n",*(u32*)&aica_ram.data[pc+i*4]);
+		}
+	}
+
+	printf("blocks: %d blocks, %d opcodes, %d mismatches\n",BLOCKS,ops,bad);
+
+	return bad;
+}
+
+//whole programs through the dispatcher, with every block checked by arm_Validate
+static u32 test_programs()
+{
+	//the branches stay in code
+	for (u32 i=0;i<DATA_START;i+=4)
+		*(u32*)&aica_ram.data[i]=gen_opcode(GEN_BRANCHES);
+
+	settings.aica.ArmRec=ARM_Validate;
+	memset(&arm_rec_stats,0,sizeof(arm_rec_stats));
+
+	for (u32 i=0;i<PROGRAMS;i++)
+	{
+		reset_mode();
+		gen_regs();
+		armNextPC=CODE_START+(rnd()&0x1FFFC);
+		arm_rec_Run(256);
+	}
+
+	printf("programs: %d blocks compiled, %d validated, %d stale, %d mismatches\n",arm_rec_stats.blocks,
+		arm_rec_stats.validated,arm_rec_stats.stale,arm_rec_stats.mismatches);
+
+	return arm_rec_stats.mismatches;
+}
+
+int main()
+{
+	aica_ram.data=(u8*)malloc(ARAM_SIZE);
+	aica_ram.size=ARAM_SIZE;
+	for (u32 i=0;i<ARAM_SIZE;i+=4)
+		*(u32*)&aica_ram.data[i]=rnd();
+
+	arm_Init();
+	arm_SetEnabled(true);
+
+	u32 bad=0;
+
+	bad+=test_blocks();
+	bad+=test_programs();
+
+	return bad ? 1 : 0;
+}
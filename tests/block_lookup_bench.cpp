@@ -0,0 +1,136 @@
+/*
+	Block manager benchmark
+
+	Fills the code cache with 60k blocks of random sizes, plus 4k blocks outside of
+	it (as rec_cpp makes them), then times the host code -> block lookups (the
+	fastmem rewrites and the stale block checks use them), the guest pc -> block
+	ones, and evicting the whole cache in CODE_EVICT_SIZE steps like the ring does.
+	Every lookup is checked against the block the pointer was taken from.
+*/
+#include "hw/sh4/dyna/blockmanager.cpp"
+#include "test_common.h"
+
+#define CODE_BLOCKS 60000
+#define EXT_BLOCKS 4096
+#define LOOKUPS (10*1000*1000)
+
+Sh4RCB* p_sh4rcb;
+u8* CodeCache;
+u32 RAM_SIZE=16*1024*1024, RAM_MASK=RAM_SIZE-1;
+
+static void failed_to_find() { }
+void(*ngen_FailedToFindBlock)()=&failed_to_find;
+void ngen_ResetBlocks() { }
+ssa_stats_t ssa_stats;
+
+void _vmem_bm_reset() { }
+string shil_opcode::dissasm() { return ""; }
+
+//same as sh4_mem.cpp
+bool IsOnRam(u32 addr)
+{
+	return ((addr>>26)&7)==3 && ((addr>>29)&7)!=7 && ((addr>>29)&7)!=3;
+}
+
+struct BenchBlock : RuntimeBlockInfo
+{
+	virtual u32 Relink() { return 0; }
+	virtual void Relocate(void* dst) { }
+};
+
+static vector<RuntimeBlockInfo*> blocks;
+
+static RuntimeBlockInfo* add_block(u32 addr,u8* code,u32 size)
+{
+	RuntimeBlockInfo* blk=new BenchBlock();
+
+	blk->addr=addr;
+	blk->code=(DynarecCodeEntryPtr)code;
+	blk->host_code_size=size;
+	blk->sh4_code_size=2+(rnd()%32)*2;
+	blk->BlockType=BET_DynamicJump;
+	blk->pBranchBlock=blk->pNextBlock=0;
+
+	bm_AddBlock(blk);
+	blocks.push_back(blk);
+
+	return blk;
+}
+
+int main()
+{
+	p_sh4rcb=(Sh4RCB*)calloc(1,sizeof(Sh4RCB));
+	CodeCache=(u8*)malloc(CODE_SIZE);
+	u8* ext_code=(u8*)malloc(EXT_BLOCKS*256);
+
+	for (u32 i=0;i<=FPCB_MASK;i++)
+		p_sh4rcb->fpcb[i]=(void*)ngen_FailedToFindBlock;
+
+	double t0=now_seconds();
+
+	//one block per 64 bytes of guest code, host code 32..512 bytes long, back to back
+	u32 offs=0;
+	for (u32 i=0;i<CODE_BLOCKS;i++)
+	{
+		u32 size=32+rnd()%240*2;
+		verify(offs+size<=CODE_SIZE);
+		add_block(0x8C010000+i*64,CodeCache+offs,size);
+		offs+=size;
+	}
+
+	for (u32 i=0;i<EXT_BLOCKS;i++)
+		add_block(0x8C010000+(CODE_BLOCKS+i)*64,ext_code+i*256,1+rnd()%256);
+
+	double t1=now_seconds();
+	printf("%d blocks (%d KB of code): %.0f ns/add\n",(int)blocks.size(),offs/1024,(t1-t0)*1e9/blocks.size());
+
+	u32 bad=0;
+
+	t0=now_seconds();
+	for (u32 i=0;i<LOOKUPS;i++)
+	{
+		RuntimeBlockInfo* blk=blocks[rnd()%blocks.size()];
+		u8* ptr=(u8*)blk->code+rnd()%blk->host_code_size;
+
+		if (bm_GetBlock2(ptr)!=blk)
+			bad++;
+	}
+	t1=now_seconds();
+	printf("code -> block: %.1f ns/lookup\n",(t1-t0)*1e9/LOOKUPS);
+
+	t0=now_seconds();
+	for (u32 i=0;i<LOOKUPS;i++)
+	{
+		RuntimeBlockInfo* blk=blocks[rnd()%blocks.size()];
+
+		if (bm_GetBlock(blk->addr)!=blk)
+			bad++;
+	}
+	t1=now_seconds();
+	printf("pc -> block: %.1f ns/lookup\n",(t1-t0)*1e9/LOOKUPS);
+
+	//the ring cache evicts CODE_SIZE/16 at a time
+	t0=now_seconds();
+	u32 evicted=0;
+	for (u32 i=0;i<CODE_SIZE;i+=CODE_SIZE/16)
+	{
+		u32 before=bm_stats.evicted_blocks;
+		bm_EvictBlocks(CodeCache+i,CodeCache+i+CODE_SIZE/16);
+		evicted+=bm_stats.evicted_blocks-before;
+	}
+	t1=now_seconds();
+	printf("evicted %d blocks: %.0f ns/block\n",evicted,(t1-t0)*1e9/max(evicted,1u));
+
+	if (evicted!=CODE_BLOCKS)
+		bad++;
+
+	for (u32 i=0;i<CODE_BLOCKS;i++)
+	{
+		if (bm_GetBlock(blocks[i]->addr)!=0 || bm_GetStaleBlock((void*)blocks[i]->code)!=blocks[i])
+			bad++;
+	}
+
+	printf("%d bad lookups\n",bad);
+
+	return bad ? 1 : 0;
+}
@@ -0,0 +1,295 @@
+/*
+	CHD reader benchmark
+
+	Writes a small gdrom CHD (v4, zlib, the layout chdman makes) and reads it back the
+	ways the gdrom does: sequentially, 2 to 8 streams at once like FMVs (video & audio
+	files) and games streaming several files, random seeks, and random single sectors in
+	a small area. Prints the sectors per second for a few hunk cache sizes and checks
+	every sector read against the generated data.
+
+	Only the data at the start of the high density track is real, the rest of the
+	disc points to a single empty hunk, as the padding of real images compresses to.
+	The prefetch thread isn't covered, the tests build without threads.
+*/
+#include "imgread/chd.cpp"
+#include "deps/chdr/chdr.cpp"
+#include "deps/coreio/coreio.cpp"
+#include "deps/crypto/md5.cpp"
+#include "deps/crypto/sha1.cpp"
+#include "test_common.h"
+
+#define CHD_FILE "chd_bench.chd"
+
+#define SECTOR_BYTES (2352+96)
+#define HUNK_SECTORS 8
+#define HUNK_BYTES (SECTOR_BYTES*HUNK_SECTORS)
+
+//tracks 1 and 2 are the low density area, 3 the high density one
+#define TRACK1_FRAMES 600
+#define TRACK2_FRAMES 1000
+#define TRACK3_FRAMES (549150-TRACK1_FRAMES-TRACK2_FRAMES)
+
+#define DATA_HUNKS 4096        //32k real sectors at the start of track 3, 80 MB uncompressed
+
+settings_t settings;
+
+static u32 hunk_count(u32 frames)
+{
+	return (frames+HUNK_SECTORS-1)/HUNK_SECTORS;
+}
+
+static u32 track3_fad()
+{
+	return 150+TRACK1_FRAMES+TRACK2_FRAMES;
+}
+
+//contents of a real sector, compresses about as well as game data
+static void fill_sector(u32 fad,u8* dst)
+{
+	u32 s=fad*2654435761u+1;
+
+	for (u32 i=0;i<2352;i+=4)
+	{
+		s^=s<<13;
+		s^=s>>17;
+		s^=s<<5;
+		*(u32*)&dst[i]=(s&0x0F0F0F0F)|(fad<<24);
+	}
+
+	memset(dst+2352,0,96);
+}
+
+static void put_be32(u8* p,u32 v)
+{
+	p[0]=v>>24; p[1]=v>>16; p[2]=v>>8; p[3]=v;
+}
+
+static void put_be64(u8* p,u64 v)
+{
+	put_be32(p,v>>32);
+	put_be32(p+4,(u32)v);
+}
+
+//raw deflate, as the chd zlib codec
+static u32 deflate_hunk(const u8* src,u8* dst)
+{
+	z_stream z;
+	memset(&z,0,sizeof(z));
+	deflateInit2(&z,Z_BEST_SPEED,Z_DEFLATED,-MAX_WBITS,8,Z_DEFAULT_STRATEGY);
+
+	z.next_in=(Bytef*)src;
+	z.avail_in=HUNK_BYTES;
+	z.next_out=dst;
+	z.avail_out=HUNK_BYTES;
+
+	int rv=deflate(&z,Z_FINISH);
+	verify(rv==Z_STREAM_END);
+
+	u32 len=z.total_out;
+	deflateEnd(&z);
+
+	return len;
+}
+
+static void write_chd()
+{
+	u32 track_frames[3]={TRACK1_FRAMES,TRACK2_FRAMES,TRACK3_FRAMES};
+	const char* track_type[3]={"MODE1_RAW","AUDIO","MODE1_RAW"};
+
+	u32 total_hunks=0;
+	for (int i=0;i<3;i++)
+		total_hunks+=hunk_count(track_frames[i]);
+
+	u32 data_start=hunk_count(TRACK1_FRAMES)+hunk_count(TRACK2_FRAMES);
+	verify(data_start+DATA_HUNKS<total_hunks);
+
+	FILE* f=fopen(CHD_FILE,"wb");
+	verify(f!=0);
+
+	//header, map, end of map cookie, metadata, then the hunks
+	u32 map_offs=CHD_V4_HEADER_SIZE;
+	u32 meta_offs=map_offs+(total_hunks+1)*16;
+
+	char meta[3][256];
+	u32 meta_len[3];
+	u32 data_offs=meta_offs;
+	for (int i=0;i<3;i++)
+	{
+		sprintf(meta[i],CDROM_TRACK_METADATA2_FORMAT,i+1,track_type[i],"NONE",track_frames[i],0,"MODE1","NONE",0);
+		meta_len[i]=strlen(meta[i])+1;
+		data_offs+=16+meta_len[i];
+	}
+
+	u8 header[CHD_V4_HEADER_SIZE]={0};
+	memcpy(header,"MComprHD",8);
+	put_be32(header+8,CHD_V4_HEADER_SIZE);
+	put_be32(header+12,4);
+	put_be32(header+20,CHDCOMPRESSION_ZLIB);
+	put_be32(header+24,total_hunks);
+	put_be64(header+28,(u64)total_hunks*HUNK_BYTES);
+	put_be64(header+36,meta_offs);
+	put_be32(header+44,HUNK_BYTES);
+	fwrite(header,1,sizeof(header),f);
+
+	//the hunks, hunk 0 is the empty one all the padding points to
+	vector<u8> hunks;
+	vector<u8> map(total_hunks*16);
+	u8 src[HUNK_BYTES];
+	u8 dst[HUNK_BYTES];
+
+	for (u32 i=0;i<total_hunks;i++)
+	{
+		u8* entry=&map[i*16];
+		bool data=i>=data_start && i<data_start+DATA_HUNKS;
+
+		if (i!=0 && !data)
+		{
+			put_be64(entry,0);
+			entry[15]=MAP_ENTRY_TYPE_SELF_HUNK | MAP_ENTRY_FLAG_NO_CRC;
+			continue;
+		}
+
+		memset(src,0,sizeof(src));
+		for (u32 s=0;data && s<HUNK_SECTORS;s++)
+			fill_sector(track3_fad()+(i-data_start)*HUNK_SECTORS+s,src+s*SECTOR_BYTES);
+
+		u32 len=deflate_hunk(src,dst);
+		put_be64(entry,data_offs+hunks.size());
+		entry[12]=len>>8;
+		entry[13]=len;
+		entry[14]=len>>16;
+		entry[15]=MAP_ENTRY_TYPE_COMPRESSED | MAP_ENTRY_FLAG_NO_CRC;
+		hunks.insert(hunks.end(),dst,dst+len);
+	}
+
+	fwrite(&map[0],1,map.size(),f);
+	fwrite(END_OF_LIST_COOKIE,1,16,f);
+
+	u32 offs=meta_offs;
+	for (int i=0;i<3;i++)
+	{
+		u8 mh[16];
+		offs+=16+meta_len[i];
+		put_be32(mh,CDROM_TRACK_METADATA2_TAG);
+		put_be32(mh+4,meta_len[i]);
+		put_be64(mh+8,i==2 ? 0 : offs);
+		fwrite(mh,1,16,f);
+		fwrite(meta[i],1,meta_len[i],f);
+	}
+
+	fwrite(&hunks[0],1,hunks.size(),f);
+	fclose(f);
+
+	printf("%d hunks, %d with data, %d KB compressed\n",total_hunks,DATA_HUNKS,(u32)hunks.size()/1024);
+}
+
+static u32 bad;
+
+static void read_sector(Disc* disc,u32 fad)
+{
+	u8 buf[2352];
+	u8 ref[SECTOR_BYTES];
+	u8 subcode[96];
+	SectorFormat secfmt;
+	SubcodeFormat subfmt;
+
+	if (!disc->ReadSector(fad,buf,&secfmt,subcode,&subfmt) || secfmt!=SECFMT_2352)
+	{
+		bad++;
+		return;
+	}
+
+	fill_sector(fad,ref);
+	if (memcmp(buf,ref,2352)!=0)
+		bad++;
+}
+
+#define SECTORS (DATA_HUNKS*HUNK_SECTORS)
+#define READS 40000
+
+//streams files read 2 sectors at a time, in turns, like the video and audio of FMVs
+static double read_streams(Disc* disc,u32 streams)
+{
+	double t0=now_seconds();
+
+	for (u32 i=0;i<READS;i++)
+	{
+		u32 stream=(i/2)%streams;
+		u32 pos=(i/(2*streams))*2+i%2;
+		read_sector(disc,track3_fad()+(stream*SECTORS/streams+pos)%SECTORS);
+	}
+
+	return READS/(now_seconds()-t0);
+}
+
+//a seek every 16 sectors
+static double read_seeks(Disc* disc)
+{
+	seed=1234;
+	u32 pos=0;
+
+	double t0=now_seconds();
+
+	for (u32 i=0;i<READS;i++)
+	{
+		if (i%16==0)
+			pos=rnd()%SECTORS;
+		read_sector(disc,track3_fad()+(pos++)%SECTORS);
+	}
+
+	return READS/(now_seconds()-t0);
+}
+
+//single sectors anywhere in a 48 hunk area, like a game loading many small files from
+//one directory. It only fits in the larger caches
+#define LOCAL_HUNKS 48
+
+static double read_local(Disc* disc)
+{
+	seed=5678;
+	u32 base=rnd()%(SECTORS-LOCAL_HUNKS*HUNK_SECTORS);
+
+	double t0=now_seconds();
+
+	for (u32 i=0;i<READS/4;i++)
+		read_sector(disc,track3_fad()+base+rnd()%(LOCAL_HUNKS*HUNK_SECTORS));
+
+	return READS/4/(now_seconds()-t0);
+}
+
+static void run(u32 cache_hunks)
+{
+	settings.imgread.ChdCacheHunks=cache_hunks;
+	CHDDisc* disc=(CHDDisc*)chd_parse(CHD_FILE);
+	verify(disc!=0);
+
+	double seq=read_streams(disc,1);
+	double fmv2=read_streams(disc,2);
+	double fmv4=read_streams(disc,4);
+	double fmv8=read_streams(disc,8);
+	double seek=read_seeks(disc);
+	double local=read_local(disc);
+
+	printf("%2d hunks cached, sectors/s: sequential %6.0f, 2 streams %6.0f, 4 streams %6.0f, 8 streams %6.0f, seeking %6.0f, local %6.0f, %d%% hits\n",
+		disc->cache_size,seq,fmv2,fmv4,fmv8,seek,local,(int)(disc->hits*100ull/(disc->hits+disc->misses)));
+
+	delete disc;
+}
+
+int main()
+{
+	double t0=now_seconds();
+	write_chd();
+	printf("written in %.2f s\n",now_seconds()-t0);
+
+	run(1);
+	run(4);
+	run(16);
+	run(64);
+
+	remove(CHD_FILE);
+
+	printf("%d bad sectors\n",bad);
+
+	return bad ? 1 : 0;
+}
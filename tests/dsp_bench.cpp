@@ -0,0 +1,149 @@
+/*
+	AICA DSP benchmark
+
+	Loads random programs (all 128 steps, random coefficients, delay lines and ring buffer
+	sizes) and the empty program, and runs each one for a second of audio through dsp_step,
+	on the interpreter and then on the recompiler, from the same state with the same
+	MIXS/EXTS input. Prints the time per sample of each and of the program recompilation,
+	and checks that both give the same EFREG output, state and aram.
+*/
+#include "hw/aica/dsp.cpp"
+#include <sys/mman.h>
+#include "test_common.h"
+
+#define PROGRAMS 16
+#define SAMPLES  44100
+
+settings_t settings;
+VArray2 aica_ram;
+u32 ARAM_SIZE=2*1024*1024, ARAM_MASK=ARAM_SIZE-1;
+DSPData_struct* DSPData;
+
+void os_MakeExecutable(void* ptr,u32 sz)
+{
+	mprotect((void*)((size_t)ptr&~4095),sz+4096,PROT_READ|PROT_WRITE|PROT_EXEC);
+}
+
+static void load_program(bool empty)
+{
+	for (u32 i=0;i<128*4;i++)
+		DSPData->MPRO[i]=empty ? 0 : rnd()&0xFFFF;
+	for (u32 i=0;i<128;i++)
+		DSPData->COEF[i]=rnd()&0xFFF8;
+	for (u32 i=0;i<64;i++)
+		DSPData->MADRS[i]=rnd()&0xFFFF;
+
+	dsp.RBL=(8192<<(rnd()&3))-1;
+	dsp.RBP=(rnd()&0xFFF)*2048&ARAM_MASK;
+	dsp.dyndirty=true;
+}
+
+struct dsp_run
+{
+	u32 output;      //hash of EFREG after every sample
+	double time;
+};
+
+static dsp_run run(u32 mode)
+{
+	settings.aica.DSPRec=mode;
+	seed=5678;
+
+	dsp_run rv;
+	rv.output=0;
+
+	double t0=now_seconds();
+	for (u32 s=0;s<SAMPLES;s++)
+	{
+		for (u32 i=0;i<16;i++)
+			dsp.MIXS[i]=(s32)(rnd()<<12)>>12;
+		DSPData->EXTS[0]=rnd()&0xFFFF;
+		DSPData->EXTS[1]=rnd()&0xFFFF;
+
+		dsp_step();
+
+		for (u32 i=0;i<16;i++)
+			rv.output=(rv.output^DSPData->EFREG[i])*0x01000193;
+	}
+	rv.time=now_seconds()-t0;
+
+	return rv;
+}
+
+int main()
+{
+	aica_ram.data=(u8*)malloc(ARAM_SIZE);
+	aica_ram.size=ARAM_SIZE;
+	DSPData=(DSPData_struct*)calloc(1,sizeof(DSPData_struct));
+
+	seed=1234;
+	for (u32 i=0;i<ARAM_SIZE;i+=4)
+		*(u32*)&aica_ram.data[i]=rnd();
+
+	dsp_init();
+
+	//the state a run starts from, after the TEMP..dyndirty registers the code is kept
+	const u32 state_offs=offsetof(dsp_t,TEMP);
+	const u32 state_size=sizeof(dsp_t)-state_offs;
+	u8* aram=(u8*)malloc(ARAM_SIZE);
+	u8* state=(u8*)malloc(state_size);
+	u8* int_state=(u8*)malloc(state_size);
+	u8* int_aram=(u8*)malloc(ARAM_SIZE);
+
+	double int_time=0,rec_time=0,compile_time=0;
+	u32 bad=0;
+
+	for (u32 p=0;p<=PROGRAMS;p++)
+	{
+		seed=1234+p;
+		load_program(p==PROGRAMS);
+
+		//recompiles until the clock moves enough to time it
+		u32 compiles=0;
+		double t0=now_seconds();
+		do
+		{
+			dsp_prog_valid=false;
+			dsp_update_program();
+			compiles++;
+		} while (now_seconds()-t0<0.01);
+		compile_time+=(now_seconds()-t0)/compiles;
+		dsp.dyndirty=false;
+
+		memcpy(aram,aica_ram.data,ARAM_SIZE);
+		memcpy(state,(u8*)&dsp+state_offs,state_size);
+
+		dsp_run ref=run(DSP_Interpreter);
+		memcpy(int_aram,aica_ram.data,ARAM_SIZE);
+		memcpy(int_state,(u8*)&dsp+state_offs,state_size);
+
+		memcpy(aica_ram.data,aram,ARAM_SIZE);
+		memcpy((u8*)&dsp+state_offs,state,state_size);
+
+		dsp_run rec=run(DSP_Recompiler);
+
+		if (ref.output!=rec.output || memcmp(int_state,(u8*)&dsp+state_offs,state_size)!=0 ||
+			memcmp(int_aram,aica_ram.data,ARAM_SIZE)!=0)
+		{
+			printf("program %d: the recompiler doesn't match the interpreter\n",p);
+			bad++;
+		}
+
+		if (p==PROGRAMS)
+		{
+			printf("empty program: interpreter %.0f ns/sample, recompiler %.0f ns/sample\n",
+				ref.time*1e9/SAMPLES,rec.time*1e9/SAMPLES);
+		}
+		else
+		{
+			int_time+=ref.time;
+			rec_time+=rec.time;
+		}
+	}
+
+	printf("%d programs: interpreter %.0f ns/sample, recompiler %.0f ns/sample, %.1f us to recompile\n",PROGRAMS,
+		int_time*1e9/(PROGRAMS*SAMPLES),rec_time*1e9/(PROGRAMS*SAMPLES),compile_time*1e6/(PROGRAMS+1));
+	printf("%d mismatches\n",bad);
+
+	return bad ? 1 : 0;
+}
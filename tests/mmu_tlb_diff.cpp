@@ -0,0 +1,292 @@
+/*
+	software TLB differential test, built without NO_MMU
+
+	Runs random reads, writes and fetches through the mmu_* calls, mixed with ASID
+	changes, mode switches, UTLB rewrites (as ldtlb does) and ITLB rewrites, each
+	followed by its UTLB_Sync/ITLB_Sync. The same sequence runs twice from the same
+	seed: once with the software TLB, once with it flushed before every access, so
+	every access goes through the UTLB/ITLB lookup. The data, exceptions, TEA, URC,
+	LRUI, ITLB contents and memory of both runs are compared after every step.
+
+	The entries overlap only where the ASID keeps them apart (SV stays 0), so there is
+	no multiple hit, the mmu code stops on those.
+*/
+#include "hw/sh4/modules/mmu.cpp"
+#include "test_common.h"
+
+#define STEPS 1000000
+
+//the pages map into a 1 MB mirrored ram at 0x0C000000, the rest of the physical
+//space goes through handlers that return a hash of the address and log the writes
+#define RAM_SIZE (1024*1024)
+
+Sh4RCB* p_sh4rcb;
+Array<RegisterStruct> CCN(16,true);
+u32 CCN_QACR_TR[2];
+
+static u8 ram[RAM_SIZE];
+static u32 io_writes;
+
+static bool is_ram(u32 addr) { return (addr>>24)==0x0C; }
+
+void* _vmem_get_ptr2(u32 addr,u32& mask)
+{
+	mask=RAM_SIZE-1;
+	return is_ram(addr) ? ram : 0;
+}
+
+template<typename T>
+static T read_mem(u32 addr)
+{
+	if (is_ram(addr))
+		return *(T*)&ram[addr&(RAM_SIZE-1)];
+	return (T)(addr*0x9E3779B97F4A7C15ull);
+}
+
+template<typename T>
+static void write_mem(u32 addr,T data)
+{
+	if (is_ram(addr))
+		*(T*)&ram[addr&(RAM_SIZE-1)]=data;
+	else
+		io_writes=(io_writes^addr^(u32)data^sizeof(T))*0x01000193;
+}
+
+u8 DYNACALL _vmem_ReadMem8(u32 addr) { return read_mem<u8>(addr); }
+u16 DYNACALL _vmem_ReadMem16(u32 addr) { return read_mem<u16>(addr); }
+u32 DYNACALL _vmem_ReadMem32(u32 addr) { return read_mem<u32>(addr); }
+u64 DYNACALL _vmem_ReadMem64(u32 addr) { return read_mem<u64>(addr); }
+void DYNACALL _vmem_WriteMem8(u32 addr,u8 data) { write_mem(addr,data); }
+void DYNACALL _vmem_WriteMem16(u32 addr,u16 data) { write_mem(addr,data); }
+void DYNACALL _vmem_WriteMem32(u32 addr,u32 data) { write_mem(addr,data); }
+void DYNACALL _vmem_WriteMem64(u32 addr,u64 data) { write_mem(addr,data); }
+
+//the virtual pages all sit in the first 64 MB of U0, so the entries hit each other often
+static TLB_Entry gen_entry()
+{
+	TLB_Entry e;
+	e.Address.reg_data=0;
+	e.Data.reg_data=0;
+
+	u32 sz=rnd()%8;
+	sz=sz<2 ? 0 : sz<5 ? 1 : sz<7 ? 2 : 3;
+	u32 mask=mmu_mask[sz];
+
+	e.Address.VPN=((rnd()&0x3FFFFFF)&mask)>>10;
+	e.Address.ASID=rnd()%2;
+
+	e.Data.SZ1=sz>>1;
+	e.Data.SZ0=sz&1;
+	e.Data.V=rnd()%16!=0;
+	e.Data.SH=rnd()%4==0;
+	e.Data.PR=rnd()%4 ? 3 : rnd()%4;
+	e.Data.D=rnd()%8!=0;
+	e.Data.C=1;
+
+	u32 pa=rnd()%8 ? 0x0C000000+(rnd()&0xFFFFFF) : 0x10000000+(rnd()&0xFFFFFF);
+	e.Data.PPN=(pa&mask)>>10;
+
+	return e;
+}
+
+//two valid entries that can match the same address at once, for some ASID
+static bool overlaps(const TLB_Entry& a,const TLB_Entry& b)
+{
+	if (!a.Data.V || !b.Data.V)
+		return false;
+
+	u32 mask=mmu_mask[a.Data.SZ1*2+a.Data.SZ0] & mmu_mask[b.Data.SZ1*2+b.Data.SZ0];
+	if ((((u32)a.Address.VPN<<10)&mask)!=(((u32)b.Address.VPN<<10)&mask))
+		return false;
+
+	return a.Data.SH || b.Data.SH || a.Address.ASID==b.Address.ASID;
+}
+
+static void write_utlb(u32 i)
+{
+	TLB_Entry e=gen_entry();
+	for (u32 j=0;j<64;j++)
+	{
+		if (j!=i && overlaps(e,UTLB[j]))
+			e.Data.V=0;
+	}
+
+	UTLB[i]=e;
+	UTLB_Sync(i);
+
+	//as the os would, the stale ITLB copies go too
+	for (u32 j=0;j<4;j++)
+	{
+		if (overlaps(e,ITLB[j]))
+		{
+			ITLB[j].Data.V=0;
+			ITLB_Sync(j);
+		}
+	}
+}
+
+static void write_itlb(u32 i)
+{
+	TLB_Entry e=UTLB[rnd()%64];
+	for (u32 j=0;j<4;j++)
+	{
+		if (j!=i && overlaps(e,ITLB[j]))
+			e.Data.V=0;
+	}
+
+	ITLB[i]=e;
+	ITLB_Sync(i);
+}
+
+struct mmu_run
+{
+	vector<u64> log;     //one hash per step
+	u32 accesses;
+	u32 cached;          //accesses the software TLB had the page for
+	u32 exceptions;
+};
+
+static u64 step_hash(u64 data,u32 exception)
+{
+	u64 h=data;
+	h=h*31+exception;
+	h=h*31+CCN_TEA;
+	h=h*31+CCN_MMUCR.URC;
+	h=h*31+CCN_MMUCR.LRUI;
+	for (u32 i=0;i<4;i++)
+		h=h*31+ITLB[i].Address.reg_data*7+ITLB[i].Data.reg_data;
+	return h*31+io_writes;
+}
+
+static bool in_cache(u32 tt,u32 va)
+{
+	TLB_CacheEntry* e=&TLB_Cache[tt][(va>>12)&(TLB_CACHE_SIZE-1)];
+	return e->tag==mmu_tlb_cache_tag(va) && e->gen==(tt==MMU_TT_IREAD ? ITLB_gen[e->entry] : UTLB_gen[e->entry]);
+}
+
+static mmu_run run(bool use_cache)
+{
+	mmu_run rv;
+	rv.accesses=rv.cached=rv.exceptions=0;
+
+	seed=1234;
+	for (u32 i=0;i<RAM_SIZE;i+=4)
+		*(u32*)&ram[i]=rnd();
+	io_writes=0;
+
+	memset(&p_sh4rcb->cntx,0,sizeof(p_sh4rcb->cntx));
+	memset(CCN.data,0,sizeof(RegisterStruct)*CCN.Size);
+	MMU_init();
+	MMU_reset();
+	CCN_MMUCR.AT=1;
+	CCN_MMUCR.URB=0;
+
+	for (u32 i=0;i<64;i++)
+		write_utlb(i);
+
+	for (u32 s=0;s<STEPS;s++)
+	{
+		u32 op=rnd()%100;
+		u32 va=rnd()&0x3FFFFFF;
+
+		//mostly in the pages of an entry that matches, so not everything misses
+		TLB_Entry* near=&UTLB[rnd()%64];
+		for (u32 i=0;i<4 && !(near->Data.V && (near->Data.SH || near->Address.ASID==CCN_PTEH.ASID));i++)
+			near=&UTLB[rnd()%64];
+		if (rnd()%8)
+		{
+			u32 mask=mmu_mask[near->Data.SZ1*2+near->Data.SZ0];
+			va=(((u32)near->Address.VPN<<10)&mask)|(va&~mask);
+		}
+		u64 data=0;
+		u32 exception=0;
+
+		if (op<80)
+		{
+			u32 size=rnd()%4;
+			va&=~((1<<size)-1);
+
+			//fetches from privileged pages in user mode stop the mmu code, they are only done in privileged mode
+			u32 tt=op<45 ? MMU_TT_DREAD : op<70 ? MMU_TT_DWRITE : MMU_TT_IREAD;
+			if (tt==MMU_TT_IREAD)
+				sr.MD=1,size=1;
+
+			if (!use_cache)
+				mmu_flush_tlb_cache();
+			else if (in_cache(tt,va))
+				rv.cached++;
+			rv.accesses++;
+
+			data=rnd()|((u64)rnd()<<32);
+			try
+			{
+				if (tt==MMU_TT_IREAD)
+					data=mmu_IReadMem16(va);
+				else if (tt==MMU_TT_DREAD)
+				{
+					switch (size)
+					{
+					case 0: data=mmu_ReadMem8(va); break;
+					case 1: data=mmu_ReadMem16(va); break;
+					case 2: data=mmu_ReadMem32(va); break;
+					case 3: data=mmu_ReadMem64(va); break;
+					}
+				}
+				else
+				{
+					switch (size)
+					{
+					case 0: mmu_WriteMem8(va,(u8)data); break;
+					case 1: mmu_WriteMem16(va,(u16)data); break;
+					case 2: mmu_WriteMem32(va,(u32)data); break;
+					case 3: mmu_WriteMem64(va,data); break;
+					}
+				}
+			}
+			catch (SH4ThrownException& ex)
+			{
+				exception=ex.expEvn;
+				rv.exceptions++;
+			}
+		}
+		else if (op<86)
+			CCN_PTEH.ASID=rnd()%2;
+		else if (op<92)
+			sr.MD=rnd()&1;
+		else if (op<97)
+			write_utlb(rnd()%64);
+		else
+			write_itlb(rnd()%4);
+
+		rv.log.push_back(step_hash(data,exception));
+	}
+
+	u64 h=0;
+	for (u32 i=0;i<RAM_SIZE;i+=8)
+		h=h*31+*(u64*)&ram[i];
+	rv.log.push_back(h);
+
+	return rv;
+}
+
+int main()
+{
+	p_sh4rcb=(Sh4RCB*)calloc(1,sizeof(Sh4RCB));
+
+	mmu_run ref=run(false);
+	mmu_run tlb=run(true);
+
+	u32 bad=0;
+	for (u32 s=0;s<ref.log.size();s++)
+	{
+		if (ref.log[s]!=tlb.log[s])
+		{
+			if (bad++<4)
+				printf("step %d: the software TLB doesn't match the lookup\n",s);
+		}
+	}
+
+	printf("%d accesses, %d from the software TLB, %d exceptions, %d mismatches\n",tlb.accesses,tlb.cached,tlb.exceptions,bad);
+
+	return bad ? 1 : 0;
+}
@@ -0,0 +1,116 @@
+/*
+	sh4 scheduler benchmark
+
+	Runs the UpdateSystem loop (448 cycle ticks) with a number of registered
+	callbacks that reschedule themselves at random periods, and random requests
+	from outside of the callbacks, like the mmio writes that start dma or timers.
+	Prints the time per tick and checks that every event fires on time and in order,
+	and that the per callback counters match.
+*/
+#include "hw/sh4/sh4_sched.cpp"
+#include "test_common.h"
+
+Sh4RCB* p_sh4rcb;
+
+static int rnd_period()
+{
+	//mostly short periods (line, timers, aica), some long ones (frame, rtc)
+	return rnd()%8 ? 448+rnd()%20000 : 100000+rnd()%(SH4_MAIN_CLOCK-100000);
+}
+
+static u64 due[256];
+static u64 last_fire;
+static u32 fired;
+static u32 late;
+static u32 total_late;
+
+static int bench_cb(int tag, int cycl, int jitter)
+{
+	u64 now=sh4_sched_now64();
+
+	//ticks are 448 cycles and only happen once the time is past the next event, so it
+	//fires up to 448 cycles after its end time
+	if (now<due[tag] || now>due[tag]+448 || now<last_fire)
+		late++;
+
+	last_fire=now;
+	fired++;
+
+	if (rnd()%16==0)
+	{
+		due[tag]=SCHED_IDLE;
+		return 0;
+	}
+
+	int period=rnd_period();
+	due[tag]=now-jitter+period;
+	return period;
+}
+
+static void request(int id, int cycles)
+{
+	sh4_sched_request(id,cycles);
+	due[list[id].tag]=cycles==-1 ? SCHED_IDLE : sh4_sched_now64()+cycles;
+}
+
+static void run(u32 ids, u32 ticks)
+{
+	seed=1234;
+	fired=late=0;
+	last_fire=0;
+
+	list.clear();
+	sched_heap.clear();
+	sh4_sched_ffb=0;
+	Sh4cntx.sh4_sched_next=0;
+	sh4_sched_ffts();
+
+	for (u32 i=0;i<ids;i++)
+	{
+		request(sh4_sched_register(i,&bench_cb),rnd_period());
+	}
+
+	u32 requests=0;
+	double start=now_seconds();
+
+	for (u32 i=0;i<ticks;i++)
+	{
+		if (rnd()%4==0)
+		{
+			request(rnd()%ids,rnd()%8 ? rnd_period() : -1);
+			requests++;
+		}
+
+		Sh4cntx.sh4_sched_next-=448;
+		if (Sh4cntx.sh4_sched_next<0)
+			sh4_sched_tick(448);
+	}
+
+	double t=now_seconds()-start;
+
+	//the per callback counters have to add up to what the callbacks saw
+	u32 counted=0;
+	for (u32 i=0;i<ids;i++)
+		counted+=list[i].fired;
+	if (counted!=fired)
+	{
+		printf("the callbacks counted %d firings, %d fired\n",counted,fired);
+		late++;
+	}
+
+	printf("%3d ids: %6.1f ns/tick, %d requests, %d fired, %d late or out of order\n",
+		ids,t*1e9/ticks,requests,fired,late);
+
+	total_late+=late;
+}
+
+int main()
+{
+	p_sh4rcb=(Sh4RCB*)calloc(1,sizeof(Sh4RCB));
+
+	run(10,2000000);   //about what the emulator registers
+	run(64,2000000);
+	run(256,2000000);
+
+	return total_late ? 1 : 0;
+}
@@ -0,0 +1,207 @@
+/*
+	Savestate benchmark
+
+	Does what run-ahead does every frame: modifies some random pages of ram, vram
+	and aram, saves the state to the same buffer, modifies other pages (the frames
+	that are run ahead), and restores the state. Prints the save and restore time
+	per frame, and a full save and restore to a new buffer for comparison.
+	The memory is checked against a copy after every restore, and the pages the
+	dynarec is told to discard against the ram pages that were restored.
+
+	Only the memory is real here, the state of the other modules is stubbed.
+*/
+#include "serialize.cpp"
+#include "test_common.h"
+
+#define FRAMES 300
+#define RAM_PAGES_PER_FRAME 256    //1 MB
+#define VRAM_PAGES_PER_FRAME 128
+#define ARAM_PAGES_PER_FRAME 32
+
+//memory
+unsigned RAM_SIZE=16*1024*1024;
+unsigned VRAM_SIZE=8*1024*1024;
+unsigned ARAM_SIZE=2*1024*1024;
+VArray2 mem_b,vram,aica_ram;
+
+//sh4
+Sh4RCB* p_sh4rcb;
+Array<u8> OnChipRAM;
+Array<RegisterStruct> CCN(16,true);  //sized statically, as in sh4_mmr.cpp
+Array<RegisterStruct> UBC,BSC,DMAC,CPG,RTC,INTC,TMU,SCI,SCIF;
+u32 CCN_QACR_TR[2];
+TLB_Entry UTLB[64];
+TLB_Entry ITLB[4];
+u32 sq_remap[64];
+BSC_PDTRA_type BSC_PDTRA;
+u32 tmu_shift[3],tmu_mask[3],old_mode[3],tmu_ch_base[3];
+u64 tmu_mask64[3],tmu_ch_base64[3];
+u16 IRLPriority;
+u16 InterruptEnvId[32];
+u32 InterruptBit[32];
+u32 InterruptLevelBit[16];
+u32 interrupt_vpend,interrupt_vmask,decoded_srimask;
+u32 old_rm,old_dn;
+void SetFloatStatusReg() { }
+void sh4_sched_serialize(dc_state& st) { }
+
+//holly/pvr
+Array<RegisterStruct> sb_regs;
+u32 SB_ISTNRM,SB_FFST,SB_FFST_rc;
+u8 pvr_regs[pvr_RegSize];
+u32 in_vblank,clc_pvr_scanline,pvr_numscanlines,prv_cur_scanline,vblk_cnt,Line_Cycles,Frame_Cycles;
+u32 YUV_tempdata[512/4];
+u32 YUV_dest,YUV_blockcount,YUV_x_curr,YUV_y_curr,YUV_x_size,YUV_y_size;
+u8 ta_fsm[2049];
+u32 ta_fsm_cl;
+void tactx_serialize(dc_state& st) { }
+u8* vq_codebook;
+u32 palette_index;
+u32 palette_ram[1024];
+bool pal_needs_update,fog_needs_update;
+u32 detwiddle[2][8][1024];
+
+//aica and the rest
+u32 VREG,ARMRST,rtc_EN;
+s32 aica_pending_dma;
+void aica_serialize(dc_state& st) { }
+void arm_serialize(dc_state& st) { }
+void gdrom_serialize(dc_state& st) { }
+void naomi_serialize(dc_state& st) { }
+u32 dmacount;
+bool maple_ddt_pending_reset;
+maple_device* MapleDevices[4][6];
+SRamChip sys_nvmem_sram;
+DCFlashChip sys_nvmem_flash;
+settings_t settings;
+
+static u32 discarded_pages;
+void bm_DiscardPages(u32 addr,u32 size)
+{
+	discarded_pages+=size/PAGE_SIZE;
+}
+
+static void qacr_write(u32 addr,u32 data) { }
+
+static void alloc_mem(VArray2& mem,u32 size)
+{
+	mem.data=(u8*)malloc(size);
+	mem.size=size;
+
+	for (u32 i=0;i<size;i+=4)
+		*(u32*)&mem.data[i]=rnd();
+}
+
+//a write to count random pages
+static void touch_pages(VArray2& mem,u32 count)
+{
+	for (u32 i=0;i<count;i++)
+	{
+		u32 page=rnd()%(mem.size/PAGE_SIZE);
+		mem.data[page*PAGE_SIZE+rnd()%PAGE_SIZE]++;
+	}
+}
+
+static bool same_mem(VArray2& mem,u8* copy)
+{
+	return memcmp(mem.data,copy,mem.size)==0;
+}
+
+static u32 diff_pages(VArray2& mem,u8* copy)
+{
+	u32 rv=0;
+	for (u32 i=0;i<mem.size;i+=PAGE_SIZE)
+		rv+=memcmp(mem.data+i,copy+i,PAGE_SIZE)!=0;
+	return rv;
+}
+
+int main()
+{
+	//the frontend gets the size at load time, before dc_init sets anything up
+	u32 load_size=dc_serialize_size();
+
+	p_sh4rcb=(Sh4RCB*)calloc(1,sizeof(Sh4RCB));
+	OnChipRAM.Resize(OnChipRAM_SIZE,true);
+
+	//serialize_fixup rewrites the QACRs through their handlers
+	CCN.data[(CCN_QACR0_addr&255)/4].writeFunctionAddr=&qacr_write;
+	CCN.data[(CCN_QACR1_addr&255)/4].writeFunctionAddr=&qacr_write;
+
+	alloc_mem(mem_b,RAM_SIZE);
+	alloc_mem(vram,VRAM_SIZE);
+	alloc_mem(aica_ram,ARAM_SIZE);
+
+	u8* ram_copy=(u8*)malloc(RAM_SIZE);
+	u8* vram_copy=(u8*)malloc(VRAM_SIZE);
+	u8* aram_copy=(u8*)malloc(ARAM_SIZE);
+
+	u32 size=dc_serialize_size();
+	u8* state=(u8*)calloc(1,size);
+	u32 bad=0;
+
+	if (size!=load_size)
+	{
+		printf("the state is %d bytes, %d before the setup\n",size,load_size);
+		bad++;
+	}
+
+	//first save to a new buffer and a restore to memory that differs everywhere, every page is copied
+	double t0=now_seconds();
+	bad+=!dc_serialize(state,size);
+	double t1=now_seconds();
+
+	u8* full=(u8*)calloc(1,size);
+	memcpy(full,state,size);
+	memset(state,0,size);
+	double t2=now_seconds();
+	bad+=!dc_unserialize(full,size);
+	double t3=now_seconds();
+	bad+=!dc_serialize(state,size);
+	bad+=memcmp(state,full,size)!=0;
+
+	printf("%d KB state, first save %.2f ms, full restore %.2f ms\n",size/1024,(t1-t0)*1000,(t3-t2)*1000);
+
+	double save_time=0,load_time=0;
+
+	for (u32 frame=0;frame<FRAMES;frame++)
+	{
+		touch_pages(mem_b,RAM_PAGES_PER_FRAME);
+		touch_pages(vram,VRAM_PAGES_PER_FRAME);
+		touch_pages(aica_ram,ARAM_PAGES_PER_FRAME);
+
+		t0=now_seconds();
+		bad+=!dc_serialize(state,size);
+		save_time+=now_seconds()-t0;
+
+		memcpy(ram_copy,mem_b.data,RAM_SIZE);
+		memcpy(vram_copy,vram.data,VRAM_SIZE);
+		memcpy(aram_copy,aica_ram.data,ARAM_SIZE);
+
+		//the frames that are run ahead
+		for (int i=0;i<2;i++)
+		{
+			touch_pages(mem_b,RAM_PAGES_PER_FRAME);
+			touch_pages(vram,VRAM_PAGES_PER_FRAME);
+			touch_pages(aica_ram,ARAM_PAGES_PER_FRAME);
+		}
+
+		u32 ram_diff=diff_pages(mem_b,ram_copy);
+		discarded_pages=0;
+
+		t0=now_seconds();
+		bad+=!dc_unserialize(state,size);
+		load_time+=now_seconds()-t0;
+
+		if (!same_mem(mem_b,ram_copy) || !same_mem(vram,vram_copy) || !same_mem(aica_ram,aram_copy))
+			bad++;
+
+		if (discarded_pages!=ram_diff)
+			bad++;
+	}
+
+	printf("%d ram, %d vram, %d aram pages modified per frame: save %.2f ms, restore %.2f ms per frame\n",
+		RAM_PAGES_PER_FRAME,VRAM_PAGES_PER_FRAME,ARAM_PAGES_PER_FRAME,save_time*1000/FRAMES,load_time*1000/FRAMES);
+	printf("%d mismatches\n",bad);
+
+	return bad ? 1 : 0;
+}
@@ -0,0 +1,480 @@
+/*
+	shil optimiser differential test
+
+	Generates a corpus of blocks in the shapes the decoder emits (alu, compares and
+	T bit juggling, shifts, carries, mul, memory accesses with updates, fpu, fallbacks,
+	superblock side exits and the block end ops), runs each block through ssa_Optimise
+	with every pass alone and with all of them, then runs the original and optimised
+	oplists on the same random register files and compares the registers, the memory
+	and the side effects afterwards.
+
+	Unlike the validation mode of the optimiser, every op is evaluated for real here,
+	with the canonical implementations. Memory is a map, reads of unwritten addresses
+	return a hash of the address. Fallbacks, sync_sr/fpscr and side exits log a hash
+	of the whole context, fallbacks and syncs then change every register.
+*/
+#include "hw/sh4/dyna/ssa.cpp"
+#include <map>
+#include "test_common.h"
+
+//opcode names, as shil.cpp makes them
+#define SHIL_MODE 4
+#include "hw/sh4/dyna/shil_canonical.h"
+
+const char* shil_opcode_name(int op) { return shilop_str[op]; }
+
+#define BLOCKS 20000
+#define INPUTS 16
+
+settings_t settings;
+Sh4RCB* p_sh4rcb;
+
+RuntimeBlockInfo::~RuntimeBlockInfo() { }
+
+struct TestBlock : RuntimeBlockInfo
+{
+	virtual u32 Relink() { return 0; }
+	virtual void Relocate(void* dst) { }
+};
+
+static u32 mix(u32 h,u32 v)
+{
+	h^=v;
+	h*=0x01000193;
+	return h^(h>>15);
+}
+
+/*
+	Evaluation
+*/
+struct test_context
+{
+	u32 regs[sh4_reg_count];
+	map<u32,u32> mem;
+	vector<u32> log;
+
+	bool operator==(const test_context& o) const
+	{
+		return memcmp(regs,o.regs,sizeof(regs))==0 && mem==o.mem && log==o.log;
+	}
+};
+
+static u32 get(test_context& ctx,const shil_param& prm)
+{
+	if (prm.is_null())
+		return 0;
+	if (prm.is_imm())
+		return prm._imm;
+
+	verify(prm.count()==1);
+	return ctx.regs[prm._reg];
+}
+
+static f32 getf(test_context& ctx,const shil_param& prm)
+{
+	u32 v=get(ctx,prm);
+	return (f32&)v;
+}
+
+static void set(test_context& ctx,const shil_param& prm,u32 v)
+{
+	if (prm.is_reg())
+		ctx.regs[prm._reg]=v;
+}
+
+static void setf(test_context& ctx,const shil_param& prm,f32 v)
+{
+	set(ctx,prm,(u32&)v);
+}
+
+static void set64(test_context& ctx,const shil_opcode& op,u64 v)
+{
+	set(ctx,op.rd,(u32)v);
+	set(ctx,op.rd2,(u32)(v>>32));
+}
+
+static u32 context_hash(test_context& ctx,u32 h)
+{
+	for (u32 rn=0;rn<sh4_reg_count;rn++)
+		h=mix(h,ctx.regs[rn]);
+	return h;
+}
+
+static void eval(const vector<shil_opcode>& oplist,test_context& ctx)
+{
+	for (size_t i=0;i<oplist.size();i++)
+	{
+		const shil_opcode& op=oplist[i];
+		u32 r1=op.rs1.is_reg() && op.rs1.count()!=1 ? 0 : get(ctx,op.rs1);
+		u32 r2=get(ctx,op.rs2);
+		u32 r3=get(ctx,op.rs3);
+
+		switch (op.op)
+		{
+		case shop_mov32: set(ctx,op.rd,r1); break;
+		case shop_mov64:
+			for (u32 k=0;k<2;k++)
+				ctx.regs[op.rd._reg+k]=ctx.regs[op.rs1._reg+k];
+			break;
+
+		case shop_jdyn:  set(ctx,op.rd,r1+r2); break;
+		case shop_jcond: set(ctx,op.rd,r1); break;
+
+		case shop_jexit:
+			ctx.log.push_back(context_hash(ctx,mix(r2,r3)));
+			break;
+
+		case shop_ifb: case shop_sync_sr: case shop_sync_fpscr:
+			{
+				u32 h=context_hash(ctx,mix(mix(op.op,r1),mix(r2,r3)));
+				ctx.log.push_back(h);
+				for (u32 rn=0;rn<sh4_reg_count;rn++)
+					ctx.regs[rn]^=mix(h,rn)&(rn==reg_sr_T ? 1 : 0xFFFFFFFF);
+			}
+			break;
+
+		case shop_readm:
+			{
+				u32 addr=r1+r3;
+				u32 v=ctx.mem.count(addr) ? ctx.mem[addr] : mix(0x5EED,addr);
+				if (op.flags==1) v=(s8)v;
+				if (op.flags==2) v=(s16)v;
+				ctx.log.push_back(addr);
+				set(ctx,op.rd,v);
+			}
+			break;
+
+		case shop_writem:
+			{
+				u32 addr=r1+r3;
+				ctx.mem[addr]=op.flags==4 ? r2 : r2&((1<<(op.flags*8))-1);
+				ctx.log.push_back(addr^r2);
+			}
+			break;
+
+		case shop_pref: ctx.log.push_back(r1); break;
+
+		case shop_and:     set(ctx,op.rd,shil_opcl_and::f1::impl(r1,r2)); break;
+		case shop_or:      set(ctx,op.rd,shil_opcl_or::f1::impl(r1,r2)); break;
+		case shop_xor:     set(ctx,op.rd,shil_opcl_xor::f1::impl(r1,r2)); break;
+		case shop_not:     set(ctx,op.rd,shil_opcl_not::f1::impl(r1)); break;
+		case shop_add:     set(ctx,op.rd,shil_opcl_add::f1::impl(r1,r2)); break;
+		case shop_sub:     set(ctx,op.rd,shil_opcl_sub::f1::impl(r1,r2)); break;
+		case shop_neg:     set(ctx,op.rd,shil_opcl_neg::f1::impl(r1)); break;
+		case shop_shl:     set(ctx,op.rd,shil_opcl_shl::f1::impl(r1,r2)); break;
+		case shop_shr:     set(ctx,op.rd,shil_opcl_shr::f1::impl(r1,r2)); break;
+		case shop_sar:     set(ctx,op.rd,shil_opcl_sar::f1::impl(r1,r2)); break;
+		case shop_ror:     set(ctx,op.rd,shil_opcl_ror::f1::impl(r1,r2)); break;
+		case shop_shld:    set(ctx,op.rd,shil_opcl_shld::f1::impl(r1,r2)); break;
+		case shop_shad:    set(ctx,op.rd,shil_opcl_shad::f1::impl(r1,r2)); break;
+		case shop_swaplb:  set(ctx,op.rd,shil_opcl_swaplb::f1::impl(r1)); break;
+		case shop_swap:    set(ctx,op.rd,shil_opcl_swap::f1::impl(r1)); break;
+		case shop_ext_s8:  set(ctx,op.rd,shil_opcl_ext_s8::f1::impl(r1)); break;
+		case shop_ext_s16: set(ctx,op.rd,shil_opcl_ext_s16::f1::impl(r1)); break;
+		case shop_mul_u16: set(ctx,op.rd,shil_opcl_mul_u16::f1::impl(r1,r2)); break;
+		case shop_mul_s16: set(ctx,op.rd,shil_opcl_mul_s16::f1::impl(r1,r2)); break;
+		case shop_mul_i32: set(ctx,op.rd,shil_opcl_mul_i32::f1::impl(r1,r2)); break;
+		case shop_test:    set(ctx,op.rd,shil_opcl_test::f1::impl(r1,r2)); break;
+		case shop_seteq:   set(ctx,op.rd,shil_opcl_seteq::f1::impl(r1,r2)); break;
+		case shop_setge:   set(ctx,op.rd,shil_opcl_setge::f1::impl(r1,r2)); break;
+		case shop_setgt:   set(ctx,op.rd,shil_opcl_setgt::f1::impl(r1,r2)); break;
+		case shop_setae:   set(ctx,op.rd,shil_opcl_setae::f1::impl(r1,r2)); break;
+		case shop_setab:   set(ctx,op.rd,shil_opcl_setab::f1::impl(r1,r2)); break;
+		case shop_setpeq:  set(ctx,op.rd,shil_opcl_setpeq::f1::impl(r1,r2)); break;
+		case shop_div32p2: set(ctx,op.rd,shil_opcl_div32p2::f1::impl(r1,r2,r3)); break;
+
+		case shop_adc:     set64(ctx,op,shil_opcl_adc::f1::impl(r1,r2,r3)); break;
+		case shop_sbc:     set64(ctx,op,shil_opcl_sbc::f1::impl(r1,r2,r3)); break;
+		case shop_rocl:    set64(ctx,op,shil_opcl_rocl::f1::impl(r1,r2)); break;
+		case shop_rocr:    set64(ctx,op,shil_opcl_rocr::f1::impl(r1,r2)); break;
+		case shop_mul_u64: set64(ctx,op,shil_opcl_mul_u64::f1::impl(r1,r2)); break;
+		case shop_mul_s64: set64(ctx,op,shil_opcl_mul_s64::f1::impl(r1,r2)); break;
+
+		case shop_fadd:   setf(ctx,op.rd,shil_opcl_fadd::f1::impl(getf(ctx,op.rs1),getf(ctx,op.rs2))); break;
+		case shop_fsub:   setf(ctx,op.rd,shil_opcl_fsub::f1::impl(getf(ctx,op.rs1),getf(ctx,op.rs2))); break;
+		case shop_fmul:   setf(ctx,op.rd,shil_opcl_fmul::f1::impl(getf(ctx,op.rs1),getf(ctx,op.rs2))); break;
+		case shop_fabs:   setf(ctx,op.rd,shil_opcl_fabs::f1::impl(getf(ctx,op.rs1))); break;
+		case shop_fneg:   setf(ctx,op.rd,shil_opcl_fneg::f1::impl(getf(ctx,op.rs1))); break;
+		case shop_fseteq: set(ctx,op.rd,shil_opcl_fseteq::f1::impl(getf(ctx,op.rs1),getf(ctx,op.rs2))); break;
+		case shop_fsetgt: set(ctx,op.rd,shil_opcl_fsetgt::f1::impl(getf(ctx,op.rs1),getf(ctx,op.rs2))); break;
+		case shop_cvt_i2f_n: setf(ctx,op.rd,shil_opcl_cvt_i2f_n::f1::impl(r1)); break;
+		case shop_cvt_f2i_t: set(ctx,op.rd,shil_opcl_cvt_f2i_t::f1::impl(getf(ctx,op.rs1))); break;
+
+		default:
+			printf("ssa_diff: no evaluation for %s\n",shil_opcode_name(op.op));
+			verify(false);
+		}
+	}
+}
+
+/*
+	Corpus
+*/
+static vector<shil_opcode>* oplist;
+
+static void emit(shilop op,shil_param rd=shil_param(),shil_param rs1=shil_param(),shil_param rs2=shil_param(),
+	u32 flags=0,shil_param rs3=shil_param(),shil_param rd2=shil_param())
+{
+	shil_opcode sp;
+	memset(&sp,0,sizeof(sp));
+
+	sp.op=op;
+	sp.flags=flags;
+	sp.rd=rd;
+	sp.rd2=rd2;
+	sp.rs1=rs1;
+	sp.rs2=rs2;
+	sp.rs3=rs3;
+
+	oplist->push_back(sp);
+}
+
+static shil_param imm(u32 v)
+{
+	return shil_param(FMT_IMM,v);
+}
+
+//few registers, so values are reused and overwritten often
+static shil_param rn()
+{
+	return shil_param((Sh4RegType)(reg_r0+rnd()%6));
+}
+
+static shil_param frn()
+{
+	return shil_param((Sh4RegType)(reg_fr_0+rnd()%4));
+}
+
+static u32 simm8()
+{
+	return (s8)rnd();
+}
+
+static const shil_param srT(reg_sr_T);
+
+static void gen_op()
+{
+	shil_param n=rn(),m=rn();
+	static const shilop alu[]={shop_add,shop_sub,shop_and,shop_or,shop_xor};
+	static const shilop cmp[]={shop_seteq,shop_setge,shop_setgt,shop_setae,shop_setab,shop_test,shop_setpeq};
+
+	switch (rnd()%32)
+	{
+	case 0: case 1: case 2: emit(shop_mov32,n,imm(simm8())); break;          //mov #imm,Rn
+	case 3:  emit(shop_mov32,n,m); break;                                     //mov Rm,Rn
+	case 4: case 5: emit(alu[rnd()%5],n,n,m); break;                         //add Rm,Rn ...
+	case 6:  emit(shop_add,n,n,imm(simm8())); break;                          //add #imm,Rn
+	case 7:  emit(alu[2+rnd()%3],shil_param(reg_r0),shil_param(reg_r0),imm(rnd()&0xFF)); break; //and #imm,R0 ...
+	case 8: case 9: emit(cmp[rnd()%7],srT,n,m); break;                         //cmp/xx Rm,Rn
+	case 10: emit(shop_seteq,srT,shil_param(reg_r0),imm(simm8())); break;       //cmp/eq #imm,R0
+	case 11: emit(rnd()%2 ? shop_setge : shop_setgt,srT,n,imm(0)); break;       //cmp/pz cmp/pl
+	case 12: emit(shop_sub,n,n,imm(1)); emit(shop_seteq,srT,n,imm(0)); break;   //dt Rn
+	case 13:                                                                  //shll/shlr/shar
+		{
+			u32 k=rnd()%3;
+			if (k==0) emit(shop_shr,srT,n,imm(31)); else emit(shop_and,srT,n,imm(1));
+			emit(k==0 ? shop_shl : k==1 ? shop_shr : shop_sar,n,n,imm(1));
+		}
+		break;
+	case 14: emit(rnd()%2 ? shop_shl : shop_shr,n,n,imm(rnd()%2 ? 2 : rnd()%2 ? 8 : 16)); break;
+	case 15: emit(shop_ror,n,n,imm(rnd()%2 ? 1 : 31)); break;
+	case 16: emit(rnd()%2 ? shop_rocl : shop_rocr,n,n,srT,0,shil_param(),srT); break;
+	case 17: emit(rnd()%2 ? shop_adc : shop_sbc,n,n,m,0,srT,srT); break;          //addc subc
+	case 18: emit(shop_mov32,n,srT); break;                                     //movt
+	case 19: emit(shop_mov32,srT,imm(rnd()%2)); break;                          //clrt sett
+	case 20:                                                                  //extu exts swap neg not
+		{
+			switch (rnd()%7)
+			{
+			case 0: emit(shop_and,n,m,imm(0xFF)); break;
+			case 1: emit(shop_and,n,m,imm(0xFFFF)); break;
+			case 2: emit(shop_ext_s8,n,m); break;
+			case 3: emit(shop_ext_s16,n,m); break;
+			case 4: emit(shop_swaplb,n,m); break;
+			case 5: emit(shop_swap,n,m); break;
+			case 6: emit(rnd()%2 ? shop_neg : shop_not,n,m); break;
+			}
+		}
+		break;
+	case 21: emit(rnd()%2 ? shop_shld : shop_shad,n,n,m); break;
+	case 22:                                                                  //mul.l mulu.w muls.w dmulu.l dmuls.l
+		{
+			shil_param macl(reg_macl),mach(reg_mach);
+			switch (rnd()%5)
+			{
+			case 0: emit(shop_mul_i32,macl,n,m); break;
+			case 1: emit(shop_mul_u16,macl,n,m); break;
+			case 2: emit(shop_mul_s16,macl,n,m); break;
+			case 3: emit(shop_mul_u64,macl,n,m,0,shil_param(),mach); break;
+			case 4: emit(shop_mul_s64,macl,n,m,0,shil_param(),mach); break;
+			}
+		}
+		break;
+	case 23: emit(shop_div32p2,n,n,m,0,srT); break;
+	case 24:                                                                  //mov.x @Rm,Rn, @Rm+, @(R0,Rm)
+		{
+			u32 sz=1<<(rnd()%3);
+			u32 k=rnd()%3;
+			emit(shop_readm,n,m,shil_param(),sz,k==2 ? shil_param(reg_r0) : rnd()%2 ? imm(rnd()%16*4) : shil_param());
+			if (k==1 && n._reg!=m._reg)
+				emit(shop_add,m,m,imm(sz));
+		}
+		break;
+	case 25:                                                                  //mov.x Rm,@Rn, @-Rn
+		{
+			u32 sz=1<<(rnd()%3);
+			if (rnd()%2 && n._reg!=m._reg)
+				emit(shop_sub,n,n,imm(sz));
+			emit(shop_writem,shil_param(),n,m,sz,rnd()%2 ? shil_param(reg_r0) : shil_param());
+		}
+		break;
+	case 26:                                                                  //fadd fsub fmul fneg fabs
+		{
+			shil_param fn=frn(),fm=frn();
+			switch (rnd()%5)
+			{
+			case 0: emit(shop_fadd,fn,fn,fm); break;
+			case 1: emit(shop_fsub,fn,fn,fm); break;
+			case 2: emit(shop_fmul,fn,fn,fm); break;
+			case 3: emit(shop_fneg,fn,fn); break;
+			case 4: emit(shop_fabs,fn,fn); break;
+			}
+		}
+		break;
+	case 27: emit(rnd()%2 ? shop_fseteq : shop_fsetgt,srT,frn(),frn()); break; //fcmp
+	case 28:                                                                  //lds sts float ftrc
+		{
+			shil_param ul(reg_fpul);
+			switch (rnd()%4)
+			{
+			case 0: emit(shop_mov32,ul,n); break;
+			case 1: emit(shop_mov32,n,ul); break;
+			case 2: emit(shop_cvt_i2f_n,frn(),ul); break;
+			case 3: emit(shop_cvt_f2i_t,ul,frn()); break;
+			}
+		}
+		break;
+	case 29:
+		if (rnd()%4==0)
+			emit(shop_ifb,shil_param(),imm(rnd()%2),imm(0x8C010000+rnd()%256*2),0,imm(rnd()&0xFFFF));
+		else if (rnd()%4==0)
+			emit(shop_sync_sr);
+		break;
+	case 30:                                                                  //superblock side exit
+		if (rnd()%2)
+			emit(shop_jexit,shil_param(),srT,imm(rnd()%2),0,imm(0x8C010000+rnd()%256*2));
+		break;
+	case 31: emit(shop_mov32,shil_param(reg_pr),imm(0x8C010000+rnd()%256*2)); break;
+	}
+}
+
+static void gen_block(RuntimeBlockInfo* blk)
+{
+	oplist=&blk->oplist;
+	oplist->clear();
+
+	u32 len=1+rnd()%24;
+	while (oplist->size()<len)
+		gen_op();
+
+	switch (rnd()%3)
+	{
+	case 0: emit(shop_jcond,shil_param(reg_pc_dyn),srT); break;
+	case 1: emit(shop_jdyn,shil_param(reg_pc_dyn),rn(),rnd()%2 ? imm(4) : shil_param()); break;
+	case 2: emit(shop_mov32,shil_param(reg_nextpc),imm(0x8C010000+rnd()%256*2)); break;
+	}
+}
+
+//register values that make compares go both ways, and carries/overflows happen
+static u32 gen_value(u32 rn)
+{
+	static const u32 common[]={0,1,2,0x7FFFFFFF,0x80000000,0xFFFFFFFF,0x80,0xFF,0x8000,0xFFFF};
+
+	if (rn==reg_sr_T)
+		return rnd()&1;
+	if (rn>=reg_fr_0 && rn<=reg_xf_15)
+	{
+		f32 f=(s32)(rnd()%2001-1000)/8.0f;
+		return (u32&)f;
+	}
+
+	switch (rnd()%3)
+	{
+	case 0: return common[rnd()%10];
+	case 1: return rnd()%16;
+	default: return rnd();
+	}
+}
+
+static void dump(const char* name,const vector<shil_opcode>& oplist)
+{
+	printf("%s:\n",name);
+	for (size_t i=0;i<oplist.size();i++)
+		printf("\t%s %08X %08X %08X -> %08X %08X\n",shil_opcode_name(oplist[i].op),oplist[i].rs1._imm,oplist[i].rs2._imm,oplist[i].rs3._imm,
+			oplist[i].rd._imm,oplist[i].rd2._imm);
+}
+
+static u32 run(u32 passes)
+{
+	settings.dynarec.OptPasses=passes;
+	settings.dynarec.OptValidate=false;
+	memset(&ssa_stats,0,sizeof(ssa_stats));
+
+	seed=1234;
+	u32 bad=0,changed=0;
+	TestBlock blk;
+
+	for (u32 b=0;b<BLOCKS;b++)
+	{
+		gen_block(&blk);
+
+		vector<shil_opcode> original=blk.oplist;
+		ssa_Optimise(&blk);
+
+		bool same=original.size()==blk.oplist.size();
+		for (size_t i=0;same && i<original.size();i++)
+			same=memcmp(&original[i],&blk.oplist[i],sizeof(shil_opcode))==0;
+		if (!same)
+			changed++;
+
+		for (u32 i=0;i<INPUTS;i++)
+		{
+			test_context ref;
+			for (u32 rn=0;rn<sh4_reg_count;rn++)
+				ref.regs[rn]=gen_value(rn);
+
+			test_context opt=ref;
+			eval(original,ref);
+			eval(blk.oplist,opt);
+
+			if (ref==opt)
+				continue;
+
+			if (bad++<4)
+			{
+				printf("block %d, passes %d: optimised block doesn't match\n",b,passes);
+				dump("original",original);
+				dump("optimised",blk.oplist);
+			}
+			break;
+		}
+	}
+
+	printf("passes %d: %d of %d blocks changed, %d -> %d ops, %d const args, %d folded, %d srT writes, %d dead, %d mismatches\n",
+		passes,changed,BLOCKS,ssa_stats.ops_in,ssa_stats.ops_out,ssa_stats.const_args,ssa_stats.folded,
+		ssa_stats.srt_removed,ssa_stats.dead_removed,bad);
+
+	return bad;
+}
+
+int main()
+{
+	u32 bad=0;
+
+	bad+=run(SSA_ConstProp);
+	bad+=run(SSA_SRT);
+	bad+=run(SSA_DeadCode);
+	bad+=run(SSA_AllPasses);
+
+	return bad ? 1 : 0;
+}
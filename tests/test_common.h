@@ -0,0 +1,36 @@
+/*
+	What every test and benchmark needs besides the core sources it includes: the error
+	reporting the core calls (verify/die end up in msgboxf and os_DebugBreak), a clock and
+	a small random generator. Included after the core sources.
+*/
+#pragma once
+#include "types.h"
+#include <time.h>
+
+int msgboxf(const wchar* text,unsigned int type,...)
+{
+	printf("%s\n",text);
+	return 0;
+}
+
+void os_DebugBreak()
+{
+	abort();
+}
+
+static double now_seconds()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return t.tv_sec+t.tv_nsec*1e-9;
+}
+
+//xorshift32, the tests set seed to get the same sequence again
+static u32 seed=1234;
+static u32 rnd()
+{
+	seed^=seed<<13;
+	seed^=seed>>17;
+	seed^=seed<<5;
+	return seed;
+}
@@ -0,0 +1,405 @@
+/*
+	x64 recompiler inline op differential test
+
+	Every shil op GenNativeOp emits inline is compiled three ways, each into a small function
+	that runs the op on the sh4 context: through its canonical implementation (the shil_chf
+	fallback the recompiler calls for the ops it doesn't inline), inline with the operands
+	in the context, and inline with the operands allocated to host registers the way RegAlloc
+	hands them out for a block. The three run on the same random contexts and the whole
+	context is compared afterwards.
+
+	The operands are in the shapes the decoder emits, with some immediates, and the values
+	are mostly the interesting ones (0, the ints around the sign bit, the shift amounts
+	around 32, signed zeros, inf, NaN, denormals, the float to int limits).
+
+	Not generated: the divisions the host traps on (div32 by 0, 0x80000000/-1). fseteq
+	isn't compared on NaN operands, the inline one is false there as on the sh4, the
+	-ffast-math canonical one drops the parity check (see GenNativeOp).
+
+	Built with -fno-associative-math, so the canonical fipr and ftrv sum in the order they
+	write out. The -ffast-math core build is free to reorder those sums, the results of
+	the two versions can differ in the last bits there.
+*/
+#include "deps/xbyak/xbyak.h"
+#include "hw/sh4/dyna/shil.cpp"
+#include "rec-x64/rec_x64.cpp"
+#include "hw/sh4/sh4_core_regs.cpp"
+#include "hw/sh4/sh4_rom.cpp"
+#include <sys/mman.h>
+#include "test_common.h"
+
+#define SHAPES   200    //operand shapes per op
+#define CONTEXTS 64     //contexts each shape runs on
+
+settings_t settings;
+unsigned RAM_SIZE=16*1024*1024;
+u8* virt_ram_base;
+Array<RegisterStruct> CCN;
+sh4_opcodelistentry* OpDesc[0x10000];
+ngen_ra_stats_t ra_stats;
+
+//the ops run on their own, nothing outside of the op is called
+int cycle_counter;
+bool inside_loop;
+u8* CodeCache;
+u32 bm_discard_gen;
+RuntimeBlockInfo::~RuntimeBlockInfo() { }
+RuntimeBlockInfo* bm_GetBlock2(void* dynarec_code) { return 0; }
+DynarecCodeEntryPtr DYNACALL rdv_BlockCheckFail(u32 pc) { return 0; }
+void DYNACALL rdv_HotBlock(u32 pc) { }
+DynarecCodeEntryPtr rdv_FindOrCompile() { return 0; }
+void* DYNACALL rdv_LinkBlock(u8* code,u32 dpc) { return 0; }
+u32 DYNACALL rdv_DoInterrupts_pc(u32 pc) { return 0; }
+void ssa_Optimise(RuntimeBlockInfo* blk) { }
+int UpdateSystem() { return 0; }
+int UpdateINTC() { return 0; }
+bool SRdecode() { return false; }
+bool IsOnRam(u32 addr) { return false; }
+u8* GetMemPtr(u32 Addr,u32 size) { return 0; }
+void DYNACALL do_sqw_mmu(u32 dst) { }
+void os_MakeExecutable(void* ptr,u32 sz) { }
+u8 DYNACALL _vmem_ReadMem8(u32 Address) { return 0; }
+u16 DYNACALL _vmem_ReadMem16(u32 Address) { return 0; }
+u32 DYNACALL _vmem_ReadMem32(u32 Address) { return 0; }
+u64 DYNACALL _vmem_ReadMem64(u32 Address) { return 0; }
+void DYNACALL _vmem_WriteMem8(u32 Address,u8 data) { }
+void DYNACALL _vmem_WriteMem16(u32 Address,u16 data) { }
+void DYNACALL _vmem_WriteMem32(u32 Address,u32 data) { }
+void DYNACALL _vmem_WriteMem64(u32 Address,u64 data) { }
+
+void ngen_GetFeatures(ngen_features* dst)
+{
+	memset(dst,0,sizeof(*dst));
+}
+
+//as rec.cpp forwards them
+void ngen_CC_Start(shil_opcode* op) { ngen_CC_Start_x64(op); }
+void ngen_CC_Param(shil_opcode* op,shil_param* par,CanonicalParamType tp) { ngen_CC_Param_x64(op,par,tp); }
+void ngen_CC_Call(shil_opcode* op,void* function) { ngen_CC_Call_x64(op,function); }
+void ngen_CC_Finish(shil_opcode* op) { ngen_CC_Finish_x64(op); }
+
+//in the image like the real code cache, the calls out are rel32
+static u8 DECL_ALIGN(4096) code_buffer[4*CODE_BLOCK_MAX];
+static u32 code_used;
+
+void* emit_GetCCPtr() { return code_buffer+code_used; }
+u32 emit_FreeSpace() { return 4*CODE_BLOCK_MAX-code_used; }
+void emit_Skip(u32 sz) { code_used+=sz; }
+
+/*
+	The functions are called from C, so they save the registers RegAlloc uses and keep
+	rsp aligned for the canonical calls
+*/
+class OpCompiler : public BlockCompilerx64
+{
+public:
+	enum mode_t { Canonical, Inline, InlineAllocated };
+
+	void* compile(RuntimeBlockInfo* block,mode_t mode)
+	{
+		shil_opcode& op=block->oplist[0];
+
+		push(rbx); push(rbp); push(r12); push(r13); push(r14); push(r15);
+		sub(rsp,8);
+
+		if (mode==InlineAllocated)
+			regalloc.DoAlloc(block,alloc_regs,xmm_alloc_regs);
+		else
+			regalloc.Cleanup();
+		regalloc.reads=regalloc.writes=0;
+		regalloc.call_loads=regalloc.call_stores=0;
+
+		regalloc.OpBegin(&op,0);
+		if (mode==Canonical)
+			shil_chf[op.op](&op);
+		else if (!GenNativeOp(op))
+			die("x64_ops_diff: the op isn't inline");
+		regalloc.OpEnd(&op);
+
+		add(rsp,8);
+		pop(r15); pop(r14); pop(r13); pop(r12); pop(rbp); pop(rbx);
+		ret();
+
+		ready();
+		code_used+=getSize();
+
+		return (void*)getCode();
+	}
+};
+
+static u32 reads;    //operands the allocated versions read from host registers
+
+static void* compile(RuntimeBlockInfo* block,OpCompiler::mode_t mode)
+{
+	OpCompiler* compiler=new OpCompiler();
+	compilerx64_data=compiler;
+
+	void* rv=compiler->compile(block,mode);
+	reads+=compiler->regalloc.reads;
+
+	delete compiler;
+	return rv;
+}
+
+/*
+	Values
+*/
+static u32 gen_int()
+{
+	static const u32 special[]={ 0,1,2,3,0x7F,0x80,0xFF,0x7FFF,0x8000,0xFFFF,0x10000,31,32,33,
+		0x7FFFFFFF,0x80000000,0x80000001,0xFFFFFFFF,0xFFFFFFFE,0xFFFFFFE0,0xFFFFFFE1,0xFFFF8000 };
+
+	switch (rnd()%4)
+	{
+	case 0: return special[rnd()%(sizeof(special)/sizeof(special[0]))];
+	case 1: return rnd()%64;
+	case 2: return (s32)(rnd()%64)-32;
+	default: return rnd();
+	}
+}
+
+static u32 gen_float()
+{
+	static const u32 special[]={ 0,0x80000000,0x3F800000,0xBF800000,0x40000000,0x3F000000,
+		0x7F800000,0xFF800000,0x7FC00000,0xFFC00000,0x7FBFFFFF,0x7F800001,1,0x807FFFFF,
+		0x7F7FFFFF,0xFF7FFFFF,0x4EFFFFFF,0x4F000000,0xCF000000,0xCF000001,0x00800000 };
+
+	switch (rnd()%4)
+	{
+	case 0: return special[rnd()%(sizeof(special)/sizeof(special[0]))];
+	case 1: return (rnd()&0x807FFFFF)|((110+rnd()%40)<<23);           //something you'd compute with
+	case 2: return (rnd()&0x807FFFFF)|((120+rnd()%10)<<23);
+	default: return rnd();
+	}
+}
+
+static void gen_context()
+{
+	for (u32 i=0;i<16;i++)
+		r[i]=gen_int();
+	for (u32 i=0;i<16;i++)
+	{
+		fr_hex[i]=gen_float();
+		xf_hex[i]=gen_float();
+	}
+	mac.l=gen_int();
+	mac.h=gen_int();
+	fpul=rnd()%2 ? gen_int() : gen_float();
+	sr.T=rnd()&1;
+}
+
+static bool is_nan(u32 v)
+{
+	return (v&0x7FFFFFFF)>0x7F800000;
+}
+
+/*
+	Operands, as the decoder emits them
+*/
+static shil_param rn()   { return shil_param((Sh4RegType)(reg_r0+rnd()%8)); }
+static shil_param frn()  { return shil_param((Sh4RegType)(reg_fr_0+rnd()%16)); }
+static shil_param imm(u32 v) { return shil_param(FMT_IMM,v); }
+static const shil_param srT(reg_sr_T);
+
+static shil_param rn_or_imm()
+{
+	return rnd()%4 ? rn() : imm(gen_int());
+}
+
+static shil_opcode gen_op(shilop opc)
+{
+	shil_opcode op;
+	memset(&op,0,sizeof(op));
+	op.op=opc;
+
+	switch (opc)
+	{
+	case shop_and: case shop_or: case shop_xor: case shop_add: case shop_sub:
+	case shop_mul_u16: case shop_mul_s16: case shop_mul_i32:
+		op.rd=rn(); op.rs1=rn(); op.rs2=rn_or_imm();
+		break;
+
+	case shop_test: case shop_seteq: case shop_setge: case shop_setgt:
+	case shop_setae: case shop_setab: case shop_setpeq:
+		op.rd=srT; op.rs1=rn(); op.rs2=rn_or_imm();
+		break;
+
+	case shop_shl: case shop_shr: case shop_sar: case shop_ror:
+		op.rd=rn(); op.rs1=rn(); op.rs2=rnd()%4 ? imm(rnd()%32) : rn();
+		break;
+
+	case shop_shld: case shop_shad:
+		op.rd=rn(); op.rs1=rn(); op.rs2=rn();
+		break;
+
+	case shop_not: case shop_neg: case shop_swaplb: case shop_ext_s8: case shop_ext_s16:
+		op.rd=rn(); op.rs1=rn();
+		break;
+
+	case shop_adc: case shop_sbc:
+		op.rd=rn(); op.rs1=op.rd; op.rs2=rn(); op.rs3=srT; op.rd2=srT;
+		break;
+
+	case shop_rocl: case shop_rocr:
+		op.rd=rn(); op.rs1=op.rd; op.rs2=srT; op.rd2=srT;
+		break;
+
+	case shop_mul_u64: case shop_mul_s64:
+		op.rd=shil_param(reg_macl); op.rs1=rn(); op.rs2=rn(); op.rd2=shil_param(reg_mach);
+		break;
+
+	//as the div1 sequences get them, rd2 is a third register
+	case shop_div32u: case shop_div32s:
+		op.rd=shil_param(reg_r1); op.rs1=op.rd; op.rs2=shil_param(reg_r2); op.rd2=shil_param(reg_r3);
+		break;
+
+	case shop_div32p2:
+		op.rd=rn(); op.rs1=op.rd; op.rs2=rn(); op.rs3=srT;
+		break;
+
+	case shop_fadd: case shop_fsub: case shop_fmul: case shop_fdiv:
+		op.rd=frn(); op.rs1=op.rd; op.rs2=frn();
+		break;
+
+	case shop_fabs: case shop_fneg: case shop_fsqrt: case shop_fsrra:
+		op.rd=frn(); op.rs1=op.rd;
+		break;
+
+	case shop_fmac:
+		op.rd=frn(); op.rs1=op.rd; op.rs2=frn(); op.rs3=shil_param(reg_fr_0);
+		break;
+
+	case shop_fseteq: case shop_fsetgt:
+		op.rd=srT; op.rs1=frn(); op.rs2=frn();
+		break;
+
+	case shop_cvt_f2i_t:
+		op.rd=shil_param(reg_fpul); op.rs1=frn();
+		break;
+
+	case shop_cvt_i2f_n: case shop_cvt_i2f_z:
+		op.rd=frn(); op.rs1=shil_param(reg_fpul);
+		break;
+
+	case shop_fipr:
+		{
+			u32 n=rnd()%4;
+			op.rd=shil_param((Sh4RegType)(reg_fr_0+n*4+3)); op.rs1=shil_param((Sh4RegType)(regv_fv_0+n));
+			op.rs2=shil_param((Sh4RegType)(regv_fv_0+rnd()%4));
+		}
+		break;
+
+	case shop_ftrv:
+		op.rd=shil_param((Sh4RegType)(regv_fv_0+rnd()%4)); op.rs1=op.rd; op.rs2=shil_param(regv_xmtrx);
+		break;
+
+	case shop_fsca:
+		op.rd=shil_param((Sh4RegType)(regv_dr_0+rnd()%8)); op.rs1=shil_param(reg_fpul);
+		break;
+
+	case shop_frswap:
+		op.rd=shil_param(regv_xmtrx); op.rs1=shil_param(regv_fmtrx); op.rs2=op.rd; op.rd2=op.rs1;
+		break;
+
+	default:
+		die("x64_ops_diff: no operands for the op");
+	}
+
+	return op;
+}
+
+//the inputs the host would trap on
+static void fix_inputs(const shil_opcode& op)
+{
+	if (op.op==shop_div32u || op.op==shop_div32s)
+	{
+		if (r[2]==0)
+			r[2]=1;
+		if (op.op==shop_div32s && r[1]==0x80000000 && r[2]==0xFFFFFFFF)
+			r[1]=0x7FFFFFFF;
+	}
+}
+
+static void run(void* code,const Sh4Context& start,Sh4Context& end)
+{
+	Sh4cntx=start;
+	((void (*)())code)();
+	end=Sh4cntx;
+}
+
+static const shilop ops[]={
+	shop_and,shop_or,shop_xor,shop_add,shop_sub,shop_not,shop_neg,
+	shop_shl,shop_shr,shop_sar,shop_ror,shop_shld,shop_shad,
+	shop_adc,shop_sbc,shop_rocl,shop_rocr,shop_swaplb,shop_ext_s8,shop_ext_s16,
+	shop_mul_u16,shop_mul_s16,shop_mul_i32,shop_mul_u64,shop_mul_s64,
+	shop_div32u,shop_div32s,shop_div32p2,
+	shop_test,shop_seteq,shop_setge,shop_setgt,shop_setae,shop_setab,shop_setpeq,
+	shop_fadd,shop_fsub,shop_fmul,shop_fdiv,shop_fabs,shop_fneg,shop_fsqrt,shop_fsrra,shop_fmac,
+	shop_fseteq,shop_fsetgt,shop_cvt_f2i_t,shop_cvt_i2f_n,shop_cvt_i2f_z,
+	shop_fipr,shop_ftrv,shop_fsca,shop_frswap,
+};
+
+int main()
+{
+	mprotect(code_buffer,sizeof(code_buffer),PROT_READ|PROT_WRITE|PROT_EXEC);
+	p_sh4rcb=(Sh4RCB*)calloc(1,sizeof(Sh4RCB));
+
+	DynaRBI block;
+	Sh4Context start,ref,inl,alloc;
+
+	u32 bad=0,runs=0;
+
+	for (u32 o=0;o<sizeof(ops)/sizeof(ops[0]);o++)
+	{
+		u32 op_bad=0;
+
+		for (u32 s=0;s<SHAPES;s++)
+		{
+			block.oplist.clear();
+			block.oplist.push_back(gen_op(ops[o]));
+			const shil_opcode& op=block.oplist[0];
+
+			code_used=0;
+			void* ref_code=compile(&block,OpCompiler::Canonical);
+			void* inl_code=compile(&block,OpCompiler::Inline);
+			void* alloc_code=compile(&block,OpCompiler::InlineAllocated);
+
+			for (u32 c=0;c<CONTEXTS;c++)
+			{
+				gen_context();
+				fix_inputs(op);
+				start=Sh4cntx;
+
+				run(ref_code,start,ref);
+				run(inl_code,start,inl);
+				run(alloc_code,start,alloc);
+				runs++;
+
+				if (op.op==shop_fseteq && (is_nan(*op.rs1.reg_ptr()) || is_nan(*op.rs2.reg_ptr())))
+					continue;
+
+				bool inl_bad=memcmp(&ref,&inl,sizeof(Sh4Context))!=0;
+				bool alloc_bad=memcmp(&ref,&alloc,sizeof(Sh4Context))!=0;
+
+				if ((inl_bad || alloc_bad) && op_bad++<4)
+				{
+					printf("%s: %s%s don't match the canonical one\n",op.dissasm().c_str(),
+						inl_bad ? "inline" : "",alloc_bad ? (inl_bad ? ", allocated" : "allocated") : "");
+					for (u32 i=0;i<sizeof(Sh4Context)/4;i++)
+					{
+						u32 v=((u32*)&ref)[i],vi=((u32*)&inl)[i],va=((u32*)&alloc)[i];
+						if (v!=vi || v!=va)
+							printf("\tword %d: %08X, inline %08X, allocated %08X, was %08X\n",i,v,vi,va,((u32*)&start)[i]);
+					}
+				}
+			}
+		}
+
+		bad+=op_bad;
+	}
+
+	printf("%d ops, %d runs, %d operands read from host registers, %d mismatches\n",
+		(int)(sizeof(ops)/sizeof(ops[0])),runs,reads,bad);
+
+	return bad ? 1 : 0;
+}